@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <libgen.h>
+#include <limits.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <ioth.h>
+#include <iothconf.h>
+#include <iothconf_data.h>
+#include <iothconf_mod.h>
+#include <iothconf_parse.h>
+#include "iothconf_responder.h"
+
+/* benchmarks of the configuration paths:
+	 - conf: time from ioth_newstackc to a configured stack for each mode
+		 (the server side stack runs the scripted responders of the test harness)
+	 - confdata: add/lookup/forall/delete cost at 10/1k/100k records spread on many stacks
+	 - dns: ioth_resolvconf (unchanged configuration and rendered string) and ioth_dnsconf cost
+	 - packet: build (DHCP, DHCPv6, RS) and parse (DHCP, DHCPv6, RA, DHCPv6 domain list) cost,
+		 the parsed messages are the samples of the regression corpus of the fuzzers
+	 The results are printed in CSV (default) or JSON format, one result per row:
+	 benchmark, parameter, iterations, value, unit */
+
+#define BENCH_NSTACKS 64
+#define BENCH_MAXLOOKUP 10000
+#define BENCH_DNSLOOP 10000
+#define BENCH_PKTLOOP 100000
+#define BENCH_PKTMAXLEN 2048
+
+#ifndef IOTHCONF_CORPUS
+#define IOTHCONF_CORPUS "fuzz/corpus"
+#endif
+
+struct mode {
+	const char *name;
+	const char *config;
+	int protocols; // responders to run, -1: none
+};
+
+static struct mode modes[] = {
+	{"eth", "eth", -1},
+	{"rd", "eth,rd,slaac", IOTHCONF_RD},
+	{"dhcp", "eth,dhcp", IOTHCONF_DHCP},
+	{"dhcp6", "eth,dhcp6", IOTHCONF_DHCPV6},
+	{"auto", "eth,auto", 0},
+};
+#define NMODES (sizeof(modes) / sizeof(modes[0]))
+
+static const int confdata_sizes[] = {10, 1000, 100000};
+#define NSIZES (sizeof(confdata_sizes) / sizeof(confdata_sizes[0]))
+
+static int json;
+static int nresults;
+
+static void usage(char *progname) {
+	fprintf(stderr,
+			"Usage: %s OPTIONS [benchmark ...]\n"
+			"OPTIONS:\n"
+			" -s --stack:       ioth stack implementation of the client (default vdestack)\n"
+			" -S --serverstack: ioth stack implementation of the server (default vdestack)\n"
+			" -n --runs:        runs of each configuration mode (default 5)\n"
+			" -m --maxrecords:  skip the confdata sizes above this limit\n"
+			" -c --corpus:      directory of the packet samples (default " IOTHCONF_CORPUS ")\n"
+			" -j --json:        JSON output (default CSV)\n"
+			" -h, --help:       usage message\n"
+			"benchmarks: conf confdata dns packet (default all)\n", progname);
+	exit(1);
+}
+
+static uint64_t now_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void result(const char *benchmark, const char *param, long iterations, double value, const char *unit) {
+	if (json)
+		printf("%s\n  {\"benchmark\": \"%s\", \"param\": \"%s\", \"iterations\": %ld, \"value\": %.3f, \"unit\": \"%s\"}",
+				nresults == 0 ? "[" : ",", benchmark, param, iterations, value, unit);
+	else {
+		if (nresults == 0)
+			printf("benchmark,param,iterations,value,unit\n");
+		printf("%s,%s,%ld,%.3f,%s\n", benchmark, param, iterations, value, unit);
+	}
+	nresults++;
+}
+
+static void results_end(void) {
+	if (json)
+		printf("%s]\n", nresults == 0 ? "[" : "\n");
+}
+
+/* time to configure */
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+static void bench_conf(const char *stacklib, const char *serverstacklib, int runs) {
+	for (size_t i = 0; i < NMODES; i++) {
+		double times[runs];
+		int ok = 0;
+		for (int run = 0; run < runs; run++) {
+			char vnl[64];
+			char config[256];
+			snprintf(vnl, sizeof(vnl), "ptp:///tmp/iothconf_bench.%d.%zu.%d", getpid(), i, run);
+			struct ioth *server = ioth_newstack(serverstacklib, vnl);
+			if (server == NULL) {
+				fprintf(stderr, "server stack %s: %s\n", serverstacklib, strerror(errno));
+				return;
+			}
+			ioth_config(server, "eth");
+			struct iothconf_responder_script script = {.protocols = modes[i].protocols};
+			struct iothconf_responder *responder = (modes[i].protocols < 0) ? NULL :
+				iothconf_responder_start(server, ioth_if_nametoindex(server, "vde0"), &script);
+			snprintf(config, sizeof(config), "stack=%s,vnl=%s,%s", stacklib, vnl, modes[i].config);
+			uint64_t start = now_nsec();
+			struct ioth *client = ioth_newstackc(config);
+			uint64_t elapsed = now_nsec() - start;
+			if (client != NULL) {
+				times[ok++] = elapsed / 1000000.0;
+				ioth_config_release(client);
+				ioth_delstack(client);
+			}
+			if (responder != NULL)
+				iothconf_responder_stop(responder);
+			ioth_config_release(server);
+			ioth_delstack(server);
+			unlink(vnl + strlen("ptp://"));
+		}
+		if (ok > 0) {
+			qsort(times, ok, sizeof(times[0]), cmp_double);
+			result("conf", modes[i].name, ok, times[ok / 2], "ms");
+		}
+	}
+}
+
+/* confdata */
+
+static char fakestacks[BENCH_NSTACKS];
+#define FAKESTACK(i) ((struct ioth *) &fakestacks[(i) % BENCH_NSTACKS])
+#define BENCH_IFINDEX 1
+
+static struct ioth_confdata_ipaddr bench_record(int i) {
+	return (struct ioth_confdata_ipaddr) {
+		.addr.s_addr = htonl(0x0a000000 + i),
+		.prefixlen = 24,
+	};
+}
+
+static int count_cb(void *data, void *arg) {
+	(void) data;
+	(*(long *) arg)++;
+	return 0;
+}
+
+static int delete_cb(void *data, void *arg) {
+	(void) data;
+	(*(long *) arg)++;
+	return IOTH_CONFDATA_FORALL_DELETE;
+}
+
+static void bench_confdata(int maxrecords) {
+	time_t now = time(NULL);
+	for (size_t s = 0; s < NSIZES; s++) {
+		int n = confdata_sizes[s];
+		char param[32];
+		uint64_t start;
+		if (maxrecords > 0 && n > maxrecords)
+			continue;
+		snprintf(param, sizeof(param), "%d", n);
+
+		start = now_nsec();
+		for (int i = 0; i < n; i++) {
+			struct ioth_confdata_ipaddr record = bench_record(i);
+			ioth_confdata_add(FAKESTACK(i), BENCH_IFINDEX, IOTH_CONFDATA_STATIC4_ADDR, now, 0,
+					&record, sizeof(record));
+		}
+		result("confdata_add", param, n, (double) (now_nsec() - start) / n, "ns/op");
+
+		int nlookup = n < BENCH_MAXLOOKUP ? n : BENCH_MAXLOOKUP;
+		start = now_nsec();
+		for (int i = 0; i < nlookup; i++) {
+			/* spread the lookups on the whole set of records */
+			int index = (int) (((uint64_t) i * 7919) % n);
+			struct ioth_confdata_ipaddr record = bench_record(index);
+			ioth_confdata_getflags(FAKESTACK(index), BENCH_IFINDEX, IOTH_CONFDATA_STATIC4_ADDR,
+					&record, sizeof(record));
+		}
+		result("confdata_lookup", param, nlookup, (double) (now_nsec() - start) / nlookup, "ns/op");
+
+		long visited = 0;
+		start = now_nsec();
+		for (int i = 0; i < BENCH_NSTACKS; i++)
+			ioth_confdata_forall(FAKESTACK(i), BENCH_IFINDEX, IOTH_CONFDATA_STATIC4_ADDR, count_cb, &visited);
+		result("confdata_forall", param, visited, (double) (now_nsec() - start) / (visited ? visited : 1),
+				"ns/record");
+
+		long deleted = 0;
+		start = now_nsec();
+		ioth_confdata_forall(IOTH_CONFDATA_ANYSTACK, 0, 0, delete_cb, &deleted);
+		result("confdata_delete", param, deleted, (double) (now_nsec() - start) / (deleted ? deleted : 1),
+				"ns/record");
+	}
+}
+
+/* DNS configuration */
+
+static void bench_dns(void) {
+	struct ioth *stack = FAKESTACK(0);
+	time_t now = time(NULL);
+	struct in_addr dns4;
+	struct in6_addr dns6;
+	static char domains[] = "harness.test\0example.org";
+	static char toggle[] = "toggle.test";
+	inet_pton(AF_INET, RESPONDER_DHCP_DNS, &dns4);
+	inet_pton(AF_INET6, RESPONDER_DHCP6_DNS, &dns6);
+	ioth_confdata_add(stack, BENCH_IFINDEX, IOTH_CONFDATA_DHCP4_DNS, now, 0, &dns4, sizeof(dns4));
+	ioth_confdata_add(stack, BENCH_IFINDEX, IOTH_CONFDATA_DHCP6_DNS, now, 0, &dns6, sizeof(dns6));
+	ioth_confdata_add(stack, BENCH_IFINDEX, IOTH_CONFDATA_DHCP4_DOMAIN, now, 0, domains, sizeof(domains));
+	ioth_confdata_add(stack, BENCH_IFINDEX, IOTH_CONFDATA_DHCP6_DOMAIN, now, 0, domains, sizeof(domains));
+
+	uint64_t start = now_nsec();
+	for (int i = 0; i < BENCH_DNSLOOP; i++)
+		free(iothconf_resolvconf(stack, BENCH_IFINDEX, NULL));
+	result("resolvconf", "unchanged", BENCH_DNSLOOP, (double) (now_nsec() - start) / BENCH_DNSLOOP, "ns/op");
+
+	/* each change of the DNS records invalidates the cached string:
+		 the cost of the add/del of a record is included */
+	start = now_nsec();
+	for (int i = 0; i < BENCH_DNSLOOP; i++) {
+		if (i & 1)
+			ioth_confdata_del(stack, BENCH_IFINDEX, IOTH_CONFDATA_STATIC_DOMAIN, toggle, sizeof(toggle));
+		else
+			ioth_confdata_add(stack, BENCH_IFINDEX, IOTH_CONFDATA_STATIC_DOMAIN, now, 0, toggle, sizeof(toggle));
+		free(iothconf_resolvconf(stack, BENCH_IFINDEX, NULL));
+	}
+	result("resolvconf", "render", BENCH_DNSLOOP, (double) (now_nsec() - start) / BENCH_DNSLOOP, "ns/op");
+
+	start = now_nsec();
+	for (int i = 0; i < BENCH_DNSLOOP; i++) {
+		struct ioth_dnsserver servers[3];
+		struct ioth_dnsdomain domains[6];
+		int nservers = 3;
+		int ndomains = 6;
+		ioth_dnsconf(stack, BENCH_IFINDEX, servers, &nservers, domains, &ndomains);
+	}
+	result("dnsconf", "-", BENCH_DNSLOOP, (double) (now_nsec() - start) / BENCH_DNSLOOP, "ns/op");
+
+	long deleted = 0;
+	ioth_confdata_forall(IOTH_CONFDATA_ANYSTACK, 0, 0, delete_cb, &deleted);
+}
+
+/* packet build/parse */
+
+#define BENCH_PKT(benchmark, param, stmt) do { \
+	uint64_t start = now_nsec(); \
+	for (int i = 0; i < BENCH_PKTLOOP; i++) { \
+		stmt; \
+	} \
+	result(benchmark, param, BENCH_PKTLOOP, (double) (now_nsec() - start) / BENCH_PKTLOOP, "ns/op"); \
+} while (0)
+
+static size_t read_sample(const char *corpus, const char *name, uint8_t *buf) {
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", corpus, name);
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	size_t len = fread(buf, 1, BENCH_PKTMAXLEN, f);
+	fclose(f);
+	return len;
+}
+
+static void bench_packet(const char *corpus) {
+	static uint8_t macaddr[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+	static uint8_t id[] = {0x01, 0x02, 0x03, 0x04};
+	static uint8_t serverid[] = {0x00, 0x03, 0x00, 0x01, 0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+	const char *fqdn = "host.harness.test";
+	struct ioth_hashid hashid;
+	struct in_addr clientaddr;
+	struct in_addr serveraddr;
+	uint8_t buf[BENCH_PKTMAXLEN];
+	volatile size_t sink;
+	ioth_hashid(fqdn, &hashid);
+	inet_pton(AF_INET, RESPONDER_DHCP_ADDR, &clientaddr);
+	inet_pton(AF_INET, RESPONDER_DHCP_SERVER, &serveraddr);
+
+	BENCH_PKT("build", "dhcp", sink = iothconf_dhcp_build(buf, 3 /* DHCPREQUEST */, id, macaddr,
+				clientaddr, serveraddr, fqdn));
+	BENCH_PKT("build", "dhcp6", size_t len;
+			free(iothconf_dhcp6_build(3 /* REQUEST */, id, hashid.duid, sizeof(hashid.duid),
+					serverid, sizeof(serverid), fqdn, macaddr, NULL, 0, &len));
+			sink = len);
+	BENCH_PKT("build", "rs", sink = iothconf_rs_build(buf, macaddr));
+
+	size_t len;
+	if ((len = read_sample(corpus, "dhcp/ack", buf)) > 0) {
+		struct iothconf_dhcp_msg msg;
+		BENCH_PKT("parse", "dhcp", sink = iothconf_dhcp_parse(buf, len, &msg));
+	}
+	if ((len = read_sample(corpus, "ra/ra", buf)) > 0) {
+		struct iothconf_ra_msg msg;
+		BENCH_PKT("parse", "ra", sink = iothconf_ra_parse(buf, len, &msg));
+	}
+	if ((len = read_sample(corpus, "dhcp6/reply", buf)) > 0) {
+		struct iothconf_dhcp6_msg msg;
+		BENCH_PKT("parse", "dhcp6", sink = iothconf_dhcp6_parse(buf, len, &msg));
+		if (iothconf_dhcp6_parse(buf, len, &msg) == 0 && msg.domain != NULL) {
+			char mstr[msg.domainlen + 1];
+			BENCH_PKT("parse", "domain", sink = iothconf_domain2mstr(msg.domain, msg.domainlen, mstr, sizeof(mstr)));
+		}
+	}
+	(void) sink;
+}
+
+static int selected(const char *name, int argc, char *argv[]) {
+	if (optind >= argc)
+		return 1;
+	for (int i = optind; i < argc; i++)
+		if (strcmp(argv[i], name) == 0)
+			return 1;
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	char *progname = basename(argv[0]);
+	static char *short_options = "s:S:n:m:c:jh";
+	static struct option long_options[] = {
+		{"stack",       required_argument, 0,  's' },
+		{"serverstack", required_argument, 0,  'S' },
+		{"runs",        required_argument, 0,  'n' },
+		{"maxrecords",  required_argument, 0,  'm' },
+		{"corpus",      required_argument, 0,  'c' },
+		{"json",              no_argument, 0,  'j' },
+		{"help",              no_argument, 0,  'h' },
+		{0,             0,                 0,  0 }
+	};
+
+	char *stacklib = "vdestack";
+	char *serverstacklib = "vdestack";
+	int runs = 5;
+	int maxrecords = 0;
+	char *corpus = IOTHCONF_CORPUS;
+	int c;
+	while ((c = getopt_long(argc, argv, short_options, long_options, NULL)) >= 0) {
+		switch (c) {
+			case 's': stacklib = optarg; break;
+			case 'S': serverstacklib = optarg; break;
+			case 'n': runs = atoi(optarg); break;
+			case 'm': maxrecords = atoi(optarg); break;
+			case 'c': corpus = optarg; break;
+			case 'j': json = 1; break;
+			case '?':
+			case 'h':
+			default: usage(progname); break;
+		}
+	}
+	if (runs <= 0)
+		usage(progname);
+
+	if (selected("confdata", argc, argv))
+		bench_confdata(maxrecords);
+	if (selected("dns", argc, argv))
+		bench_dns();
+	if (selected("packet", argc, argv))
+		bench_packet(corpus);
+	if (selected("conf", argc, argv))
+		bench_conf(stacklib, serverstacklib, runs);
+	results_end();
+	return 0;
+}
@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <netinet/icmp6.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <ioth.h>
+#include <iothconf.h>
+#include <iothconf_data.h>
+#include <iothconf_mod.h>
+#include <iothconf_parse.h>
+#include <iothconf_capture.h>
+
+/* offline replay of a capture file (see ioth_config_capture):
+	 each received message (DHCPACK, DHCPv6 REPLY, router advertisement) is parsed and
+	 stored in the configuration data of a fake stack (no network, no stack is configured),
+	 on the interface index recorded in the capture.
+	 - debugging: one line per packet, the resulting configuration data (-d, JSON)
+	 - benchmark (-n N): the capture is replayed N times, the parsing and the parsing+storing
+		 times are printed in the CSV format of iothconf_bench */
+
+#define DHCPACK 5
+#define DHCP6_REPLY 7
+
+static const char *dhcp_types[] = {"?", "discover", "offer", "request", "decline", "ack", "nak", "release", "inform"};
+static const char *dhcp6_types[] = {"?", "solicit", "advertise", "request", "confirm", "renew",
+	"rebind", "reply", "release", "decline", "reconfigure"};
+#define TYPENAME(table, type) \
+	((size_t) (type) < sizeof(table) / sizeof(table[0]) ? table[type] : "?")
+
+struct packet {
+	struct timeval ts;
+	unsigned int ifindex;
+	int out;
+	uint16_t protocol;
+	uint8_t *data;
+	size_t len;
+};
+
+/* the messages sent (DHCP requests, RS) are only printed */
+enum kind {KIND_DHCP, KIND_DHCP6, KIND_RA, KIND_DHCP_OUT, KIND_RS, KIND_OTHER};
+static const char *kind_names[] = {"dhcp", "dhcp6", "ra", "dhcp", "rs", "other"};
+
+static char fakestack;
+#define STACK ((struct ioth *) &fakestack)
+
+static int json;
+static int nresults;
+
+static void usage(char *progname) {
+	fprintf(stderr,
+			"Usage: %s OPTIONS file.pcap\n"
+			"OPTIONS:\n"
+			" -n --loops:       replay the capture N times and print the throughput\n"
+			" -m --mac:         MAC address for the slaac addresses (e.g. 02:00:00:00:00:01)\n"
+			" -d --dump:        print the resulting configuration data (JSON)\n"
+			" -q --quiet:       do not print the packets\n"
+			" -j --json:        JSON output of the throughput (default CSV)\n"
+			" -h, --help:       usage message\n", progname);
+	exit(1);
+}
+
+static uint64_t now_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void result(const char *benchmark, const char *param, long iterations, double value, const char *unit) {
+	if (json)
+		printf("%s\n  {\"benchmark\": \"%s\", \"param\": \"%s\", \"iterations\": %ld, \"value\": %.3f, \"unit\": \"%s\"}",
+				nresults == 0 ? "[" : ",", benchmark, param, iterations, value, unit);
+	else {
+		if (nresults == 0)
+			printf("benchmark,param,iterations,value,unit\n");
+		printf("%s,%s,%ld,%.3f,%s\n", benchmark, param, iterations, value, unit);
+	}
+	nresults++;
+}
+
+/* load the whole capture: the packets point into *buf */
+static struct packet *load_pcap(const char *path, uint8_t **buf, size_t *npackets) {
+	FILE *f = fopen(path, "r");
+	struct iothconf_pcap_hdr hdr;
+	struct iothconf_pcap_rec rec;
+	struct packet *packets = NULL;
+	size_t n = 0;
+	size_t size = 0;
+	if (f == NULL)
+		return NULL;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != IOTHCONF_PCAP_MAGIC ||
+			hdr.linktype != IOTHCONF_PCAP_LINKTYPE_SLL2) {
+		fclose(f);
+		return errno = EINVAL, NULL;
+	}
+	*buf = NULL;
+	/* first pass: size of the data */
+	while (fread(&rec, sizeof(rec), 1, f) == 1 && rec.caplen <= IOTHCONF_PCAP_SNAPLEN &&
+			fseek(f, rec.caplen, SEEK_CUR) == 0)
+		n++, size += rec.caplen;
+	*buf = malloc(size + 1);
+	packets = calloc(n + 1, sizeof(*packets));
+	if (*buf == NULL || packets == NULL)
+		goto err;
+	fseek(f, sizeof(hdr), SEEK_SET);
+	size_t pos = 0;
+	*npackets = 0;
+	for (size_t i = 0; i < n; i++) {
+		struct iothconf_sll2_hdr sll2;
+		if (fread(&rec, sizeof(rec), 1, f) != 1 || fread(*buf + pos, rec.caplen, 1, f) != 1)
+			break;
+		if (rec.caplen < sizeof(sll2))
+			continue;
+		memcpy(&sll2, *buf + pos, sizeof(sll2));
+		packets[*npackets] = (struct packet) {
+			.ts = {rec.ts_sec, rec.ts_usec},
+			.ifindex = ntohl(sll2.ifindex),
+			.out = sll2.pkttype == PACKET_OUTGOING,
+			.protocol = ntohs(sll2.protocol),
+			.data = *buf + pos + sizeof(sll2),
+			.len = rec.caplen - sizeof(sll2),
+		};
+		(*npackets)++;
+		pos += rec.caplen;
+	}
+	fclose(f);
+	return packets;
+err:
+	free(*buf);
+	free(packets);
+	fclose(f);
+	return errno = ENOMEM, NULL;
+}
+
+/* the payload of an IPv6 packet (no extension headers) */
+static uint8_t *ip6_payload(struct packet *pkt, uint8_t proto, size_t *len) {
+	struct ip6_hdr ip6h;
+	if (pkt->len < sizeof(ip6h))
+		return NULL;
+	memcpy(&ip6h, pkt->data, sizeof(ip6h));
+	if (ip6h.ip6_nxt != proto || ntohs(ip6h.ip6_plen) > pkt->len - sizeof(ip6h))
+		return NULL;
+	*len = ntohs(ip6h.ip6_plen);
+	return pkt->data + sizeof(ip6h);
+}
+
+static enum kind packet_kind(struct packet *pkt) {
+	size_t len;
+	uint8_t *icmp;
+	if (pkt->protocol == ETH_P_IP)
+		return pkt->out ? KIND_DHCP_OUT : KIND_DHCP;
+	if (pkt->protocol != ETH_P_IPV6)
+		return KIND_OTHER;
+	if (ip6_payload(pkt, IPPROTO_UDP, &len) != NULL)
+		return KIND_DHCP6;
+	if ((icmp = ip6_payload(pkt, IPPROTO_ICMPV6, &len)) != NULL && len > 0) {
+		if (icmp[0] == ND_ROUTER_ADVERT)
+			return KIND_RA;
+		if (icmp[0] == ND_ROUTER_SOLICIT)
+			return KIND_RS;
+	}
+	return KIND_OTHER;
+}
+
+/* type of a DHCP message sent by the client (the parser accepts only replies) */
+static int dhcp_out_type(struct packet *pkt) {
+	if (pkt->len == 0)
+		return 0;
+	size_t iphlen = (pkt->data[0] & 0xf) * 4;
+	/* ip header, udp header, bootp, cookie */
+	size_t pos = iphlen + sizeof(struct udphdr) + 236 + 4;
+	uint8_t *value;
+	size_t optlen;
+	int code;
+	if (pkt->len < pos)
+		return 0;
+	size_t optpos = 0;
+	while ((code = iothconf_dhcp_nextopt(pkt->data + pos, pkt->len - pos, &optpos, &value, &optlen)) >= 0)
+		if (code == 53 && optlen >= 1)
+			return value[0];
+	return 0;
+}
+
+/* parse a packet and (if store) add its data to the configuration data.
+	 descr (if not NULL) is a short description of the packet.
+	 it returns 0 if the packet is a valid message, -1 otherwise */
+static int replay(struct packet *pkt, enum kind kind, int store, const struct iothconf_param *param,
+		uint8_t *macaddr, char *descr, size_t descrlen) {
+	char addr[INET6_ADDRSTRLEN];
+	size_t len;
+	uint8_t *payload;
+	switch (kind) {
+		case KIND_DHCP:
+			{
+				struct iothconf_dhcp_msg msg;
+				if (iothconf_dhcp_parse(pkt->data, pkt->len, &msg) < 0)
+					break;
+				if (store && !pkt->out && msg.type == DHCPACK && msg.server != NULL)
+					iothconf_dhcp_store(STACK, pkt->ifindex, pkt->ts.tv_sec, &msg);
+				if (descr)
+					snprintf(descr, descrlen, "%s %s/%d", TYPENAME(dhcp_types, msg.type),
+							inet_ntop(AF_INET, &msg.yiaddr, addr, sizeof(addr)), msg.prefixlen);
+				return 0;
+			}
+		case KIND_DHCP6:
+			{
+				struct iothconf_dhcp6_msg msg;
+				if ((payload = ip6_payload(pkt, IPPROTO_UDP, &len)) == NULL || len < sizeof(struct udphdr) ||
+						iothconf_dhcp6_parse(payload + sizeof(struct udphdr), len - sizeof(struct udphdr), &msg) < 0)
+					break;
+				if (store && !pkt->out && msg.type == DHCP6_REPLY)
+					iothconf_dhcp6_store(STACK, pkt->ifindex, pkt->ts.tv_sec, &msg);
+				if (descr) {
+					struct ioth_confdata_ip6addr iaaddr;
+					size_t pos = 0;
+					int n = snprintf(descr, descrlen, "%s", TYPENAME(dhcp6_types, msg.type));
+					while (msg.iana != NULL && n < (int) descrlen &&
+							iothconf_dhcp6_nextiaaddr(msg.iana, msg.ianalen, &pos, &iaaddr) == 0)
+						n += snprintf(descr + n, descrlen - n, " %s",
+								inet_ntop(AF_INET6, &iaaddr.addr, addr, sizeof(addr)));
+				}
+				return 0;
+			}
+		case KIND_RA:
+			{
+				struct iothconf_ra_msg msg;
+				struct ip6_hdr ip6h;
+				if ((payload = ip6_payload(pkt, IPPROTO_ICMPV6, &len)) == NULL ||
+						iothconf_ra_parse(payload, len, &msg) < 0)
+					break;
+				memcpy(&ip6h, pkt->data, sizeof(ip6h));
+				if (store && !pkt->out)
+					iothconf_rd_store(STACK, pkt->ifindex, pkt->ts.tv_sec, &ip6h.ip6_src, &msg,
+							param, NULL, macaddr);
+				if (descr) {
+					int n = snprintf(descr, descrlen, "ra lifetime %d mtu %d", msg.router_lifetime, msg.mtu);
+					for (int i = 0; i < msg.nprefixes && n < (int) descrlen; i++)
+						n += snprintf(descr + n, descrlen - n, " %s/%d",
+								inet_ntop(AF_INET6, &msg.prefixes[i].prefix, addr, sizeof(addr)),
+								msg.prefixes[i].prefixlen);
+				}
+				return 0;
+			}
+		case KIND_DHCP_OUT:
+			if (descr)
+				snprintf(descr, descrlen, "%s", TYPENAME(dhcp_types, dhcp_out_type(pkt)));
+			return 0;
+		case KIND_RS:
+			if (descr)
+				snprintf(descr, descrlen, "rs");
+			return 0;
+		default:
+			break;
+	}
+	if (descr)
+		snprintf(descr, descrlen, "invalid");
+	return -1;
+}
+
+static void print_packet(struct packet *pkt, enum kind kind, const char *descr) {
+	printf("%ld.%06ld %u %s %s %s\n", (long) pkt->ts.tv_sec, (long) pkt->ts.tv_usec, pkt->ifindex,
+			pkt->out ? "out" : "in", kind_names[kind], descr);
+}
+
+static void bench_replay(struct packet *packets, size_t npackets, enum kind *kinds, int loops,
+		const struct iothconf_param *param, uint8_t *macaddr) {
+	for (int kind = KIND_DHCP; kind <= KIND_RA; kind++) {
+		long count = 0;
+		uint64_t start = now_nsec();
+		for (int loop = 0; loop < loops; loop++) {
+			for (size_t i = 0; i < npackets; i++) {
+				if (kinds[i] == (enum kind) kind) {
+					replay(&packets[i], kinds[i], 0, param, macaddr, NULL, 0);
+					count++;
+				}
+			}
+		}
+		if (count > 0)
+			result("replay_parse", kind_names[kind], count, (double) (now_nsec() - start) / count, "ns/pkt");
+	}
+	uint64_t start = now_nsec();
+	for (int loop = 0; loop < loops; loop++) {
+		for (size_t i = 0; i < npackets; i++)
+			replay(&packets[i], kinds[i], 1, param, macaddr, NULL, 0);
+	}
+	if (npackets > 0)
+		result("replay_store", "all", npackets * loops,
+				(double) (now_nsec() - start) / (npackets * loops), "ns/pkt");
+	if (json)
+		printf("%s]\n", nresults == 0 ? "[" : "\n");
+}
+
+int main(int argc, char *argv[]) {
+	char *progname = basename(argv[0]);
+	static char *short_options = "n:m:dqjh";
+	static struct option long_options[] = {
+		{"loops",       required_argument, 0,  'n' },
+		{"mac",         required_argument, 0,  'm' },
+		{"dump",              no_argument, 0,  'd' },
+		{"quiet",             no_argument, 0,  'q' },
+		{"json",              no_argument, 0,  'j' },
+		{"help",              no_argument, 0,  'h' },
+		{0,             0,                 0,  0 }
+	};
+	int loops = 0;
+	int dump = 0;
+	int quiet = 0;
+	uint8_t macaddr[ETH_ALEN] = {0};
+	struct iothconf_param param = {0};
+	int c;
+	while ((c = getopt_long(argc, argv, short_options, long_options, NULL)) >= 0) {
+		switch (c) {
+			case 'n': loops = atoi(optarg); break;
+			case 'm': if (sscanf(optarg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+										macaddr, macaddr + 1, macaddr + 2, macaddr + 3, macaddr + 4, macaddr + 5) != ETH_ALEN)
+									usage(progname);
+								param.config_flags |= IOTHCONF_RD_SLAAC;
+								break;
+			case 'd': dump = 1; break;
+			case 'q': quiet = 1; break;
+			case 'j': json = 1; break;
+			case '?':
+			case 'h':
+			default: usage(progname); break;
+		}
+	}
+	if (argc - optind != 1)
+		usage(progname);
+
+	uint8_t *buf;
+	size_t npackets;
+	struct packet *packets = load_pcap(argv[optind], &buf, &npackets);
+	if (packets == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+	enum kind kinds[npackets + 1];
+	int invalid = 0;
+	for (size_t i = 0; i < npackets; i++) {
+		char descr[256];
+		kinds[i] = packet_kind(&packets[i]);
+		if (replay(&packets[i], kinds[i], loops == 0, &param, macaddr, descr, sizeof(descr)) < 0)
+			invalid++;
+		if (!quiet)
+			print_packet(&packets[i], kinds[i], descr);
+	}
+	if (loops > 0)
+		bench_replay(packets, npackets, kinds, loops, &param, macaddr);
+	if (dump) {
+		int len = ioth_config_dump(STACK, 0, NULL, 0);
+		char *str = len >= 0 ? malloc(len + 1) : NULL;
+		if (str != NULL) {
+			ioth_config_dump(STACK, 0, str, len + 1);
+			printf("%s\n", str);
+			free(str);
+		}
+	}
+	free(packets);
+	free(buf);
+	return invalid ? 2 : 0;
+}
@@ -0,0 +1,40 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/ip.h>
+#include <iothconf_parse.h>
+
+/* DHCPv4 reply parser. The IP header checksum of the input is fixed up:
+	 otherwise almost all the inputs would be rejected by the first check */
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	uint8_t *buf = malloc(size);
+	struct iothconf_dhcp_msg msg;
+	volatile uint8_t sink = 0;
+	if (size > 0 && buf == NULL)
+		return 0;
+	memcpy(buf, data, size);
+	if (size >= sizeof(struct iphdr)) {
+		size_t iphlen = (buf[0] & 0xf) * 4;
+		if (iphlen >= sizeof(struct iphdr) && iphlen <= size) {
+			buf[10] = buf[11] = 0;
+			unsigned int sum = iothconf_chksum(0, buf, iphlen);
+			buf[10] = ~sum >> 8;
+			buf[11] = ~sum;
+		}
+	}
+	if (iothconf_dhcp_parse(buf, size, &msg) == 0) {
+		/* all the pointers must refer to the input buffer */
+		if (msg.server)
+			for (size_t i = 0; i < sizeof(struct in_addr); i++) sink ^= msg.server[i];
+		for (size_t i = 0; i < msg.routerlen; i++) sink ^= msg.router[i];
+		for (size_t i = 0; i < msg.dnslen; i++) sink ^= msg.dns[i];
+		for (size_t i = 0; i < msg.domainlen; i++) sink ^= msg.domain[i];
+		if (msg.routerlen % sizeof(struct in_addr) || msg.dnslen % sizeof(struct in_addr) ||
+				msg.prefixlen > 32)
+			abort();
+	}
+	(void) sink;
+	free(buf);
+	return 0;
+}
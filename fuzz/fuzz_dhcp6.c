@@ -0,0 +1,39 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iothconf_data.h>
+#include <iothconf_parse.h>
+
+/* DHCPv6 parser, IAADDR iterator and domain list conversion (as in a REPLY) */
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	uint8_t *buf = malloc(size);
+	struct iothconf_dhcp6_msg msg;
+	volatile uint8_t sink = 0;
+	if (size > 0 && buf == NULL)
+		return 0;
+	memcpy(buf, data, size);
+	if (iothconf_dhcp6_parse(buf, size, &msg) == 0) {
+		for (size_t i = 0; i < msg.clientidlen; i++) sink ^= msg.clientid[i];
+		for (size_t i = 0; i < msg.serveridlen; i++) sink ^= msg.serverid[i];
+		for (size_t i = 0; i < msg.dnslen; i++) sink ^= msg.dns[i];
+		if (msg.iana != NULL) {
+			struct ioth_confdata_ip6addr iaaddr;
+			size_t pos = 0;
+			if (msg.ianalen < 12)
+				abort();
+			while (iothconf_dhcp6_nextiaaddr(msg.iana, msg.ianalen, &pos, &iaaddr) == 0)
+				sink ^= iaaddr.addr.s6_addr[15];
+		}
+		if (msg.domain != NULL) {
+			char *mstr = malloc(msg.domainlen + 1);
+			int mstrlen = iothconf_domain2mstr(msg.domain, msg.domainlen, mstr, msg.domainlen + 1);
+			if (mstrlen > (int) msg.domainlen + 1)
+				abort();
+			free(mstr);
+		}
+	}
+	(void) sink;
+	free(buf);
+	return 0;
+}
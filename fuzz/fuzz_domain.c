@@ -0,0 +1,47 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iothconf_parse.h>
+
+/* RFC 1035 domain list to multistring conversion.
+	 The first byte of the input is the size of the output buffer
+	 (to test the truncation of the list), the rest is the encoded list */
+
+static void check_mstr(const char *mstr, int len) {
+	/* a sequence of non empty null terminated strings */
+	for (int i = 0; i < len; i++) {
+		if (mstr[i] == 0 && (i == 0 || mstr[i - 1] == 0))
+			abort();
+	}
+	if (len > 0 && mstr[len - 1] != 0)
+		abort();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if (size < 1)
+		return 0;
+	size_t len = size - 1;
+	size_t outsize = data[0];
+	uint8_t *buf = malloc(len);
+	char *mstr = malloc(outsize);
+	char *fullmstr = malloc(len + 1);
+	if (buf == NULL || mstr == NULL || fullmstr == NULL)
+		goto out;
+	memcpy(buf, data + 1, len);
+	int rv = iothconf_domain2mstr(buf, len, mstr, outsize);
+	if (rv > (int) outsize)
+		abort();
+	if (rv > 0)
+		check_mstr(mstr, rv);
+	/* len + 1 bytes are always enough */
+	rv = iothconf_domain2mstr(buf, len, fullmstr, len + 1);
+	if (rv > (int) len + 1)
+		abort();
+	if (rv > 0)
+		check_mstr(fullmstr, rv);
+out:
+	free(buf);
+	free(mstr);
+	free(fullmstr);
+	return 0;
+}
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* standalone driver of the fuzzing targets (when libFuzzer is not available):
+	 it runs the target on each file (or on each file of each directory) given as argument,
+	 on the standard input if there are no arguments (for AFL: afl-fuzz ... -- fuzz_ra).
+	 It is used to replay the regression corpus */
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+#define MAXINPUT (1 << 16)
+
+static int run_stream(FILE *f) {
+	uint8_t *buf = malloc(MAXINPUT);
+	if (buf == NULL)
+		return -1;
+	size_t len = fread(buf, 1, MAXINPUT, f);
+	LLVMFuzzerTestOneInput(buf, len);
+	free(buf);
+	return 0;
+}
+
+static int run_file(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	int rv = run_stream(f);
+	fclose(f);
+	return rv;
+}
+
+static int run_path(const char *path) {
+	struct stat st;
+	if (stat(path, &st) < 0) {
+		perror(path);
+		return -1;
+	}
+	if (S_ISDIR(st.st_mode)) {
+		DIR *dir = opendir(path);
+		struct dirent *de;
+		int rv = 0;
+		if (dir == NULL) {
+			perror(path);
+			return -1;
+		}
+		while ((de = readdir(dir)) != NULL) {
+			if (de->d_name[0] == '.')
+				continue;
+			size_t len = strlen(path) + strlen(de->d_name) + 2;
+			char child[len];
+			snprintf(child, len, "%s/%s", path, de->d_name);
+			if (run_path(child) < 0)
+				rv = -1;
+		}
+		closedir(dir);
+		return rv;
+	} else
+		return run_file(path);
+}
+
+int main(int argc, char *argv[]) {
+	int rv = 0;
+	if (argc < 2)
+		return run_stream(stdin) < 0 ? 1 : 0;
+	for (int i = 1; i < argc; i++)
+		if (run_path(argv[i]) < 0)
+			rv = 1;
+	return rv;
+}
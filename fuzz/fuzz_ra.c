@@ -0,0 +1,23 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iothconf_parse.h>
+
+/* router advertisement parser */
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	uint8_t *buf = malloc(size);
+	struct iothconf_ra_msg msg;
+	if (size > 0 && buf == NULL)
+		return 0;
+	memcpy(buf, data, size);
+	if (iothconf_ra_parse(buf, size, &msg) == 0) {
+		if (msg.nprefixes < 0 || msg.nprefixes > IOTHCONF_RA_MAXPREFIX)
+			abort();
+		for (int i = 0; i < msg.nprefixes; i++)
+			if (msg.prefixes[i].prefixlen > 128)
+				abort();
+	}
+	free(buf);
+	return 0;
+}
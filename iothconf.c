@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stropt.h>
 #include <strcase.h>
 #include <linux/if_ether.h>
@@ -28,23 +29,25 @@
 #include <iothconf_hash.h>
 #include <iothconf_data.h>
 #include <iothconf_mod.h>
+#include <iothconf_arp.h>
+#include <iothconf_stats.h>
 
 /* configuration for ethernet:
 	 if fqdn, create a hash based MAC address (so that the node always gets the same MAC);
 	 turn on the interface */
-int iothconf_eth(struct ioth *stack, unsigned int ifindex,
-		const char *fqdn, const char *mac, uint32_t config_flags) {
-	(void) config_flags;
+int iothconf_eth(struct ioth *stack, unsigned int ifindex, const struct iothconf_param *param) {
 	uint8_t macaddr[ETH_ALEN];
-	if (mac) {
-		ioth_macton(mac, macaddr);
+	uint64_t start = iothconf_stats_now();
+	if (param->mac) {
+		ioth_macton(param->mac, macaddr);
 		ioth_linksetaddr(stack,ifindex, macaddr);
-	} else if (fqdn) {
-		iothconf_hashmac(macaddr, fqdn);
+	} else if (param->fqdn) {
+		iothconf_hashmac(macaddr, param->fqdn);
 		ioth_linksetaddr(stack,ifindex, macaddr);
 	}
 	ioth_linksetupdown(stack, ifindex, 1);
 	usleep(1000000);
+	iothconf_stats_add(stack, ifindex, IOTHCONF_PHASE_ETH, start);
 	return 0;
 }
 
@@ -53,129 +56,228 @@ void iothconf_cleaneth(struct ioth *stack, unsigned int ifindex, uint32_t config
 	ioth_linksetupdown(stack, ifindex, 0);
 }
 
-static int iothconf_static(struct ioth *stack, unsigned int ifindex, char **tags, char **args, uint32_t config_flags) {
-	time_t ioth_timestamp = 1; // static! all records dated back to 1970 Jan 01 0:00:01
+/* split addr/prefix: the arg is not modified (it can be shared by several interfaces).
+	 return the prefix length (0 if missing) */
+static int iothconf_prefix(const char *arg, char *ipstr, size_t ipstrlen) {
+	const char *prefixstr = strchr(arg, '/');
+	size_t len = (prefixstr == NULL) ? strlen(arg) : (size_t) (prefixstr - arg);
+	if (len >= ipstrlen)
+		len = ipstrlen - 1;
+	memcpy(ipstr, arg, len);
+	ipstr[len] = 0;
+	return (prefixstr == NULL) ? 0 : strtol(prefixstr + 1, NULL, 10);
+}
+
+/* static configuration items (ip, gw, dns, domain and their -... counterparts):
+	 the addresses are parsed once, by ioth_config_compile */
+struct iothconf_static {
+	uint8_t type; // IOTH_CONFDATA_STATIC*
+	uint8_t del;
+	int prefixlen;
+	union {
+		struct in_addr addr4;
+		struct in6_addr addr6;
+	};
+	char *domain;
+};
+
+/* return -1 if tag is not a static item or its argument is not valid */
+static int iothconf_static_parse(const char *tag, char *arg, struct iothconf_static *item) {
+	char ipstr[INET6_ADDRSTRLEN];
 	int prefix;
-	char *prefixstr;
-	uint8_t addr[sizeof(struct in6_addr)];
-	for (; *tags != NULL; tags++, args++) {
-		switch(strcase(*tags)) {
-			case STRCASE(i,p):
-				if (*args == NULL) break;
-				prefixstr = strchr(*args, '/');
-				if (prefixstr == NULL)
-					prefix = 0;
-				else {
-					*prefixstr++ = 0;
-					prefix = strtol(prefixstr, NULL, 10);
-				}
-				if (inet_pton(AF_INET6, *args, addr))
-					ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_STATIC6_ADDR, ioth_timestamp, 0,
+	*item = (struct iothconf_static) {.del = (*tag == '-')};
+	if (arg == NULL)
+		return -1;
+	switch(strcase(tag)) {
+		case STRCASE(i,p):
+		case STRCASE(minus,i,p):
+			prefix = iothconf_prefix(arg, ipstr, sizeof(ipstr));
+			if (inet_pton(AF_INET6, ipstr, &item->addr6)) {
+				item->type = IOTH_CONFDATA_STATIC6_ADDR;
+				item->prefixlen = (prefix == 0) ? 64 : prefix;
+			} else if (inet_pton(AF_INET, ipstr, &item->addr4)) {
+				item->type = IOTH_CONFDATA_STATIC4_ADDR;
+				item->prefixlen = (prefix == 0) ? 24 : prefix;
+			}
+			break;
+		case STRCASE(g,w):
+		case STRCASE(minus,g,w):
+			if (inet_pton(AF_INET6, arg, &item->addr6))
+				item->type = IOTH_CONFDATA_STATIC6_ROUTE;
+			else if (inet_pton(AF_INET, arg, &item->addr4))
+				item->type = IOTH_CONFDATA_STATIC4_ROUTE;
+			break;
+		case STRCASE(d,n,s):
+		case STRCASE(minus,d,n,s):
+			if (inet_pton(AF_INET6, arg, &item->addr6))
+				item->type = IOTH_CONFDATA_STATIC6_DNS;
+			else if (inet_pton(AF_INET, arg, &item->addr4))
+				item->type = IOTH_CONFDATA_STATIC4_DNS;
+			break;
+		case STRCASE(d,o,m,a,i,n):
+		case STRCASE(minus,d,o,m,a,i,n):
+			item->type = IOTH_CONFDATA_STATIC_DOMAIN;
+			item->domain = arg;
+			break;
+	}
+	return (item->type == 0) ? -1 : 0;
+}
+
+static int iothconf_static(struct ioth *stack, unsigned int ifindex,
+		struct iothconf_static *items, int nitems, const struct iothconf_param *param) {
+	uint32_t config_flags = param->config_flags;
+	time_t ioth_timestamp = 1; // static! all records dated back to 1970 Jan 01 0:00:01
+	uint8_t macaddr[ETH_ALEN];
+	int conflict = 0;
+	int naddr4 = 0;
+	struct in_addr *addr4 = NULL; // new addresses to probe and announce (acd)
+	int *conflict4 = NULL;
+	if (config_flags & IOTHCONF_ACD) {
+		addr4 = calloc(nitems + 1, sizeof(*addr4));
+		conflict4 = calloc(nitems + 1, sizeof(*conflict4));
+		if (addr4 == NULL || conflict4 == NULL) {
+			free(addr4);
+			free(conflict4);
+			return -1;
+		}
+		ioth_linkgetaddr(stack, ifindex, macaddr);
+		/* a new address must not be in use by another node:
+			 the new addresses are probed in parallel */
+		for (int i = 0; i < nitems; i++) {
+			if (items[i].type == IOTH_CONFDATA_STATIC4_ADDR && !items[i].del &&
+					!(ioth_confdata_getflags_data(stack, ifindex, IOTH_CONFDATA_STATIC4_ADDR,
+							struct ioth_confdata_ipaddr,
+							.addr = items[i].addr4,
+							.prefixlen = items[i].prefixlen,
+							.leasetime = TIME_INFINITY) & IOTH_CONFDATA_ACTIVE))
+				addr4[naddr4++] = items[i].addr4;
+		}
+		if (naddr4 > 0)
+			iothconf_arp_check(stack, ifindex, macaddr, addr4, conflict4, naddr4);
+	}
+	for (int i = 0; i < nitems; i++) {
+		struct iothconf_static *item = &items[i];
+		switch(item->type) {
+			case IOTH_CONFDATA_STATIC6_ADDR:
+				if (item->del)
+					ioth_confdata_del_data(stack, ifindex, IOTH_CONFDATA_STATIC6_ADDR,
 							struct ioth_confdata_ip6addr,
-							.addr = *((struct in6_addr *)(&addr)),
-							.prefixlen = (prefix == 0) ? 64 : prefix,
+							.addr = item->addr6,
+							.prefixlen = item->prefixlen,
 							.preferred_lifetime = TIME_INFINITY,
 							.valid_lifetime = TIME_INFINITY);
-				else if (inet_pton(AF_INET, *args, addr))
-					ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_STATIC4_ADDR, ioth_timestamp, 0,
-							struct ioth_confdata_ipaddr,
-							.addr = *((struct in_addr *)(&addr)),
-							.prefixlen = (prefix == 0) ? 24 : prefix,
-							.leasetime = TIME_INFINITY);
-				break;
-			case STRCASE(minus,i,p):
-				if (*args == NULL) break;
-				prefixstr = strchr(*args, '/');
-				if (prefixstr == NULL)
-					prefix = 0;
-				else {
-					*prefixstr++ = 0;
-					prefix = strtol(prefixstr, NULL, 10);
-				}
-				if (inet_pton(AF_INET6, *args, addr))
-					ioth_confdata_del_data(stack, ifindex, IOTH_CONFDATA_STATIC6_ADDR,
+				else
+					ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_STATIC6_ADDR, ioth_timestamp, 0,
 							struct ioth_confdata_ip6addr,
-							.addr = *((struct in6_addr *)(&addr)),
-							.prefixlen = (prefix == 0) ? 64 : prefix,
+							.addr = item->addr6,
+							.prefixlen = item->prefixlen,
 							.preferred_lifetime = TIME_INFINITY,
 							.valid_lifetime = TIME_INFINITY);
-				else if (inet_pton(AF_INET, *args, addr))
+				break;
+			case IOTH_CONFDATA_STATIC4_ADDR:
+				if (item->del) {
 					ioth_confdata_del_data(stack, ifindex, IOTH_CONFDATA_STATIC4_ADDR,
 							struct ioth_confdata_ipaddr,
-							.addr = *((struct in_addr *)(&addr)),
-							.prefixlen = (prefix == 0) ? 24 : prefix,
+							.addr = item->addr4,
+							.prefixlen = item->prefixlen,
 							.leasetime = TIME_INFINITY);
+					break;
+				}
+				if (config_flags & IOTHCONF_ACD) {
+					int j;
+					for (j = 0; j < naddr4; j++)
+						if (addr4[j].s_addr == item->addr4.s_addr && conflict4[j])
+							break;
+					if (j < naddr4) {
+						conflict = 1;
+						break;
+					}
+				}
+				ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_STATIC4_ADDR, ioth_timestamp, 0,
+						struct ioth_confdata_ipaddr,
+						.addr = item->addr4,
+						.prefixlen = item->prefixlen,
+						.leasetime = TIME_INFINITY);
 				break;
-			case STRCASE(g,w):
-				if (*args == NULL) break;
-				if (inet_pton(AF_INET6, *args, addr))
-					ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_STATIC6_ROUTE, ioth_timestamp, 0,
+			case IOTH_CONFDATA_STATIC6_ROUTE:
+				if (item->del)
+					ioth_confdata_del_data(stack, ifindex, IOTH_CONFDATA_STATIC6_ROUTE,
 							struct ioth_confdata_ip6addr,
-							.addr = *((struct in6_addr *)(&addr)),
+							.addr = item->addr6,
 							.valid_lifetime = TIME_INFINITY);
-				else if (inet_pton(AF_INET, *args, addr))
-					ioth_confdata_add(stack, ifindex, IOTH_CONFDATA_STATIC4_ROUTE, ioth_timestamp, 0,
-							addr, sizeof(struct in_addr));
-				break;
-			case STRCASE(minus,g,w):
-				if (*args == NULL) break;
-				if (inet_pton(AF_INET6, *args, addr))
-					ioth_confdata_del_data(stack, ifindex, IOTH_CONFDATA_STATIC6_ROUTE,
+				else
+					ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_STATIC6_ROUTE, ioth_timestamp, 0,
 							struct ioth_confdata_ip6addr,
-							.addr = *((struct in6_addr *)(&addr)),
+							.addr = item->addr6,
 							.valid_lifetime = TIME_INFINITY);
-				else if (inet_pton(AF_INET, *args, addr))
-					ioth_confdata_del(stack, ifindex, IOTH_CONFDATA_STATIC4_ROUTE,
-							addr, sizeof(struct in_addr));
 				break;
-			case STRCASE(d,n,s):
-				if (inet_pton(AF_INET6, *args, addr))
-					ioth_confdata_add(stack, ifindex, IOTH_CONFDATA_STATIC6_DNS, ioth_timestamp, 0,
-							addr, sizeof(struct in6_addr));
-				else if (inet_pton(AF_INET, *args, addr))
-					ioth_confdata_add(stack, ifindex, IOTH_CONFDATA_STATIC4_DNS, ioth_timestamp, 0,
-							addr, sizeof(struct in_addr));
+			case IOTH_CONFDATA_STATIC4_ROUTE:
+			case IOTH_CONFDATA_STATIC4_DNS:
+				if (item->del)
+					ioth_confdata_del(stack, ifindex, item->type, &item->addr4, sizeof(struct in_addr));
+				else
+					ioth_confdata_add(stack, ifindex, item->type, ioth_timestamp, 0,
+							&item->addr4, sizeof(struct in_addr));
 				break;
-			case STRCASE(minus,d,n,s):
-				if (inet_pton(AF_INET6, *args, addr))
-					ioth_confdata_del(stack, ifindex, IOTH_CONFDATA_STATIC6_DNS,
-							addr, sizeof(struct in6_addr));
-				else if (inet_pton(AF_INET, *args, addr))
-					ioth_confdata_del(stack, ifindex, IOTH_CONFDATA_STATIC4_DNS,
-							addr, sizeof(struct in_addr));
+			case IOTH_CONFDATA_STATIC6_DNS:
+				if (item->del)
+					ioth_confdata_del(stack, ifindex, item->type, &item->addr6, sizeof(struct in6_addr));
+				else
+					ioth_confdata_add(stack, ifindex, item->type, ioth_timestamp, 0,
+							&item->addr6, sizeof(struct in6_addr));
 				break;
-			case STRCASE(d,o,m,a,i,n):
-				if (*args == NULL) break;
-				ioth_confdata_add(stack, ifindex, IOTH_CONFDATA_STATIC_DOMAIN, ioth_timestamp, 0,
-						*args, strlen(*args) + 1);
-				break;
-			case STRCASE(minus,d,o,m,a,i,n):
-				if (*args == NULL) break;
-				ioth_confdata_del(stack, ifindex, IOTH_CONFDATA_STATIC_DOMAIN,
-						*args, strlen(*args) + 1);
+			case IOTH_CONFDATA_STATIC_DOMAIN:
+				if (item->del)
+					ioth_confdata_del(stack, ifindex, item->type, item->domain, strlen(item->domain) + 1);
+				else
+					ioth_confdata_add(stack, ifindex, item->type, ioth_timestamp, 0,
+							item->domain, strlen(item->domain) + 1);
 				break;
 		}
 	}
 	ioth_confdata_write_timestamp(stack, ifindex, IOTH_CONFDATA_STATIC_TIMESTAMP, ioth_timestamp);
-	iothconf_ip_update(stack, ifindex, IOTH_CONFDATA_STATIC_TIMESTAMP, config_flags);
+	iothconf_ip_update(stack, ifindex, IOTH_CONFDATA_STATIC_TIMESTAMP, param);
+	for (int i = 0; i < naddr4; i++)
+		if (!conflict4[i])
+			iothconf_arp_announce_addr(stack, ifindex, macaddr, &addr4[i]);
+	free(addr4);
+	free(conflict4);
+	if (conflict)
+		return errno = EADDRINUSE, -1;
 	return 0;
 }
 
-static int _ioth_config(struct ioth *stack, const char *config, int from_ioth_newstackc) {
+/* a configuration string can define several interfaces (groups):
+	 each iface=... or ifindex=... tag starts a new group (except ifindex after iface
+	 or vice versa, e.g. "iface=eth0,ifindex=2" is one group).
+	 The options before the first iface/ifindex tag are common to all the groups.
+	 The interfaces are configured concurrently, one thread per interface. */
+struct iothconf_group {
+	struct ioth *stack;
+	struct iothconf_static *items;
+	int nitems;
+	char *iface;
+	int ifindex;
+	uint32_t clean_flags;
+	int debug;
+	struct iothconf_param param;
+	int retvalue;
+};
+
+/* tags and args are NULL terminated. group->items must have room for all the tags */
+static int iothconf_parse(struct iothconf_group *group, char **tags, char **args,
+		int from_ioth_newstackc) {
 	uint32_t config_flags = 0;
 	uint32_t clean_flags = 0;
 	char *fqdn = NULL;
 	char *iface = NULL;
 	char *mac = NULL;
+	char *secret = NULL;
+	unsigned int grace = 0;
+	struct iothconf_retry retry = {.timeout = 0, .retries = -1, .maxtime = -1, .delay = 0};
 	int ifindex = 0;
 	int debug = 0;
-	if (config == NULL) config = "";
-	int tagc = stropt(config, NULL, NULL, NULL);
-	char buf[strlen(config) + 1];
-	char *tags[tagc];
-	char *args[tagc];
-	stropt(config, tags, args, buf);
-	for (int i = 0; i < tagc - 1; i++) {
+	for (int i = 0; tags[i] != NULL; i++) {
 		switch(strcase(tags[i])) {
 			case STRCASE(e,t,h): config_flags |= IOTHCONF_ETH; break;
 			case STRCASE(d,h,c,p):
@@ -190,6 +292,12 @@ static int _ioth_config(struct ioth *stack, const char *config, int from_ioth_ne
 													 config_flags |= IOTHCONF_RD; break;
 			case STRCASE(s,l,a,a,c):
 													 config_flags |= IOTHCONF_RD_SLAAC; break;
+			case STRCASE(s,t,a,b,l,e):
+													 config_flags |= IOTHCONF_RD_SLAAC | IOTHCONF_RD_STABLE; break;
+			case STRCASE(d,a,d):
+													 config_flags |= IOTHCONF_DAD; break;
+			case STRCASE(a,c,d):
+													 config_flags |= IOTHCONF_ACD; break;
 			case STRCASE(a,u,t,o):
 													 config_flags |=
 														 IOTHCONF_ETH | IOTHCONF_DHCP | IOTHCONF_DHCPV6 | IOTHCONF_RD;
@@ -236,6 +344,27 @@ static int _ioth_config(struct ioth *stack, const char *config, int from_ioth_ne
 													 break;
 
 			case STRCASE(f,q,d,n): fqdn = args[i]; break;
+			case STRCASE(s,e,c,r,e,t): secret = args[i]; break;
+			case STRCASE(g,r,a,c,e):
+															 if (args[i] != NULL)
+																 grace = strtoul(args[i], NULL, 10);
+															 break;
+			case STRCASE(t,i,m,e,o,u,t):
+															 if (args[i] != NULL)
+																 retry.timeout = strtol(args[i], NULL, 10);
+															 break;
+			case STRCASE(r,e,t,r,i,e,s):
+															 if (args[i] != NULL)
+																 retry.retries = strtol(args[i], NULL, 10);
+															 break;
+			case STRCASE(m,a,x,t,i,m,e):
+															 if (args[i] != NULL)
+																 retry.maxtime = strtol(args[i], NULL, 10);
+															 break;
+			case STRCASE(d,e,l,a,y):
+															 retry.delay = (args[i] == NULL) ? IOTHCONF_DEFAULT_DELAY :
+																 strtol(args[i], NULL, 10);
+															 break;
 			case STRCASE(i,f,a,c,e): iface = args[i]; break;
 			case STRCASE(i,f,i,n,d,e,x):
 															 if (args[i] != NULL)
@@ -251,7 +380,11 @@ static int _ioth_config(struct ioth *stack, const char *config, int from_ioth_ne
 			case STRCASE(minus,g,w):
 			case STRCASE(minus,d,n,s):
 			case STRCASE(minus,d,o,m,a,i,n):
-																	 config_flags |= IOTHCONF_STATIC; break;
+																	 config_flags |= IOTHCONF_STATIC;
+																	 if (iothconf_static_parse(tags[i], args[i],
+																				 &group->items[group->nitems]) == 0)
+																		 group->nitems++;
+																	 break;
 			case STRCASE(d,e,b,u,g):
 																	 debug = 1; break;
 			case STRCASE(s,t,a,c,k):
@@ -263,50 +396,292 @@ static int _ioth_config(struct ioth *stack, const char *config, int from_ioth_ne
 																	 return errno = EINVAL, -1;
 		}
 	}
+	/* RFC 7217: the secret key must not be predictable (fqdn and MAC are public) */
+	if ((config_flags & IOTHCONF_RD_STABLE) && (secret == NULL || *secret == 0))
+		return errno = EINVAL, -1;
+	group->iface = iface;
+	group->ifindex = ifindex;
+	group->clean_flags = clean_flags;
+	group->debug = debug;
+	group->param = (struct iothconf_param) {
+		.config_flags = config_flags,
+		.fqdn = fqdn,
+		.mac = mac,
+		.secret = secret,
+		.grace = grace,
+		.retry = retry,
+	};
+	return 0;
+}
+
+static void *iothconf_group_run(void *arg) {
+	struct iothconf_group *group = arg;
+	struct ioth *stack = group->stack;
+	int ifindex = group->ifindex;
+	uint32_t clean_flags = group->clean_flags;
+	uint32_t config_flags = group->param.config_flags;
 	int retvalue = 0;
-	if (config_flags || clean_flags || debug) {
-		if (iface == NULL) iface = DEFAULT_INTERFACE;
-		if (ifindex == 0) ifindex = ioth_if_nametoindex(stack, iface);
-		if (ifindex <= 0)
-			return errno = ENODEV, -1;
-		if (clean_flags & IOTHCONF_STATIC)
-			iothconf_ip_clean(stack, ifindex, IOTH_CONFDATA_STATIC_TIMESTAMP, 0);
-		if (clean_flags & IOTHCONF_RD)
-			iothconf_ip_clean(stack, ifindex, IOTH_CONFDATA_RD6_TIMESTAMP, 0);
-		if (clean_flags & IOTHCONF_DHCPV6)
-			iothconf_ip_clean(stack, ifindex, IOTH_CONFDATA_DHCP6_TIMESTAMP, 0);
-		if (clean_flags & IOTHCONF_DHCP)
-			iothconf_ip_clean(stack, ifindex, IOTH_CONFDATA_DHCP4_TIMESTAMP, 0);
-		if (clean_flags & IOTHCONF_ETH)
-			iothconf_cleaneth(stack, ifindex, 0);
-		if (config_flags & IOTHCONF_ETH)
-			if (iothconf_eth(stack, ifindex, fqdn, mac, config_flags) == 0)
-				retvalue |= IOTHCONF_ETH;
-		if (config_flags & IOTHCONF_RD)
-			if (iothconf_rd(stack, ifindex, fqdn, config_flags) == 0)
-				retvalue |= IOTHCONF_RD;
-		if (config_flags & IOTHCONF_DHCPV6)
-			if (iothconf_dhcpv6(stack, ifindex, fqdn, config_flags) == 0)
-				retvalue |= IOTHCONF_DHCPV6;
-		if (config_flags & IOTHCONF_DHCP)
-			if (iothconf_dhcp(stack, ifindex, fqdn, config_flags) == 0)
-				retvalue |= IOTHCONF_DHCP;
-		if (config_flags & IOTHCONF_STATIC)
-			if (iothconf_static(stack, ifindex, tags, args, config_flags) == 0)
-				retvalue |= IOTHCONF_STATIC;
-		if(debug)
-			iothconf_data_debug(stack, ifindex);
+	uint64_t start = iothconf_stats_now();
+	if ((config_flags | clean_flags) & IOTHCONF_ALL)
+		iothconf_stats_reset(stack, ifindex);
+	if (clean_flags & IOTHCONF_STATIC)
+		iothconf_ip_clean(stack, ifindex, IOTH_CONFDATA_STATIC_TIMESTAMP, 0);
+	if (clean_flags & IOTHCONF_RD)
+		iothconf_ip_clean(stack, ifindex, IOTH_CONFDATA_RD6_TIMESTAMP, 0);
+	if (clean_flags & IOTHCONF_DHCPV6)
+		iothconf_ip_clean(stack, ifindex, IOTH_CONFDATA_DHCP6_TIMESTAMP, 0);
+	if (clean_flags & IOTHCONF_DHCP)
+		iothconf_ip_clean(stack, ifindex, IOTH_CONFDATA_DHCP4_TIMESTAMP, 0);
+	if (clean_flags & IOTHCONF_ETH)
+		iothconf_cleaneth(stack, ifindex, 0);
+	/* the change notifications are delivered as each engine returns (no lock is held here) */
+	ioth_confdata_dispatch();
+	if (config_flags & IOTHCONF_ETH)
+		if (iothconf_eth(stack, ifindex, &group->param) == 0)
+			retvalue |= IOTHCONF_ETH;
+	if (config_flags & IOTHCONF_RD) {
+		if (iothconf_rd(stack, ifindex, &group->param) == 0)
+			retvalue |= IOTHCONF_RD;
+		ioth_confdata_dispatch();
+	}
+	if (config_flags & IOTHCONF_DHCPV6) {
+		if (iothconf_dhcpv6(stack, ifindex, &group->param) == 0)
+			retvalue |= IOTHCONF_DHCPV6;
+		ioth_confdata_dispatch();
+	}
+	if (config_flags & IOTHCONF_DHCP) {
+		if (iothconf_dhcp(stack, ifindex, &group->param) == 0)
+			retvalue |= IOTHCONF_DHCP;
+		ioth_confdata_dispatch();
+	}
+	if (config_flags & IOTHCONF_STATIC) {
+		if (iothconf_static(stack, ifindex, group->items, group->nitems, &group->param) == 0)
+			retvalue |= IOTHCONF_STATIC;
+		ioth_confdata_dispatch();
+	}
+	if ((config_flags | clean_flags) & IOTHCONF_ALL)
+		iothconf_stats_add(stack, ifindex, IOTHCONF_PHASE_TOTAL, start);
+	group->retvalue = retvalue;
+	return NULL;
+}
+
+/* group of each tag: -1 = common options */
+static int iothconf_groups(char **tags, int *groupid) {
+	int ngroups = 0;
+	int has_iface = 0;
+	int has_ifindex = 0;
+	for (int i = 0; tags[i] != NULL; i++) {
+		switch(strcase(tags[i])) {
+			case STRCASE(i,f,a,c,e):
+				if (ngroups == 0 || has_iface) {
+					ngroups++;
+					has_ifindex = 0;
+				}
+				has_iface = 1;
+				break;
+			case STRCASE(i,f,i,n,d,e,x):
+				if (ngroups == 0 || has_ifindex) {
+					ngroups++;
+					has_iface = 0;
+				}
+				has_ifindex = 1;
+				break;
+		}
+		groupid[i] = ngroups - 1;
+	}
+	return ngroups == 0 ? 1 : ngroups;
+}
+
+/* the configuration string is parsed once: tags, args and the parsed static items
+	 of all the groups are stored in the handle, the interfaces are resolved */
+struct ioth_config_compiled {
+	struct ioth *stack;
+	int ngroups;
+	struct iothconf_group *groups;
+	struct iothconf_static *items;
+	char buf[]; // tags and args point here
+};
+
+static struct ioth_config_compiled *iothconf_compile(struct ioth *stack, const char *config,
+		int from_ioth_newstackc) {
+	struct ioth_config_compiled *cc;
+	if (config == NULL) config = "";
+	int tagc = stropt(config, NULL, NULL, NULL);
+	char *tags[tagc];
+	char *args[tagc];
+	int groupid[tagc];
+	char *grouptags[tagc];
+	char *groupargs[tagc];
+	if ((cc = malloc(sizeof(*cc) + strlen(config) + 1)) == NULL)
+		return NULL;
+	stropt(config, tags, args, cc->buf);
+	int ngroups = iothconf_groups(tags, groupid);
+	cc->stack = stack;
+	cc->ngroups = ngroups;
+	cc->groups = calloc(ngroups, sizeof(*cc->groups));
+	cc->items = calloc(ngroups * tagc, sizeof(*cc->items));
+	if (cc->groups == NULL || cc->items == NULL)
+		goto err;
+	for (int g = 0; g < ngroups; g++) {
+		int n = 0;
+		for (int i = 0; i < tagc - 1; i++) {
+			if (groupid[i] < 0 || groupid[i] == g) {
+				grouptags[n] = tags[i];
+				groupargs[n++] = args[i];
+			}
+		}
+		grouptags[n] = groupargs[n] = NULL;
+		cc->groups[g] = (struct iothconf_group) {
+			.stack = stack,
+			.items = cc->items + g * tagc,
+		};
+		if (iothconf_parse(&cc->groups[g], grouptags, groupargs, from_ioth_newstackc) < 0)
+			goto err;
+	}
+	/* check all the interfaces first */
+	for (int g = 0; g < ngroups; g++) {
+		struct iothconf_group *group = &cc->groups[g];
+		if (group->param.config_flags || group->clean_flags || group->debug) {
+			if (group->iface == NULL) group->iface = DEFAULT_INTERFACE;
+			if (group->ifindex == 0) group->ifindex = ioth_if_nametoindex(stack, group->iface);
+			if (group->ifindex <= 0) {
+				errno = ENODEV;
+				goto err;
+			}
+		}
+	}
+	return cc;
+err:
+	ioth_config_compiled_free(cc);
+	return NULL;
+}
+
+/* the handle is read only: each call works on a (heap allocated) copy of the groups */
+struct iothconf_apply_group {
+	struct iothconf_group group;
+	pthread_t thread;
+	int running;
+};
+
+static int iothconf_apply(struct ioth_config_compiled *cc,
+		struct ioth_config_ifresult *ifresult, int count) {
+	struct ioth *stack = cc->stack;
+	int ngroups = cc->ngroups;
+	struct iothconf_apply_group *groups = calloc(ngroups + 1, sizeof(*groups));
+	if (groups == NULL)
+		return -1;
+	for (int g = 0; g < ngroups; g++) {
+		groups[g].group = cc->groups[g];
+		if (groups[g].group.ifindex <= 0)
+			continue;
+		if (g < ngroups - 1 &&
+				pthread_create(&groups[g].thread, NULL, iothconf_group_run, &groups[g].group) == 0)
+			groups[g].running = 1;
+		else
+			iothconf_group_run(&groups[g].group);
 	}
+	int retvalue = 0;
+	for (int g = 0; g < ngroups; g++) {
+		if (groups[g].running)
+			pthread_join(groups[g].thread, NULL);
+		retvalue |= groups[g].group.retvalue;
+		if (g < count)
+			ifresult[g] = (struct ioth_config_ifresult) {
+				.ifindex = groups[g].group.ifindex,
+				.retvalue = groups[g].group.retvalue,
+			};
+	}
+	for (int g = 0; g < ngroups; g++) {
+		if (groups[g].group.debug)
+			iothconf_data_debug(stack, groups[g].group.ifindex);
+	}
+	free(groups);
+	return (ifresult == NULL) ? retvalue : ngroups;
+}
+
+static int _ioth_config(struct ioth *stack, const char *config, int from_ioth_newstackc,
+		struct ioth_config_ifresult *ifresult, int count) {
+	struct ioth_config_compiled *cc = iothconf_compile(stack, config, from_ioth_newstackc);
+	if (cc == NULL)
+		return -1;
+	int retvalue = iothconf_apply(cc, ifresult, count);
+	ioth_config_compiled_free(cc);
 	return retvalue;
 }
 
 int ioth_config(struct ioth *stack, const char *config) {
-	return _ioth_config(stack, config, 0);
+	return _ioth_config(stack, config, 0, NULL, 0);
+}
+
+int ioth_configv(struct ioth *stack, const char *config,
+		struct ioth_config_ifresult *ifresult, int count) {
+	struct ioth_config_ifresult dummy;
+	if (ifresult == NULL) ifresult = &dummy, count = 0;
+	return _ioth_config(stack, config, 0, ifresult, count);
+}
+
+struct ioth_config_compiled *ioth_config_compile(struct ioth *stack, const char *config) {
+	return iothconf_compile(stack, config, 0);
+}
+
+int ioth_config_apply(struct ioth_config_compiled *cc) {
+	if (cc == NULL)
+		return errno = EINVAL, -1;
+	return iothconf_apply(cc, NULL, 0);
+}
+
+int ioth_config_applyv(struct ioth_config_compiled *cc,
+		struct ioth_config_ifresult *ifresult, int count) {
+	struct ioth_config_ifresult dummy;
+	if (cc == NULL)
+		return errno = EINVAL, -1;
+	if (ifresult == NULL) ifresult = &dummy, count = 0;
+	return iothconf_apply(cc, ifresult, count);
+}
+
+void ioth_config_compiled_free(struct ioth_config_compiled *cc) {
+	int saved_errno = errno;
+	if (cc != NULL) {
+		free(cc->groups);
+		free(cc->items);
+		free(cc);
+	}
+	errno = saved_errno;
+}
+
+/* prio=...: list of sources separated by ':' (e.g. prio=dhcp6:static).
+	 The sources missing in the list follow in the default order */
+static int iothconf_dnsprio(char *list, uint8_t *prio) {
+	int n = 0;
+	char *saveptr;
+	for (char *src = strtok_r(list, ":", &saveptr); src != NULL; src = strtok_r(NULL, ":", &saveptr)) {
+		uint8_t type;
+		switch(strcase(src)) {
+			case STRCASE(s,t,a,t,i,c): type = IOTH_CONFDATA_STATIC_TIMESTAMP; break;
+			case STRCASE(d,h,c,p):
+			case STRCASE(d,h,c,p,4):
+			case STRCASE(d,h,c,p,v,4): type = IOTH_CONFDATA_DHCP4_TIMESTAMP; break;
+			case STRCASE(d,h,c,p,6):
+			case STRCASE(d,h,c,p,v,6): type = IOTH_CONFDATA_DHCP6_TIMESTAMP; break;
+			case STRCASE(r,d):
+			case STRCASE(r,d,6): type = IOTH_CONFDATA_RD6_TIMESTAMP; break;
+			default: return errno = EINVAL, -1;
+		}
+		if (memchr(prio, type, n) == NULL)
+			prio[n++] = type;
+	}
+	for (int i = 0; i < IOTHCONF_DNS_NSOURCES; i++) {
+		if (memchr(prio, iothconf_resolvconf_defprio[i], n) == NULL)
+			prio[n++] = iothconf_resolvconf_defprio[i];
+	}
+	return 0;
 }
 
 char *ioth_resolvconf(struct ioth *stack, const char *config) {
 	char *iface = NULL;
 	int ifindex = 0;
+	uint8_t prio[IOTHCONF_DNS_NSOURCES];
+	uint8_t *prioptr = NULL;
 	if (config == NULL) config = "";
 	int tagc = stropt(config, NULL, NULL, NULL);
 	char buf[strlen(config) + 1];
@@ -320,15 +695,20 @@ char *ioth_resolvconf(struct ioth *stack, const char *config) {
 															 if (args[i] != NULL)
 																 ifindex = strtoul(args[i], NULL, 10);
 															 break;
+			case STRCASE(p,r,i,o):
+															 if (args[i] == NULL || iothconf_dnsprio(args[i], prio) < 0)
+																 return errno = EINVAL, NULL;
+															 prioptr = prio;
+															 break;
 			default:
 															 return errno = EINVAL, NULL;
 		}
 	}
 	if (iface == NULL) iface = DEFAULT_INTERFACE;
-	if (ifindex == 0) ifindex = ioth_if_nametoindex(stack, DEFAULT_INTERFACE);
+	if (ifindex == 0) ifindex = ioth_if_nametoindex(stack, iface);
 	if (ifindex <= 0)
 		return errno = ENODEV, NULL;
-	return iothconf_resolvconf(stack, ifindex);
+	return iothconf_resolvconf(stack, ifindex, prioptr);
 }
 
 struct ioth *ioth_newstackc(const char *stack_config) {
@@ -353,9 +733,20 @@ struct ioth *ioth_newstackc(const char *stack_config) {
 	}
 	if ((ioth_stack = ioth_newstack(stack, vnl)) == NULL)
 		return NULL;
-	if (_ioth_config(ioth_stack, stack_config, 1) == -1) {
+	if (_ioth_config(ioth_stack, stack_config, 1, NULL, 0) == -1) {
+		ioth_config_release(ioth_stack);
 		ioth_delstack(ioth_stack);
 		return NULL;
 	}
 	return ioth_stack;
 }
+
+/* the configuration data and the caches are indexed by the stack pointer:
+	 a new stack could get the address of a deleted one */
+void ioth_config_release(struct ioth *stack) {
+	iothconf_dad6_stop(stack);
+	iothconf_ip_stop(stack);
+	ioth_confdata_release(stack);
+	iothconf_resolvconf_release(stack);
+	iothconf_stats_release(stack);
+}
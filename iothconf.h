@@ -1,5 +1,8 @@
 #ifndef IOTHCONF_H
 #define IOTHCONF_H
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
 #include <ioth.h>
 
 /* config is a comma separated list of flags and variable assignments:
@@ -15,6 +18,28 @@
  *   dhcp6 : (or dhcpv6) use dhcpv6 (for IPv6)
  *   rd : (or rd6) use the router discovery protocol (IPv6)
  *   slaac : use stateless auto-configuration (IPv6) (requires rd)
+ *   stable : slaac using stable and opaque interface identifiers (RFC 7217), requires secret=...
+ *   secret=... : secret key for stable (required by stable: it must not be guessable)
+ *   dad : optimistic duplicate address detection (RFC 4429) of slaac and dhcp6 addresses.
+ *         Addresses can be used at once, probes run in background for about one second
+ *         (ioth_config_release stops them: call it before ioth_delstack).
+ *   acd : IPv4 address conflict detection (RFC 5227) of dhcp and static addresses.
+ *         Each new address is probed by 3 ARP probes 1-2 secs apart (about 5 secs,
+ *         the probes of the dhcp address run in parallel with the DHCPREQUEST).
+ *         A conflicting dhcp address is declined (dhcp restarts after 10 secs),
+ *         a conflicting static address is not set.
+ *   grace=N : renumbering (make-before-break): addresses no longer provided are kept
+ *         for N seconds, the new addresses are set before the old ones are removed.
+ *         The old addresses are removed in background at the end of the grace period
+ *         (ioth_config_release stops the removal: call it before ioth_delstack).
+ *   timeout=N : initial retransmission timeout of dhcp, dhcp6 and rd messages (msecs).
+ *         The timeout doubles at each retransmission (randomized exponential backoff).
+ *   retries=N : max number of retransmissions (default 2 for dhcp/dhcp6, 0 for rd)
+ *   maxtime=N : max duration of each message exchange (msecs, 0 = unlimited,
+ *         default 6000 for dhcp/dhcp6, unlimited for rd).
+ *         The timeouts are shortened so that all the retries fit in maxtime.
+ *   delay=N : random delay (0 ... N msecs) before the first message of dhcp, dhcp6 and rd
+ *         ("delay" without a value: 1000 msecs, as in RFC 4861 and RFC 8415)
  *   auto : shortcut for eth+dhcp+dhcp6+rd
  *   auto4 : (or autov4) shortcut for eth+dhcp
  *   auto6 : (or autov6) shortcut for eth+dhcp6+rd
@@ -24,10 +49,17 @@
  *   dns=.... : set a static address for a DNS server
  *   domain=.... : set a static domain for the dns search
  *   debug : show the status of the current configuration parameters
+ *           and the time spent in each phase (see ioth_config_stats)
  *   -static, -eth, -dhcp, -dhcp6, -rd, -auto, -auto4, -auto
  *     (and all the synonyms + a heading minus)
  *     clean (undo) the configuration
  *
+ *   Several interfaces can be configured by one call: each iface=... (or ifindex=...)
+ *   starts the options of a new interface, the options before the first iface/ifindex
+ *   are common to all the interfaces. e.g.:
+ *     "fqdn=host.example.org,iface=vde0,auto,iface=vde1,dhcp"
+ *   The interfaces are configured concurrently.
+ *
  *   ioth_config can use four sources to compute the current configuration:
  *   static data, dhcp, router discovery and dhcpv6
  *   The current confiuration is a merge of all the parameters collected from
@@ -46,19 +78,273 @@ int ioth_config(struct ioth *stack, const char *config);
 #define IOTHCONF_DHCPV6   1 << 3
 #define IOTHCONF_RD       1 << 4
 
+/* ioth_configv is ioth_config returning the result of each interface:
+	 ifresult is an array of count elements, the i-th element is the result of the i-th
+	 interface of config: its ifindex and the mask of the successful configurations.
+	 The return value is the number of interfaces defined in config (it can be greater than count)
+	 or -1 in case of error */
+struct ioth_config_ifresult {
+	unsigned int ifindex;
+	int retvalue;
+};
+
+int ioth_configv(struct ioth *stack, const char *config,
+		struct ioth_config_ifresult *ifresult, int count);
+
+/* ioth_config_compile parses config once (same syntax as ioth_config) and returns a handle
+ *   (NULL and errno set in case of error: EINVAL invalid option, ENODEV unknown interface).
+ *   The options are validated, the interfaces resolved and the static addresses parsed:
+ *   ioth_config_apply (and ioth_config_applyv) run the configuration as
+ *   ioth_config (ioth_configv) with no parsing (e.g. to periodically reconfigure a stack).
+ *   The handle is bound to stack and it is never modified by ioth_config_apply*:
+ *   it can be applied concurrently by several threads.
+ *   ioth_config_compiled_free deallocates the handle.
+ */
+struct ioth_config_compiled;
+struct ioth_config_compiled *ioth_config_compile(struct ioth *stack, const char *config);
+int ioth_config_apply(struct ioth_config_compiled *cc);
+int ioth_config_applyv(struct ioth_config_compiled *cc,
+		struct ioth_config_ifresult *ifresult, int count);
+void ioth_config_compiled_free(struct ioth_config_compiled *cc);
+
+/* ioth_config_async is the non blocking version of ioth_config:
+ *   it returns at once a handle (NULL in case of error), the configuration runs
+ *   in an internal worker thread.
+ *   When the configuration completes:
+ *     - callback (if not NULL) is called (by the worker thread) with the return value
+ *       of ioth_config (errno is set as set by ioth_config);
+ *     - the file descriptor returned by ioth_config_async_fd becomes readable
+ *       (it can be added to the caller's event loop: poll/select/epoll).
+ *   ioth_config_async_result returns the result of ioth_config
+ *       or -1 and errno = EINPROGRESS if the configuration is still running.
+ *   ioth_config_async_free waits for the completion, frees the handle and returns the result.
+ *       It can be called by the callback (the handle is freed when the callback returns).
+ *   Do not delete the stack before the completion.
+ */
+struct ioth_config_async;
+typedef void ioth_config_async_cb(struct ioth *stack, int retvalue, void *arg);
+struct ioth_config_async *ioth_config_async(struct ioth *stack, const char *config,
+		ioth_config_async_cb *callback, void *arg);
+int ioth_config_async_fd(struct ioth_config_async *handle);
+int ioth_config_async_result(struct ioth_config_async *handle);
+int ioth_config_async_free(struct ioth_config_async *handle);
+
+/* ioth_config_ratelimit limits the rate of the configuration messages (dhcp, dhcpv6,
+ *   router solicitations) sent by all the stacks of the process:
+ *   at most rate msgs per second, bursts up to burst msgs (token bucket).
+ *   rate == 0 disables the limit (default).
+ */
+void ioth_config_ratelimit(unsigned int rate, unsigned int burst);
+
+/* ioth_config_capture writes the configuration messages (dhcp, dhcpv6, router
+ *   solicitations/advertisements) sent and received by all the stacks of the process
+ *   in the pcap file path (link type LINUX_SLL2: each packet has the interface index and
+ *   the direction). path == NULL stops the capture. It returns 0 on success, -1 in case of error.
+ *   The IPv6 and UDP headers of dhcpv6 and rd messages are reconstructed:
+ *   the addresses chosen by the stack (e.g. the link-local source address) are unspecified (::).
+ *   bench/iothconf_replay feeds a capture file to the parsers and to the configuration data.
+ */
+int ioth_config_capture(const char *path);
+
 /* ioth_resolvconf returns a string in resolv.conf(5) format.
  *	 the string is dynamically allocated (use free(3) to deallocate it).
  *	 config is a comma separated list of flags and variable assignments:
  *
  *   iface=... : select the interface e.g. iface=eth0 (default value vde0)
  *   ifindex=... : id of the interface (it can be used instead of iface)
+ *   prio=... : priority of the sources, a list separated by ':' e.g. prio=dhcp6:static
+ *      (sources: static, dhcp, dhcp6, rd; default order static:dhcp6:dhcp:rd)
  *
+ *   Duplicate nameservers and domains are removed, the resolv.conf(5) limits are
+ *   enforced: the first 3 nameservers and the first 6 search domains are used.
  *   It returns NULL and errno = 0 if nothing changed since the previous call.
  *   In case of error it returns NULL and errno != 0
  */
 
 char *ioth_resolvconf(struct ioth *stack, const char *config);
 
+/* ioth_resolvconf_generation returns the generation number of the DNS configuration
+ *   of the interface ifindex: it changes each time a nameserver or a search domain
+ *   is added or removed (0: no DNS data has ever been defined).
+ *   It is a cheap test to check if the DNS configuration has changed since a
+ *   previous call. The string returned by ioth_resolvconf is cached and generated
+ *   again only when the generation changes.
+ */
+uint64_t ioth_resolvconf_generation(struct ioth *stack, unsigned int ifindex);
+
+/* ioth_dnsconf returns the DNS configuration of the interface ifindex in caller provided arrays:
+ *   the nameservers (ordered: static IPv6, static IPv4, DHCPv6, DHCPv4) and the search domains.
+ *   *nservers and *ndomains are the sizes of the arrays (in) and the number of elements
+ *   stored (out). Duplicates are removed. Each element includes its source
+ *   (IOTHCONF_STATIC, IOTHCONF_DHCP, IOTHCONF_DHCPV6 or IOTHCONF_RD) and
+ *   its remaining lifetime in seconds (the lease time of the source, 0xffffffff = infinite).
+ *   ioth_dnsconf does not allocate memory. it returns 0 on success, -1 in case of error.
+ */
+#define IOTH_DNSDOMAIN_MAXLEN 254
+struct ioth_dnsserver {
+	struct sockaddr_storage addr;
+	uint8_t source;
+	uint32_t lifetime;
+};
+
+struct ioth_dnsdomain {
+	char domain[IOTH_DNSDOMAIN_MAXLEN];
+	uint8_t source;
+	uint32_t lifetime;
+};
+
+int ioth_dnsconf(struct ioth *stack, unsigned int ifindex,
+		struct ioth_dnsserver *servers, int *nservers,
+		struct ioth_dnsdomain *domains, int *ndomains);
+
+/* ioth_config_stats returns the time spent (usecs, monotonic clock) in each phase of
+ *   the latest configuration run of the interface ifindex (stats->usec[phase]):
+ *     IOTHCONF_PHASE_TOTAL: the whole run
+ *     IOTHCONF_PHASE_ETH: link-up (eth)
+ *     IOTHCONF_PHASE_TIMESTAMP: wait for a new timestamp (one update per second per source)
+ *     IOTHCONF_PHASE_RD: router solicitation -> router advertisement
+ *     IOTHCONF_PHASE_DHCP6_ADVERTISE, IOTHCONF_PHASE_DHCP6_REPLY: SOLICIT -> ADVERTISE, REQUEST -> REPLY
+ *     IOTHCONF_PHASE_DHCP_OFFER, IOTHCONF_PHASE_DHCP_ACK: DISCOVER -> OFFER, REQUEST -> ACK
+ *     IOTHCONF_PHASE_APPLY: addresses and routes set in the stack
+ *   Exchanges include the retransmissions. The stats are shown also by the debug option.
+ *   It returns 0 on success, -1 and errno = ENOENT if the interface has never been configured.
+ */
+#define IOTHCONF_PHASE_TOTAL            0
+#define IOTHCONF_PHASE_ETH              1
+#define IOTHCONF_PHASE_TIMESTAMP        2
+#define IOTHCONF_PHASE_RD               3
+#define IOTHCONF_PHASE_DHCP6_ADVERTISE  4
+#define IOTHCONF_PHASE_DHCP6_REPLY      5
+#define IOTHCONF_PHASE_DHCP_OFFER       6
+#define IOTHCONF_PHASE_DHCP_ACK         7
+#define IOTHCONF_PHASE_APPLY            8
+#define IOTHCONF_NPHASES                9
+
+struct ioth_config_stats {
+	uint64_t usec[IOTHCONF_NPHASES];
+};
+
+int ioth_config_stats(struct ioth *stack, unsigned int ifindex, struct ioth_config_stats *stats);
+
+/* ioth_config_counters returns the counters of the interface ifindex
+ *   (ifindex == 0: the sum of the counters of all the interfaces of the stack).
+ *   The counters are cumulative (never reset):
+ *     tx/rx messages per type, retransmissions, exchanges timed out, spurious packets
+ *     (rejected: inconsistent or not matching the request), DHCP NAKs, malformed packets,
+ *     records added/removed, wait time for the lock of the configuration data.
+ *   It returns 0 on success, -1 and errno = ENOENT if there are no counters.
+ * ioth_config_stats_dump returns the counters and the stats of the interface ifindex
+ *   (ifindex == 0: all the interfaces of the stack) in a machine-parsable format:
+ *   one line per value: "ifindex name value\n" e.g. "2 dhcp.tx.discover 1".
+ *   the string is dynamically allocated (use free(3) to deallocate it), NULL in case of error.
+ */
+#define IOTHCONF_COUNT_DHCP_TX_DISCOVER   0
+#define IOTHCONF_COUNT_DHCP_TX_REQUEST    1
+#define IOTHCONF_COUNT_DHCP_TX_DECLINE    2
+#define IOTHCONF_COUNT_DHCP_RX_OFFER      3
+#define IOTHCONF_COUNT_DHCP_RX_ACK        4
+#define IOTHCONF_COUNT_DHCP_RX_NAK        5
+#define IOTHCONF_COUNT_DHCP_RETRY         6
+#define IOTHCONF_COUNT_DHCP_TIMEOUT       7
+#define IOTHCONF_COUNT_DHCP_SPURIOUS      8
+#define IOTHCONF_COUNT_DHCP6_TX_SOLICIT   9
+#define IOTHCONF_COUNT_DHCP6_TX_REQUEST   10
+#define IOTHCONF_COUNT_DHCP6_RX_ADVERTISE 11
+#define IOTHCONF_COUNT_DHCP6_RX_REPLY     12
+#define IOTHCONF_COUNT_DHCP6_RETRY        13
+#define IOTHCONF_COUNT_DHCP6_TIMEOUT      14
+#define IOTHCONF_COUNT_DHCP6_SPURIOUS     15
+#define IOTHCONF_COUNT_RD_TX_RS           16
+#define IOTHCONF_COUNT_RD_RX_RA           17
+#define IOTHCONF_COUNT_RD_RETRY           18
+#define IOTHCONF_COUNT_RD_TIMEOUT         19
+#define IOTHCONF_COUNT_RD_SPURIOUS        20
+#define IOTHCONF_COUNT_PARSE_ERROR        21
+#define IOTHCONF_COUNT_RECORD_ADD         22
+#define IOTHCONF_COUNT_RECORD_DEL         23
+#define IOTHCONF_COUNT_LOCK_WAIT          24
+#define IOTHCONF_COUNT_LOCK_WAIT_USEC     25
+#define IOTHCONF_NCOUNTERS                26
+
+struct ioth_config_counters {
+	uint64_t count[IOTHCONF_NCOUNTERS];
+};
+
+int ioth_config_counters(struct ioth *stack, unsigned int ifindex, struct ioth_config_counters *counters);
+char *ioth_config_stats_dump(struct ioth *stack, unsigned int ifindex);
+
+/* ioth_config_dump stores in buf (size bytes) the configuration data of the interface ifindex
+ *   (ifindex == 0: all the interfaces of the stack) in JSON format:
+ *     {"records":[{"ifindex":2,"type":66,"name":"d4a","source":"dhcp","timestamp":1633072800,
+ *       "flags":1,"active":true,"checked":false,"deprecated":false,
+ *       "addr":"10.0.0.1","prefixlen":24,"leasetime":3600}, ...]}
+ *   lifetimes are in seconds (4294967295: infinite), timestamps are in seconds since the Epoch.
+ *   Records are sorted by type, non-ASCII bytes of the domains are escaped (\u00XX).
+ *   The data is copied (snapshot) and the JSON string is generated without holding the lock.
+ *   Like snprintf(3), the return value is the length of the whole JSON string: if it is
+ *   greater than or equal to size the output has been truncated (buf can be NULL if size is 0).
+ *   It returns -1 in case of error.
+ */
+int ioth_config_dump(struct ioth *stack, unsigned int ifindex, char *buf, size_t size);
+
+/* ioth_config_save stores in buf (size bytes) a binary snapshot of the configuration data
+ *   acquired by dhcp, dhcpv6 and rd for the interface ifindex (ifindex == 0: all the
+ *   interfaces of the stack). Each record has its absolute expiration time.
+ *   The format is versioned, in host byte order, the records are 8 byte aligned (a snapshot
+ *   file can be mmapped). Like ioth_config_dump the return value is the length of the
+ *   whole snapshot (nothing is stored if it is greater than size), -1 in case of error.
+ * ioth_config_restore adds the records of a snapshot which are still valid to the
+ *   configuration data of stack and installs their addresses and routes at once.
+ *   The interfaces must have the same indexes. The duplicate address detection state
+ *   is not saved: the next run of the engines checks the restored addresses again (dad).
+ *   It returns the number of restored records, -1 in case of error (EINVAL: invalid snapshot,
+ *   ENOTSUP: unsupported version).
+ * ioth_config_save_file and ioth_config_restore_file save/restore a snapshot file
+ *   (the new file replaces the old one atomically, the file is mmapped to restore it).
+ *
+ *   Warm restart: ioth_config_restore_file and then ioth_config_async with the same
+ *   configuration string: the configuration data is refreshed in background, the
+ *   addresses confirmed by the servers/routers are kept in place.
+ */
+int ioth_config_save(struct ioth *stack, unsigned int ifindex, void *buf, size_t size);
+int ioth_config_restore(struct ioth *stack, const void *buf, size_t len);
+int ioth_config_save_file(struct ioth *stack, unsigned int ifindex, const char *path);
+int ioth_config_restore_file(struct ioth *stack, const char *path);
+
+/* ioth_config_subscribe notifies the changes of the configuration data
+ *   (instead of polling ioth_resolvconf or ioth_dnsconf).
+ *   stack: NULL means all the stacks, ifindex: 0 means all the interfaces.
+ *   sources: mask of IOTHCONF_STATIC, IOTHCONF_DHCP, IOTHCONF_DHCPV6, IOTHCONF_RD (0 = all)
+ *   what: mask of IOTHCONF_NOTIFY_ADDR, IOTHCONF_NOTIFY_ROUTE, IOTHCONF_NOTIFY_DNS (0 = all)
+ *   When a matching record is added, changed (e.g. deprecated address, completed DAD)
+ *   or removed (expired or deleted):
+ *     - the file descriptor returned by ioth_config_notify_fd becomes readable;
+ *       ioth_config_notify_events returns (and clears) the events since its previous call;
+ *     - callback (if not NULL) is called with the stack of the subscription and the mask
+ *       of events: what bits | IOTHCONF_NOTIFY_ADDED/CHANGED/REMOVED.
+ *   Events are coalesced. Callbacks are serialized and run when an engine returns
+ *   (ioth_config, ioth_config_restore, end of DAD), when the library does not hold any lock:
+ *   they can call the library functions (e.g. ioth_resolvconf, ioth_config).
+ *   The events raised by other threads while a callback runs are delivered by the thread
+ *   running the callback, after it returns.
+ *   ioth_config_unsubscribe deletes the subscription. It can be called by the callback,
+ *   otherwise it waits for the end of the running callback of the subscription (if any).
+ */
+#define IOTHCONF_NOTIFY_ADDR     1 << 0
+#define IOTHCONF_NOTIFY_ROUTE    1 << 1
+#define IOTHCONF_NOTIFY_DNS      1 << 2
+#define IOTHCONF_NOTIFY_ADDED    1 << 8
+#define IOTHCONF_NOTIFY_CHANGED  1 << 9
+#define IOTHCONF_NOTIFY_REMOVED  1 << 10
+
+struct ioth_config_notify;
+typedef void ioth_config_notify_cb(struct ioth *stack, uint32_t events, void *arg);
+struct ioth_config_notify *ioth_config_subscribe(struct ioth *stack, unsigned int ifindex,
+		uint32_t sources, uint32_t what, ioth_config_notify_cb *callback, void *arg);
+int ioth_config_notify_fd(struct ioth_config_notify *sub);
+uint32_t ioth_config_notify_events(struct ioth_config_notify *sub);
+void ioth_config_unsubscribe(struct ioth_config_notify *sub);
+
 /* ioth_newstackc creates a stack and configure it.
  *    ioth_newstackc:
  *      - is a shortcut call for ioth_newstack+ioth_config;
@@ -72,4 +358,40 @@ char *ioth_resolvconf(struct ioth *stack, const char *config);
  */
 struct ioth *ioth_newstackc(const char *stack_config);
 
+/* ioth_newstackcv creates and configures count stacks: stack_config[i] is the
+ *    configuration string of the i-th stack (same syntax of ioth_newstackc).
+ *    The stacks are created/configured concurrently by a pool of nthreads threads
+ *    (nthreads <= 0: default pool size, 64).
+ *    stacks[i] is set to the descriptor of the i-th stack (NULL in case of error).
+ *    callback (if not NULL) is called as soon as each stack is ready (or failed):
+ *      the calls are serialized, errno is set when stack is NULL.
+ *    it returns when all the stacks have been processed: the return value is the number
+ *    of stacks successfully created, -1 in case of error.
+ */
+typedef void ioth_newstackcv_cb(int index, struct ioth *stack, void *arg);
+int ioth_newstackcv(const char *stack_config[], struct ioth *stacks[], int count, int nthreads,
+		ioth_newstackcv_cb *callback, void *arg);
+
+/* ioth_config_release stops the background activities of iothconf on stack
+ *    (duplicate address detection threads, removal of the deprecated addresses) and frees its configuration data,
+ *    its cached resolv.conf strings and its stats.
+ *    It must be called before ioth_delstack (a new stack could get the same address).
+ */
+void ioth_config_release(struct ioth *stack);
+
+/* ioth_hashid computes the hash based identities that iothconf derives from fqdn:
+ *   the MAC address (eth), the IPv6 interface identifier (slaac) and
+ *   the DUID (DUID-LL of the hash based MAC, the DHCPv6 client identifier if fqdn is defined).
+ *   Results are cached: it is cheap to compute the identities of the same name again.
+ * ioth_hashidv computes the identities of an array of count names at once.
+ */
+struct ioth_hashid {
+	uint8_t mac[6];
+	uint8_t iid[8];
+	uint8_t duid[10];
+};
+
+void ioth_hashid(const char *fqdn, struct ioth_hashid *id);
+void ioth_hashidv(const char *fqdn[], struct ioth_hashid *ids, size_t count);
+
 #endif
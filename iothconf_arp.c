@@ -0,0 +1,192 @@
+/*
+ *   iothconf_arp.c: auto configuration library for ioth
+ *       IPv4 address conflict detection (RFC 5227): arp probes and announcements
+ *
+ *   Copyright 2021 Renzo Davoli - Virtual Square Team
+ *   University of Bologna - Italy
+ *
+ *   This library is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or (at
+ *   your option) any later version.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <netinet/if_ether.h>
+#include <arpa/inet.h>
+#include <ioth.h>
+#include <iothconf.h>
+#include <iothconf_mod.h>
+#include <iothconf_stats.h>
+#include <iothconf_arp.h>
+
+int iothconf_arp_open(struct ioth *stack) {
+	return ioth_msocket(stack, AF_PACKET, SOCK_DGRAM, htons(ETH_P_ARP));
+}
+
+/* probe: sender IP 0.0.0.0, announcement: sender IP = target IP */
+static void arp_send(int fd, unsigned int ifindex, uint8_t *macaddr, struct in_addr *addr, int announce) {
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_ARP),
+		.sll_ifindex = ifindex,
+		.sll_halen = ETH_ALEN,
+		.sll_addr = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}
+	};
+	struct ether_arp arp = {
+		.ea_hdr.ar_hrd = htons(ARPHRD_ETHER),
+		.ea_hdr.ar_pro = htons(ETH_P_IP),
+		.ea_hdr.ar_hln = ETH_ALEN,
+		.ea_hdr.ar_pln = sizeof(struct in_addr),
+		.ea_hdr.ar_op = htons(ARPOP_REQUEST),
+	};
+	memcpy(arp.arp_sha, macaddr, ETH_ALEN);
+	if (announce)
+		memcpy(arp.arp_spa, addr, sizeof(struct in_addr));
+	memcpy(arp.arp_tpa, addr, sizeof(struct in_addr));
+	ioth_sendto(fd, &arp, sizeof(arp), 0, (struct sockaddr *) &sll, sizeof(sll));
+}
+
+void iothconf_arp_probe(int fd, unsigned int ifindex, uint8_t *macaddr, struct in_addr *addr) {
+	arp_send(fd, ifindex, macaddr, addr, 0);
+}
+
+void iothconf_arp_announce(int fd, unsigned int ifindex, uint8_t *macaddr, struct in_addr *addr) {
+	arp_send(fd, ifindex, macaddr, addr, 1);
+}
+
+/* read all the pending arp packets, return 1 if another node uses (or is probing) addr:
+	 sender IP == addr or (probe) sender IP == 0 && target IP == addr,
+	 sender MAC != macaddr */
+int iothconf_arp_conflict(int fd, unsigned int ifindex, uint8_t *macaddr, struct in_addr *addr) {
+	struct pollfd pfd[] = {{fd, POLLIN, 0}};
+	int conflict = 0;
+	while (poll(pfd, 1, 0) > 0) {
+		struct ether_arp arp;
+		struct sockaddr_ll sll;
+		socklen_t slllen = sizeof(sll);
+		static const uint8_t zero[sizeof(struct in_addr)];
+		ssize_t len = ioth_recvfrom(fd, &arp, sizeof(arp), 0, (struct sockaddr *) &sll, &slllen);
+		if (len < (ssize_t) sizeof(arp))
+			continue;
+		if (sll.sll_ifindex != (int) ifindex ||
+				arp.ea_hdr.ar_pro != htons(ETH_P_IP) || arp.ea_hdr.ar_pln != sizeof(struct in_addr) ||
+				memcmp(arp.arp_sha, macaddr, ETH_ALEN) == 0)
+			continue;
+		if (memcmp(arp.arp_spa, addr, sizeof(struct in_addr)) == 0 ||
+				(memcmp(arp.arp_spa, zero, sizeof(zero)) == 0 &&
+				 memcmp(arp.arp_tpa, addr, sizeof(struct in_addr)) == 0))
+			conflict = 1;
+	}
+	return conflict;
+}
+
+/* random value in the range 0 ... range */
+static int acd_rand(int range) {
+	uint32_t r;
+	if (range <= 0 || getrandom(&r, sizeof(r), 0) < 0)
+		return 0;
+	return r % ((uint32_t) range + 1);
+}
+
+void iothconf_acd_start(struct iothconf_acd *acd, int fd, unsigned int ifindex,
+		uint8_t *macaddr, struct in_addr *addr) {
+	*acd = (struct iothconf_acd) {
+		.fd = fd,
+		.ifindex = ifindex,
+		.addr = *addr,
+		.next = iothconf_stats_now() + 1000ULL * acd_rand(ACD_PROBE_WAIT),
+	};
+	memcpy(acd->macaddr, macaddr, ETH_ALEN);
+	/* packets received before the start are not conflicts of this sequence */
+	iothconf_arp_conflict(fd, ifindex, acd->macaddr, &acd->addr);
+}
+
+int iothconf_acd_step(struct iothconf_acd *acd) {
+	uint64_t now;
+	if (acd->conflict)
+		return 0;
+	if (iothconf_arp_conflict(acd->fd, acd->ifindex, acd->macaddr, &acd->addr)) {
+		acd->conflict = 1;
+		return 0;
+	}
+	now = iothconf_stats_now();
+	if (now >= acd->next) {
+		if (acd->nprobes >= ACD_PROBE_NUM)
+			return 0;
+		iothconf_arp_probe(acd->fd, acd->ifindex, acd->macaddr, &acd->addr);
+		acd->nprobes++;
+		acd->next = now + 1000ULL * (acd->nprobes < ACD_PROBE_NUM ?
+				ACD_PROBE_MIN + acd_rand(ACD_PROBE_MAX - ACD_PROBE_MIN) : ACD_ANNOUNCE_WAIT);
+	}
+	return (acd->next - now + 999) / 1000;
+}
+
+int iothconf_acd_run(struct iothconf_acd *acd, int nacd) {
+	struct pollfd *pfd = calloc(nacd, sizeof(*pfd));
+	int nconflict = 0;
+	for (;;) {
+		int timeout = 0;
+		for (int i = 0; i < nacd; i++) {
+			int steptimeout = iothconf_acd_step(&acd[i]);
+			if (steptimeout > 0 && (timeout == 0 || steptimeout < timeout))
+				timeout = steptimeout;
+			if (pfd != NULL)
+				pfd[i] = (struct pollfd) {steptimeout > 0 ? acd[i].fd : -1, POLLIN, 0};
+		}
+		if (timeout == 0)
+			break;
+		/* no memory for pfd: sleep up to the next step */
+		poll(pfd, pfd != NULL ? nacd : 0, timeout);
+	}
+	free(pfd);
+	for (int i = 0; i < nacd; i++)
+		nconflict += acd[i].conflict;
+	return nconflict;
+}
+
+/* probe the addresses in parallel */
+int iothconf_arp_check(struct ioth *stack, unsigned int ifindex, uint8_t *macaddr,
+		struct in_addr *addr, int *conflict, int naddr) {
+	struct iothconf_acd *acd = calloc(naddr, sizeof(*acd));
+	int nconflict = 0;
+	if (acd == NULL)
+		return 0;
+	for (int i = 0; i < naddr; i++) {
+		int fd = iothconf_arp_open(stack);
+		if (fd >= 0)
+			iothconf_acd_start(&acd[i], fd, ifindex, macaddr, &addr[i]);
+		else /* no arp socket: nothing to probe */
+			acd[i] = (struct iothconf_acd) {.fd = -1, .nprobes = ACD_PROBE_NUM};
+	}
+	iothconf_acd_run(acd, naddr);
+	for (int i = 0; i < naddr; i++) {
+		if (acd[i].fd >= 0)
+			ioth_close(acd[i].fd);
+		conflict[i] = acd[i].conflict;
+		nconflict += conflict[i];
+	}
+	free(acd);
+	return nconflict;
+}
+
+void iothconf_arp_announce_addr(struct ioth *stack, unsigned int ifindex, uint8_t *macaddr, struct in_addr *addr) {
+	int fd = iothconf_arp_open(stack);
+	if (fd >= 0) {
+		iothconf_arp_announce(fd, ifindex, macaddr, addr);
+		ioth_close(fd);
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef IOTHCONF_ARP_H
+#define IOTHCONF_ARP_H
+#include <stdint.h>
+#include <netinet/in.h>
+
+/* IPv4 address conflict detection (RFC 5227) */
+
+/* timing of the probes (msecs, RFC 5227 section 1.1):
+	 the first probe after a random delay (0 ... ACD_PROBE_WAIT),
+	 ACD_PROBE_NUM probes spaced by a random interval (ACD_PROBE_MIN ... ACD_PROBE_MAX),
+	 the address can be used if no conflict is detected for ACD_ANNOUNCE_WAIT
+	 after the last probe */
+#define ACD_PROBE_WAIT 1000
+#define ACD_PROBE_NUM 3
+#define ACD_PROBE_MIN 1000
+#define ACD_PROBE_MAX 2000
+#define ACD_ANNOUNCE_WAIT 2000
+
+int iothconf_arp_open(struct ioth *stack);
+void iothconf_arp_probe(int fd, unsigned int ifindex, uint8_t *macaddr, struct in_addr *addr);
+void iothconf_arp_announce(int fd, unsigned int ifindex, uint8_t *macaddr, struct in_addr *addr);
+
+/* read all the pending packets: return 1 in case of conflict */
+int iothconf_arp_conflict(int fd, unsigned int ifindex, uint8_t *macaddr, struct in_addr *addr);
+
+/* the probe sequence of an address */
+struct iothconf_acd {
+	int fd; // arp socket (iothconf_arp_open)
+	unsigned int ifindex;
+	uint8_t macaddr[6];
+	struct in_addr addr;
+	int nprobes; // probes sent so far
+	uint64_t next; // time of the next step (usecs, iothconf_stats_now)
+	int conflict;
+};
+
+/* start the probe sequence of addr (the first probe is not sent yet) */
+void iothconf_acd_start(struct iothconf_acd *acd, int fd, unsigned int ifindex,
+		uint8_t *macaddr, struct in_addr *addr);
+/* process the arp packets received so far and send the probe (if due):
+	 return the msecs to the next step, 0 if the sequence has completed
+	 or a conflict has been detected (acd->conflict) */
+int iothconf_acd_step(struct iothconf_acd *acd);
+/* run the sequences of nacd addresses (in parallel) to completion:
+	 return the number of conflicts */
+int iothconf_acd_run(struct iothconf_acd *acd, int nacd);
+
+/* one shot functions: probe naddr addresses (conflict[i] = 1 if addr[i] is in use,
+	 return the number of conflicts), announce */
+int iothconf_arp_check(struct ioth *stack, unsigned int ifindex, uint8_t *macaddr,
+		struct in_addr *addr, int *conflict, int naddr);
+void iothconf_arp_announce_addr(struct ioth *stack, unsigned int ifindex, uint8_t *macaddr, struct in_addr *addr);
+#endif
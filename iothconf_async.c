@@ -0,0 +1,134 @@
+/*
+ *   iothconf_async.c: auto configuration library for ioth
+ *       non blocking ioth_config
+ *
+ *   Copyright 2021 Renzo Davoli - Virtual Square Team
+ *   University of Bologna - Italy
+ *
+ *   This library is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or (at
+ *   your option) any later version.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <iothconf.h>
+
+/* the protocol engines are blocking: ioth_config_async runs ioth_config
+	 in an internal worker thread.
+	 When the configuration completes the worker stores the result,
+	 calls the callback (if any) and makes the eventfd readable.
+	 ioth_config_async_free called by the callback cannot join the worker:
+	 it sets freed and the worker itself releases the handle */
+
+struct ioth_config_async {
+	struct ioth *stack;
+	char *config;
+	ioth_config_async_cb *callback;
+	void *arg;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	int efd;
+	int done;
+	int freed;
+	int retvalue;
+	int err;
+};
+
+static void async_destroy(struct ioth_config_async *handle) {
+	pthread_mutex_destroy(&handle->mutex);
+	close(handle->efd);
+	free(handle->config);
+	free(handle);
+}
+
+static void *async_worker(void *arg) {
+	struct ioth_config_async *handle = arg;
+	int retvalue = ioth_config(handle->stack, handle->config);
+	int err = errno;
+	uint64_t one = 1;
+	pthread_mutex_lock(&handle->mutex);
+	handle->retvalue = retvalue;
+	handle->err = err;
+	handle->done = 1;
+	pthread_mutex_unlock(&handle->mutex);
+	if (handle->callback) {
+		errno = err;
+		handle->callback(handle->stack, retvalue, handle->arg);
+	}
+	while (write(handle->efd, &one, sizeof(one)) < 0 && errno == EINTR)
+		;
+	if (handle->freed) {
+		pthread_detach(pthread_self());
+		async_destroy(handle);
+	}
+	return NULL;
+}
+
+struct ioth_config_async *ioth_config_async(struct ioth *stack, const char *config,
+		ioth_config_async_cb *callback, void *arg) {
+	struct ioth_config_async *handle = malloc(sizeof(*handle));
+	if (handle == NULL)
+		return NULL;
+	*handle = (struct ioth_config_async) {
+		.stack = stack,
+		.config = strdup(config == NULL ? "" : config),
+		.callback = callback,
+		.arg = arg,
+		.efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK),
+	};
+	if (handle->config == NULL || handle->efd < 0)
+		goto err;
+	pthread_mutex_init(&handle->mutex, NULL);
+	if ((errno = pthread_create(&handle->thread, NULL, async_worker, handle)) != 0) {
+		pthread_mutex_destroy(&handle->mutex);
+		goto err;
+	}
+	return handle;
+err:
+	if (handle->efd >= 0)
+		close(handle->efd);
+	free(handle->config);
+	free(handle);
+	return NULL;
+}
+
+int ioth_config_async_fd(struct ioth_config_async *handle) {
+	return handle->efd;
+}
+
+int ioth_config_async_result(struct ioth_config_async *handle) {
+	int retvalue;
+	pthread_mutex_lock(&handle->mutex);
+	if (handle->done)
+		retvalue = handle->retvalue, errno = handle->err;
+	else
+		retvalue = -1, errno = EINPROGRESS;
+	pthread_mutex_unlock(&handle->mutex);
+	return retvalue;
+}
+
+int ioth_config_async_free(struct ioth_config_async *handle) {
+	/* called by the callback: the worker frees the handle when the callback returns */
+	if (pthread_equal(pthread_self(), handle->thread)) {
+		handle->freed = 1;
+		return ioth_config_async_result(handle);
+	}
+	pthread_join(handle->thread, NULL);
+	int retvalue = ioth_config_async_result(handle);
+	int err = errno;
+	async_destroy(handle);
+	errno = err;
+	return retvalue;
+}
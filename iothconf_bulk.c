@@ -0,0 +1,92 @@
+/*
+ *   iothconf_bulk.c: auto configuration library for ioth
+ *       create and configure many stacks at once
+ *
+ *   Copyright 2021 Renzo Davoli - Virtual Square Team
+ *   University of Bologna - Italy
+ *
+ *   This library is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or (at
+ *   your option) any later version.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <iothconf.h>
+
+/* The configuration exchanges spend most of their time waiting (link-up delay,
+	 protocol timeouts): each worker thread of the pool creates and configures
+	 one stack at a time, the next stack is picked from the shared index. */
+
+#define IOTHCONF_BULK_NTHREADS 64
+
+struct bulk_arg {
+	pthread_mutex_t mutex;
+	const char **stack_config;
+	struct ioth **stacks;
+	int count;
+	int next;
+	int ok;
+	ioth_newstackcv_cb *callback;
+	void *arg;
+};
+
+static void *bulk_worker(void *arg) {
+	struct bulk_arg *ba = arg;
+	for (;;) {
+		pthread_mutex_lock(&ba->mutex);
+		int index = ba->next < ba->count ? ba->next++ : -1;
+		pthread_mutex_unlock(&ba->mutex);
+		if (index < 0)
+			break;
+		struct ioth *stack = ioth_newstackc(ba->stack_config[index]);
+		int err = errno;
+		pthread_mutex_lock(&ba->mutex);
+		ba->stacks[index] = stack;
+		if (stack != NULL)
+			ba->ok++;
+		if (ba->callback) {
+			errno = err;
+			ba->callback(index, stack, ba->arg);
+		}
+		pthread_mutex_unlock(&ba->mutex);
+	}
+	return NULL;
+}
+
+int ioth_newstackcv(const char *stack_config[], struct ioth *stacks[], int count, int nthreads,
+		ioth_newstackcv_cb *callback, void *arg) {
+	if (count < 0 || (count > 0 && (stack_config == NULL || stacks == NULL)))
+		return errno = EINVAL, -1;
+	if (count == 0)
+		return 0;
+	struct bulk_arg ba = {
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.stack_config = stack_config,
+		.stacks = stacks,
+		.count = count,
+		.callback = callback,
+		.arg = arg,
+	};
+	if (nthreads <= 0) nthreads = IOTHCONF_BULK_NTHREADS;
+	if (nthreads > count) nthreads = count;
+	pthread_t threads[nthreads];
+	int nrunning;
+	for (nrunning = 0; nrunning < nthreads; nrunning++) {
+		if (pthread_create(&threads[nrunning], NULL, bulk_worker, &ba) != 0)
+			break;
+	}
+	if (nrunning == 0)
+		bulk_worker(&ba);
+	for (int i = 0; i < nrunning; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&ba.mutex);
+	return ba.ok;
+}
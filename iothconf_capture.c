@@ -0,0 +1,177 @@
+/*
+ *   iothconf_capture.c: auto configuration library for ioth
+ *       pcap capture of the configuration messages
+ *
+ *   Copyright 2021 Renzo Davoli - Virtual Square Team
+ *   University of Bologna - Italy
+ *
+ *   This library is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or (at
+ *   your option) any later version.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <netinet/icmp6.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if_arp.h>
+
+#include <iothconf.h>
+#include <iothconf_parse.h>
+#include <iothconf_capture.h>
+
+/* one capture file for all the stacks of the process.
+	 The mutex serializes the records written by the concurrent engines.
+	 capture_file is changed holding the mutex (atomic store) and it is tested with
+	 no lock (relaxed atomic load): when the capture is off (the common case)
+	 the engines do not contend for the mutex */
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *capture_file;
+
+int ioth_config_capture(const char *path) {
+	FILE *f = NULL;
+	if (path != NULL) {
+		struct iothconf_pcap_hdr hdr = {
+			.magic = IOTHCONF_PCAP_MAGIC,
+			.version_major = 2,
+			.version_minor = 4,
+			.snaplen = IOTHCONF_PCAP_SNAPLEN,
+			.linktype = IOTHCONF_PCAP_LINKTYPE_SLL2,
+		};
+		f = fopen(path, "w");
+		if (f == NULL)
+			return -1;
+		if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 || fflush(f) != 0) {
+			int saved_errno = errno;
+			fclose(f);
+			return errno = saved_errno, -1;
+		}
+	}
+	pthread_mutex_lock(&capture_mutex);
+	if (capture_file != NULL)
+		fclose(capture_file);
+	__atomic_store_n(&capture_file, f, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&capture_mutex);
+	return 0;
+}
+
+/* a hint: capture_write checks capture_file again holding the mutex */
+static int capturing(void) {
+	return __atomic_load_n(&capture_file, __ATOMIC_RELAXED) != NULL;
+}
+
+/* write a record: sll2 header + the IP header (if any) + the payload */
+static void capture_write(unsigned int ifindex, int dir, uint16_t protocol,
+		const void *hdr, size_t hdrlen, const void *payload, size_t len) {
+	if (!capturing())
+		return;
+	pthread_mutex_lock(&capture_mutex);
+	if (capture_file != NULL) {
+		struct timeval now;
+		struct iothconf_sll2_hdr sll2 = {
+			.protocol = htons(protocol),
+			.ifindex = htonl(ifindex),
+			.hatype = htons(ARPHRD_ETHER),
+			.pkttype = dir == IOTHCONF_CAPTURE_OUT ? PACKET_OUTGOING : PACKET_HOST,
+		};
+		size_t caplen = sizeof(sll2) + hdrlen + len;
+		gettimeofday(&now, NULL);
+		struct iothconf_pcap_rec rec = {
+			.ts_sec = now.tv_sec,
+			.ts_usec = now.tv_usec,
+			.caplen = caplen,
+			.len = caplen,
+		};
+		fwrite(&rec, sizeof(rec), 1, capture_file);
+		fwrite(&sll2, sizeof(sll2), 1, capture_file);
+		if (hdrlen > 0)
+			fwrite(hdr, hdrlen, 1, capture_file);
+		fwrite(payload, len, 1, capture_file);
+		/* the file must be complete if the process is killed */
+		fflush(capture_file);
+	}
+	pthread_mutex_unlock(&capture_mutex);
+}
+
+void iothconf_capture_ip(unsigned int ifindex, int dir, const void *pkt, size_t len) {
+	capture_write(ifindex, dir, ETH_P_IP, NULL, 0, pkt, len);
+}
+
+/* checksum of an upper layer protocol on IPv6 (RFC 8200 8.1) */
+static uint16_t ip6_chksum(const struct ip6_hdr *ip6h, const void *hdr, size_t hdrlen,
+		const void *payload, size_t len) {
+	uint32_t pseudo[2] = {htonl(hdrlen + len), htonl(ip6h->ip6_nxt)};
+	unsigned int sum = 0;
+	sum = iothconf_chksum(sum, (void *) &ip6h->ip6_src, 2 * sizeof(struct in6_addr));
+	sum = iothconf_chksum(sum, pseudo, sizeof(pseudo));
+	sum = iothconf_chksum(sum, (void *) hdr, hdrlen);
+	/* hdrlen is even: the 16 bit words of the payload are aligned */
+	sum = iothconf_chksum(sum, (void *) payload, len);
+	sum = ~sum & 0xffff;
+	return sum == 0 ? 0xffff : sum;
+}
+
+static void ip6_hdr_init(struct ip6_hdr *ip6h, uint8_t proto, size_t plen,
+		const struct in6_addr *src, const struct in6_addr *dst) {
+	*ip6h = (struct ip6_hdr) {
+		.ip6_flow = htonl(6 << 28),
+		.ip6_plen = htons(plen),
+		.ip6_nxt = proto,
+		.ip6_hlim = 255,
+		.ip6_src = src == NULL ? in6addr_any : *src,
+		.ip6_dst = dst == NULL ? in6addr_any : *dst,
+	};
+}
+
+void iothconf_capture_udp6(unsigned int ifindex, int dir,
+		const struct in6_addr *src, uint16_t sport, const struct in6_addr *dst, uint16_t dport,
+		const void *payload, size_t len) {
+	struct {
+		struct ip6_hdr ip6h;
+		struct udphdr udph;
+	} hdr;
+	if (!capturing())
+		return;
+	ip6_hdr_init(&hdr.ip6h, IPPROTO_UDP, sizeof(hdr.udph) + len, src, dst);
+	hdr.udph = (struct udphdr) {
+		.uh_sport = htons(sport),
+		.uh_dport = htons(dport),
+		.uh_ulen = htons(sizeof(hdr.udph) + len),
+	};
+	hdr.udph.uh_sum = htons(ip6_chksum(&hdr.ip6h, &hdr.udph, sizeof(hdr.udph), payload, len));
+	capture_write(ifindex, dir, ETH_P_IPV6, &hdr, sizeof(hdr), payload, len);
+}
+
+void iothconf_capture_icmp6(unsigned int ifindex, int dir,
+		const struct in6_addr *src, const struct in6_addr *dst,
+		const void *msg, size_t len) {
+	struct ip6_hdr ip6h;
+	if (len < sizeof(struct icmp6_hdr) || !capturing())
+		return;
+	ip6_hdr_init(&ip6h, IPPROTO_ICMPV6, len, src, dst);
+	/* the checksum of the messages sent is computed by the stack */
+	if (dir == IOTHCONF_CAPTURE_OUT) {
+		uint8_t out[len];
+		memcpy(out, msg, len);
+		out[2] = out[3] = 0;
+		uint16_t sum = ip6_chksum(&ip6h, NULL, 0, out, len);
+		out[2] = sum >> 8;
+		out[3] = sum;
+		capture_write(ifindex, dir, ETH_P_IPV6, &ip6h, sizeof(ip6h), out, len);
+	} else
+		capture_write(ifindex, dir, ETH_P_IPV6, &ip6h, sizeof(ip6h), msg, len);
+}
@@ -0,0 +1,61 @@
+#ifndef IOTHCONF_CAPTURE_H
+#define IOTHCONF_CAPTURE_H
+#include <stdint.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+/* pcap capture of the configuration messages (see ioth_config_capture).
+	 The functions do nothing if the capture is not active.
+	 The link type is LINKTYPE_LINUX_SLL2: the pseudo link layer header of each
+	 packet records the interface index and the direction.
+	 ip: a whole IPv4 packet (DHCP).
+	 udp6, icmp6: the IPv6 (and UDP) header is added to the payload,
+	 src/dst == NULL means unspecified address (the source address of the messages sent
+	 and the destination address of the messages received by the DHCPv6 and RD engines
+	 are chosen by the stack).
+	 The checksums of the added headers and of the ICMPv6 messages sent are computed */
+
+#define IOTHCONF_CAPTURE_IN  0
+#define IOTHCONF_CAPTURE_OUT 1
+
+void iothconf_capture_ip(unsigned int ifindex, int dir, const void *pkt, size_t len);
+void iothconf_capture_udp6(unsigned int ifindex, int dir,
+		const struct in6_addr *src, uint16_t sport, const struct in6_addr *dst, uint16_t dport,
+		const void *payload, size_t len);
+void iothconf_capture_icmp6(unsigned int ifindex, int dir,
+		const struct in6_addr *src, const struct in6_addr *dst,
+		const void *msg, size_t len);
+
+/* pcap file format constants (used by the replay driver too) */
+#define IOTHCONF_PCAP_MAGIC 0xa1b2c3d4
+#define IOTHCONF_PCAP_LINKTYPE_SLL2 276
+#define IOTHCONF_PCAP_SNAPLEN 65535
+
+struct iothconf_pcap_hdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct iothconf_pcap_rec {
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+/* LINKTYPE_LINUX_SLL2 header: network byte order */
+struct iothconf_sll2_hdr {
+	uint16_t protocol;
+	uint16_t reserved;
+	uint32_t ifindex;
+	uint16_t hatype;
+	uint8_t pkttype; // PACKET_HOST (in) or PACKET_OUTGOING (out)
+	uint8_t halen;
+	uint8_t addr[8];
+};
+#endif
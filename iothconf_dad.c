@@ -0,0 +1,405 @@
+/*
+ *   iothconf_dad.c: auto configuration library for ioth
+ *       optimistic duplicate address detection (RFC 4429, RFC 4862 5.4)
+ *
+ *   Copyright 2021 Renzo Davoli - Virtual Square Team
+ *   University of Bologna - Italy
+ *
+ *   This library is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or (at
+ *   your option) any later version.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+
+#include <ioth.h>
+#include <iothconf.h>
+#include <iothconf_mod.h>
+#include <iothconf_data.h>
+#include <iothconf_hash.h>
+
+/* Optimistic addresses: the first probe (NS from the unspecified address) is sent
+	 by iothconf_dad6_probe before the address is installed, then the address is
+	 installed and used at once while the next probes and the wait for the replies
+	 run in a background thread (iothconf_dad6_start).
+	 When a duplicate is detected the address is removed from the stack and from
+	 the configuration data. RFC 7217 addresses are replaced by a new address
+	 computed using the next DAD counter (up to IDGEN_RETRIES times).
+	 The threads keep a pointer to the stack: iothconf_dad6_stop (ioth_config_release)
+	 stops and joins the threads of a stack before it is deleted. */
+
+#define DAD_RETRANS_TIMER 1000
+#define DAD_TRANSMITS 1
+#define IDGEN_RETRIES 3
+
+struct dad_addr {
+	struct ioth_confdata_ip6addr ipaddr;
+	int installed;
+	int conflict;
+	int done;
+};
+
+struct iothconf_dad {
+	struct iothconf_dad *next;
+	struct ioth *stack;
+	unsigned int ifindex;
+	uint8_t type;
+	time_t timestamp;
+	int stable;
+	struct iothconf_stablekey stablekey;
+	uint8_t macaddr[8];
+	size_t macaddrlen;
+	int naddr;
+	struct dad_addr *addr;
+	int fd;
+	int efd; // iothconf_dad6_stop wakes up the thread
+	pthread_t thread;
+	int terminated;
+};
+
+/* running threads, the terminated threads are joined when a new one starts */
+static pthread_mutex_t dad_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct iothconf_dad *dad_root;
+
+/* collect the current addresses which have not been checked yet,
+	 those already active have been installed by a previous run */
+static int dad_collect_cb(void *data, void *arg) {
+	struct iothconf_dad *da = arg;
+	uint8_t flags = ioth_confdata_setflags(data, 0);
+	if (!(flags & IOTH_CONFDATA_CHECKED) && ioth_confdata_gettimestamp(data) >= da->timestamp &&
+			ioth_confdata_getdatalen(data) == sizeof(struct ioth_confdata_ip6addr)) {
+		struct dad_addr *new = realloc(da->addr, (da->naddr + 1) * sizeof(*new));
+		if (new != NULL) {
+			da->addr = new;
+			da->addr[da->naddr++] = (struct dad_addr) {
+				.ipaddr = *((struct ioth_confdata_ip6addr *) data),
+				.installed = 1,
+			};
+		}
+	}
+	return 0;
+}
+
+struct dad_match {
+	struct ioth_confdata_ip6addr *ipaddr;
+	uint8_t flags;
+	int found;
+};
+
+static int dad_match(void *data, struct dad_match *dm) {
+	return ioth_confdata_getdatalen(data) == sizeof(*dm->ipaddr) &&
+		memcmp(data, dm->ipaddr, sizeof(*dm->ipaddr)) == 0;
+}
+
+static int dad_checked_cb(void *data, void *arg) {
+	struct dad_match *dm = arg;
+	if (dad_match(data, dm)) {
+		ioth_confdata_setflags(data, IOTH_CONFDATA_CHECKED);
+		dm->found = 1;
+		return IOTH_CONFDATA_FORALL_BREAK;
+	}
+	return 0;
+}
+
+static int dad_remove_cb(void *data, void *arg) {
+	struct dad_match *dm = arg;
+	if (dad_match(data, dm)) {
+		dm->flags = ioth_confdata_clrflags(data, IOTH_CONFDATA_ACTIVE);
+		dm->found = 1;
+		return IOTH_CONFDATA_FORALL_DELETE | IOTH_CONFDATA_FORALL_BREAK;
+	}
+	return 0;
+}
+
+/* duplicate: remove the address, compute the next RFC 7217 address
+	 (it is installed after its first probe).
+	 return 1 if a new address has to be probed */
+static int dad_conflict(struct iothconf_dad *da, struct dad_addr *dad) {
+	struct dad_match dm = {.ipaddr = &dad->ipaddr};
+	ioth_confdata_forall(da->stack, da->ifindex, da->type, dad_remove_cb, &dm);
+	if (!dm.found)
+		return 0;
+	if (dm.flags & IOTH_CONFDATA_ACTIVE)
+		ioth_ipaddr_del(da->stack, AF_INET6, &dad->ipaddr.addr, dad->ipaddr.prefixlen, da->ifindex);
+	if (da->stable && da->type == IOTH_CONFDATA_RD6_ADDR && dad->ipaddr.flags < IDGEN_RETRIES) {
+		struct ioth_confdata_ip6addr *ipaddr = &dad->ipaddr;
+		ipaddr->flags = iothconf_stableaddr6(&ipaddr->addr, &da->stablekey, da->macaddr, da->macaddrlen,
+				NULL, 0, ipaddr->flags + 1);
+		dad->installed = 0;
+		dad->conflict = 0;
+		return 1;
+	}
+	return 0;
+}
+
+static void dad_install(struct iothconf_dad *da, struct dad_addr *dad) {
+	struct ioth_confdata_ip6addr *ipaddr = &dad->ipaddr;
+	time_t timestamp = ioth_confdata_read_timestamp(da->stack, da->ifindex, da->type);
+	ioth_confdata_add(da->stack, da->ifindex, da->type, timestamp, IOTH_CONFDATA_ACTIVE,
+			ipaddr, sizeof(*ipaddr));
+	ioth_ipaddr_add(da->stack, AF_INET6, &ipaddr->addr, ipaddr->prefixlen, da->ifindex);
+	dad->installed = 1;
+}
+
+/* RFC 4862 5.4.2: the source address of the probes is the unspecified address */
+static void dad_send_ns(int fd, unsigned int ifindex, struct in6_addr *target) {
+	struct nd_neighbor_solicit ns = {
+		.nd_ns_type = ND_NEIGHBOR_SOLICIT,
+		.nd_ns_target = *target,
+	};
+	/* solicited-node multicast address ff02::1:ffXX:XXXX */
+	struct sockaddr_in6 dst = {
+		.sin6_family = AF_INET6,
+		.sin6_addr.s6_addr = {0xff, 0x02, [11] = 0x01, [12] = 0xff,
+			target->s6_addr[13], target->s6_addr[14], target->s6_addr[15]},
+		.sin6_scope_id = ifindex,
+	};
+	struct iovec iov = {&ns, sizeof(ns)};
+	union {
+		struct cmsghdr cmsg;
+		uint8_t buf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+	} control = {0};
+	struct msghdr msg = {
+		.msg_name = &dst,
+		.msg_namelen = sizeof(dst),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = &control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = IPPROTO_IPV6;
+	cmsg->cmsg_type = IPV6_PKTINFO;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+	*((struct in6_pktinfo *) CMSG_DATA(cmsg)) = (struct in6_pktinfo) {
+		.ipi6_addr = IN6ADDR_ANY_INIT,
+		.ipi6_ifindex = ifindex,
+	};
+	ioth_sendmsg(fd, &msg, 0);
+}
+
+/* send a probe for each pending address, then install the new addresses */
+static void dad_probe(struct iothconf_dad *da) {
+	for (int i = 0; i < da->naddr; i++) {
+		if (!da->addr[i].done)
+			dad_send_ns(da->fd, da->ifindex, &da->addr[i].ipaddr.addr);
+	}
+	for (int i = 0; i < da->naddr; i++) {
+		if (!da->addr[i].done && !da->addr[i].installed)
+			dad_install(da, &da->addr[i]);
+	}
+}
+
+/* NA for the target or NS for the target sent by another node running DAD */
+static void dad_recv(struct iothconf_dad *da) {
+	uint8_t inbuf[1500];
+	struct sockaddr_in6 from;
+	socklen_t fromlen = sizeof(from);
+	ssize_t len = ioth_recvfrom(da->fd, inbuf, sizeof(inbuf), 0, (void *) &from, &fromlen);
+	struct in6_addr *target;
+	if (len < (ssize_t) sizeof(struct nd_neighbor_solicit))
+		return;
+	switch (inbuf[0]) {
+		case ND_NEIGHBOR_ADVERT:
+			target = &((struct nd_neighbor_advert *) inbuf)->nd_na_target;
+			break;
+		case ND_NEIGHBOR_SOLICIT:
+			if (!IN6_IS_ADDR_UNSPECIFIED(&from.sin6_addr))
+				return;
+			target = &((struct nd_neighbor_solicit *) inbuf)->nd_ns_target;
+			break;
+		default:
+			return;
+	}
+	for (int i = 0; i < da->naddr; i++) {
+		if (!da->addr[i].done && memcmp(target, &da->addr[i].ipaddr.addr, sizeof(*target)) == 0)
+			da->addr[i].conflict = 1;
+	}
+}
+
+/* wait for the replies. return -1 if iothconf_dad6_stop has been called */
+static int dad_wait(struct iothconf_dad *da) {
+	struct pollfd pfd[] = {{da->fd, POLLIN, 0}, {da->efd, POLLIN, 0}};
+	int timeout = DAD_RETRANS_TIMER;
+	struct timeval start;
+	struct timeval end;
+	struct timeval timediff;
+	while (timeout > 0) {
+		gettimeofday(&start, NULL);
+		if (poll(pfd, 2, timeout) <= 0)
+			break;
+		if (pfd[1].revents)
+			return -1;
+		dad_recv(da);
+		gettimeofday(&end, NULL);
+		timersub(&end, &start, &timediff);
+		timeout -= timediff.tv_sec * 1000 + timediff.tv_usec / 1000;
+	}
+	return 0;
+}
+
+static void *dad_thread(void *arg) {
+	struct iothconf_dad *da = arg;
+	int pending = da->naddr;
+	/* the first probes have been sent by iothconf_dad6_probe */
+	while (pending > 0) {
+		if (dad_wait(da) < 0)
+			break;
+		for (int transmit = 1; transmit < DAD_TRANSMITS; transmit++) {
+			dad_probe(da);
+			if (dad_wait(da) < 0)
+				goto stop;
+		}
+		for (int i = 0; i < da->naddr; i++) {
+			struct dad_addr *dad = &da->addr[i];
+			if (dad->done)
+				continue;
+			if (dad->conflict) {
+				if (dad_conflict(da, dad))
+					continue;
+			} else {
+				struct dad_match dm = {.ipaddr = &dad->ipaddr};
+				ioth_confdata_forall(da->stack, da->ifindex, da->type, dad_checked_cb, &dm);
+			}
+			dad->done = 1;
+			pending--;
+		}
+		if (pending > 0)
+			dad_probe(da);
+		ioth_confdata_dispatch();
+	}
+stop:
+	pthread_mutex_lock(&dad_mutex);
+	da->terminated = 1;
+	pthread_mutex_unlock(&dad_mutex);
+	return NULL;
+}
+
+static void dad_free(struct iothconf_dad *da) {
+	if (da->fd >= 0)
+		ioth_close(da->fd);
+	if (da->efd >= 0)
+		close(da->efd);
+	free(da->addr);
+	free(da);
+}
+
+static void dad_join(struct iothconf_dad *list) {
+	while (list != NULL) {
+		struct iothconf_dad *next = list->next;
+		pthread_join(list->thread, NULL);
+		dad_free(list);
+		list = next;
+	}
+}
+
+/* type is IOTH_CONFDATA_RD6_ADDR or IOTH_CONFDATA_DHCP6_ADDR.
+	 Call it before iothconf_ip_update installs the addresses: the first probes of the new
+	 addresses are sent. It returns NULL if there are no addresses to check.
+	 stablekey and macaddr are needed to compute the next RFC 7217 address in case of conflict,
+	 stablekey is NULL if addresses are not RFC 7217 stable addresses */
+struct iothconf_dad *iothconf_dad6_probe(struct ioth *stack, unsigned int ifindex, uint8_t type,
+		const struct iothconf_stablekey *stablekey, const uint8_t *macaddr, size_t macaddrlen) {
+	struct iothconf_dad *da = malloc(sizeof(*da));
+	if (da == NULL)
+		return NULL;
+	*da = (struct iothconf_dad) {
+		.stack = stack,
+			.ifindex = ifindex,
+			.type = type,
+			.timestamp = ioth_confdata_read_timestamp(stack, ifindex, type),
+			.stable = stablekey != NULL,
+			.fd = -1,
+			.efd = -1,
+	};
+	if (stablekey != NULL && macaddrlen <= sizeof(da->macaddr)) {
+		da->stablekey = *stablekey;
+		memcpy(da->macaddr, macaddr, macaddrlen);
+		da->macaddrlen = macaddrlen;
+	} else
+		da->stable = 0;
+	ioth_confdata_forall(stack, ifindex, type, dad_collect_cb, da);
+	if (da->naddr == 0)
+		goto err;
+	if ((da->fd = ioth_msocket(stack, AF_INET6, SOCK_RAW, IPPROTO_ICMPV6)) < 0)
+		goto err;
+	if ((da->efd = eventfd(0, EFD_CLOEXEC)) < 0)
+		goto err;
+	int hoplimit = 255;
+	int loop = 0;
+	struct icmp6_filter filter;
+	ICMP6_FILTER_SETBLOCKALL(&filter);
+	ICMP6_FILTER_SETPASS(ND_NEIGHBOR_SOLICIT, &filter);
+	ICMP6_FILTER_SETPASS(ND_NEIGHBOR_ADVERT, &filter);
+	ioth_setsockopt(da->fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter));
+	ioth_setsockopt(da->fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hoplimit, sizeof(hoplimit));
+	ioth_setsockopt(da->fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop, sizeof(loop));
+	for (int i = 0; i < da->naddr; i++)
+		dad_send_ns(da->fd, ifindex, &da->addr[i].ipaddr.addr);
+	return da;
+err:
+	dad_free(da);
+	return NULL;
+}
+
+/* start the thread which completes the detection (da can be NULL) */
+void iothconf_dad6_start(struct iothconf_dad *da) {
+	struct iothconf_dad *terminated = NULL;
+	if (da == NULL)
+		return;
+	pthread_mutex_lock(&dad_mutex);
+	for (struct iothconf_dad **scan = &dad_root; *scan != NULL; ) {
+		struct iothconf_dad *this = *scan;
+		if (this->terminated) {
+			*scan = this->next;
+			this->next = terminated;
+			terminated = this;
+		} else
+			scan = &this->next;
+	}
+	if (pthread_create(&da->thread, NULL, dad_thread, da) == 0) {
+		da->next = dad_root;
+		dad_root = da;
+		da = NULL;
+	}
+	pthread_mutex_unlock(&dad_mutex);
+	dad_join(terminated);
+	if (da != NULL)
+		dad_free(da);
+}
+
+/* stop and join the threads of stack */
+void iothconf_dad6_stop(struct ioth *stack) {
+	struct iothconf_dad *stopped = NULL;
+	uint64_t one = 1;
+	pthread_mutex_lock(&dad_mutex);
+	for (struct iothconf_dad **scan = &dad_root; *scan != NULL; ) {
+		struct iothconf_dad *this = *scan;
+		if (this->stack == stack) {
+			*scan = this->next;
+			this->next = stopped;
+			stopped = this;
+			while (write(this->efd, &one, sizeof(one)) < 0 && errno == EINTR)
+				;
+		} else
+			scan = &this->next;
+	}
+	pthread_mutex_unlock(&dad_mutex);
+	dad_join(stopped);
+}
@@ -20,10 +20,14 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <sys/eventfd.h>
 
+#include <iothconf.h>
 #include <iothconf_data.h>
+#include <iothconf_stats.h>
 
 struct ioth_confdata {
 	struct ioth_confdata *next;
@@ -38,14 +42,278 @@ struct ioth_confdata {
 static pthread_mutex_t ioth_confdata_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct ioth_confdata *ioth_confdata_root;
 
+/* lock the data structure: count the waits for the lock (and the time spent waiting)
+	 when the mutex is busy */
+static void ioth_confdata_lock(struct ioth *stack, uint32_t ifindex) {
+	if (pthread_mutex_trylock(&ioth_confdata_mutex) != 0) {
+		uint64_t start = iothconf_stats_now();
+		pthread_mutex_lock(&ioth_confdata_mutex);
+		if (stack != IOTH_CONFDATA_ANYSTACK) {
+			iothconf_stats_count(stack, ifindex, IOTHCONF_COUNT_LOCK_WAIT, 1);
+			iothconf_stats_count(stack, ifindex, IOTHCONF_COUNT_LOCK_WAIT_USEC, iothconf_stats_now() - start);
+		}
+	}
+}
+
+/* DNS generation numbers: a hash table indexed by stack/ifindex.
+	 The generation of an interface is incremented each time a DNS or DOMAIN
+	 record is added or deleted (protected by ioth_confdata_mutex) */
+#define IOTH_CONFDATA_GEN_HASHSIZE 64
+struct ioth_confdata_gen {
+	struct ioth_confdata_gen *next;
+	struct ioth *stack;
+	uint32_t ifindex;
+	uint64_t generation;
+};
+static struct ioth_confdata_gen *ioth_confdata_gen_hash[IOTH_CONFDATA_GEN_HASHSIZE];
+
+static inline int ioth_confdata_gen_hashkey(struct ioth *stack, uint32_t ifindex) {
+	return ((uintptr_t) stack / sizeof(void *) + ifindex) % IOTH_CONFDATA_GEN_HASHSIZE;
+}
+
+static struct ioth_confdata_gen **ioth_confdata_gen_search(struct ioth *stack, uint32_t ifindex) {
+	struct ioth_confdata_gen **scan = &ioth_confdata_gen_hash[ioth_confdata_gen_hashkey(stack, ifindex)];
+	for (; *scan != NULL; scan = &(*scan)->next) {
+		if ((*scan)->stack == stack && (*scan)->ifindex == ifindex)
+			break;
+	}
+	return scan;
+}
+
+/* a record has been added or deleted */
+static void ioth_confdata_changed(struct ioth_confdata *this) {
+	if ((this->type & IOTH_CONFDATA_DNS_DOM_MASK) == IOTH_CONFDATA_DNS_DOM_BASE) {
+		struct ioth_confdata_gen **gen = ioth_confdata_gen_search(this->stack, this->ifindex);
+		if (*gen == NULL) {
+			*gen = calloc(1, sizeof(struct ioth_confdata_gen));
+			if (*gen == NULL)
+				return;
+			(*gen)->stack = this->stack;
+			(*gen)->ifindex = this->ifindex;
+		}
+		(*gen)->generation++;
+	}
+}
+
+uint64_t ioth_confdata_dns_generation(struct ioth *stack, uint32_t ifindex) {
+	uint64_t generation;
+	pthread_mutex_lock(&ioth_confdata_mutex);
+	struct ioth_confdata_gen *gen = *ioth_confdata_gen_search(stack, ifindex);
+	generation = (gen == NULL) ? 0 : gen->generation;
+	pthread_mutex_unlock(&ioth_confdata_mutex);
+	return generation;
+}
+
+void ioth_confdata_release(struct ioth *stack) {
+	pthread_mutex_lock(&ioth_confdata_mutex);
+	for (struct ioth_confdata **scan = &ioth_confdata_root; *scan != NULL; ) {
+		struct ioth_confdata *this = *scan;
+		if (this->stack == stack) {
+			*scan = this->next;
+			free(this);
+		} else
+			scan = &this->next;
+	}
+	for (int i = 0; i < IOTH_CONFDATA_GEN_HASHSIZE; i++) {
+		for (struct ioth_confdata_gen **scan = &ioth_confdata_gen_hash[i]; *scan != NULL; ) {
+			struct ioth_confdata_gen *this = *scan;
+			if (this->stack == stack) {
+				*scan = this->next;
+				free(this);
+			} else
+				scan = &this->next;
+		}
+	}
+	pthread_mutex_unlock(&ioth_confdata_mutex);
+}
+
+/* change notification subscriptions (ioth_config_subscribe).
+	 The events are recorded in the pending field of the matching subscriptions while
+	 ioth_confdata_mutex is held. ioth_confdata_dispatch delivers them (eventfd + callback):
+	 it is called at the top-level return points of the engines, where the library
+	 does not hold any lock, so callbacks can use the library.
+	 Callbacks are serialized without holding any lock while they run: one thread at a time
+	 is the dispatcher (ioth_confdata_dispatcher_active), the other threads only record their
+	 events, the dispatcher scans the subscriptions again after each callback.
+	 So a callback can wait for other threads which generate events (e.g. ioth_config of
+	 several interfaces, ioth_config_release joining the DAD threads). */
+struct ioth_config_notify {
+	struct ioth_config_notify *next;
+	struct ioth *stack;
+	uint32_t ifindex;
+	uint32_t sources;
+	uint32_t what;
+	ioth_config_notify_cb *callback;
+	void *arg;
+	int efd;
+	uint32_t pending; // events to dispatch
+	uint32_t events;  // events not read yet by ioth_config_notify_events
+	int unsubscribed; // deleted by its own callback, the dispatcher frees it
+};
+
+static struct ioth_config_notify *ioth_confdata_notify_root;
+static int ioth_confdata_notify_pending;
+/* dispatcher state (protected by ioth_confdata_mutex) */
+static int ioth_confdata_dispatcher_active;
+static pthread_t ioth_confdata_dispatcher;
+static struct ioth_config_notify *ioth_confdata_dispatch_current;
+static pthread_cond_t ioth_confdata_dispatch_cond = PTHREAD_COND_INITIALIZER;
+
+static uint32_t ioth_confdata_what(uint8_t type) {
+	switch (type & 0x0f) {
+		case 0x02: case 0x04: return IOTHCONF_NOTIFY_ADDR;
+		case 0x03: case 0x05: return IOTHCONF_NOTIFY_ROUTE;
+		case 0x08: case 0x09: case 0x0a: case 0x0b: return IOTHCONF_NOTIFY_DNS;
+		default: return 0;
+	}
+}
+
+static uint32_t ioth_confdata_source(uint8_t type) {
+	switch (TIMESTAMP(type)) {
+		case IOTH_CONFDATA_DHCP4_TIMESTAMP: return IOTHCONF_DHCP;
+		case IOTH_CONFDATA_RD6_TIMESTAMP: return IOTHCONF_RD;
+		case IOTH_CONFDATA_DHCP6_TIMESTAMP: return IOTHCONF_DHCPV6;
+		default: return IOTHCONF_STATIC;
+	}
+}
+
+/* record an event (ioth_confdata_mutex must be held) */
+static void ioth_confdata_notify(struct ioth_confdata *this, uint32_t event) {
+	uint32_t what = ioth_confdata_what(this->type);
+	uint32_t source = ioth_confdata_source(this->type);
+	if (what == 0)
+		return;
+	for (struct ioth_config_notify *sub = ioth_confdata_notify_root; sub != NULL; sub = sub->next) {
+		if ((sub->stack == NULL || sub->stack == this->stack) &&
+				(sub->ifindex == 0 || sub->ifindex == this->ifindex) &&
+				(sub->sources & source) && (sub->what & what)) {
+			sub->pending |= what | event;
+			ioth_confdata_notify_pending = 1;
+		}
+	}
+}
+
+static void ioth_confdata_notify_free(struct ioth_config_notify *sub) {
+	close(sub->efd);
+	free(sub);
+}
+
+/* dispatch the pending events (no library lock must be held).
+	 If another thread (or an outer call of this thread) is the dispatcher,
+	 it returns at once: the events will be delivered by the active dispatcher */
+void ioth_confdata_dispatch(void) {
+	pthread_mutex_lock(&ioth_confdata_mutex);
+	if (!ioth_confdata_notify_pending || ioth_confdata_dispatcher_active) {
+		pthread_mutex_unlock(&ioth_confdata_mutex);
+		return;
+	}
+	ioth_confdata_dispatcher_active = 1;
+	ioth_confdata_dispatcher = pthread_self();
+	for (;;) {
+		struct ioth_config_notify *sub;
+		uint32_t events;
+		uint64_t one = 1;
+		for (sub = ioth_confdata_notify_root; sub != NULL && sub->pending == 0; sub = sub->next)
+			;
+		if (sub == NULL)
+			break;
+		events = sub->pending;
+		sub->pending = 0;
+		sub->events |= events;
+		ioth_confdata_dispatch_current = sub;
+		pthread_mutex_unlock(&ioth_confdata_mutex);
+		while (write(sub->efd, &one, sizeof(one)) < 0 && errno == EINTR)
+			;
+		if (sub->callback)
+			sub->callback(sub->stack, events, sub->arg);
+		pthread_mutex_lock(&ioth_confdata_mutex);
+		ioth_confdata_dispatch_current = NULL;
+		if (sub->unsubscribed)
+			ioth_confdata_notify_free(sub);
+		pthread_cond_broadcast(&ioth_confdata_dispatch_cond);
+	}
+	ioth_confdata_notify_pending = 0;
+	ioth_confdata_dispatcher_active = 0;
+	pthread_mutex_unlock(&ioth_confdata_mutex);
+}
+
+struct ioth_config_notify *ioth_config_subscribe(struct ioth *stack, unsigned int ifindex,
+		uint32_t sources, uint32_t what, ioth_config_notify_cb *callback, void *arg) {
+	struct ioth_config_notify *sub = malloc(sizeof(*sub));
+	if (sub == NULL)
+		return NULL;
+	*sub = (struct ioth_config_notify) {
+		.stack = stack,
+		.ifindex = ifindex,
+		.sources = (sources == 0) ? ~0U : sources,
+		.what = (what == 0) ? ~0U : what,
+		.callback = callback,
+		.arg = arg,
+		.efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK),
+	};
+	if (sub->efd < 0) {
+		free(sub);
+		return NULL;
+	}
+	pthread_mutex_lock(&ioth_confdata_mutex);
+	sub->next = ioth_confdata_notify_root;
+	ioth_confdata_notify_root = sub;
+	pthread_mutex_unlock(&ioth_confdata_mutex);
+	return sub;
+}
+
+int ioth_config_notify_fd(struct ioth_config_notify *sub) {
+	return sub->efd;
+}
+
+uint32_t ioth_config_notify_events(struct ioth_config_notify *sub) {
+	uint64_t count;
+	uint32_t events;
+	while (read(sub->efd, &count, sizeof(count)) < 0 && errno == EINTR)
+		;
+	pthread_mutex_lock(&ioth_confdata_mutex);
+	events = sub->events;
+	sub->events = 0;
+	pthread_mutex_unlock(&ioth_confdata_mutex);
+	return events;
+}
+
+/* the callback of sub can be running:
+	 if it is the caller, the dispatcher frees sub when the callback returns,
+	 otherwise wait for the end of the callback */
+void ioth_config_unsubscribe(struct ioth_config_notify *sub) {
+	pthread_mutex_lock(&ioth_confdata_mutex);
+	for (struct ioth_config_notify **scan = &ioth_confdata_notify_root; *scan != NULL; scan = &(*scan)->next) {
+		if (*scan == sub) {
+			*scan = sub->next;
+			break;
+		}
+	}
+	if (ioth_confdata_dispatch_current == sub &&
+			pthread_equal(pthread_self(), ioth_confdata_dispatcher)) {
+		sub->unsubscribed = 1;
+		pthread_mutex_unlock(&ioth_confdata_mutex);
+		return;
+	}
+	while (ioth_confdata_dispatch_current == sub)
+		pthread_cond_wait(&ioth_confdata_dispatch_cond, &ioth_confdata_mutex);
+	pthread_mutex_unlock(&ioth_confdata_mutex);
+	ioth_confdata_notify_free(sub);
+}
+
 void ioth_confdata_add(struct ioth *stack, uint32_t ifindex, uint8_t type, time_t timestamp, uint8_t flags,
 		void *data, uint16_t datalen) {
 	struct ioth_confdata **scan, *this;
-	pthread_mutex_lock(&ioth_confdata_mutex);
+	ioth_confdata_lock(stack, ifindex);
 	for (scan = &ioth_confdata_root; *scan != NULL; scan = &this->next) {
 		this = *scan;
 		if (stack == this->stack && type == this->type && datalen == this->datalen &&
 				memcmp(this + 1, data, datalen) == 0) {
+			if (this->timestamp == 0 && timestamp != 0) {
+				/* deleted record added again */
+				ioth_confdata_changed(this);
+				ioth_confdata_notify(this, IOTHCONF_NOTIFY_ADDED);
+			}
 			if (timestamp > this->timestamp)
 				this->timestamp = timestamp;
 			break;
@@ -65,6 +333,9 @@ void ioth_confdata_add(struct ioth *stack, uint32_t ifindex, uint8_t type, time_
 			};
 			memcpy(this + 1, data, datalen);
 			*scan = this;
+			ioth_confdata_changed(this);
+			ioth_confdata_notify(this, IOTHCONF_NOTIFY_ADDED);
+			iothconf_stats_count(stack, ifindex, IOTHCONF_COUNT_RECORD_ADD, 1);
 		}
 	}
 	pthread_mutex_unlock(&ioth_confdata_mutex);
@@ -77,7 +348,7 @@ void ioth_confdata_forall_mask(struct ioth *stack, uint32_t ifindex, uint8_t typ
 	struct ioth_confdata **scan, *this;
 	int cb_retval = 0;
 	type &= mask;
-	pthread_mutex_lock(&ioth_confdata_mutex);
+	ioth_confdata_lock(stack, ifindex);
 	scan = &ioth_confdata_root;
 	while(*scan != NULL) {
 		this = *scan;
@@ -86,6 +357,12 @@ void ioth_confdata_forall_mask(struct ioth *stack, uint32_t ifindex, uint8_t typ
 				(type == 0 || type == (this->type & mask)) &&
 				(cb_retval = callback(this + 1, callback_arg)) & IOTH_CONFDATA_FORALL_DELETE) {
 			*scan = this->next;
+			/* records deleted by ioth_confdata_del have been notified already */
+			if (this->timestamp != 0) {
+				ioth_confdata_changed(this);
+				ioth_confdata_notify(this, IOTHCONF_NOTIFY_REMOVED);
+			}
+			iothconf_stats_count(this->stack, this->ifindex, IOTHCONF_COUNT_RECORD_DEL, 1);
 			free(this);
 		} else
 			scan = &this->next;
@@ -95,6 +372,61 @@ void ioth_confdata_forall_mask(struct ioth *stack, uint32_t ifindex, uint8_t typ
 	pthread_mutex_unlock(&ioth_confdata_mutex);
 }
 
+/* snapshot: a copy of the selected records in one allocated buffer.
+	 The copies have the same layout of the records (header + data):
+	 the get methods can be used on the snapshot records */
+struct ioth_confdata_snapshot {
+	struct ioth_confdata *first;
+};
+
+#define SNAPSHOT_ALIGN(X) (((X) + _Alignof(struct ioth_confdata) - 1) & ~(_Alignof(struct ioth_confdata) - 1))
+
+static inline int ioth_confdata_selected(struct ioth_confdata *this, struct ioth *stack, uint32_t ifindex) {
+	return (stack == IOTH_CONFDATA_ANYSTACK || stack == this->stack) &&
+		(ifindex == 0 || ifindex == this->ifindex);
+}
+
+struct ioth_confdata_snapshot *ioth_confdata_snapshot(struct ioth *stack, uint32_t ifindex) {
+	struct ioth_confdata *this;
+	size_t size = SNAPSHOT_ALIGN(sizeof(struct ioth_confdata_snapshot));
+	ioth_confdata_lock(stack, ifindex);
+	for (this = ioth_confdata_root; this != NULL; this = this->next) {
+		if (ioth_confdata_selected(this, stack, ifindex))
+			size += SNAPSHOT_ALIGN(sizeof(struct ioth_confdata) + this->datalen);
+	}
+	struct ioth_confdata_snapshot *snap = malloc(size);
+	if (snap != NULL) {
+		struct ioth_confdata **tail = &snap->first;
+		uint8_t *scan = (uint8_t *) snap + SNAPSHOT_ALIGN(sizeof(struct ioth_confdata_snapshot));
+		for (this = ioth_confdata_root; this != NULL; this = this->next) {
+			if (ioth_confdata_selected(this, stack, ifindex)) {
+				struct ioth_confdata *copy = (void *) scan;
+				memcpy(copy, this, sizeof(struct ioth_confdata) + this->datalen);
+				*tail = copy;
+				tail = &copy->next;
+				scan += SNAPSHOT_ALIGN(sizeof(struct ioth_confdata) + this->datalen);
+			}
+		}
+		*tail = NULL;
+	}
+	pthread_mutex_unlock(&ioth_confdata_mutex);
+	return snap;
+}
+
+void ioth_confdata_snapshot_forall(struct ioth_confdata_snapshot *snap, uint8_t type, uint8_t mask,
+		ioth_confdata_forall_cb *callback,  void *callback_arg) {
+	type &= mask;
+	for (struct ioth_confdata *this = snap->first; this != NULL; this = this->next) {
+		if ((type == 0 || type == (this->type & mask)) &&
+				(callback(this + 1, callback_arg) & IOTH_CONFDATA_FORALL_BREAK))
+			break;
+	}
+}
+
+void ioth_confdata_snapshot_free(struct ioth_confdata_snapshot *snap) {
+	free(snap);
+}
+
 static int delete_cb(void *data, void *arg) {
 	time_t *timestamp = arg;
 	struct ioth_confdata *ioth_confdata = ((struct ioth_confdata *) data) - 1;
@@ -135,6 +467,8 @@ uint8_t ioth_confdata_setflags(void *data, uint8_t flags) {
 	struct ioth_confdata *ioth_confdata = ((struct ioth_confdata *) data) - 1;
 	uint8_t oldflags = ioth_confdata->flags;
 	ioth_confdata->flags |= flags;
+	if (ioth_confdata->flags != oldflags)
+		ioth_confdata_notify(ioth_confdata, IOTHCONF_NOTIFY_CHANGED);
 	return oldflags;
 }
 
@@ -142,9 +476,16 @@ uint8_t ioth_confdata_clrflags(void *data, uint8_t flags) {
 	struct ioth_confdata *ioth_confdata = ((struct ioth_confdata *) data) - 1;
 	uint8_t oldflags = ioth_confdata->flags;
 	ioth_confdata->flags &= ~flags;
+	if (ioth_confdata->flags != oldflags)
+		ioth_confdata_notify(ioth_confdata, IOTHCONF_NOTIFY_CHANGED);
 	return oldflags;
 }
 
+void ioth_confdata_settimestamp(void *data, time_t timestamp) {
+	struct ioth_confdata *ioth_confdata = ((struct ioth_confdata *) data) - 1;
+	ioth_confdata->timestamp = timestamp;
+}
+
 static int read_timestamp_cb(void *data, void *arg) {
 	time_t *timestamp = arg;
 	struct ioth_confdata *ioth_confdata = ((struct ioth_confdata *) data) - 1;
@@ -161,12 +502,15 @@ time_t ioth_confdata_read_timestamp(struct ioth *stack, uint32_t ifindex, uint8_
 
 time_t ioth_confdata_new_timestamp(struct ioth *stack, uint32_t ifindex, uint8_t type) {
 	time_t oldtimestamp = ioth_confdata_read_timestamp(stack, ifindex, type);
+	uint64_t start = iothconf_stats_now();
 	type = TIMESTAMP(type);
 	for (;;) {
 		struct timeval newtimestamp;
 		gettimeofday(&newtimestamp, NULL);
-		if (newtimestamp.tv_sec > oldtimestamp)
+		if (newtimestamp.tv_sec > oldtimestamp) {
+			iothconf_stats_add(stack, ifindex, IOTHCONF_PHASE_TIMESTAMP, start);
 			return newtimestamp.tv_sec;
+		}
 		usleep(1000000 - newtimestamp.tv_usec);
 	}
 }
@@ -200,6 +544,10 @@ static int ioth_confdata_del_cb(void *data, void *arg) {
 
 	if (ioth_confdata->datalen == dd->datalen &&
 			memcmp(data, dd->data, dd->datalen) == 0) {
+		if (ioth_confdata->timestamp != 0) {
+			ioth_confdata_changed(ioth_confdata);
+			ioth_confdata_notify(ioth_confdata, IOTHCONF_NOTIFY_REMOVED);
+		}
 		ioth_confdata->timestamp = 0;
 		dd->found = 1;
 		return IOTH_CONFDATA_FORALL_BREAK;
@@ -213,3 +561,28 @@ int ioth_confdata_del(struct ioth *stack, uint32_t ifindex, uint8_t type,
 	ioth_confdata_forall(stack, ifindex, type, ioth_confdata_del_cb, &dd);
 	return dd.found ? 0 : -1;
 }
+
+struct getflagsdata {
+	void *data;
+	uint16_t datalen;
+	uint8_t flags;
+};
+
+static int ioth_confdata_getflags_cb(void *data, void *arg) {
+	struct getflagsdata *gd = arg;
+	struct ioth_confdata *ioth_confdata = ((struct ioth_confdata *) data) - 1;
+
+	if (ioth_confdata->datalen == gd->datalen &&
+			memcmp(data, gd->data, gd->datalen) == 0) {
+		gd->flags = ioth_confdata->flags;
+		return IOTH_CONFDATA_FORALL_BREAK;
+	} else
+		return 0;
+}
+
+uint8_t ioth_confdata_getflags(struct ioth *stack, uint32_t ifindex, uint8_t type,
+    void *data, uint16_t datalen) {
+	struct getflagsdata gd = {data, datalen, 0};
+	ioth_confdata_forall(stack, ifindex, type, ioth_confdata_getflags_cb, &gd);
+	return gd.flags;
+}
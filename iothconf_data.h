@@ -51,7 +51,7 @@
 
 #define IOTH_CONFDATA_RD6_TIMESTAMP    0x50 // no data
 #define IOTH_CONFDATA_RD6_PREFIX       0x51 // struct ioth_confdata_ip6addr
-#define IOTH_CONFDATA_RD6_ADDR         0x52 // struct ioth_confdata_ip6addr
+#define IOTH_CONFDATA_RD6_ADDR         0x52 // struct ioth_confdata_ip6addr (flags = RFC 7217 DAD counter)
 #define IOTH_CONFDATA_RD6_ROUTER       0x53 // struct ioth_confdata_ip6addr
 #define IOTH_CONFDATA_RD6_MTU          0x5f // uint32_t
 
@@ -78,6 +78,14 @@ void ioth_confdata_add(struct ioth *stack, uint32_t ifindex, uint8_t type, time_
 int ioth_confdata_del(struct ioth *stack, uint32_t ifindex, uint8_t type,
     void *data, uint16_t datalen);
 
+/* get the flags of an element. retvalue: flags, 0 if not found */
+#define ioth_confdata_getflags_data(stack, ifindex, type, datatype, ...) \
+	ioth_confdata_getflags(stack, ifindex, type, \
+			&((datatype) { __VA_ARGS__ }), sizeof(datatype))
+
+uint8_t ioth_confdata_getflags(struct ioth *stack, uint32_t ifindex, uint8_t type,
+    void *data, uint16_t datalen);
+
 /* iterate on all selected records:
 	 stack/ifindex/type are select keys.
 	 stack can be IOTH_CONFDATA_ANYSTACK, ifindex and type can be zero.
@@ -112,6 +120,20 @@ static inline void ioth_confdata_forall(struct ioth *stack, uint32_t ifindex,
 			callback, callback_arg);
 }
 
+/* deliver the change notifications (ioth_config_subscribe) queued by add, del and forall.
+	 It must be called when no library lock is held (e.g. when an engine returns) */
+void ioth_confdata_dispatch(void);
+
+/* snapshot: copy the records of stack/ifindex (stack can be IOTH_CONFDATA_ANYSTACK,
+	 ifindex can be zero), the copy can be scanned without holding the lock
+	 (callbacks cannot delete records: IOTH_CONFDATA_FORALL_DELETE is ignored).
+	 ioth_confdata_snapshot returns NULL in case of error */
+struct ioth_confdata_snapshot;
+struct ioth_confdata_snapshot *ioth_confdata_snapshot(struct ioth *stack, uint32_t ifindex);
+void ioth_confdata_snapshot_forall(struct ioth_confdata_snapshot *snap, uint8_t type, uint8_t mask,
+		ioth_confdata_forall_cb *callback,  void *callback_arg);
+void ioth_confdata_snapshot_free(struct ioth_confdata_snapshot *snap);
+
 /* get methods to retrieve record fields */
 struct ioth *ioth_confdata_getstack(void *data);
 uint8_t ioth_confdata_gettype(void *data);
@@ -120,8 +142,21 @@ time_t ioth_confdata_gettimestamp(void *data);
 uint16_t ioth_confdata_getdatalen(void *data);
 
 #define IOTH_CONFDATA_ACTIVE 0x01
+// duplicate address detection completed
+#define IOTH_CONFDATA_CHECKED 0x02
+// obsolete address kept during the grace period (make-before-break)
+#define IOTH_CONFDATA_DEPRECATED 0x04
 uint8_t ioth_confdata_setflags(void *data, uint8_t flags);
 uint8_t ioth_confdata_clrflags(void *data, uint8_t flags);
+void ioth_confdata_settimestamp(void *data, time_t timestamp);
+
+/* DNS generation number of an interface: it changes each time a DNS or DOMAIN record
+	 of the interface is added or deleted (0 if there have never been DNS records) */
+uint64_t ioth_confdata_dns_generation(struct ioth *stack, uint32_t ifindex);
+
+/* delete all the records and the DNS generation numbers of stack, no notification
+	 is generated (ioth_config_release: the stack is going to be deleted) */
+void ioth_confdata_release(struct ioth *stack);
 
 /* delete and free (obsolete) records */
 void ioth_confdata_free(struct ioth *stack, uint32_t ifindex, uint8_t type, time_t timestamp);
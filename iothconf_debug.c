@@ -15,7 +15,11 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <inttypes.h>
 #include <arpa/inet.h>
@@ -23,6 +27,7 @@
 #include <iothconf.h>
 #include <iothconf_data.h>
 #include <iothconf_mod.h>
+#include <iothconf_stats.h>
 
 #define STRTIMESTAMPLEN 128
 static char *strtimestamp(time_t timestamp,  char *buf) {
@@ -120,7 +125,7 @@ static void debug_type(uint8_t type, uint16_t len, void *data) {
 			if (len >= sizeof(struct in6_addr)) {
 				struct in6_addr *addr = data;
 				fprintf(stderr, " %s", inet_ntop(AF_INET6, addr, abuf, INET6_ADDRSTRLEN));
-				debug_type(type, len - sizeof(struct in_addr), addr + 1);
+				debug_type(type, len - sizeof(struct in6_addr), addr + 1);
 			}
 			break;
 
@@ -166,9 +171,217 @@ static int iothconf_debug_cb(void *data, void *arg) {
 	return 0;
 }
 
+/* the records are printed from a snapshot: no lock is held during I/O */
 void iothconf_data_debug(struct ioth *stack, unsigned int ifindex) {
 	uint8_t type = 0;
-	fprintf(stderr, " k typ   date    time flag len  data\n");
-	for (type = 1; type != 0; type++)
-		ioth_confdata_forall(stack, ifindex, type, iothconf_debug_cb, NULL);
+	struct ioth_confdata_snapshot *snap = ioth_confdata_snapshot(stack, ifindex);
+	if (snap != NULL) {
+		fprintf(stderr, " k typ   date    time flag len  data\n");
+		for (type = 1; type != 0; type++)
+			ioth_confdata_snapshot_forall(snap, type, IOTH_CONFDATA_MASK_ALL, iothconf_debug_cb, NULL);
+		ioth_confdata_snapshot_free(snap);
+	}
+	struct ioth_config_stats stats;
+	if (ioth_config_stats(stack, ifindex, &stats) == 0 && stats.usec[IOTHCONF_PHASE_TOTAL] > 0) {
+		fprintf(stderr, " phase                 msecs\n");
+		for (int phase = 0; phase < IOTHCONF_NPHASES; phase++) {
+			if (phase == IOTHCONF_PHASE_TOTAL || stats.usec[phase] > 0)
+				fprintf(stderr, " %-18s %8" PRIu64 ".%03" PRIu64 "\n", iothconf_stats_phase_name(phase),
+						stats.usec[phase] / 1000, stats.usec[phase] % 1000);
+		}
+	}
+}
+
+/* JSON dump (ioth_config_dump): snprintf(3) semantics, the output is truncated
+	 if the buffer is too small, len counts the length of the whole string */
+struct iothconf_json {
+	char *buf;
+	size_t size;
+	size_t len;
+	int count;
+};
+
+static void json_printf(struct iothconf_json *json, const char *format, ...) {
+	va_list ap;
+	size_t avail = (json->len < json->size) ? json->size - json->len : 0;
+	va_start(ap, format);
+	int n = vsnprintf(avail > 0 ? json->buf + json->len : NULL, avail, format, ap);
+	va_end(ap);
+	if (n > 0)
+		json->len += n;
+}
+
+static void json_string(struct iothconf_json *json, const char *s, size_t len) {
+	json_printf(json, "\"");
+	for (size_t i = 0; i < len && s[i] != 0; i++) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\')
+			json_printf(json, "\\%c", c);
+		else if (c < 0x20 || c >= 0x7f) /* non-ASCII bytes: latin-1 code points */
+			json_printf(json, "\\u%04x", c);
+		else
+			json_printf(json, "%c", c);
+	}
+	json_printf(json, "\"");
+}
+
+static void json_addrs(struct iothconf_json *json, int family, uint8_t *data, uint16_t len) {
+	size_t addrlen = (family == AF_INET6) ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+	char abuf[INET6_ADDRSTRLEN];
+	json_printf(json, ",\"addrs\":[");
+	for (size_t i = 0; i + addrlen <= len; i += addrlen)
+		json_printf(json, "%s\"%s\"", i == 0 ? "" : ",", inet_ntop(family, data + i, abuf, INET6_ADDRSTRLEN));
+	json_printf(json, "]");
+}
+
+static void json_data(struct iothconf_json *json, uint8_t type, uint16_t len, void *data) {
+	char abuf[INET6_ADDRSTRLEN];
+	switch(type) {
+		case IOTH_CONFDATA_STATIC4_ADDR     :
+		case IOTH_CONFDATA_DHCP4_ADDR       :
+			if (len >= sizeof(struct ioth_confdata_ipaddr)) {
+				struct ioth_confdata_ipaddr *ipaddr = data;
+				json_printf(json, ",\"addr\":\"%s\",\"prefixlen\":%d,\"leasetime\":%" PRIu32,
+						inet_ntop(AF_INET, &ipaddr->addr, abuf, INET6_ADDRSTRLEN),
+						ipaddr->prefixlen, ipaddr->leasetime);
+			}
+			break;
+		case IOTH_CONFDATA_DHCP4_SERVER     :
+		case IOTH_CONFDATA_DHCP4_ROUTER     :
+		case IOTH_CONFDATA_DHCP4_DNS        :
+		case IOTH_CONFDATA_STATIC4_DNS      :
+		case IOTH_CONFDATA_STATIC4_ROUTE    :
+			json_addrs(json, AF_INET, data, len);
+			break;
+		case IOTH_CONFDATA_DHCP6_DNS        :
+		case IOTH_CONFDATA_STATIC6_DNS      :
+			json_addrs(json, AF_INET6, data, len);
+			break;
+		case IOTH_CONFDATA_STATIC6_ADDR     :
+		case IOTH_CONFDATA_STATIC6_ROUTE    :
+		case IOTH_CONFDATA_DHCP6_ADDR       :
+		case IOTH_CONFDATA_RD6_PREFIX       :
+		case IOTH_CONFDATA_RD6_ADDR         :
+		case IOTH_CONFDATA_RD6_ROUTER       :
+			if (len >= sizeof(struct ioth_confdata_ip6addr)) {
+				struct ioth_confdata_ip6addr *ip6addr = data;
+				json_printf(json, ",\"addr\":\"%s\",\"prefixlen\":%d,\"addrflags\":%d,"
+						"\"preferred_lifetime\":%" PRIu32 ",\"valid_lifetime\":%" PRIu32,
+						inet_ntop(AF_INET6, &ip6addr->addr, abuf, INET6_ADDRSTRLEN),
+						ip6addr->prefixlen, ip6addr->flags,
+						ip6addr->preferred_lifetime, ip6addr->valid_lifetime);
+			}
+			break;
+		case IOTH_CONFDATA_DHCP4_DOMAIN     :
+		case IOTH_CONFDATA_DHCP6_DOMAIN     :
+		case IOTH_CONFDATA_STATIC_DOMAIN    :
+			{
+				char *s = data;
+				json_printf(json, ",\"domains\":[");
+				for (size_t i = 0; i < len; i += strnlen(s + i, len - i) + 1) {
+					json_printf(json, "%s", i == 0 ? "" : ",");
+					json_string(json, s + i, len - i);
+				}
+				json_printf(json, "]");
+			}
+			break;
+		case IOTH_CONFDATA_DHCP6_SERVERID   :
+			{
+				uint8_t *hd = data;
+				json_printf(json, ",\"hex\":\"");
+				for (int i = 0; i < len; i++)
+					json_printf(json, "%02x", hd[i]);
+				json_printf(json, "\"");
+			}
+			break;
+		case IOTH_CONFDATA_RD6_MTU          :
+			if (len >= sizeof(uint32_t)) {
+				uint32_t *mtu = data;
+				json_printf(json, ",\"mtu\":%" PRIu32, *mtu);
+			}
+			break;
+	}
+}
+
+static const char *json_source(uint8_t type) {
+	switch (TIMESTAMP(type)) {
+		case IOTH_CONFDATA_DHCP4_TIMESTAMP: return "dhcp";
+		case IOTH_CONFDATA_RD6_TIMESTAMP: return "rd";
+		case IOTH_CONFDATA_DHCP6_TIMESTAMP: return "dhcp6";
+		case IOTH_CONFDATA_STATIC_TIMESTAMP: return "static";
+		default: return "unknown";
+	}
+}
+
+static int iothconf_json_cb(void *data, void *arg) {
+	struct iothconf_json *json = arg;
+	uint8_t type = ioth_confdata_gettype(data);
+	uint8_t flags = ioth_confdata_setflags(data, 0);
+	uint16_t len = ioth_confdata_getdatalen(data);
+	json_printf(json, "%s{\"ifindex\":%" PRIu32 ",\"type\":%d,\"name\":\"%s\",\"source\":\"%s\","
+			"\"timestamp\":%lld,\"flags\":%d,\"active\":%s,\"checked\":%s,\"deprecated\":%s",
+			json->count++ == 0 ? "" : ",",
+			ioth_confdata_getifindex(data), type, strtype(type), json_source(type),
+			(long long) ioth_confdata_gettimestamp(data), flags,
+			(flags & IOTH_CONFDATA_ACTIVE) ? "true" : "false",
+			(flags & IOTH_CONFDATA_CHECKED) ? "true" : "false",
+			(flags & IOTH_CONFDATA_DEPRECATED) ? "true" : "false");
+	json_data(json, type, len, data);
+	json_printf(json, "}");
+	return 0;
+}
+
+/* the records of the snapshot in one scan, then sorted by type (counting sort, stable) */
+struct iothconf_json_records {
+	void **records;
+	int nrecords;
+	int size;
+	int count[256];
+};
+
+static int iothconf_json_collect_cb(void *data, void *arg) {
+	struct iothconf_json_records *jr = arg;
+	if (jr->nrecords >= jr->size) {
+		int newsize = jr->size == 0 ? 32 : jr->size * 2;
+		void **newrecords = realloc(jr->records, newsize * sizeof(*newrecords));
+		if (newrecords == NULL) {
+			jr->nrecords = -1;
+			return IOTH_CONFDATA_FORALL_BREAK;
+		}
+		jr->records = newrecords;
+		jr->size = newsize;
+	}
+	jr->records[jr->nrecords++] = data;
+	jr->count[ioth_confdata_gettype(data)]++;
+	return 0;
+}
+
+int ioth_config_dump(struct ioth *stack, unsigned int ifindex, char *buf, size_t size) {
+	struct iothconf_json json = {.buf = buf, .size = (buf == NULL) ? 0 : size};
+	struct ioth_confdata_snapshot *snap = ioth_confdata_snapshot(stack, ifindex);
+	struct iothconf_json_records jr = {0};
+	void **sorted = NULL;
+	int first[256];
+	if (snap == NULL)
+		return errno = ENOMEM, -1;
+	ioth_confdata_snapshot_forall(snap, 0, IOTH_CONFDATA_MASK_ALL, iothconf_json_collect_cb, &jr);
+	if (jr.nrecords < 0 || (jr.nrecords > 0 && (sorted = malloc(jr.nrecords * sizeof(*sorted))) == NULL)) {
+		free(jr.records);
+		ioth_confdata_snapshot_free(snap);
+		return errno = ENOMEM, -1;
+	}
+	for (int type = 0, n = 0; type < 256; n += jr.count[type++])
+		first[type] = n;
+	for (int i = 0; i < jr.nrecords; i++)
+		sorted[first[ioth_confdata_gettype(jr.records[i])]++] = jr.records[i];
+	if (json.size > 0)
+		buf[0] = 0;
+	json_printf(&json, "{\"records\":[");
+	for (int i = 0; i < jr.nrecords; i++)
+		iothconf_json_cb(sorted[i], &json);
+	json_printf(&json, "]}");
+	free(sorted);
+	free(jr.records);
+	ioth_confdata_snapshot_free(snap);
+	return json.len;
 }
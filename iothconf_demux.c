@@ -0,0 +1,338 @@
+/*
+ *   iothconf_demux.c: auto configuration library for ioth
+ *       per stack demultiplexer of DHCP/DHCPv6 replies
+ *
+ *   Copyright 2021 Renzo Davoli - Virtual Square Team
+ *   University of Bologna - Italy
+ *
+ *   This library is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or (at
+ *   your option) any later version.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <ioth.h>
+#include <iothconf_demux.h>
+#include <iothconf_capture.h>
+
+#define DHCP_CLIENTPORT 68
+#define DHCP6_CLIENTPORT 546
+#define DEMUX_MAXPKT 65536
+/* max number of pending replies of a transaction */
+#define DEMUX_MAXQUEUE 16
+#define DEMUX_MAXID 4
+
+struct demux_pkt {
+	struct demux_pkt *next;
+	size_t len;
+	uint8_t data[];
+};
+
+struct iothconf_demux_tx {
+	struct iothconf_demux_tx *next;
+	struct iothconf_demux *demux;
+	unsigned int ifindex;
+	uint8_t id[DEMUX_MAXID];
+	size_t idlen;
+	int efd;
+	int qlen;
+	struct demux_pkt *head;
+	struct demux_pkt **tail;
+};
+
+struct iothconf_demux {
+	struct iothconf_demux *next;
+	struct ioth *stack;
+	int proto;
+	int refcount;
+	int fd;
+	int stopfd;
+	pthread_t thread;
+	pthread_mutex_t mutex; // protects the list of transactions
+	struct iothconf_demux_tx *txlist;
+};
+
+static pthread_mutex_t demux_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct iothconf_demux *demux_list;
+
+/* get the id and the payload position of a reply, return -1 if it is not a reply */
+static int demux_getid(int proto, uint8_t *pkt, size_t len, uint8_t **id, size_t *idlen) {
+	switch (proto) {
+		case IOTHCONF_DEMUX_DHCP:
+			{
+				/* ip header, udp header, bootp: op, htype, hlen, hops, xid */
+				struct iphdr *iph = (void *) pkt;
+				if (len < sizeof(*iph) || iph->protocol != IPPROTO_UDP)
+					return -1;
+				size_t iphlen = iph->ihl * 4;
+				struct udphdr *udph = (void *) (pkt + iphlen);
+				if (len < iphlen + sizeof(*udph) + 8 || udph->uh_dport != htons(DHCP_CLIENTPORT))
+					return -1;
+				*id = pkt + iphlen + sizeof(*udph) + 4;
+				*idlen = 4;
+				return 0;
+			}
+		case IOTHCONF_DEMUX_DHCP6:
+			/* msg-type, transaction-id */
+			if (len < 4)
+				return -1;
+			*id = pkt + 1;
+			*idlen = 3;
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+/* from6: the sender of a DHCPv6 message */
+static void demux_dispatch(struct iothconf_demux *demux, uint8_t *pkt, size_t len, unsigned int ifindex,
+		const struct sockaddr_in6 *from6) {
+	uint8_t *id;
+	size_t idlen;
+	uint64_t one = 1;
+	if (demux_getid(demux->proto, pkt, len, &id, &idlen) < 0)
+		return;
+	if (demux->proto == IOTHCONF_DEMUX_DHCP)
+		iothconf_capture_ip(ifindex, IOTHCONF_CAPTURE_IN, pkt, len);
+	else
+		iothconf_capture_udp6(ifindex, IOTHCONF_CAPTURE_IN, &from6->sin6_addr, ntohs(from6->sin6_port),
+				NULL, DHCP6_CLIENTPORT, pkt, len);
+	pthread_mutex_lock(&demux->mutex);
+	for (struct iothconf_demux_tx *tx = demux->txlist; tx != NULL; tx = tx->next) {
+		if (tx->idlen != idlen || memcmp(tx->id, id, idlen) != 0)
+			continue;
+		if (ifindex != 0 && tx->ifindex != 0 && ifindex != tx->ifindex)
+			continue;
+		if (tx->qlen >= DEMUX_MAXQUEUE)
+			break;
+		struct demux_pkt *new = malloc(sizeof(*new) + len);
+		if (new == NULL)
+			break;
+		new->next = NULL;
+		new->len = len;
+		memcpy(new->data, pkt, len);
+		*tx->tail = new;
+		tx->tail = &new->next;
+		tx->qlen++;
+		while (write(tx->efd, &one, sizeof(one)) < 0 && errno == EINTR)
+			;
+		break;
+	}
+	pthread_mutex_unlock(&demux->mutex);
+}
+
+static void *demux_thread(void *arg) {
+	struct iothconf_demux *demux = arg;
+	struct pollfd pfd[] = {{demux->fd, POLLIN, 0}, {demux->stopfd, POLLIN, 0}};
+	uint8_t *pkt = malloc(DEMUX_MAXPKT);
+	if (pkt == NULL)
+		return NULL;
+	while (poll(pfd, 2, -1) >= 0 && !(pfd[1].revents & POLLIN)) {
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+		union {
+			struct sockaddr_ll ll;
+			struct sockaddr_in6 in6;
+		} from;
+		socklen_t fromlen = sizeof(from);
+		ssize_t len = ioth_recvfrom(demux->fd, pkt, DEMUX_MAXPKT, 0, (void *) &from, &fromlen);
+		if (len <= 0)
+			continue;
+		unsigned int ifindex = (demux->proto == IOTHCONF_DEMUX_DHCP) ?
+			(unsigned int) from.ll.sll_ifindex : from.in6.sin6_scope_id;
+		demux_dispatch(demux, pkt, len, ifindex, &from.in6);
+	}
+	free(pkt);
+	return NULL;
+}
+
+static int demux_socket(struct ioth *stack, int proto) {
+	int fd;
+	switch (proto) {
+		case IOTHCONF_DEMUX_DHCP:
+			return ioth_msocket(stack, AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+		case IOTHCONF_DEMUX_DHCP6:
+			{
+				struct sockaddr_in6 bindaddr = {
+					.sin6_family = AF_INET6,
+					.sin6_port = htons(DHCP6_CLIENTPORT)
+				};
+				fd = ioth_msocket(stack, AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+				if (fd >= 0 && ioth_bind(fd, (struct sockaddr *) &bindaddr, sizeof(bindaddr)) < 0) {
+					int saved_errno = errno;
+					ioth_close(fd);
+					return errno = saved_errno, -1;
+				}
+				return fd;
+			}
+		default:
+			return errno = EINVAL, -1;
+	}
+}
+
+struct iothconf_demux *iothconf_demux_get(struct ioth *stack, int proto) {
+	struct iothconf_demux *demux;
+	pthread_mutex_lock(&demux_mutex);
+	for (demux = demux_list; demux != NULL; demux = demux->next) {
+		if (demux->stack == stack && demux->proto == proto) {
+			demux->refcount++;
+			goto out;
+		}
+	}
+	demux = malloc(sizeof(*demux));
+	if (demux == NULL)
+		goto out;
+	*demux = (struct iothconf_demux) {
+		.stack = stack,
+		.proto = proto,
+		.refcount = 1,
+		.fd = demux_socket(stack, proto),
+		.stopfd = eventfd(0, EFD_CLOEXEC),
+	};
+	if (demux->fd < 0 || demux->stopfd < 0)
+		goto err;
+	pthread_mutex_init(&demux->mutex, NULL);
+	if (pthread_create(&demux->thread, NULL, demux_thread, demux) != 0) {
+		pthread_mutex_destroy(&demux->mutex);
+		goto err;
+	}
+	demux->next = demux_list;
+	demux_list = demux;
+out:
+	pthread_mutex_unlock(&demux_mutex);
+	return demux;
+err:
+	if (demux->fd >= 0) ioth_close(demux->fd);
+	if (demux->stopfd >= 0) close(demux->stopfd);
+	free(demux);
+	pthread_mutex_unlock(&demux_mutex);
+	return NULL;
+}
+
+/* demux_mutex is held until the socket has been closed: a new demux of the same
+	 stack and protocol cannot bind the client port while the old socket is open */
+void iothconf_demux_put(struct iothconf_demux *demux) {
+	uint64_t one = 1;
+	pthread_mutex_lock(&demux_mutex);
+	if (--demux->refcount > 0) {
+		pthread_mutex_unlock(&demux_mutex);
+		return;
+	}
+	for (struct iothconf_demux **scan = &demux_list; *scan != NULL; scan = &(*scan)->next) {
+		if (*scan == demux) {
+			*scan = demux->next;
+			break;
+		}
+	}
+	while (write(demux->stopfd, &one, sizeof(one)) < 0 && errno == EINTR)
+		;
+	pthread_join(demux->thread, NULL);
+	ioth_close(demux->fd);
+	pthread_mutex_unlock(&demux_mutex);
+	close(demux->stopfd);
+	pthread_mutex_destroy(&demux->mutex);
+	free(demux);
+}
+
+int iothconf_demux_fd(struct iothconf_demux *demux) {
+	return demux->fd;
+}
+
+struct iothconf_demux_tx *iothconf_demux_tx_new(struct iothconf_demux *demux, unsigned int ifindex) {
+	struct iothconf_demux_tx *tx = malloc(sizeof(*tx));
+	if (tx == NULL)
+		return NULL;
+	*tx = (struct iothconf_demux_tx) {
+		.demux = demux,
+		.ifindex = ifindex,
+		.efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE),
+	};
+	if (tx->efd < 0) {
+		free(tx);
+		return NULL;
+	}
+	tx->tail = &tx->head;
+	pthread_mutex_lock(&demux->mutex);
+	tx->next = demux->txlist;
+	demux->txlist = tx;
+	pthread_mutex_unlock(&demux->mutex);
+	return tx;
+}
+
+void iothconf_demux_tx_setid(struct iothconf_demux_tx *tx, const void *id, size_t idlen) {
+	if (idlen > DEMUX_MAXID)
+		idlen = DEMUX_MAXID;
+	pthread_mutex_lock(&tx->demux->mutex);
+	memcpy(tx->id, id, idlen);
+	tx->idlen = idlen;
+	pthread_mutex_unlock(&tx->demux->mutex);
+}
+
+int iothconf_demux_tx_fd(struct iothconf_demux_tx *tx) {
+	return tx->efd;
+}
+
+ssize_t iothconf_demux_tx_recv(struct iothconf_demux_tx *tx, void *buf, size_t len, int flags) {
+	struct iothconf_demux *demux = tx->demux;
+	struct demux_pkt *pkt;
+	ssize_t retval;
+	uint64_t count;
+	pthread_mutex_lock(&demux->mutex);
+	pkt = tx->head;
+	if (pkt == NULL) {
+		pthread_mutex_unlock(&demux->mutex);
+		return errno = EAGAIN, -1;
+	}
+	if (len > pkt->len)
+		len = pkt->len;
+	if (buf != NULL)
+		memcpy(buf, pkt->data, len);
+	retval = (flags & MSG_TRUNC) ? (ssize_t) pkt->len : (ssize_t) len;
+	if (!(flags & MSG_PEEK)) {
+		tx->head = pkt->next;
+		if (tx->head == NULL)
+			tx->tail = &tx->head;
+		tx->qlen--;
+		free(pkt);
+		while (read(tx->efd, &count, sizeof(count)) < 0 && errno == EINTR)
+			;
+	}
+	pthread_mutex_unlock(&demux->mutex);
+	return retval;
+}
+
+void iothconf_demux_tx_free(struct iothconf_demux_tx *tx) {
+	struct iothconf_demux *demux = tx->demux;
+	pthread_mutex_lock(&demux->mutex);
+	for (struct iothconf_demux_tx **scan = &demux->txlist; *scan != NULL; scan = &(*scan)->next) {
+		if (*scan == tx) {
+			*scan = tx->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&demux->mutex);
+	while (tx->head != NULL) {
+		struct demux_pkt *next = tx->head->next;
+		free(tx->head);
+		tx->head = next;
+	}
+	close(tx->efd);
+	free(tx);
+}
@@ -0,0 +1,33 @@
+#ifndef IOTHCONF_DEMUX_H
+#define IOTHCONF_DEMUX_H
+#include <stdint.h>
+#include <unistd.h>
+
+/* per stack demultiplexer of the DHCP replies.
+	 There is one socket per protocol per stack (shared by all the interfaces and
+	 all the concurrent exchanges): a receiver thread dispatches each reply to the
+	 transaction waiting for its xid (DHCP) or transaction-id (DHCPv6) on the
+	 same interface. */
+
+#define IOTHCONF_DEMUX_DHCP  0 // AF_PACKET socket, IPv4/UDP DHCP replies (xid)
+#define IOTHCONF_DEMUX_DHCP6 1 // UDP socket bound to port 546 (transaction-id)
+
+struct ioth;
+struct iothconf_demux;
+struct iothconf_demux_tx;
+
+/* get/release the demultiplexer of a stack (reference counted) */
+struct iothconf_demux *iothconf_demux_get(struct ioth *stack, int proto);
+void iothconf_demux_put(struct iothconf_demux *demux);
+/* the shared socket (to send the requests) */
+int iothconf_demux_fd(struct iothconf_demux *demux);
+
+/* a transaction receives the replies whose id matches (on interface ifindex) */
+struct iothconf_demux_tx *iothconf_demux_tx_new(struct iothconf_demux *demux, unsigned int ifindex);
+void iothconf_demux_tx_setid(struct iothconf_demux_tx *tx, const void *id, size_t idlen);
+/* file descriptor readable when there are pending replies */
+int iothconf_demux_tx_fd(struct iothconf_demux_tx *tx);
+/* get a reply, flags: MSG_PEEK, MSG_TRUNC (as in recv(2)). -1/EAGAIN if no reply is pending */
+ssize_t iothconf_demux_tx_recv(struct iothconf_demux_tx *tx, void *buf, size_t len, int flags);
+void iothconf_demux_tx_free(struct iothconf_demux_tx *tx);
+#endif
@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <poll.h>
 #include <sys/time.h>
 #include <sys/socket.h>
@@ -34,6 +35,12 @@
 #include <iothconf_mod.h>
 #include <iothconf_hash.h>
 #include <iothconf_data.h>
+#include <iothconf_arp.h>
+#include <iothconf_retry.h>
+#include <iothconf_demux.h>
+#include <iothconf_stats.h>
+#include <iothconf_parse.h>
+#include <iothconf_capture.h>
 
 struct dhcpdata {
 	struct ioth *stack;
@@ -41,11 +48,32 @@ struct dhcpdata {
 	uint8_t xid[4];
 	uint8_t macaddr[ETH_ALEN];
 	const char *fqdn;
+	const struct iothconf_retry *retry;
 	time_t timestamp;
 	struct in_addr serveraddr;
 	struct in_addr clientaddr;
+	struct iothconf_demux_tx *tx; // replies for xid
+	uint64_t start; // time of the first transmission of the current exchange
+	int arpfd; // address conflict detection, -1 if disabled
+	int acdactive; // 1 while the probe sequence of clientaddr is running
+	struct iothconf_acd acd;
 };
 
+#define ACD_MAX_DECLINE 3
+/* wait before restarting from DHCPDISCOVER after a DHCPDECLINE (RFC 2131 3.1.5) */
+#define ACD_DECLINE_WAIT 10
+
+/* retransmissions (RFC 2131 4.1): the timeout doubles at each retransmission
+	 (randomized by +/- DHCP_JITTER) up to DHCP_MAX_RT.
+	 Each exchange lasts DHCP_MAX_RD at most (6 secs, the time of the three
+	 fixed timeouts of 2 secs used before): the timeouts are shortened so that all
+	 the DHCP_MAX_RC + 1 transmissions are sent (see iothconf_retry.h) */
+#define DHCP_TIMEOUT 2000
+#define DHCP_MAX_RT 64000
+#define DHCP_MAX_RC 2
+#define DHCP_MAX_RD 6000
+#define DHCP_JITTER 1000
+
 #define   DHCP_CLIENTPORT   68
 #define   DHCP_SERVERPORT   67
 
@@ -107,7 +135,7 @@ __attribute__((__packed__)) struct dhcp_option {
 	uint8_t opt_value[];
 };
 
-#define MAXDHCP 576
+#define MAXDHCP IOTHCONF_DHCP_MAXLEN
 #define DHCPPKT \
 	(sizeof(struct iphdr) + sizeof(struct udphdr) + sizeof(struct bootp_head) + sizeof(struct dhcp_head))
 #define MAXOPT MAXDHCP - DHCPPKT
@@ -120,17 +148,6 @@ struct dhcp_pkt {
 	uint8_t options[MAXOPT];
 };
 
-/* IP checksum */
-unsigned int chksum(unsigned int sum, void *vbuf, size_t len) {
-	uint8_t *buf=vbuf;
-	unsigned int i;
-	for (i = 0; i < len; i++)
-		sum += (i & 1)? buf[i]: buf[i]<<8;
-	sum = (sum>>16) + (sum & 0xffff);
-	sum = (sum>>16) + (sum & 0xffff);
-	return sum;
-}
-
 /* packet composing helper functions */
 static void add_dhcp_opt_type(FILE *f, int type) {
 	fputc(OPTION_TYPE, f);
@@ -138,7 +155,7 @@ static void add_dhcp_opt_type(FILE *f, int type) {
 	fputc(type, f);
 }
 
-static void add_dhcp_opt_clientid(FILE *f, uint8_t *macaddr) {
+static void add_dhcp_opt_clientid(FILE *f, const uint8_t *macaddr) {
 	fputc(OPTION_CLIENTID, f);
 	fputc(7, f);
 	fputc(1, f); // ethernet
@@ -193,18 +210,42 @@ static void add_dhcp_opt_parlist(FILE *f, ...) {
 
 /* dialog functions. dhcp_send and dhcp_get use indirect recursion.
 	 In this way temporary data can be stored on the stack */
-static int dhcp_get(int sendtype, int fd, const struct sockaddr_ll *dest_addr, struct dhcpdata *data);
-static int dhcp_send(int type, int fd, const struct sockaddr_ll *dest_addr, struct dhcpdata *data) {
-	switch (type) {
-		case DHCPDISCOVER:
-		case DHCPREQUEST:
-			break;
-		default:
-			return errno = EINVAL, -1;
+/* store the configuration data of a DHCPACK */
+void iothconf_dhcp_store(struct ioth *stack, unsigned int ifindex, time_t timestamp,
+		const struct iothconf_dhcp_msg *msg) {
+	struct in_addr serveraddr;
+	memcpy(&serveraddr, msg->server, sizeof(serveraddr));
+	ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_DHCP4_SERVER, timestamp, 0,
+			struct in_addr, serveraddr.s_addr);
+	ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_DHCP4_ADDR, timestamp, 0,
+			struct ioth_confdata_ipaddr,
+			.addr = msg->yiaddr,
+			.prefixlen = msg->prefixlen,
+			.leasetime = msg->leasetime);
+	if (msg->routerlen > 0)
+		ioth_confdata_add(stack, ifindex, IOTH_CONFDATA_DHCP4_ROUTER, timestamp, 0,
+				msg->router, msg->routerlen);
+	if (msg->dnslen > 0)
+		ioth_confdata_add(stack, ifindex, IOTH_CONFDATA_DHCP4_DNS, timestamp, 0,
+				msg->dns, msg->dnslen);
+	if (msg->domainlen > 0) {
+		/* add string termination */
+		size_t len = strnlen(msg->domain, msg->domainlen);
+		char domname[len + 1];
+		memcpy(domname, msg->domain, len);
+		domname[len] = 0;
+		ioth_confdata_add(stack, ifindex, IOTH_CONFDATA_DHCP4_DOMAIN, timestamp, 0,
+				domname, len + 1);
 	}
-	if (getrandom(data->xid, sizeof(data->xid), 0) < 0)
-		return -1;
-	struct dhcp_pkt outbuf = {
+	ioth_confdata_write_timestamp(stack, ifindex, IOTH_CONFDATA_DHCP4_TIMESTAMP, timestamp);
+}
+
+/* compose a client message (DHCPDISCOVER, DHCPREQUEST or DHCPDECLINE) in buf
+	 (IOTHCONF_DHCP_MAXLEN bytes), return its length */
+size_t iothconf_dhcp_build(void *buf, int type, const uint8_t *xid, const uint8_t *macaddr,
+		struct in_addr clientaddr, struct in_addr serveraddr, const char *fqdn) {
+	struct dhcp_pkt *outbuf = buf;
+	*outbuf = (struct dhcp_pkt) {
 		.ip_h.version = 4,
 		.ip_h.ihl = 5,
 		.ip_h.ttl = 64,
@@ -216,85 +257,97 @@ static int dhcp_send(int type, int fd, const struct sockaddr_ll *dest_addr, stru
 		.bootp_h.htype = 1, // ethernet
 		.bootp_h.hlen = ETH_ALEN,
 		.dhcp_h.dhcp_cookie = DHCP_COOKIE};
-	memcpy(outbuf.bootp_h.xid, data->xid, sizeof(data->xid));
-	memcpy(outbuf.bootp_h.chaddr, data->macaddr, sizeof(data->macaddr));
-	if (type != DHCPDISCOVER) {
-		memcpy(outbuf.bootp_h.ciaddr, &data->clientaddr, sizeof(data->clientaddr));
-		memcpy(outbuf.bootp_h.siaddr, &data->serveraddr, sizeof(data->serveraddr));
+	memcpy(outbuf->bootp_h.xid, xid, 4);
+	memcpy(outbuf->bootp_h.chaddr, macaddr, ETH_ALEN);
+	if (type == DHCPREQUEST) {
+		memcpy(outbuf->bootp_h.ciaddr, &clientaddr, sizeof(clientaddr));
+		memcpy(outbuf->bootp_h.siaddr, &serveraddr, sizeof(serveraddr));
 	}
 	unsigned int sum=0;
-	FILE *optf = fmemopen(&outbuf.options, MAXOPT, "w");
+	FILE *optf = fmemopen(outbuf->options, MAXOPT, "w");
 	add_dhcp_opt_type(optf, type);
-	add_dhcp_opt_maxsize(optf);
-	add_dhcp_opt_clientid(optf, data->macaddr);
+	/* DHCPDECLINE: type, requested IP address, server id and client id only (RFC 2131 table 5) */
+	if (type != DHCPDECLINE)
+		add_dhcp_opt_maxsize(optf);
+	add_dhcp_opt_clientid(optf, macaddr);
 	if (type != DHCPDISCOVER) {
-		add_dhcp_opt(optf, OPTION_REQIP, sizeof(data->clientaddr), &data->clientaddr);
-		add_dhcp_opt(optf, OPTION_SERVID, sizeof(data->serveraddr), &data->serveraddr);
+		add_dhcp_opt(optf, OPTION_REQIP, sizeof(clientaddr), &clientaddr);
+		add_dhcp_opt(optf, OPTION_SERVID, sizeof(serveraddr), &serveraddr);
+	}
+	if (type != DHCPDECLINE) {
+		add_dhcp_opt_parlist(optf,
+				OPTION_MASK,
+				OPTION_ROUTER,
+				OPTION_DNS,
+				OPTION_DOMNAME,
+				0);
+		if (fqdn)
+			add_dhcp_opt_fqdn(optf, fqdn);
 	}
-	add_dhcp_opt_parlist(optf,
-			OPTION_MASK,
-			OPTION_ROUTER,
-			OPTION_DNS,
-			OPTION_DOMNAME,
-			0);
-	if (data->fqdn)
-		add_dhcp_opt_fqdn(optf, data->fqdn);
 	add_dhcp_opt_end(optf);
 	long optlen = ftell(optf);
 	fclose(optf);
-	outbuf.udp_h.uh_ulen = htons(DHCPPKT - sizeof(struct iphdr) + optlen);
-	outbuf.ip_h.tot_len = htons(DHCPPKT + optlen);
-	outbuf.ip_h.check = 0;
-	sum = chksum(sum, &outbuf.ip_h, sizeof(outbuf.ip_h));
-	outbuf.ip_h.check = htons(~sum);
-	/* try 3 times */
-	int times = 0;
-	for (;;) {
-		if (ioth_sendto(fd, &outbuf, DHCPPKT + optlen, 0, (struct sockaddr *) dest_addr, sizeof(*dest_addr)) < 0)
+	outbuf->udp_h.uh_ulen = htons(DHCPPKT - sizeof(struct iphdr) + optlen);
+	outbuf->ip_h.tot_len = htons(DHCPPKT + optlen);
+	outbuf->ip_h.check = 0;
+	sum = iothconf_chksum(sum, &outbuf->ip_h, sizeof(outbuf->ip_h));
+	outbuf->ip_h.check = htons(~sum);
+	return DHCPPKT + optlen;
+}
+
+static int dhcp_get(int sendtype, int fd, const struct sockaddr_ll *dest_addr, struct dhcpdata *data,
+		int timeout);
+static int dhcp_send(int type, int fd, const struct sockaddr_ll *dest_addr, struct dhcpdata *data) {
+	switch (type) {
+		case DHCPDISCOVER:
+		case DHCPREQUEST:
+		case DHCPDECLINE:
+			break;
+		default:
+			return errno = EINVAL, -1;
+	}
+	/* a new transaction starts at each DHCPDISCOVER:
+		 DHCPREQUEST and DHCPDECLINE use the xid of the exchange */
+	if (type == DHCPDISCOVER) {
+		if (getrandom(data->xid, sizeof(data->xid), 0) < 0)
+			return -1;
+		iothconf_demux_tx_setid(data->tx, data->xid, sizeof(data->xid));
+	}
+	struct dhcp_pkt outbuf;
+	size_t outlen = iothconf_dhcp_build(&outbuf, type, data->xid, data->macaddr,
+			data->clientaddr, data->serveraddr, data->fqdn);
+	/* DHCPDECLINE: no reply */
+	if (type == DHCPDECLINE) {
+		iothconf_ratelimit();
+		iothconf_stats_count(data->stack, data->ifindex, IOTHCONF_COUNT_DHCP_TX_DECLINE, 1);
+		iothconf_capture_ip(data->ifindex, IOTHCONF_CAPTURE_OUT, &outbuf, outlen);
+		return ioth_sendto(fd, &outbuf, outlen, 0, (struct sockaddr *) dest_addr, sizeof(*dest_addr)) < 0 ? -1 : 0;
+	}
+	/* retransmissions: randomized exponential backoff */
+	struct iothconf_backoff backoff;
+	int timeout;
+	iothconf_backoff_init(&backoff, data->retry, DHCP_TIMEOUT, DHCP_MAX_RT, DHCP_MAX_RC, DHCP_MAX_RD, DHCP_JITTER);
+	data->start = iothconf_stats_now();
+	while ((timeout = iothconf_backoff_next(&backoff)) >= 0) {
+		iothconf_ratelimit();
+		iothconf_capture_ip(data->ifindex, IOTHCONF_CAPTURE_OUT, &outbuf, outlen);
+		if (ioth_sendto(fd, &outbuf, outlen, 0, (struct sockaddr *) dest_addr, sizeof(*dest_addr)) < 0)
 			return -1;
-		if (dhcp_get(type, fd, dest_addr, data) == 0)
+		iothconf_stats_count(data->stack, data->ifindex,
+				type == DHCPDISCOVER ? IOTHCONF_COUNT_DHCP_TX_DISCOVER : IOTHCONF_COUNT_DHCP_TX_REQUEST, 1);
+		if (backoff.count > 1)
+			iothconf_stats_count(data->stack, data->ifindex, IOTHCONF_COUNT_DHCP_RETRY, 1);
+		if (dhcp_get(type, fd, dest_addr, data, timeout) == 0)
 			return 0;
-		if (times >= 2 || errno != ETIME)
+		if (errno != ETIME)
 			return -1;
-		times++;
 	}
+	iothconf_stats_count(data->stack, data->ifindex, IOTHCONF_COUNT_DHCP_TIMEOUT, 1);
+	return errno = ETIME, -1;
 }
 
-/* check if the current packet is the expected one */
-static int check_consistency(struct dhcp_pkt inbuf, size_t inbuflen, struct dhcpdata *data) {
-	unsigned int sum=0;
-	static uint8_t dhcp_cookie[] = DHCP_COOKIE;
-	if (inbuflen < DHCPPKT)
-		return 0;
-	sum = chksum(sum, &inbuf.ip_h, sizeof(inbuf.ip_h));
-	if (sum != 0xffff)
-		return 0;
-	if (inbuf.ip_h.protocol != SOL_UDP)
-		return 0;
-	if (inbuf.udp_h.uh_sport != htons(DHCP_SERVERPORT))
-		return 0;
-	if (inbuf.udp_h.uh_dport != htons(DHCP_CLIENTPORT))
-		return 0;
-	if (memcmp(inbuf.bootp_h.xid, data->xid, sizeof(data->xid)))
-		return 0;
-	if (memcmp(inbuf. dhcp_h.dhcp_cookie, dhcp_cookie, sizeof(dhcp_cookie)))
-		return 0;
-	if (inbuf.bootp_h.op != 2) //boot reply
-		return 0;
-	return 1;
-}
-
-/* mask to prefix conversion. e.g.: 255.255.255.0 -> 24 */
-static uint8_t mask2prefix(uint32_t mask) {
-	int i;
-	for (i = 0;i < 32; i++, mask >>= 1)
-		if (mask & 1)
-			break;
-	return 32 - i;
-}
-
-#define DHCP_TIMEOUT 2000
-static int dhcp_get(int sendtype, int fd, const struct sockaddr_ll *dest_addr, struct dhcpdata *data) {
+static int dhcp_get(int sendtype, int fd, const struct sockaddr_ll *dest_addr, struct dhcpdata *data,
+		int timeout) {
 	int type;
 	switch (sendtype) {
 		case DHCPDISCOVER: type = DHCPOFFER; break;
@@ -303,8 +356,8 @@ static int dhcp_get(int sendtype, int fd, const struct sockaddr_ll *dest_addr, s
 											return errno = EINVAL, -1;
 	}
 	struct dhcp_pkt inbuf;
-	struct pollfd pfd[] = {{fd, POLLIN, 0}};
-	int timeout = DHCP_TIMEOUT;
+	struct pollfd pfd[] = {{iothconf_demux_tx_fd(data->tx), POLLIN, 0}, {data->arpfd, POLLIN, 0}};
+	int npfd = data->arpfd >= 0 ? 2 : 1;
 	struct timeval start;
 	struct timeval end;
 	struct timeval timediff;
@@ -313,104 +366,73 @@ static int dhcp_get(int sendtype, int fd, const struct sockaddr_ll *dest_addr, s
 		 when the timeout expires */
 	for(;;) {
 		int event;
+		int polltimeout = timeout;
+		/* the probe sequence runs in parallel with the REQUEST/ACK exchange */
+		if (data->acdactive) {
+			int acdtimeout = iothconf_acd_step(&data->acd);
+			if (acdtimeout == 0)
+				data->acdactive = 0;
+			else if (acdtimeout < polltimeout)
+				polltimeout = acdtimeout;
+		}
 		gettimeofday(&start, NULL);
-		event = poll(pfd, 1, timeout);
+		event = poll(pfd, npfd, polltimeout);
 		//printf("event %d\n", event);
-		if (event == 0)
+		if (event == 0 && polltimeout == timeout)
 			return errno = ETIME, -1;
-		size_t inbuflen = ioth_recvfrom(fd, &inbuf, sizeof(inbuf), 0, NULL, NULL);
+		/* arp packets received when there is no probe sequence running */
+		if (npfd > 1 && (pfd[1].revents & POLLIN) && !data->acdactive)
+			iothconf_arp_conflict(data->arpfd, data->ifindex, data->macaddr, &data->clientaddr);
+		if (!(pfd[0].revents & POLLIN))
+			goto spurious;
+		ssize_t inbuflen = iothconf_demux_tx_recv(data->tx, &inbuf, sizeof(inbuf), 0);
+		if (inbuflen < 0)
+			goto spurious;
 		//printf("%zd \n", inbuflen);
-		if (check_consistency(inbuf, inbuflen, data)) {
-			FILE *optf = fmemopen(&inbuf.options, MAXOPT, "r");
-			uint8_t answ_type = 0;
-			uint8_t *answ_server = NULL;
-			uint8_t answ_prefix = 0;
-			uint32_t answ_leasetime = 0;
-			/* first scan */
-			for(;;) {
-				int opt_type = getc(optf);
-				//printf("1 %d\n",opt_type);
-				if (opt_type == OPTION_PAD)
-					continue;
-				if (opt_type == EOF || opt_type == OPTION_END)
-					break;
-				unsigned int opt_len = getc(optf);
-				long next_opt = ftell(optf) + opt_len;
-				switch(opt_type) {
-					case OPTION_TYPE: answ_type = getc(optf); break;
-					case OPTION_SERVID: answ_server = inbuf.options + ftell(optf); break;
-					case OPTION_MASK:
-															answ_prefix = mask2prefix(
-																	(getc(optf) << 24) |
-																	(getc(optf) << 16) |
-																	(getc(optf) << 8) |
-																	getc(optf));
-															break;
-					case OPTION_LEASETIME:
-															answ_leasetime = (getc(optf) << 24) | (getc(optf) << 16) |
-																(getc(optf) << 8) | getc(optf);
-															break;
-
-
-				}
-				fseek(optf, next_opt, SEEK_SET);
-			}
-			fclose(optf);
-			if (answ_type == DHCPNAK)
+		struct iothconf_dhcp_msg msg;
+		/* malformed packets and replies to other transactions are spurious */
+		if (iothconf_dhcp_parse(&inbuf, inbuflen, &msg) < 0 ||
+				memcmp(msg.xid, data->xid, sizeof(data->xid)) != 0)
+			iothconf_stats_count(data->stack, data->ifindex, IOTHCONF_COUNT_DHCP_SPURIOUS, 1);
+		else {
+			if (msg.type == DHCPNAK) {
+				iothconf_stats_count(data->stack, data->ifindex, IOTHCONF_COUNT_DHCP_RX_NAK, 1);
 				return errno = ECANCELED, -1;
-			if (answ_type == type && answ_server) {
-				memcpy(&data->serveraddr, answ_server, sizeof(data->serveraddr));
-				memcpy(&data->clientaddr, inbuf.bootp_h.yiaddr, sizeof(data->clientaddr));
-				if (answ_type == DHCPOFFER)
+			}
+			if (msg.type != type || msg.server == NULL)
+				iothconf_stats_count(data->stack, data->ifindex, IOTHCONF_COUNT_DHCP_SPURIOUS, 1);
+			else {
+				iothconf_stats_count(data->stack, data->ifindex,
+						type == DHCPOFFER ? IOTHCONF_COUNT_DHCP_RX_OFFER : IOTHCONF_COUNT_DHCP_RX_ACK, 1);
+				iothconf_stats_add(data->stack, data->ifindex,
+						type == DHCPOFFER ? IOTHCONF_PHASE_DHCP_OFFER : IOTHCONF_PHASE_DHCP_ACK, data->start);
+				memcpy(&data->serveraddr, msg.server, sizeof(data->serveraddr));
+				data->clientaddr = msg.yiaddr;
+				if (msg.type == DHCPOFFER) {
+					/* start probing the offered address, the sequence runs
+						 in parallel with the REQUEST/ACK exchange */
+					if (data->arpfd >= 0) {
+						iothconf_acd_start(&data->acd, data->arpfd, data->ifindex, data->macaddr, &data->clientaddr);
+						data->acdactive = 1;
+					}
 					return dhcp_send(DHCPREQUEST, fd, dest_addr, data);
-				else if (answ_type == DHCPACK) {
-					ioth_confdata_add_data(data->stack, data->ifindex, IOTH_CONFDATA_DHCP4_SERVER, data->timestamp, 0,
-							struct in_addr, data->serveraddr.s_addr);
-					ioth_confdata_add_data(data->stack, data->ifindex, IOTH_CONFDATA_DHCP4_ADDR, data->timestamp, 0,
-							struct ioth_confdata_ipaddr,
-							.addr = data->clientaddr,
-							.prefixlen = answ_prefix,
-							.leasetime = answ_leasetime);
-					optf = fmemopen(&inbuf.options, MAXOPT, "r");
-					/* second scan */
-					for(;;) {
-						int opt_type = getc(optf);
-						if (opt_type == OPTION_PAD)
-							continue;
-						if (opt_type == EOF || opt_type == OPTION_END)
-							break;
-						unsigned int opt_len = getc(optf);
-						long next_opt = ftell(optf) + opt_len;
-						switch(opt_type) {
-							case OPTION_ROUTER:
-								ioth_confdata_add(data->stack, data->ifindex, IOTH_CONFDATA_DHCP4_ROUTER, data->timestamp, 0,
-										inbuf.options + ftell(optf), opt_len);
-								break;
-							case OPTION_DNS:
-								ioth_confdata_add(data->stack, data->ifindex, IOTH_CONFDATA_DHCP4_DNS, data->timestamp, 0,
-										inbuf.options + ftell(optf), opt_len);
-								break;
-							case OPTION_DOMNAME:
-								{
-									/* add string termination */
-									char domname[opt_len + 1];
-									snprintf(domname, opt_len + 1,  "%.*s", opt_len, inbuf.options + ftell(optf));
-									ioth_confdata_add(data->stack, data->ifindex, IOTH_CONFDATA_DHCP4_DOMAIN, data->timestamp, 0,
-											domname, opt_len + 1);
-								}
-								break;
+				} else {
+					if (data->arpfd >= 0) {
+						/* complete the probe sequence (if it is still running) */
+						data->acdactive = 0;
+						if (iothconf_acd_run(&data->acd, 1) > 0) {
+							dhcp_send(DHCPDECLINE, fd, dest_addr, data);
+							return errno = EADDRINUSE, -1;
 						}
-						fseek(optf, next_opt, SEEK_SET);
 					}
-					fclose(optf);
-					ioth_confdata_write_timestamp(data->stack, data->ifindex, IOTH_CONFDATA_DHCP4_TIMESTAMP, data->timestamp);
+					iothconf_dhcp_store(data->stack, data->ifindex, data->timestamp, &msg);
 					return 0;
-				} else
-					return errno = EFAULT, -1;
+				}
 			}
 		}
 		/* the code reaches this poinnt only if a spurious pakcet has beeen received.
 			 it loops waiting for more packets using the remaining time to the timeout */
+spurious:
 		gettimeofday(&end, NULL);
 		timersub(&end, &start, &timediff);
 		timeout -= timediff.tv_sec * 1000 + timediff.tv_usec / 1000;
@@ -418,9 +440,12 @@ static int dhcp_get(int sendtype, int fd, const struct sockaddr_ll *dest_addr, s
 	}
 }
 
-static int iothconf_dhcp_proto(struct ioth *stack, unsigned int ifindex, const char *fqdn, uint32_t config_flags) {
-	(void) config_flags;
-	int packet_socket = ioth_msocket(stack, AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+static int iothconf_dhcp_proto(struct ioth *stack, unsigned int ifindex, const struct iothconf_param *param,
+		struct in_addr *clientaddr) {
+	struct iothconf_demux *demux = iothconf_demux_get(stack, IOTHCONF_DEMUX_DHCP);
+	if (demux == NULL)
+		return -1;
+	int packet_socket = iothconf_demux_fd(demux);
 	struct sockaddr_ll sll = {
 		.sll_family = AF_PACKET,
 		.sll_protocol = htons(ETH_P_IP),
@@ -433,19 +458,49 @@ static int iothconf_dhcp_proto(struct ioth *stack, unsigned int ifindex, const c
 		.stack = stack,
 		.ifindex = ifindex,
 		.xid = {0, 0, 0, 0},
-		.fqdn = fqdn,
-		.timestamp = ioth_confdata_new_timestamp(stack, ifindex, IOTH_CONFDATA_DHCP4_TIMESTAMP)
+		.fqdn = param->fqdn,
+		.retry = &param->retry,
+		.timestamp = ioth_confdata_new_timestamp(stack, ifindex, IOTH_CONFDATA_DHCP4_TIMESTAMP),
+		.tx = iothconf_demux_tx_new(demux, ifindex),
+		.arpfd = (param->config_flags & IOTHCONF_ACD) ? iothconf_arp_open(stack) : -1,
 	};
+	if (dhcpdata.tx == NULL) {
+		if (dhcpdata.arpfd >= 0)
+			ioth_close(dhcpdata.arpfd);
+		iothconf_demux_put(demux);
+		return -1;
+	}
 	ioth_linkgetaddr(stack, ifindex, dhcpdata.macaddr);
 	//loop
-	int rv = dhcp_send(DHCPDISCOVER, packet_socket, &sll, &dhcpdata);
-	ioth_close(packet_socket);
+	int rv;
+	iothconf_initial_delay(&param->retry);
+	/* restart from DHCPDISCOVER if the address has been declined */
+	for (int declined = 0; ; declined++) {
+		if (declined > 0)
+			sleep(ACD_DECLINE_WAIT);
+		dhcpdata.acdactive = 0;
+		rv = dhcp_send(DHCPDISCOVER, packet_socket, &sll, &dhcpdata);
+		if (rv == 0 || errno != EADDRINUSE || declined >= ACD_MAX_DECLINE)
+			break;
+	}
+	if (dhcpdata.arpfd >= 0)
+		ioth_close(dhcpdata.arpfd);
+	iothconf_demux_tx_free(dhcpdata.tx);
+	iothconf_demux_put(demux);
+	*clientaddr = dhcpdata.clientaddr;
 	return rv;
 }
 
-int iothconf_dhcp(struct ioth *stack, unsigned int ifindex, const char *fqdn, uint32_t config_flags) {
-	int rv = iothconf_dhcp_proto(stack, ifindex, fqdn, config_flags);
-	if (rv == 0)
-		iothconf_ip_update(stack, ifindex, IOTH_CONFDATA_DHCP4_TIMESTAMP, config_flags);
+int iothconf_dhcp(struct ioth *stack, unsigned int ifindex, const struct iothconf_param *param) {
+	struct in_addr clientaddr;
+	int rv = iothconf_dhcp_proto(stack, ifindex, param, &clientaddr);
+	if (rv == 0) {
+		iothconf_ip_update(stack, ifindex, IOTH_CONFDATA_DHCP4_TIMESTAMP, param);
+		if (param->config_flags & IOTHCONF_ACD) {
+			uint8_t macaddr[ETH_ALEN];
+			ioth_linkgetaddr(stack, ifindex, macaddr);
+			iothconf_arp_announce_addr(stack, ifindex, macaddr, &clientaddr);
+		}
+	}
 	return rv;
 }
@@ -32,6 +32,11 @@
 #include <iothconf_hash.h>
 #include <iothconf_data.h>
 #include <iothconf_dns.h>
+#include <iothconf_retry.h>
+#include <iothconf_demux.h>
+#include <iothconf_stats.h>
+#include <iothconf_parse.h>
+#include <iothconf_capture.h>
 
 #define   DHCP_CLIENTPORT   546
 #define   DHCP_SERVERPORT   547
@@ -76,10 +81,8 @@
 
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 # define HTONS(x) ((__uint16_t) ((((x) >> 8) & 0xff) | (((x) & 0xff) << 8)))
-# define NTOHS(x) ((__uint16_t) ((((x) >> 8) & 0xff) | (((x) & 0xff) << 8)))
 #else
 # define HTONS(x) (x)
-# define NTOHS(x) (x)
 #endif
 
 static struct sockaddr_in6 mcastaddr = {
@@ -104,44 +107,20 @@ static inline void fput_int32(FILE *f, uint32_t data) {
 	fputc(data, f);
 }
 
-static inline void fput_data(FILE *f, void *data, uint16_t len) {
+static inline void fput_data(FILE *f, const void *data, uint16_t len) {
 	fwrite(data, len, 1, f);
 }
 
-/* fget_int8 and fget_int16 return EOF */
-static inline int fget_int8(FILE *f) {
-	return fgetc(f);
-}
-
-static inline int fget_int16(FILE *f) {
-	return (fget_int8(f) << 8) | fget_int8(f);
-}
-
-static inline uint32_t fget_int32(FILE *f) {
-	return (fget_int8(f) << 24) | (fget_int8(f) << 16) |
-		(fget_int8(f) << 8) | fget_int8(f);
-}
-
-static inline void fget_data(FILE *f, void *data, uint16_t len) {
-	size_t retval = fread(data, len, 1, f);
-	(void) retval;
-}
-
-struct iaaddr {
-	uint16_t type;
-	uint16_t len;
-	uint8_t addr[16];
-	uint32_t preferred_lifetime;
-	uint32_t valid_lifetime;
-};
-
+/* the lifetimes of the addresses sent back to the server in IA_NA must be zero
+	 (RFC 8415 section 18.2) */
 static void ia_lifetime_zero(uint8_t *iana_addr, uint16_t iana_addrlen) {
-	uint8_t *limit = iana_addr + iana_addrlen;
-	while (iana_addr < limit) {
-		struct iaaddr *iaaddr = (void *) iana_addr;
-		if (NTOHS(iaaddr->type) == OPTION_IAADDR)
-			iaaddr->preferred_lifetime = iaaddr-> valid_lifetime = 0;
-		iana_addr += sizeof(uint16_t) + sizeof(uint16_t) + NTOHS(iaaddr->len);
+	size_t pos = 0;
+	uint8_t *value;
+	size_t optlen;
+	int code;
+	while ((code = iothconf_dhcp6_nextopt(iana_addr, iana_addrlen, &pos, &value, &optlen)) >= 0) {
+		if (code == OPTION_IAADDR && optlen >= 24)
+			memset(value + 16, 0, 8);
 	}
 }
 
@@ -166,7 +145,7 @@ static time_t idtime(void) {
 	return duidtime;
 }
 
-static void dhcp_add_head(FILE *f, int type, uint8_t *tid) {
+static void dhcp_add_head(FILE *f, int type, const uint8_t *tid) {
 	fput_int8(f, type);
 	fput_data(f, tid, 3);
 }
@@ -176,15 +155,31 @@ static void dhcp_add_option(FILE *f, int type, int len) {
 	fput_int16(f, len);
 }
 
-static void dhcp_add_opt_clientid(FILE *f, uint8_t *macaddr) {
-	dhcp_add_option(f, OPTION_CLIENTID, 14);
-	fput_int16(f, 1);
-	fput_int16(f, 1);
-	fput_int32(f, idtime());
-	fput_data(f, macaddr, ETH_ALEN);
+/* client DUID: the DUID-LL of the hash based MAC (ioth_hashid) if fqdn is defined:
+	 the same name gets the same DUID after a restart. Otherwise DUID-LLT of the MAC address */
+#define DHCP_DUID_MAXLEN 14
+static uint16_t dhcp_duid(uint8_t *duid, const char *fqdn, uint8_t *macaddr) {
+	if (fqdn && *fqdn) {
+		struct ioth_hashid id;
+		ioth_hashid(fqdn, &id);
+		memcpy(duid, id.duid, sizeof(id.duid));
+		return sizeof(id.duid);
+	} else {
+		uint32_t duidtime = htonl(idtime());
+		duid[0] = 0; duid[1] = 1; // DUID-LLT
+		duid[2] = 0; duid[3] = 1; // ethernet
+		memcpy(duid + 4, &duidtime, sizeof(duidtime));
+		memcpy(duid + 8, macaddr, ETH_ALEN);
+		return 8 + ETH_ALEN;
+	}
 }
 
-static void dhcp_add_opt_serverid(FILE *f, uint8_t *serverid, uint16_t serveridlen) {
+static void dhcp_add_opt_clientid(FILE *f, const uint8_t *duid, uint16_t duidlen) {
+	dhcp_add_option(f, OPTION_CLIENTID, duidlen);
+	fput_data(f, duid, duidlen);
+}
+
+static void dhcp_add_opt_serverid(FILE *f, const uint8_t *serverid, uint16_t serveridlen) {
 	if (serverid) {
 		dhcp_add_option(f, OPTION_SERVERID, serveridlen);
 		fput_data(f, serverid, serveridlen);
@@ -223,7 +218,7 @@ static void dhcp_add_opt_fqdn(FILE *f, const char *fqdn, uint8_t flags) {
 	}
 }
 
-static void dhcp_add_opt_iana(FILE *f, uint8_t *macaddr, uint8_t *iana_addr, uint16_t iana_addrlen) {
+static void dhcp_add_opt_iana(FILE *f, const uint8_t *macaddr, const uint8_t *iana_addr, uint16_t iana_addrlen) {
 	dhcp_add_option(f, OPTION_IA_NA, 12);
 	fput_data(f, macaddr+2, 4);
 	fput_int32(f, 0); /* section 25 RFC 8415 */
@@ -238,38 +233,121 @@ struct dhcpdata {
 	time_t timestamp;
 	uint8_t tid[3];
 	uint8_t macaddr[ETH_ALEN];
+	uint8_t duid[DHCP_DUID_MAXLEN];
+	uint16_t duidlen;
 	const char *fqdn;
+	const struct iothconf_retry *retry;
+	struct iothconf_demux_tx *tx; // replies for tid
+	uint64_t start; // time of the first transmission of the current exchange
 	uint8_t *serverid;
 	uint16_t serveridlen;
 	uint8_t *iana_addr;
 	uint16_t iana_addrlen;
 };
 
-static int dhcp_get(int sendtype, int fd, struct dhcpdata *data);
+/* retransmission parameters (RFC 8415 section 7.6):
+	 SOL_TIMEOUT/SOL_MAX_RT and REQ_TIMEOUT/REQ_MAX_RT.
+	 The number of retransmissions and the duration of each exchange (DHCP_MAX_RD, 6 secs
+	 as the three fixed timeouts of 2 secs used before) are bounded
+	 (the default policy of RFC 8415 for Solicit is to retry forever) */
+#define DHCP_SOL_TIMEOUT 1000
+#define DHCP_SOL_MAX_RT 3600000
+#define DHCP_REQ_TIMEOUT 1000
+#define DHCP_REQ_MAX_RT 30000
+#define DHCP_MAX_RC 2
+#define DHCP_MAX_RD 6000
+
+/* store the configuration data of a DHCPv6 REPLY */
+void iothconf_dhcp6_store(struct ioth *stack, unsigned int ifindex, time_t timestamp,
+		const struct iothconf_dhcp6_msg *msg) {
+	if (msg->serverid != NULL)
+		ioth_confdata_add(stack, ifindex, IOTH_CONFDATA_DHCP6_SERVERID, timestamp, 0,
+				msg->serverid, msg->serveridlen);
+	if (msg->iana != NULL) {
+		struct ioth_confdata_ip6addr iaaddr;
+		size_t pos = 0;
+		while (iothconf_dhcp6_nextiaaddr(msg->iana, msg->ianalen, &pos, &iaaddr) == 0)
+			ioth_confdata_add(stack, ifindex, IOTH_CONFDATA_DHCP6_ADDR, timestamp, 0,
+					&iaaddr, sizeof(iaaddr));
+	}
+	/* dns server/dns search */
+	if (msg->dns != NULL) /* list of ip addrs RFC 3646 */
+		ioth_confdata_add(stack, ifindex, IOTH_CONFDATA_DHCP6_DNS, timestamp, 0,
+				msg->dns, msg->dnslen);
+	if (msg->domain != NULL) { /* list of domains in RFC1035 fmt */
+		char dns_search_mstr[msg->domainlen + 1];
+		int mstr_len = iothconf_domain2mstr(msg->domain, msg->domainlen, dns_search_mstr, sizeof(dns_search_mstr));
+		if (mstr_len < 0)
+			iothconf_stats_count(stack, ifindex, IOTHCONF_COUNT_PARSE_ERROR, 1);
+		else if (mstr_len > 0)
+			ioth_confdata_add(stack, ifindex, IOTH_CONFDATA_DHCP6_DOMAIN, timestamp, 0,
+					dns_search_mstr, mstr_len);
+	}
+	ioth_confdata_write_timestamp(stack, ifindex, IOTH_CONFDATA_DHCP6_TIMESTAMP, timestamp);
+}
+
+/* compose a client message (SOLICIT or REQUEST) in a malloc-ed buffer (*len bytes).
+	 serverid and iana_addr (the IAADDR options of the IA_NA) can be NULL */
+char *iothconf_dhcp6_build(int type, const uint8_t *tid, const uint8_t *duid, uint16_t duidlen,
+		const uint8_t *serverid, uint16_t serveridlen, const char *fqdn, const uint8_t *macaddr,
+		const uint8_t *iana_addr, uint16_t iana_addrlen, size_t *len) {
+	char *buf;
+	FILE *f = open_memstream(&buf, len);
+	if (f == NULL)
+		return NULL;
+	dhcp_add_head(f, type, tid);
+	dhcp_add_opt_clientid(f, duid, duidlen);
+	dhcp_add_opt_serverid(f, serverid, serveridlen);
+	dhcp_add_opt_oro(f, OPTION_DNS_SERVERS, OPTION_DOMAIN_LIST, 0);
+	dhcp_add_opt_elapsed_time(f, 0);
+	dhcp_add_opt_fqdn(f, fqdn, 0);
+	dhcp_add_opt_iana(f, macaddr, iana_addr, iana_addrlen);
+	fclose(f);
+	return buf;
+}
+
+static int dhcp_get(int sendtype, int fd, struct dhcpdata *data, int timeout);
 static int dhcp_send(int type, int fd, struct dhcpdata *data) {
 	char *buf;
-	size_t buflen = 0;
-	FILE *f = open_memstream(&buf, &buflen);
+	size_t buflen;
 	if (getrandom(data->tid, sizeof(data->tid), 0) < 0)
 		return -1;
+	iothconf_demux_tx_setid(data->tx, data->tid, sizeof(data->tid));
+	/* the link-local multicast address of the interface */
+	struct sockaddr_in6 dst = mcastaddr;
+	dst.sin6_scope_id = data->ifindex;
 	ia_lifetime_zero(data->iana_addr, data->iana_addrlen);
-	dhcp_add_head(f, type, data->tid);
-	dhcp_add_opt_clientid(f, data->macaddr);
-	dhcp_add_opt_serverid(f, data->serverid,  data->serveridlen);
-	dhcp_add_opt_oro(f, OPTION_DNS_SERVERS, OPTION_DOMAIN_LIST, 0);
-	dhcp_add_opt_elapsed_time(f, 0);
-	dhcp_add_opt_fqdn(f, data->fqdn, 0);
-	dhcp_add_opt_iana(f, data->macaddr, data->iana_addr, data->iana_addrlen);
-	fclose(f);
-	int times = 0;
+	buf = iothconf_dhcp6_build(type, data->tid, data->duid, data->duidlen,
+			data->serverid, data->serveridlen, data->fqdn, data->macaddr,
+			data->iana_addr, data->iana_addrlen, &buflen);
+	if (buf == NULL)
+		return -1;
+	struct iothconf_backoff backoff;
+	int timeout;
+	if (type == DHCP_SOLICIT)
+		iothconf_backoff_init(&backoff, data->retry, DHCP_SOL_TIMEOUT, DHCP_SOL_MAX_RT, DHCP_MAX_RC, DHCP_MAX_RD, -1);
+	else
+		iothconf_backoff_init(&backoff, data->retry, DHCP_REQ_TIMEOUT, DHCP_REQ_MAX_RT, DHCP_MAX_RC, DHCP_MAX_RD, -1);
+	data->start = iothconf_stats_now();
 	for (;;) {
-		if (ioth_sendto(fd, buf, buflen, 0, (struct sockaddr *) &mcastaddr, sizeof(mcastaddr)) < 0)
+		if ((timeout = iothconf_backoff_next(&backoff)) < 0) {
+			iothconf_stats_count(data->stack, data->ifindex, IOTHCONF_COUNT_DHCP6_TIMEOUT, 1);
+			errno = ETIME;
 			goto err;
-		if (dhcp_get(type, fd, data) == 0)
+		}
+		iothconf_ratelimit();
+		iothconf_capture_udp6(data->ifindex, IOTHCONF_CAPTURE_OUT, NULL, DHCP_CLIENTPORT,
+				&dst.sin6_addr, DHCP_SERVERPORT, buf, buflen);
+		if (ioth_sendto(fd, buf, buflen, 0, (struct sockaddr *) &dst, sizeof(dst)) < 0)
+			goto err;
+		iothconf_stats_count(data->stack, data->ifindex,
+				type == DHCP_SOLICIT ? IOTHCONF_COUNT_DHCP6_TX_SOLICIT : IOTHCONF_COUNT_DHCP6_TX_REQUEST, 1);
+		if (backoff.count > 1)
+			iothconf_stats_count(data->stack, data->ifindex, IOTHCONF_COUNT_DHCP6_RETRY, 1);
+		if (dhcp_get(type, fd, data, timeout) == 0)
 			break;
-		if (times >= 2 || errno != ETIME)
+		if (errno != ETIME)
 			goto err;
-		times++;
 	}
 	free(buf);
 	return 0;
@@ -278,42 +356,18 @@ err:
 	return -1;
 }
 
-static int check_consistency(int type, uint8_t *inbuf, size_t inbuflen, struct dhcpdata *data) {
-	if (inbuflen < 4) return 0;
-	if (type != inbuf[0]) return 0;
-	if (memcmp(inbuf+1, data->tid, 3) != 0) return 0;
-	return 1;
-}
-
-static int check_clientid(FILE *f, uint16_t len, uint8_t *macaddr) {
-	uint32_t cmp_data;
-	uint8_t cmp_macaddr[ETH_ALEN];
-	if (len != 14) return 0;
-	cmp_data = fget_int16(f);
-	if (cmp_data != 1) return 0;
-	cmp_data = fget_int16(f);
-	if (cmp_data != 1) return 0;
-	cmp_data = fget_int32(f);
-	if (cmp_data != idtime()) return 0;
-	fget_data(f, cmp_macaddr, ETH_ALEN);
-	if (memcmp(cmp_macaddr, macaddr, ETH_ALEN) != 0) return 0;
-	return 1;
+static int check_clientid(uint8_t *clientid, size_t len, struct dhcpdata *data) {
+	return len == data->duidlen && memcmp(clientid, data->duid, len) == 0;
 }
 
-static int check_iana(FILE *f, uint16_t len, uint8_t *macaddr) {
-	uint8_t cmp_iaid[4];
+static int check_iana(uint8_t *iana, size_t len, uint8_t *macaddr) {
 	if (len < 12) return 0;
-	fget_data(f, cmp_iaid, 4);
-	if (memcmp(cmp_iaid, macaddr + 2, 4) != 0) return 0;
-	fget_int32(f);
-	fget_int32(f);
+	if (memcmp(iana, macaddr + 2, 4) != 0) return 0;
 	return 1;
 }
 
-#define DHCP_TIMEOUT 2000
-static int dhcp_get(int sendtype, int fd, struct dhcpdata *data) {
-	struct pollfd pfd[] = {{fd, POLLIN, 0}};
-	int timeout = DHCP_TIMEOUT;
+static int dhcp_get(int sendtype, int fd, struct dhcpdata *data, int timeout) {
+	struct pollfd pfd[] = {{iothconf_demux_tx_fd(data->tx), POLLIN, 0}};
 	struct timeval start;
 	struct timeval end;
 	struct timeval timediff;
@@ -330,97 +384,39 @@ static int dhcp_get(int sendtype, int fd, struct dhcpdata *data) {
 		int event = poll(pfd, 1, timeout);
 		if (event == 0)
 			return errno = ETIME, -1;
-		size_t inbuflen = ioth_recv(fd, NULL, 0, MSG_PEEK|MSG_TRUNC);
-		uint8_t inbuf[inbuflen];
-		inbuflen = ioth_recv(fd, inbuf, inbuflen, 0);
-		if (check_consistency(type, inbuf, inbuflen, data)) {
-			uint8_t *dns_serv_addr = NULL;
-			uint8_t *dns_search_addr = NULL;
-			uint16_t dns_serv_len = 0;
-			uint16_t dns_search_len = 0;
-			uint8_t *optbuf = inbuf + 4;
-			size_t optbuflen = inbuflen - 4;
-			int ok = 1;
-			FILE *optf = fmemopen(optbuf, optbuflen, "r");
-			/* first scan */
-			for(;;) {
-				int opt_type = fget_int16(optf);
-				if (opt_type == EOF)
-					break;
-				unsigned int opt_len = fget_int16(optf);
-				long next_opt = ftell(optf) + opt_len;
-				//printf("%d\n", opt_type);
-				switch(opt_type) {
-					case OPTION_CLIENTID:
-						ok = check_clientid(optf, opt_len, data->macaddr);
-						break;
-					case OPTION_SERVERID:
-						data->serverid = optbuf + ftell(optf);
-						data->serveridlen = opt_len;
-						break;
-					case OPTION_IA_NA:
-						ok = check_iana(optf, opt_len, data->macaddr);
-						if (ok) {
-							data->iana_addr = optbuf + ftell(optf);
-							data->iana_addrlen = opt_len - 12;
-						}
-						break;
-					case OPTION_DNS_SERVERS:
-						dns_serv_addr = optbuf + ftell(optf);
-						dns_serv_len = opt_len;
-						break;
-					case OPTION_DOMAIN_LIST:
-						dns_search_addr = optbuf + ftell(optf);
-						dns_search_len = opt_len;
-						break;
-				}
-				fseek(optf, next_opt, SEEK_SET);
+		ssize_t pktlen = iothconf_demux_tx_recv(data->tx, NULL, 0, MSG_PEEK|MSG_TRUNC);
+		if (pktlen < 0)
+			pktlen = 0;
+		uint8_t inbuf[pktlen + 1];
+		ssize_t inbuflen = iothconf_demux_tx_recv(data->tx, inbuf, pktlen, 0);
+		struct iothconf_dhcp6_msg msg;
+		if (inbuflen < 0 || iothconf_dhcp6_parse(inbuf, inbuflen, &msg) < 0)
+			iothconf_stats_count(data->stack, data->ifindex, IOTHCONF_COUNT_PARSE_ERROR, 1);
+		else if (msg.type != type || memcmp(msg.tid, data->tid, sizeof(data->tid)) != 0 ||
+				(msg.clientid != NULL && !check_clientid(msg.clientid, msg.clientidlen, data)) ||
+				(msg.iana != NULL && !check_iana(msg.iana, msg.ianalen, data->macaddr)))
+			iothconf_stats_count(data->stack, data->ifindex, IOTHCONF_COUNT_DHCP6_SPURIOUS, 1);
+		else {
+			if (msg.serverid != NULL) {
+				data->serverid = msg.serverid;
+				data->serveridlen = msg.serveridlen;
 			}
-			fclose(optf);
-			if (ok) {
-				if (type == DHCP_ADVERTISE)
-					return dhcp_send(DHCP_REQUEST, fd, data);
-				else {
-					ioth_confdata_add(data->stack, data->ifindex, IOTH_CONFDATA_DHCP6_SERVERID, data->timestamp, 0,
-							data->serverid, data->serveridlen);
-					if (data->iana_addr != NULL) {
-						FILE *ianaf = fmemopen(data->iana_addr, data->iana_addrlen, "r");
-						for(;;) {
-							int opt_type = fget_int16(ianaf);
-							if (opt_type == EOF)
-								break;
-							unsigned int opt_len = fget_int16(ianaf);
-							long next_opt = ftell(ianaf) + opt_len;
-							//printf("iana %d\n", opt_type);
-							switch(opt_type) {
-								case OPTION_IAADDR:
-									if (opt_len >= 24) {
-										struct ioth_confdata_ip6addr iaaddr = {.prefixlen = 128};
-										fget_data(ianaf, &iaaddr.addr, sizeof(iaaddr.addr));
-										iaaddr.preferred_lifetime = fget_int32(ianaf);
-										iaaddr.valid_lifetime = fget_int32(ianaf);
-										ioth_confdata_add(data->stack, data->ifindex, IOTH_CONFDATA_DHCP6_ADDR, data->timestamp, 0,
-												&iaaddr, sizeof(iaaddr));
-									}
-									break;
-							}
-							fseek(ianaf, next_opt, SEEK_SET);
-						}
-						fclose(ianaf);
-					}
-					/* dns server/dns search */
-					if (dns_serv_addr != NULL) /* list of ip addrs RFC 3646 */
-						ioth_confdata_add(data->stack, data->ifindex, IOTH_CONFDATA_DHCP6_DNS, data->timestamp, 0,
-								dns_serv_addr, dns_serv_len);
-					if (dns_search_addr != NULL) { /* list of domains in RFC1035 fmt */
-						char dns_search_mstr[dns_search_len];
-						int mstr_len = iothconf_domain2mstr(dns_search_addr, dns_search_mstr, dns_search_len);
-						ioth_confdata_add(data->stack, data->ifindex, IOTH_CONFDATA_DHCP6_DOMAIN, data->timestamp, 0,
-								dns_search_mstr, mstr_len);
-					}
-					ioth_confdata_write_timestamp(data->stack, data->ifindex, IOTH_CONFDATA_DHCP6_TIMESTAMP, data->timestamp);
-					return 0;
-				}
+			if (msg.iana != NULL) {
+				data->iana_addr = msg.iana + 12;
+				data->iana_addrlen = msg.ianalen - 12;
+			}
+			iothconf_stats_count(data->stack, data->ifindex,
+					type == DHCP_ADVERTISE ? IOTHCONF_COUNT_DHCP6_RX_ADVERTISE : IOTHCONF_COUNT_DHCP6_RX_REPLY, 1);
+			iothconf_stats_add(data->stack, data->ifindex,
+					type == DHCP_ADVERTISE ? IOTHCONF_PHASE_DHCP6_ADVERTISE : IOTHCONF_PHASE_DHCP6_REPLY, data->start);
+			if (type == DHCP_ADVERTISE)
+				return dhcp_send(DHCP_REQUEST, fd, data);
+			else {
+				/* the REPLY could omit the server id of the ADVERTISE */
+				msg.serverid = data->serverid;
+				msg.serveridlen = data->serveridlen;
+				iothconf_dhcp6_store(data->stack, data->ifindex, data->timestamp, &msg);
+				return 0;
 			}
 		}
 		gettimeofday(&end, NULL);
@@ -430,29 +426,39 @@ static int dhcp_get(int sendtype, int fd, struct dhcpdata *data) {
 	}
 }
 
-static int iothconf_dhcpv6_proto(struct ioth *stack, unsigned int ifindex, const char *fqdn, uint32_t config_flags) {
-	(void) config_flags;
-	static struct sockaddr_in6 bindaddr = {
-		.sin6_family      = AF_INET6,
-		.sin6_port        = HTONS(DHCP_CLIENTPORT)
-	};
+static int iothconf_dhcpv6_proto(struct ioth *stack, unsigned int ifindex, const struct iothconf_param *param) {
+	/* the socket bound to port 546 is shared by all the interfaces of the stack */
+	struct iothconf_demux *demux = iothconf_demux_get(stack, IOTHCONF_DEMUX_DHCP6);
+	if (demux == NULL)
+		return -1;
 	struct dhcpdata dhcpdata = {
 		.stack = stack,
 		.ifindex = ifindex,
 		.timestamp = ioth_confdata_new_timestamp(stack, ifindex, IOTH_CONFDATA_DHCP6_TIMESTAMP),
-		.fqdn = fqdn};
-	int fd = ioth_msocket(stack, AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
-	ioth_bind(fd, (struct sockaddr *) &bindaddr, sizeof(bindaddr));
-	ioth_linkgetaddr(stack, ifindex, dhcpdata.macaddr);
-	int retval = dhcp_send(DHCP_SOLICIT, fd, &dhcpdata);
-	ioth_close(fd);
+		.fqdn = param->fqdn,
+		.retry = &param->retry,
+		.tx = iothconf_demux_tx_new(demux, ifindex)};
+	int retval = -1;
+	if (dhcpdata.tx != NULL) {
+		ioth_linkgetaddr(stack, ifindex, dhcpdata.macaddr);
+		dhcpdata.duidlen = dhcp_duid(dhcpdata.duid, param->fqdn, dhcpdata.macaddr);
+		iothconf_initial_delay(&param->retry);
+		retval = dhcp_send(DHCP_SOLICIT, iothconf_demux_fd(demux), &dhcpdata);
+		iothconf_demux_tx_free(dhcpdata.tx);
+	}
+	iothconf_demux_put(demux);
 	return retval;
 }
 
-int iothconf_dhcpv6(struct ioth *stack, unsigned int ifindex, const char *fqdn, uint32_t config_flags) {
-	int rv = iothconf_dhcpv6_proto(stack, ifindex, fqdn, config_flags);
-	if (rv == 0)
-		iothconf_ip_update(stack, ifindex, IOTH_CONFDATA_DHCP6_TIMESTAMP, config_flags);
+int iothconf_dhcpv6(struct ioth *stack, unsigned int ifindex, const struct iothconf_param *param) {
+	int rv = iothconf_dhcpv6_proto(stack, ifindex, param);
+	if (rv == 0) {
+		struct iothconf_dad *dad = NULL;
+		if (param->config_flags & IOTHCONF_DAD)
+			dad = iothconf_dad6_probe(stack, ifindex, IOTH_CONFDATA_DHCP6_ADDR, NULL, NULL, 0);
+		iothconf_ip_update(stack, ifindex, IOTH_CONFDATA_DHCP6_TIMESTAMP, param);
+		iothconf_dad6_start(dad);
+	}
 	return rv;
 }
 
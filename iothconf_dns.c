@@ -1,7 +1,6 @@
 /*
  *   iothconf_dns.c: auto configuration library for ioth
- *       convert an rfc1035 encoded sequence of domain names of length len
- *       in a multistring (sequence of strings) + manage multistrings
+ *       DNS configuration: resolv.conf generation, ioth_dnsconf
  *
  *   Copyright 2021 Renzo Davoli - Virtual Square Team
  *   University of Bologna - Italy
@@ -20,6 +19,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 
 #include <iothconf.h>
@@ -27,153 +29,387 @@
 #include <iothconf_mod.h>
 #include <iothconf_data.h>
 
-static inline uint8_t domain_nx(uint8_t len) {
-	if ((len & 0xc0) == 0xc0) return 0;
-	return len;
+/* resolv.conf(5) limits (MAXNS and MAXDNSRCH in resolv.h) */
+#define RESOLVCONF_MAXNS 3
+#define RESOLVCONF_MAXDNSRCH 6
+
+/* small hash set (open addressing) of the nameservers/domains already added.
+	 The keys point to the copies stored in struct iothconf_resolvconf_cb_arg,
+	 the set never gets full as it is larger than the resolv.conf limits */
+#define IOTHCONF_DNSSET_SIZE 16
+
+struct iothconf_dnsset {
+	const void *key[IOTHCONF_DNSSET_SIZE];
+	size_t keylen[IOTHCONF_DNSSET_SIZE];
+};
+
+/* FNV-1a */
+static uint32_t iothconf_dnsset_hash(const void *key, size_t keylen) {
+	const uint8_t *scan = key;
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < keylen; i++)
+		hash = (hash ^ scan[i]) * 16777619u;
+	return hash;
 }
 
-int iothconf_domain2mstr(uint8_t *domain, char *mstr, uint16_t len) {
-	uint8_t *limit = domain + len;
-	char *scan = mstr;
-	uint8_t count, oldcount;
-	if (len == 0)
-		return 0;
-	for (count = oldcount = domain_nx(*domain++); domain < limit; domain++) {
-		if (count == 0) {
-			count = domain_nx(*domain);
-			if (oldcount > 0 && count > 0)
-				*scan++ = '.';
-			else if (oldcount == 0 && count > 0)
-				*scan++ = 0;
-			oldcount = count;
-		} else {
-			*scan++ = *domain;
-			count --;
+/* return 0 if key is in the set already, 1 if it is new (and add it) */
+static int iothconf_dnsset_add(struct iothconf_dnsset *set, const void *key, size_t keylen) {
+	for (uint32_t i = iothconf_dnsset_hash(key, keylen); ; i++) {
+		i &= IOTHCONF_DNSSET_SIZE - 1;
+		if (set->key[i] == NULL) {
+			set->key[i] = key;
+			set->keylen[i] = keylen;
+			return 1;
 		}
+		if (set->keylen[i] == keylen && memcmp(set->key[i], key, keylen) == 0)
+			return 0;
 	}
-	*scan++ = 0;
-	return scan - mstr;
 }
 
 struct iothconf_resolvconf_cb_arg {
-	FILE *rc;
-	int countdomains;
-	int countupdated;
-	int scandomains;
-	char **domains;
+	int nns;
+	int ndomains;
+	struct iothconf_dnsset nsset;
+	struct iothconf_dnsset domainset;
+	struct {
+		int family;
+		uint8_t addr[sizeof(struct in6_addr)];
+	} ns[RESOLVCONF_MAXNS];
+	char domains[RESOLVCONF_MAXDNSRCH][IOTH_DNSDOMAIN_MAXLEN];
 };
 
-/* count how many domains are included in data (maybe there are dup entries from
-	 different sources (dhcpv4 dhcpv6) */
-static int iothconf_resolvconf_count_cb(void *data, void *arg) {
+/* collect the search domains (skip deleted records, timestamp == 0) */
+static int iothconf_resolvconf_domain_cb(void *data, void *arg) {
+	struct iothconf_resolvconf_cb_arg *cbarg = arg;
+	if (ioth_confdata_gettimestamp(data) == 0)
+		return 0;
+	FORmstr(domain, data, ioth_confdata_getdatalen(data)) {
+		size_t len = strlen(domain) + 1;
+		if (cbarg->ndomains >= RESOLVCONF_MAXDNSRCH)
+			return IOTH_CONFDATA_FORALL_BREAK;
+		if (len > IOTH_DNSDOMAIN_MAXLEN)
+			continue;
+		char *new = cbarg->domains[cbarg->ndomains];
+		memcpy(new, domain, len);
+		if (iothconf_dnsset_add(&cbarg->domainset, new, len))
+			cbarg->ndomains++;
+	}
+	return 0;
+}
+
+/* collect the nameservers */
+static int iothconf_resolvconf_dns_cb(void *data, void *arg) {
 	struct iothconf_resolvconf_cb_arg *cbarg = arg;
 	uint8_t type = ioth_confdata_gettype(data);
-	switch (type) {
-		case IOTH_CONFDATA_DHCP4_DOMAIN:
-		case IOTH_CONFDATA_DHCP6_DOMAIN:
-		case IOTH_CONFDATA_STATIC_DOMAIN:
-			if (!(ioth_confdata_setflags(data, IOTH_CONFDATA_ACTIVE) & IOTH_CONFDATA_ACTIVE))
-				cbarg->countupdated++;
-			cbarg->countdomains += count_mstr(data, ioth_confdata_getdatalen(data));
-			break;
-		case IOTH_CONFDATA_DHCP4_DNS:
-		case IOTH_CONFDATA_DHCP6_DNS:
-		case IOTH_CONFDATA_STATIC4_DNS:
-		case IOTH_CONFDATA_STATIC6_DNS:
-			if (!(ioth_confdata_setflags(data, IOTH_CONFDATA_ACTIVE) & IOTH_CONFDATA_ACTIVE))
-				cbarg->countupdated++;
-			break;
+	uint8_t *scan = data;
+	uint8_t *limit = scan + ioth_confdata_getdatalen(data);
+	int family = (type == IOTH_CONFDATA_DHCP6_DNS || type == IOTH_CONFDATA_STATIC6_DNS) ?
+		AF_INET6 : AF_INET;
+	size_t addrlen = (family == AF_INET6) ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+	if (ioth_confdata_gettimestamp(data) == 0)
+		return 0;
+	for (; scan + addrlen <= limit; scan += addrlen) {
+		if (cbarg->nns >= RESOLVCONF_MAXNS)
+			return IOTH_CONFDATA_FORALL_BREAK;
+		uint8_t *new = cbarg->ns[cbarg->nns].addr;
+		memcpy(new, scan, addrlen);
+		if (iothconf_dnsset_add(&cbarg->nsset, new, addrlen))
+			cbarg->ns[cbarg->nns++].family = family;
 	}
 	return 0;
 }
 
-/* return 0 if this domain has been seen already, 1 if it is new */
-static int iothconf_resolvconf_newdom(char *domain, struct iothconf_resolvconf_cb_arg *cbarg) {
-	int i;
-	for (i = 0; i < cbarg->scandomains; i++) {
-		if (strcmp(domain, cbarg->domains[i]) == 0)
-			return 0;
+/* DNS data types, IPv6 nameservers first within each source */
+static const uint8_t iothconf_resolvconf_types[] = {
+	IOTH_CONFDATA_STATIC6_DNS, IOTH_CONFDATA_STATIC4_DNS, IOTH_CONFDATA_STATIC_DOMAIN,
+	IOTH_CONFDATA_DHCP6_DNS, IOTH_CONFDATA_DHCP6_DOMAIN,
+	IOTH_CONFDATA_DHCP4_DNS, IOTH_CONFDATA_DHCP4_DOMAIN};
+
+const uint8_t iothconf_resolvconf_defprio[IOTHCONF_DNS_NSOURCES] = {
+	IOTH_CONFDATA_STATIC_TIMESTAMP, IOTH_CONFDATA_DHCP6_TIMESTAMP,
+	IOTH_CONFDATA_DHCP4_TIMESTAMP, IOTH_CONFDATA_RD6_TIMESTAMP};
+
+/* sources are scanned in priority order: the first RESOLVCONF_MAXNS nameservers
+	 and RESOLVCONF_MAXDNSRCH domains are used */
+static char *iothconf_resolvconf_render(struct ioth *stack, uint32_t ifindex, const uint8_t *prio) {
+	char *resolvconf = NULL;
+	size_t resolvconflen = 0;
+	struct iothconf_resolvconf_cb_arg cbarg = {0};
+	FILE *rc;
+	for (int i = 0; i < IOTHCONF_DNS_NSOURCES; i++) {
+		for (size_t j = 0; j < sizeof(iothconf_resolvconf_types); j++) {
+			uint8_t type = iothconf_resolvconf_types[j];
+			if (TIMESTAMP(type) == prio[i])
+				ioth_confdata_forall(stack, ifindex, type,
+						(type & IOTH_CONFDATA_DOM_MASK) == IOTH_CONFDATA_DOM_BASE ?
+						iothconf_resolvconf_domain_cb : iothconf_resolvconf_dns_cb, &cbarg);
+		}
+	}
+	rc = open_memstream(&resolvconf, &resolvconflen);
+	if (rc == NULL)
+		return NULL;
+	if (cbarg.ndomains > 0) {
+		fprintf(rc, "search");
+		for (int i = 0; i < cbarg.ndomains; i++)
+			fprintf(rc, " %s", cbarg.domains[i]);
+		fprintf(rc, "\n");
 	}
-	cbarg->domains[cbarg->scandomains++] = domain;
-	return 1;
+	for (int i = 0; i < cbarg.nns; i++) {
+		char addrbuf[INET6_ADDRSTRLEN];
+		fprintf(rc, "nameserver %s\n",
+				inet_ntop(cbarg.ns[i].family, cbarg.ns[i].addr, addrbuf, INET6_ADDRSTRLEN));
+	}
+	fclose(rc);
+	return resolvconf;
 }
 
-/* add domains to the line "search" of resolv.conf:
-	 one loop: domains in cbarg are pointer to data elements
-	 the entire operation must be done in mutual exclusion */
-static int iothconf_resolvconf_domain_cb(void *data, void *arg) {
-	struct iothconf_resolvconf_cb_arg *cbarg = arg;
+/* cache of the rendered resolv.conf strings.
+	 generation: DNS generation of the cached string.
+	 prio: source priority used to render the cached string.
+	 returned: the string returned by the latest call of iothconf_resolvconf */
+struct iothconf_resolvconf_cache {
+	struct iothconf_resolvconf_cache *next;
+	struct ioth *stack;
+	uint32_t ifindex;
+	uint64_t generation;
+	uint8_t prio[IOTHCONF_DNS_NSOURCES];
+	char *resolvconf;
+	char *returned;
+};
+
+static pthread_mutex_t iothconf_resolvconf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct iothconf_resolvconf_cache *iothconf_resolvconf_cache_root;
+
+static struct iothconf_resolvconf_cache *iothconf_resolvconf_cache(struct ioth *stack, uint32_t ifindex) {
+	struct iothconf_resolvconf_cache *scan;
+	for (scan = iothconf_resolvconf_cache_root; scan != NULL; scan = scan->next) {
+		if (scan->stack == stack && scan->ifindex == ifindex)
+			return scan;
+	}
+	scan = calloc(1, sizeof(*scan));
+	if (scan != NULL) {
+		scan->stack = stack;
+		scan->ifindex = ifindex;
+		scan->next = iothconf_resolvconf_cache_root;
+		iothconf_resolvconf_cache_root = scan;
+	}
+	return scan;
+}
+
+/* the string is rendered again only if the DNS generation (or the priority) has changed.
+	 return NULL and errno = 0 if the string is the same returned by the previous call */
+char *iothconf_resolvconf(struct ioth *stack, uint32_t ifindex, const uint8_t *prio) {
+	char *retvalue = NULL;
+	if (prio == NULL) prio = iothconf_resolvconf_defprio;
+	uint64_t generation = ioth_confdata_dns_generation(stack, ifindex);
+	pthread_mutex_lock(&iothconf_resolvconf_mutex);
+	struct iothconf_resolvconf_cache *cache = iothconf_resolvconf_cache(stack, ifindex);
+	if (cache == NULL) {
+		errno = ENOMEM;
+		goto out;
+	}
+	if (generation == 0) {
+		errno = 0;
+		goto out;
+	}
+	if (cache->resolvconf == NULL || cache->generation != generation ||
+			memcmp(cache->prio, prio, IOTHCONF_DNS_NSOURCES) != 0) {
+		char *resolvconf = iothconf_resolvconf_render(stack, ifindex, prio);
+		if (resolvconf == NULL)
+			goto out;
+		free(cache->resolvconf);
+		cache->resolvconf = resolvconf;
+		cache->generation = generation;
+		memcpy(cache->prio, prio, IOTHCONF_DNS_NSOURCES);
+	}
+	if (cache->returned != NULL && strcmp(cache->returned, cache->resolvconf) == 0) {
+		errno = 0;
+		goto out;
+	}
+	free(cache->returned);
+	cache->returned = strdup(cache->resolvconf);
+	retvalue = strdup(cache->resolvconf);
+out:
+	pthread_mutex_unlock(&iothconf_resolvconf_mutex);
+	return retvalue;
+}
+
+void iothconf_resolvconf_release(struct ioth *stack) {
+	pthread_mutex_lock(&iothconf_resolvconf_mutex);
+	for (struct iothconf_resolvconf_cache **scan = &iothconf_resolvconf_cache_root; *scan != NULL; ) {
+		struct iothconf_resolvconf_cache *this = *scan;
+		if (this->stack == stack) {
+			*scan = this->next;
+			free(this->resolvconf);
+			free(this->returned);
+			free(this);
+		} else
+			scan = &this->next;
+	}
+	pthread_mutex_unlock(&iothconf_resolvconf_mutex);
+}
+
+uint64_t ioth_resolvconf_generation(struct ioth *stack, unsigned int ifindex) {
+	return ioth_confdata_dns_generation(stack, ifindex);
+}
+
+/* structured DNS configuration (ioth_dnsconf) */
+struct iothconf_dnsconf_arg {
+	time_t now;
+	uint32_t lifetime[4]; // remaining lifetime of the data of each source
+	uint8_t haslease; // bitmask: sources providing a lease time
+	struct ioth_dnsserver *servers;
+	int maxservers;
+	int nservers;
+	struct ioth_dnsdomain *domains;
+	int maxdomains;
+	int ndomains;
+};
+
+/* index of the source of a record type */
+static int iothconf_dnsconf_srcidx(uint8_t type) {
+	return (TIMESTAMP(type) >> 4) - 4;
+}
+
+static uint8_t iothconf_dnsconf_source(uint8_t type) {
+	switch (TIMESTAMP(type)) {
+		case IOTH_CONFDATA_DHCP4_TIMESTAMP: return IOTHCONF_DHCP;
+		case IOTH_CONFDATA_RD6_TIMESTAMP: return IOTHCONF_RD;
+		case IOTH_CONFDATA_DHCP6_TIMESTAMP: return IOTHCONF_DHCPV6;
+		default: return IOTHCONF_STATIC;
+	}
+}
+
+static uint32_t iothconf_dnsconf_remaining(uint32_t lifetime, time_t timestamp, time_t now) {
+	if (lifetime == TIME_INFINITY)
+		return lifetime;
+	if (now - timestamp >= (time_t) lifetime)
+		return 0;
+	return lifetime - (now - timestamp);
+}
+
+/* the lifetime of DNS data is the lease time of the address provided by the same source */
+static int iothconf_dnsconf_lifetime_cb(void *data, void *arg) {
+	struct iothconf_dnsconf_arg *dcarg = arg;
 	uint8_t type = ioth_confdata_gettype(data);
+	time_t timestamp = ioth_confdata_gettimestamp(data);
+	uint32_t lifetime;
 	switch (type) {
-		case IOTH_CONFDATA_DHCP4_DOMAIN:
-		case IOTH_CONFDATA_DHCP6_DOMAIN:
-		case IOTH_CONFDATA_STATIC_DOMAIN:
-			FORmstr(domain, data, ioth_confdata_getdatalen(data)) {
-				if (iothconf_resolvconf_newdom(domain, cbarg))
-					fprintf(cbarg->rc, " %s", domain);
-			}
+		case IOTH_CONFDATA_DHCP4_ADDR:
+			lifetime = ((struct ioth_confdata_ipaddr *) data)->leasetime;
+			break;
+		case IOTH_CONFDATA_DHCP6_ADDR:
+			lifetime = ((struct ioth_confdata_ip6addr *) data)->valid_lifetime;
 			break;
+		default:
+			return 0;
 	}
+	int srcidx = iothconf_dnsconf_srcidx(type);
+	lifetime = iothconf_dnsconf_remaining(lifetime, timestamp, dcarg->now);
+	if (!(dcarg->haslease & (1 << srcidx)) || lifetime > dcarg->lifetime[srcidx])
+		dcarg->lifetime[srcidx] = lifetime;
+	dcarg->haslease |= 1 << srcidx;
 	return 0;
 }
 
-/* add "nameserver" lines in resolv.conf */
-static int iothconf_resolvconf_dns_cb(void *data, void *arg) {
-	struct iothconf_resolvconf_cb_arg *cbarg = arg;
+static int iothconf_dnsconf_server_cb(void *data, void *arg) {
+	struct iothconf_dnsconf_arg *dcarg = arg;
 	uint8_t type = ioth_confdata_gettype(data);
 	uint8_t *scan = data;
 	uint8_t *limit = scan + ioth_confdata_getdatalen(data);
-	while (scan < limit) {
-		char addrbuf[INET6_ADDRSTRLEN];
-		switch (type) {
-			case IOTH_CONFDATA_DHCP6_DNS:
-			case IOTH_CONFDATA_STATIC6_DNS:
-				fprintf(cbarg->rc, "nameserver %s\n",
-						inet_ntop(AF_INET6, scan, addrbuf, INET6_ADDRSTRLEN));
-				scan += sizeof(struct in6_addr);
+	int family = (type == IOTH_CONFDATA_DHCP6_DNS || type == IOTH_CONFDATA_STATIC6_DNS) ?
+		AF_INET6 : AF_INET;
+	size_t addrlen = (family == AF_INET6) ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+	for (; scan + addrlen <= limit && dcarg->nservers < dcarg->maxservers; scan += addrlen) {
+		struct sockaddr_storage ss = {.ss_family = family};
+		if (family == AF_INET6)
+			memcpy(&((struct sockaddr_in6 *) &ss)->sin6_addr, scan, addrlen);
+		else
+			memcpy(&((struct sockaddr_in *) &ss)->sin_addr, scan, addrlen);
+		int i;
+		for (i = 0; i < dcarg->nservers; i++) {
+			if (memcmp(&dcarg->servers[i].addr, &ss, sizeof(ss)) == 0)
 				break;
-			case IOTH_CONFDATA_DHCP4_DNS:
-			case IOTH_CONFDATA_STATIC4_DNS:
-				fprintf(cbarg->rc, "nameserver %s\n",
-						inet_ntop(AF_INET, scan, addrbuf, INET6_ADDRSTRLEN));
-				scan += sizeof(struct in_addr);
-				break;
-			default:
-				return 0;
 		}
+		if (i < dcarg->nservers)
+			continue;
+		dcarg->servers[dcarg->nservers++] = (struct ioth_dnsserver) {
+			.addr = ss,
+			.source = iothconf_dnsconf_source(type),
+			.lifetime = dcarg->lifetime[iothconf_dnsconf_srcidx(type)],
+		};
 	}
 	return 0;
 }
 
-char *iothconf_resolvconf(struct ioth *stack, uint32_t ifindex) {
-	char *resolvconf = NULL;
-	size_t resolvconflen = 0;
-	struct iothconf_resolvconf_cb_arg cbarg = {0};
-	ioth_confdata_forall_mask(stack, ifindex, IOTH_CONFDATA_DNS_DOM_BASE, IOTH_CONFDATA_DNS_DOM_MASK,
-			iothconf_resolvconf_count_cb, &cbarg);
-	if (cbarg.countupdated > 0) {
-		cbarg.rc = open_memstream(&resolvconf, &resolvconflen);
-		if (cbarg.countdomains > 0) {
-			char *domains[cbarg.countdomains];
-			cbarg.domains = domains;
-			printf("countdomains %d\n", cbarg.countdomains);
-			fprintf(cbarg.rc, "search");
-			ioth_confdata_forall_mask(stack, ifindex, IOTH_CONFDATA_DOM_BASE, IOTH_CONFDATA_DOM_MASK,
-					iothconf_resolvconf_domain_cb, &cbarg);
-			fprintf(cbarg.rc, "\n");
+static int iothconf_dnsconf_domain_cb(void *data, void *arg) {
+	struct iothconf_dnsconf_arg *dcarg = arg;
+	uint8_t type = ioth_confdata_gettype(data);
+	FORmstr(domain, data, ioth_confdata_getdatalen(data)) {
+		int i;
+		if (dcarg->ndomains >= dcarg->maxdomains || strlen(domain) >= IOTH_DNSDOMAIN_MAXLEN)
+			continue;
+		for (i = 0; i < dcarg->ndomains; i++) {
+			if (strcmp(dcarg->domains[i].domain, domain) == 0)
+				break;
 		}
-		ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_STATIC6_DNS,
-				iothconf_resolvconf_dns_cb, &cbarg);
-		ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_STATIC4_DNS,
-				iothconf_resolvconf_dns_cb, &cbarg);
-		ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_DHCP6_DNS,
-				iothconf_resolvconf_dns_cb, &cbarg);
-		ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_DHCP4_DNS,
-				iothconf_resolvconf_dns_cb, &cbarg);
-		fclose(cbarg.rc);
-	} else
-		errno = 0;
-	return resolvconf;
+		if (i < dcarg->ndomains)
+			continue;
+		struct ioth_dnsdomain *new = &dcarg->domains[dcarg->ndomains++];
+		strcpy(new->domain, domain);
+		new->source = iothconf_dnsconf_source(type);
+		new->lifetime = dcarg->lifetime[iothconf_dnsconf_srcidx(type)];
+	}
+	return 0;
+}
+
+struct iothconf_dnsconf_filter {
+	struct ioth *stack;
+	uint32_t ifindex;
+	ioth_confdata_forall_cb *callback;
+	void *arg;
+};
+
+/* skip deleted records (ioth_confdata_del sets the timestamp to 0) */
+static int iothconf_dnsconf_filter_cb(void *data, void *arg) {
+	struct iothconf_dnsconf_filter *filter = arg;
+	if (ioth_confdata_gettimestamp(data) == 0)
+		return 0;
+	return filter->callback(data, filter->arg);
+}
+
+int ioth_dnsconf(struct ioth *stack, unsigned int ifindex,
+		struct ioth_dnsserver *servers, int *nservers,
+		struct ioth_dnsdomain *domains, int *ndomains) {
+	struct iothconf_dnsconf_arg dcarg = {
+		.now = time(NULL),
+		.servers = servers,
+		.maxservers = (servers == NULL || nservers == NULL) ? 0 : *nservers,
+		.domains = domains,
+		.maxdomains = (domains == NULL || ndomains == NULL) ? 0 : *ndomains,
+	};
+	struct iothconf_dnsconf_filter filter = {stack, ifindex, NULL, &dcarg};
+	static const uint8_t dnstypes[] = {
+		IOTH_CONFDATA_STATIC6_DNS, IOTH_CONFDATA_STATIC4_DNS,
+		IOTH_CONFDATA_DHCP6_DNS, IOTH_CONFDATA_DHCP4_DNS};
+	if (ifindex == 0)
+		return errno = EINVAL, -1;
+	ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_DHCP4_ADDR, iothconf_dnsconf_lifetime_cb, &dcarg);
+	ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_DHCP6_ADDR, iothconf_dnsconf_lifetime_cb, &dcarg);
+	/* no lease (e.g. static data): infinite lifetime */
+	for (int i = 0; i < 4; i++) {
+		if (!(dcarg.haslease & (1 << i)))
+			dcarg.lifetime[i] = TIME_INFINITY;
+	}
+	filter.callback = iothconf_dnsconf_server_cb;
+	for (size_t i = 0; i < sizeof(dnstypes); i++)
+		ioth_confdata_forall(stack, ifindex, dnstypes[i], iothconf_dnsconf_filter_cb, &filter);
+	filter.callback = iothconf_dnsconf_domain_cb;
+	ioth_confdata_forall_mask(stack, ifindex, IOTH_CONFDATA_DOM_BASE, IOTH_CONFDATA_DOM_MASK,
+			iothconf_dnsconf_filter_cb, &filter);
+	if (nservers != NULL) *nservers = dcarg.nservers;
+	if (ndomains != NULL) *ndomains = dcarg.ndomains;
+	return 0;
 }
 
 #if 0
@@ -206,19 +442,3 @@ char *iothconf_resolvconf(struct ioth *stack, char *config) {
 	return _iothconf_resolvconf(stack, ifindex);
 }
 #endif
-
-#if 0
-uint8_t test[] = {
-	0x06,0x64,0x6f,0x6d,0x61,0x69,0x6e,0x07,0x65,0x78,0x61,0x6d,0x70,0x6c,0x65,0x00,
-	0x06,0x64,0x61,0x6d,0x61,0x69,0x6e,0x07,0x65,0x78,0x61,0x6d,0x70,0x6c,0x65,0x00,
-	0x06,0x73,0x65,0x63,0x6f,0x6e,0x64,0x06,0x64,0x6f,0x6d,0x61,0x69,0x6e,0x02,0x69,0x74,0x00};
-main() {
-	char mstr[sizeof(test)];
-	int len = iothconf_domain2mstr(test, mstr, sizeof(test));
-	printf("%d %d %d\n",len, sizeof(test), count_mstr(mstr, len));
-	FORmstr(scan, mstr, len)
-		printf("=%s=\n", scan);
-
-	//printf("=%s= %d %d\n",str,strlen(str), sizeof(test));
-}
-#endif
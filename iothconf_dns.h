@@ -3,10 +3,8 @@
 #include <stdint.h>
 #include <string.h>
 
-/* convert an rfc1035 encoded sequence of domain names of length len
-	 in multistring (sequence of strings).
-	 The result is stored in mstr (whose length must be at least len) */
-int iothconf_domain2mstr(uint8_t *domain, char *mstr, uint16_t len);
+/* multistrings: iothconf_domain2mstr (iothconf_parse.h) converts rfc1035 encoded
+	 sequences of domain names */
 
 /* iterate on the strings of a multistring.
 	 X = iteration varname
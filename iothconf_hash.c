@@ -1,6 +1,7 @@
 /*
  *   iothconf_hash.c: auto configuration library for ioth
  *       hash (md5sum) based mac and ipv6 host address + eui64 conversion
+ *       + RFC 7217 stable and opaque interface identifiers (SipHash-2-4)
  *
  *   Copyright 2021 Renzo Davoli - Virtual Square Team
  *   University of Bologna - Italy
@@ -15,44 +16,259 @@
  *
  */
 
-#include <mhash.h>
-#include <netinet/in.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <pthread.h>
+#include <netinet/in.h>
 #include <iothconf.h>
+#include <iothconf_hash.h>
 
-void iothconf_hashaddr6(void *addr, const char *name) {
-	struct in6_addr *addr6 = addr;
+/* MD5 message digest (RFC 1321).
+	 fqdn are short strings: a one-shot implementation is all we need. */
+#define MD5_ROTL(X, N) (((X) << (N)) | ((X) >> (32 - (N))))
+
+static const uint32_t md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+static const uint8_t md5_r[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+
+static void md5_block(uint32_t h[4], const uint8_t *block) {
+	uint32_t w[16];
+	uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+	int i;
+	for (i = 0; i < 16; i++)
+		w[i] = block[4 * i] | (block[4 * i + 1] << 8) |
+			(block[4 * i + 2] << 16) | ((uint32_t) block[4 * i + 3] << 24);
+	for (i = 0; i < 64; i++) {
+		uint32_t f, tmp;
+		int g;
+		switch (i >> 4) {
+			case 0: f = (b & c) | (~b & d); g = i; break;
+			case 1: f = (d & b) | (~d & c); g = (5 * i + 1) & 0xf; break;
+			case 2: f = b ^ c ^ d; g = (3 * i + 5) & 0xf; break;
+			default: f = c ^ (b | ~d); g = (7 * i) & 0xf; break;
+		}
+		tmp = d;
+		d = c;
+		c = b;
+		b = b + MD5_ROTL(a + f + md5_k[i] + w[g], md5_r[i]);
+		a = tmp;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+}
+
+static void md5(const void *data, size_t len, uint8_t out[16]) {
+	uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+	const uint8_t *udata = data;
+	uint8_t tail[128] = {0};
+	size_t taillen;
+	uint64_t bitlen = (uint64_t) len << 3;
+	int i;
+	for (; len >= 64; udata += 64, len -= 64)
+		md5_block(h, udata);
+	memcpy(tail, udata, len);
+	tail[len] = 0x80;
+	taillen = (len < 56) ? 64 : 128;
+	for (i = 0; i < 8; i++)
+		tail[taillen - 8 + i] = bitlen >> (8 * i);
+	md5_block(h, tail);
+	if (taillen == 128)
+		md5_block(h, tail + 64);
+	for (i = 0; i < 16; i++)
+		out[i] = h[i >> 2] >> (8 * (i & 3));
+}
+
+/* compute the identities from the name (a trailing dot is ignored) */
+static void hashid_compute(const char *name, size_t namelen, struct ioth_hashid *id) {
+	uint8_t out[16];
+	int i;
+	md5(name, namelen, out);
+	for (i = 0; i < 3; i++)
+		id->mac[i] = out[i];
+	for (i = 3; i < 6; i++)
+		id->mac[i] = out[i+2];
+	id->mac[0] |= 0x2; // locally adm
+	id->mac[0] &= ~0x1; // unicast
+	memcpy(id->iid, out, sizeof(id->iid));
+	id->iid[0] &= ~0x3;   // locally adm, unicast
+	/* DUID-LL (RFC 8415 11.4): type 3, hw type 1 (ethernet), mac */
+	id->duid[0] = 0; id->duid[1] = 3;
+	id->duid[2] = 0; id->duid[3] = 1;
+	memcpy(id->duid + 4, id->mac, sizeof(id->mac));
+}
+
+static size_t hashid_namelen(const char *name) {
 	size_t namelen = strlen(name);
-	MHASH td;
-	char out[mhash_get_block_size(MHASH_MD5)];
+	if (namelen > 0 && name[namelen-1] == '.') namelen--;
+	return namelen;
+}
+
+/* cache of the most recently used identities.
+	 Direct mapped: each name can be stored in one slot only (FNV-1a hash of the name) */
+#define HASHID_CACHE_SIZE 64
+struct hashid_cache {
+	char *name;
+	size_t namelen;
+	struct ioth_hashid id;
+};
+
+static pthread_mutex_t hashid_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct hashid_cache hashid_cache[HASHID_CACHE_SIZE];
+
+static unsigned int hashid_slot(const char *name, size_t namelen) {
+	uint32_t hash = 2166136261U;
+	for (size_t i = 0; i < namelen; i++)
+		hash = (hash ^ (uint8_t) name[i]) * 16777619U;
+	return hash % HASHID_CACHE_SIZE;
+}
+
+void ioth_hashid(const char *name, struct ioth_hashid *id) {
+	size_t namelen = hashid_namelen(name);
+	struct hashid_cache *slot = &hashid_cache[hashid_slot(name, namelen)];
+	pthread_mutex_lock(&hashid_cache_mutex);
+	if (slot->name != NULL && slot->namelen == namelen &&
+			memcmp(slot->name, name, namelen) == 0)
+		*id = slot->id;
+	else {
+		hashid_compute(name, namelen, id);
+		char *newname = strndup(name, namelen);
+		if (newname != NULL) {
+			free(slot->name);
+			*slot = (struct hashid_cache) {
+				.name = newname,
+					.namelen = namelen,
+					.id = *id,
+			};
+		}
+	}
+	pthread_mutex_unlock(&hashid_cache_mutex);
+}
+
+/* batch: names are processed in a row, the cache is neither locked nor polluted */
+void ioth_hashidv(const char *names[], struct ioth_hashid *ids, size_t count) {
+	for (size_t i = 0; i < count; i++)
+		hashid_compute(names[i], hashid_namelen(names[i]), &ids[i]);
+}
+
+void iothconf_hashaddr6_id(void *addr, const struct ioth_hashid *id) {
+	struct in6_addr *addr6 = addr;
 	int i;
-	memset(out, 0, mhash_get_block_size(MHASH_MD5));
-	if (name[namelen-1] == '.') namelen--;
-	td=mhash_init(MHASH_MD5);
-	mhash(td, name, namelen);
-	mhash_deinit(td, out);
 	for (i=8; i<16; i++)
-		addr6->s6_addr[i] ^= out[i-8];
+		addr6->s6_addr[i] ^= id->iid[i-8];
 	addr6->s6_addr[8] &= ~0x3;   // locally adm, unicast
 }
 
+void iothconf_hashaddr6(void *addr, const char *name) {
+	struct ioth_hashid id;
+	ioth_hashid(name, &id);
+	iothconf_hashaddr6_id(addr, &id);
+}
+
 void iothconf_hashmac(void *mac, const char *name) {
-	unsigned char *umac = mac;
-	size_t namelen = strlen(name);
-	MHASH td;
-	char out[mhash_get_block_size(MHASH_MD5)];
-	int i;
-	memset(out, 0, mhash_get_block_size(MHASH_MD5));
-	if (name[namelen-1] == '.') namelen--;
-	td=mhash_init(MHASH_MD5);
-	mhash(td, name, namelen);
-	mhash_deinit(td, out);
-	for (i=0; i<3; i++)
-		umac[i] = out[i];
-	for (i=3; i<6; i++)
-		umac[i] = out[i+2];
-	umac[0] |= 0x2; // locally adm
-	umac[0] &= ~0x1; // unicast
+	struct ioth_hashid id;
+	ioth_hashid(name, &id);
+	memcpy(mac, id.mac, sizeof(id.mac));
+}
+
+/* SipHash-2-4 (Aumasson, Bernstein 2012) */
+#define SIP_ROTL(X, N) (((X) << (N)) | ((X) >> (64 - (N))))
+#define SIP_ROUND(V0, V1, V2, V3) do { \
+	V0 += V1; V1 = SIP_ROTL(V1, 13); V1 ^= V0; V0 = SIP_ROTL(V0, 32); \
+	V2 += V3; V3 = SIP_ROTL(V3, 16); V3 ^= V2; \
+	V0 += V3; V3 = SIP_ROTL(V3, 21); V3 ^= V0; \
+	V2 += V1; V1 = SIP_ROTL(V1, 17); V1 ^= V2; V2 = SIP_ROTL(V2, 32); \
+} while (0)
+
+static inline uint64_t sip_le64(const uint8_t *p) {
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static uint64_t siphash(const struct iothconf_stablekey *key, const void *data, size_t len) {
+	const uint8_t *udata = data;
+	uint64_t v0 = key->k0 ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = key->k1 ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = key->k0 ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = key->k1 ^ 0x7465646279746573ULL;
+	uint64_t m;
+	size_t left = len & 7;
+	const uint8_t *end = udata + (len - left);
+	for (; udata < end; udata += 8) {
+		m = sip_le64(udata);
+		v3 ^= m;
+		SIP_ROUND(v0, v1, v2, v3);
+		SIP_ROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+	m = (uint64_t) len << 56;
+	for (size_t i = 0; i < left; i++)
+		m |= (uint64_t) udata[i] << (8 * i);
+	v3 ^= m;
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+	v0 ^= m;
+	v2 ^= 0xff;
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* the 128 bit key is the md5 digest of the secret */
+void iothconf_stablekey(struct iothconf_stablekey *key, const void *secret, size_t secretlen) {
+	uint8_t out[16];
+	md5(secret, secretlen, out);
+	key->k0 = sip_le64(out);
+	key->k1 = sip_le64(out + 8);
+}
+
+/* RFC 5453 reserved interface identifiers */
+static int reserved_iid(const uint8_t *iid) {
+	static const uint8_t zero[8];
+	static const uint8_t anycast[7] = {0xfd, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+	if (memcmp(iid, zero, 8) == 0)
+		return 1;
+	if (memcmp(iid, anycast, 7) == 0 && iid[7] >= 0x80)
+		return 1;
+	return 0;
+}
+
+/* RFC 7217: RID = F(Prefix, Net_Iface, Network_ID, DAD_Counter, secret_key).
+	 addr: the (64 bit) prefix in, the address out.
+	 Reserved identifiers are skipped as if DAD had failed: the DAD counter
+	 actually used is returned */
+uint8_t iothconf_stableaddr6(void *addr, const struct iothconf_stablekey *key,
+		const void *net_iface, size_t net_ifacelen,
+		const void *netid, size_t netidlen, uint8_t dad_counter) {
+	struct in6_addr *addr6 = addr;
+	uint8_t buf[8 + net_ifacelen + netidlen + 1];
+	memcpy(buf, addr6->s6_addr, 8);
+	memcpy(buf + 8, net_iface, net_ifacelen);
+	if (netidlen > 0)
+		memcpy(buf + 8 + net_ifacelen, netid, netidlen);
+	for (;; dad_counter++) {
+		buf[sizeof(buf) - 1] = dad_counter;
+		uint64_t rid = siphash(key, buf, sizeof(buf));
+		for (int i = 0; i < 8; i++)
+			addr6->s6_addr[8 + i] = rid >> (8 * (7 - i));
+		if (!reserved_iid(addr6->s6_addr + 8))
+			return dad_counter;
+	}
 }
 
 void iothconf_eui64(void *addr, void *mac) {
@@ -67,4 +283,3 @@ void iothconf_eui64(void *addr, void *mac) {
 		addr6->s6_addr[i + 10] ^= umac[i];
 	addr6->s6_addr[8] ^= 0x2;   // L bit has inverse meaning.
 }
-
@@ -1,8 +1,20 @@
 #ifndef IOTHCONF_HASH_H
 #define IOTHCONF_HASH_H
+#include <iothconf.h>
 
 void iothconf_hashaddr6(void *addr, const char *name);
+void iothconf_hashaddr6_id(void *addr, const struct ioth_hashid *id);
 void iothconf_hashmac(void *mac, const char *name);
 void iothconf_eui64(void *addr, void *mac);
 
+/* RFC 7217 stable and opaque interface identifiers */
+struct iothconf_stablekey {
+	uint64_t k0, k1;
+};
+
+void iothconf_stablekey(struct iothconf_stablekey *key, const void *secret, size_t secretlen);
+uint8_t iothconf_stableaddr6(void *addr, const struct iothconf_stablekey *key,
+		const void *net_iface, size_t net_ifacelen,
+		const void *netid, size_t netidlen, uint8_t dad_counter);
+
 #endif
@@ -17,109 +17,387 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
 
 #include <iothconf.h>
 #include <iothconf_hash.h>
 #include <iothconf_data.h>
 #include <iothconf_mod.h>
+#include <iothconf_stats.h>
 
-static int ioth_ip_setaddr6(void *data, void *arg) {
-	time_t *latest_timestamp = arg;
-	struct ioth_confdata_ip6addr *ipaddr =  data;
-	struct ioth *stack = ioth_confdata_getstack(data);
-	time_t timestamp = ioth_confdata_gettimestamp(data);
-	if (timestamp < *latest_timestamp) {
-		if (ioth_confdata_clrflags(data, IOTH_CONFDATA_ACTIVE) & IOTH_CONFDATA_ACTIVE)
-			ioth_ipaddr_del(stack, AF_INET6, &ipaddr->addr, ipaddr->prefixlen, ioth_confdata_getifindex(data));
-		return IOTH_CONFDATA_FORALL_DELETE;
-	} else {
-		if (!(ioth_confdata_setflags(data, IOTH_CONFDATA_ACTIVE) & IOTH_CONFDATA_ACTIVE))
-			ioth_ipaddr_add(stack, AF_INET6, &ipaddr->addr, ipaddr->prefixlen, ioth_confdata_getifindex(data));
-		return 0;
+/* iothconf_ip_update scans the records of a source once (holding the lock) and computes
+	 the list of the changes to apply: stale active records have to be removed from the stack,
+	 new records have to be added. The changes are applied to the stack after the scan,
+	 (i.e. without holding the lock): all the deletions first, then all the additions.
+	 Routes are deleted before addresses and added after them.
+
+	 Make-before-break (grace > 0): stale active addresses are not removed at once,
+	 they are marked as deprecated and kept for grace seconds, the additions are applied
+	 before the deletions. Deprecated addresses are removed at the end of the grace
+	 period by a background thread of the source (or by the first update of the same
+	 source after it, or by iothconf_ip_clean). iothconf_ip_stop (ioth_config_release)
+	 stops the threads of a stack. Stale routes are always removed (after the additions). */
+
+struct iothconf_ip_op {
+	uint8_t type;
+	uint8_t family;
+	uint8_t prefixlen;
+	uint8_t route;
+	uint32_t ifindex;
+	union {
+		struct in_addr in;
+		struct in6_addr in6;
+	} addr;
+};
+
+struct iothconf_ip_ops {
+	int nops;
+	int size;
+	struct iothconf_ip_op *ops;
+};
+
+struct iothconf_ip_diff {
+	time_t timestamp;
+	time_t now;
+	unsigned int grace;
+	time_t expire; // end of the first grace period of the kept deprecated addresses (0: none)
+	struct iothconf_ip_ops del;
+	struct iothconf_ip_ops add;
+	struct iothconf_ip_ops keep;
+};
+
+/* convert a record in a stack operation. return 0 if the record is not an address or a route */
+static int ioth_ip_record2op(void *data, struct iothconf_ip_op *op) {
+	uint8_t type = ioth_confdata_gettype(data);
+	*op = (struct iothconf_ip_op) {
+		.type = type,
+		.ifindex = ioth_confdata_getifindex(data),
+	};
+	switch (type) {
+		case IOTH_CONFDATA_STATIC6_ADDR:
+		case IOTH_CONFDATA_DHCP6_ADDR:
+		case IOTH_CONFDATA_RD6_ADDR:
+			op->family = AF_INET6;
+			op->addr.in6 = ((struct ioth_confdata_ip6addr *) data)->addr;
+			op->prefixlen = ((struct ioth_confdata_ip6addr *) data)->prefixlen;
+			return 1;
+		case IOTH_CONFDATA_STATIC6_ROUTE:
+		case IOTH_CONFDATA_RD6_ROUTER:
+			op->family = AF_INET6;
+			op->route = 1;
+			op->addr.in6 = ((struct ioth_confdata_ip6addr *) data)->addr;
+			return 1;
+		case IOTH_CONFDATA_STATIC4_ADDR:
+		case IOTH_CONFDATA_DHCP4_ADDR:
+			op->family = AF_INET;
+			op->addr.in = ((struct ioth_confdata_ipaddr *) data)->addr;
+			op->prefixlen = ((struct ioth_confdata_ipaddr *) data)->prefixlen;
+			return 1;
+		case IOTH_CONFDATA_STATIC4_ROUTE:
+		case IOTH_CONFDATA_DHCP4_ROUTER:
+			op->family = AF_INET;
+			op->route = 1;
+			op->addr.in = *((struct in_addr *) data);
+			op->ifindex = 0;
+			return 1;
+		default:
+			return 0;
 	}
 }
 
-static int ioth_ip_setroute6(void *data, void *arg) {
-	time_t *latest_timestamp = arg;
-	struct ioth_confdata_ip6addr *ipaddr =  data;
-	struct ioth *stack = ioth_confdata_getstack(data);
-	time_t timestamp = ioth_confdata_gettimestamp(data);
-	if (timestamp < *latest_timestamp) {
-		if (ioth_confdata_clrflags(data, IOTH_CONFDATA_ACTIVE) & IOTH_CONFDATA_ACTIVE)
-			ioth_iproute_del(stack, AF_INET6, NULL, 0, &ipaddr->addr, ioth_confdata_getifindex(data));
-		return IOTH_CONFDATA_FORALL_DELETE;
-	} else {
-		if (!(ioth_confdata_setflags(data, IOTH_CONFDATA_ACTIVE) & IOTH_CONFDATA_ACTIVE))
-			ioth_iproute_add(stack, AF_INET6, NULL, 0, &ipaddr->addr, ioth_confdata_getifindex(data));
-		return 0;
+static int ioth_ip_ops_append(struct iothconf_ip_ops *ops, struct iothconf_ip_op *op) {
+	if (ops->nops >= ops->size) {
+		int newsize = ops->size == 0 ? 8 : ops->size * 2;
+		struct iothconf_ip_op *newops = realloc(ops->ops, newsize * sizeof(*newops));
+		if (newops == NULL)
+			return -1;
+		ops->ops = newops;
+		ops->size = newsize;
 	}
+	ops->ops[ops->nops++] = *op;
+	return 0;
 }
 
-static int ioth_ip_setaddr4(void *data, void *arg) {
-	time_t *latest_timestamp = arg;
-	struct ioth_confdata_ipaddr *ipaddr =  data;
-	struct ioth *stack = ioth_confdata_getstack(data);
-	time_t timestamp = ioth_confdata_gettimestamp(data);
-	if (timestamp < *latest_timestamp) {
-		if (ioth_confdata_clrflags(data, IOTH_CONFDATA_ACTIVE) & IOTH_CONFDATA_ACTIVE)
-			ioth_ipaddr_del(stack, AF_INET, &ipaddr->addr, ipaddr->prefixlen, ioth_confdata_getifindex(data));
-		return IOTH_CONFDATA_FORALL_DELETE;
-	} else {
-		if (!(ioth_confdata_setflags(data, IOTH_CONFDATA_ACTIVE) & IOTH_CONFDATA_ACTIVE))
-			ioth_ipaddr_add(stack, AF_INET, &ipaddr->addr, ipaddr->prefixlen, ioth_confdata_getifindex(data));
-		return 0;
+static int ioth_ip_op_eq(struct iothconf_ip_op *a, struct iothconf_ip_op *b) {
+	return a->family == b->family && a->route == b->route && a->prefixlen == b->prefixlen &&
+		a->ifindex == b->ifindex && memcmp(&a->addr, &b->addr, sizeof(a->addr)) == 0;
+}
+
+/* the timestamp of a deprecated record is the time of deprecation - 1
+	 (so that it is still older than the current msg timestamp) */
+static int ioth_ip_deprecate(void *data, struct iothconf_ip_diff *diff) {
+	uint8_t flags = ioth_confdata_setflags(data, IOTH_CONFDATA_DEPRECATED);
+	if (!(flags & IOTH_CONFDATA_DEPRECATED))
+		ioth_confdata_settimestamp(data, diff->timestamp - 1);
+	time_t expire = ioth_confdata_gettimestamp(data) + 1 + diff->grace;
+	if (diff->now < expire) {
+		if (diff->expire == 0 || expire < diff->expire)
+			diff->expire = expire;
+		return 1;
 	}
+	return 0;
 }
 
-static int ioth_ip_setroute4(void *data, void *arg) {
-	time_t *latest_timestamp = arg;
-	struct in_addr *ipaddr =  data;
-	struct ioth *stack = ioth_confdata_getstack(data);
-	time_t timestamp = ioth_confdata_gettimestamp(data);
-	if (timestamp < *latest_timestamp) {
-		if (ioth_confdata_clrflags(data, IOTH_CONFDATA_ACTIVE) & IOTH_CONFDATA_ACTIVE)
-			ioth_iproute_del(stack, AF_INET, NULL, 0, ipaddr, 0);
+/* the op of a record is queued before its flags are changed (or before it is deleted):
+	 if there is no memory to queue it, the scan stops leaving the record as is
+	 (the next update of the source will process it) */
+static int ioth_ip_diff_cb(void *data, void *arg) {
+	struct iothconf_ip_diff *diff = arg;
+	struct iothconf_ip_op op;
+	int isop = ioth_ip_record2op(data, &op);
+	int active = ioth_confdata_setflags(data, 0) & IOTH_CONFDATA_ACTIVE;
+	if (ioth_confdata_gettimestamp(data) < diff->timestamp) {
+		if (isop && !op.route && diff->grace > 0 && active &&
+				ioth_ip_deprecate(data, diff))
+			return 0;
+		if (isop && active) {
+			if (ioth_ip_ops_append(&diff->del, &op) < 0)
+				return IOTH_CONFDATA_FORALL_BREAK;
+			ioth_confdata_clrflags(data, IOTH_CONFDATA_ACTIVE);
+		}
 		return IOTH_CONFDATA_FORALL_DELETE;
 	} else {
-		if (!(ioth_confdata_setflags(data, IOTH_CONFDATA_ACTIVE) & IOTH_CONFDATA_ACTIVE))
-			ioth_iproute_add(stack, AF_INET, NULL, 0, ipaddr, 0);
+		if (isop) {
+			if (ioth_ip_ops_append(active ? &diff->keep : &diff->add, &op) < 0)
+				return IOTH_CONFDATA_FORALL_BREAK;
+			ioth_confdata_clrflags(data, IOTH_CONFDATA_DEPRECATED);
+			ioth_confdata_setflags(data, IOTH_CONFDATA_ACTIVE);
+		}
 		return 0;
 	}
 }
 
-static int ioth_ip_cleanold(void *data, void *arg) {
-	time_t *latest_timestamp = arg;
-	time_t timestamp = ioth_confdata_gettimestamp(data);
-	if (timestamp < *latest_timestamp)
-		return IOTH_CONFDATA_FORALL_DELETE;
-	else
+/* remove the deprecated addresses whose grace period has elapsed
+	 (the active ones are collected in keep, as they can confirm the same address) */
+static int ioth_ip_expire_cb(void *data, void *arg) {
+	struct iothconf_ip_diff *diff = arg;
+	struct iothconf_ip_op op;
+	uint8_t flags = ioth_confdata_setflags(data, 0);
+	if (!ioth_ip_record2op(data, &op) || !(flags & IOTH_CONFDATA_ACTIVE))
 		return 0;
+	if (!(flags & IOTH_CONFDATA_DEPRECATED))
+		return ioth_ip_ops_append(&diff->keep, &op) < 0 ? IOTH_CONFDATA_FORALL_BREAK : 0;
+	if (ioth_ip_deprecate(data, diff))
+		return 0;
+	if (ioth_ip_ops_append(&diff->del, &op) < 0)
+		return IOTH_CONFDATA_FORALL_BREAK;
+	ioth_confdata_clrflags(data, IOTH_CONFDATA_ACTIVE);
+	return IOTH_CONFDATA_FORALL_DELETE;
 }
 
-void iothconf_ip_update(struct ioth *stack, unsigned int ifindex, uint8_t type, uint32_t config_flags) {
-	(void) config_flags;
+/* do not delete addresses/routes confirmed by a current record (e.g. same address, new lifetimes) */
+static void ioth_ip_ops_filter(struct iothconf_ip_ops *del, struct iothconf_ip_ops *keep) {
+	int n = 0;
+	for (int i = 0; i < del->nops; i++) {
+		int found = 0;
+		for (int j = 0; j < keep->nops && !found; j++)
+			found = ioth_ip_op_eq(&del->ops[i], &keep->ops[j]);
+		if (!found)
+			del->ops[n++] = del->ops[i];
+	}
+	del->nops = n;
+}
+
+static void ioth_ip_apply(struct ioth *stack, struct iothconf_ip_ops *ops, int add, int route) {
+	for (int i = 0; i < ops->nops; i++) {
+		struct iothconf_ip_op *op = &ops->ops[i];
+		if (op->route != route)
+			continue;
+		if (route) {
+			if (add)
+				ioth_iproute_add(stack, op->family, NULL, 0, &op->addr, op->ifindex);
+			else
+				ioth_iproute_del(stack, op->family, NULL, 0, &op->addr, op->ifindex);
+		} else {
+			if (add)
+				ioth_ipaddr_add(stack, op->family, &op->addr, op->prefixlen, op->ifindex);
+			else
+				ioth_ipaddr_del(stack, op->family, &op->addr, op->prefixlen, op->ifindex);
+		}
+	}
+}
+
+/* a thread per source waits for the end of the grace periods */
+struct iothconf_ip_expire {
+	struct iothconf_ip_expire *next;
+	struct ioth *stack;
+	unsigned int ifindex;
+	uint8_t type;
+	/* protected by expire_mutex */
+	unsigned int grace;
+	time_t expire; // next end of a grace period (0: consumed)
+	int stop;
+	int terminated;
+	int efd; // wakes up the thread (new expire time or stop)
+	pthread_t thread;
+};
+
+/* running threads, the terminated threads are joined when a new one starts */
+static pthread_mutex_t expire_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct iothconf_ip_expire *expire_root;
+
+/* remove the expired addresses of a source: return the next end of a grace period (or 0) */
+static time_t ioth_ip_expire(struct ioth *stack, unsigned int ifindex, uint8_t type, unsigned int grace) {
+	struct iothconf_ip_diff diff = {
+		.now = time(NULL),
+		.grace = grace,
+	};
+	ioth_confdata_forall_mask(stack, ifindex, type, IOTH_CONFDATA_MASK_TYPE, ioth_ip_expire_cb, &diff);
+	ioth_ip_ops_filter(&diff.del, &diff.keep);
+	ioth_ip_apply(stack, &diff.del, 0, 0);
+	free(diff.del.ops);
+	free(diff.keep.ops);
+	ioth_confdata_dispatch();
+	return diff.expire;
+}
+
+static void *ioth_ip_expire_thread(void *arg) {
+	struct iothconf_ip_expire *ex = arg;
+	struct pollfd pfd[] = {{ex->efd, POLLIN, 0}};
+	pthread_mutex_lock(&expire_mutex);
+	while (!ex->stop && ex->expire != 0) {
+		time_t now = time(NULL);
+		if (now < ex->expire) {
+			/* wake up at least once an hour (no overflow of the timeout) */
+			int timeout = (ex->expire - now > 3600 ? 3600 : ex->expire - now) * 1000;
+			uint64_t value;
+			pthread_mutex_unlock(&expire_mutex);
+			if (poll(pfd, 1, timeout) > 0)
+				while (read(ex->efd, &value, sizeof(value)) < 0 && errno == EINTR)
+					;
+			pthread_mutex_lock(&expire_mutex);
+		} else {
+			unsigned int grace = ex->grace;
+			time_t expire;
+			ex->expire = 0;
+			pthread_mutex_unlock(&expire_mutex);
+			expire = ioth_ip_expire(ex->stack, ex->ifindex, ex->type, grace);
+			pthread_mutex_lock(&expire_mutex);
+			/* iothconf_ip_update can have set an earlier end in the meanwhile */
+			if (expire != 0 && (ex->expire == 0 || expire < ex->expire))
+				ex->expire = expire;
+		}
+	}
+	ex->terminated = 1;
+	pthread_mutex_unlock(&expire_mutex);
+	return NULL;
+}
+
+static void ioth_ip_expire_join(struct iothconf_ip_expire *list) {
+	while (list != NULL) {
+		struct iothconf_ip_expire *next = list->next;
+		pthread_join(list->thread, NULL);
+		close(list->efd);
+		free(list);
+		list = next;
+	}
+}
+
+/* the source has deprecated addresses to remove at time expire:
+	 update the thread of the source or start a new one */
+static void ioth_ip_expire_start(struct ioth *stack, unsigned int ifindex, uint8_t type,
+		unsigned int grace, time_t expire) {
+	struct iothconf_ip_expire *terminated = NULL;
+	struct iothconf_ip_expire *ex = NULL;
+	uint64_t one = 1;
+	pthread_mutex_lock(&expire_mutex);
+	for (struct iothconf_ip_expire **scan = &expire_root; *scan != NULL; ) {
+		struct iothconf_ip_expire *this = *scan;
+		if (this->terminated) {
+			*scan = this->next;
+			this->next = terminated;
+			terminated = this;
+		} else {
+			if (this->stack == stack && this->ifindex == ifindex && this->type == type)
+				ex = this;
+			scan = &this->next;
+		}
+	}
+	if (ex != NULL) {
+		ex->grace = grace;
+		if (ex->expire == 0 || expire < ex->expire) {
+			ex->expire = expire;
+			while (write(ex->efd, &one, sizeof(one)) < 0 && errno == EINTR)
+				;
+		}
+	} else if ((ex = malloc(sizeof(*ex))) != NULL) {
+		*ex = (struct iothconf_ip_expire) {
+			.stack = stack,
+			.ifindex = ifindex,
+			.type = type,
+			.grace = grace,
+			.expire = expire,
+			.efd = eventfd(0, EFD_CLOEXEC),
+		};
+		if (ex->efd >= 0 && pthread_create(&ex->thread, NULL, ioth_ip_expire_thread, ex) == 0) {
+			ex->next = expire_root;
+			expire_root = ex;
+		} else {
+			if (ex->efd >= 0)
+				close(ex->efd);
+			free(ex);
+		}
+	}
+	pthread_mutex_unlock(&expire_mutex);
+	ioth_ip_expire_join(terminated);
+}
+
+void iothconf_ip_stop(struct ioth *stack) {
+	struct iothconf_ip_expire *stopped = NULL;
+	uint64_t one = 1;
+	pthread_mutex_lock(&expire_mutex);
+	for (struct iothconf_ip_expire **scan = &expire_root; *scan != NULL; ) {
+		struct iothconf_ip_expire *this = *scan;
+		if (this->stack == stack) {
+			*scan = this->next;
+			this->next = stopped;
+			stopped = this;
+			this->stop = 1;
+			while (write(this->efd, &one, sizeof(one)) < 0 && errno == EINTR)
+				;
+		} else
+			scan = &this->next;
+	}
+	pthread_mutex_unlock(&expire_mutex);
+	ioth_ip_expire_join(stopped);
+}
+
+void iothconf_ip_update(struct ioth *stack, unsigned int ifindex, uint8_t type,
+		const struct iothconf_param *param) {
 	if (type != TIMESTAMP(type)) return;
-	time_t timestamp = ioth_confdata_read_timestamp(stack, ifindex, type);
-	switch (type) {
-		case IOTH_CONFDATA_STATIC_TIMESTAMP:
-			ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_STATIC6_ADDR, ioth_ip_setaddr6, &timestamp);
-			ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_STATIC6_ROUTE, ioth_ip_setroute6, &timestamp);
-			ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_STATIC4_ADDR, ioth_ip_setaddr4, &timestamp);
-			ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_STATIC4_ROUTE, ioth_ip_setroute4, &timestamp);
-			break;
-		case IOTH_CONFDATA_DHCP4_TIMESTAMP:
-			ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_DHCP4_ADDR, ioth_ip_setaddr4, &timestamp);
-			ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_DHCP4_ROUTER, ioth_ip_setroute4, &timestamp);
-			break;
-		case IOTH_CONFDATA_DHCP6_TIMESTAMP:
-			ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_DHCP6_ADDR, ioth_ip_setaddr6, &timestamp);
-			break;
-		case IOTH_CONFDATA_RD6_TIMESTAMP:
-			ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_RD6_ADDR, ioth_ip_setaddr6, &timestamp);
-			ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_RD6_ROUTER, ioth_ip_setroute6, &timestamp);
-			break;
+	uint64_t start = iothconf_stats_now();
+	struct iothconf_ip_diff diff = {
+		.timestamp = ioth_confdata_read_timestamp(stack, ifindex, type),
+		.now = time(NULL),
+		.grace = param == NULL ? 0 : param->grace,
+	};
+	ioth_confdata_forall_mask(stack, ifindex, type, IOTH_CONFDATA_MASK_TYPE, ioth_ip_diff_cb, &diff);
+	ioth_ip_ops_filter(&diff.del, &diff.keep);
+	ioth_ip_ops_filter(&diff.del, &diff.add);
+	if (diff.grace > 0) {
+		ioth_ip_apply(stack, &diff.add, 1, 0);
+		ioth_ip_apply(stack, &diff.add, 1, 1);
+		ioth_ip_apply(stack, &diff.del, 0, 1);
+		ioth_ip_apply(stack, &diff.del, 0, 0);
+	} else {
+		ioth_ip_apply(stack, &diff.del, 0, 1);
+		ioth_ip_apply(stack, &diff.del, 0, 0);
+		ioth_ip_apply(stack, &diff.add, 1, 0);
+		ioth_ip_apply(stack, &diff.add, 1, 1);
 	}
-	ioth_confdata_forall_mask(stack, ifindex, type, IOTH_CONFDATA_MASK_TYPE, ioth_ip_cleanold, &timestamp);
+	free(diff.del.ops);
+	free(diff.add.ops);
+	free(diff.keep.ops);
+	if (diff.expire != 0)
+		ioth_ip_expire_start(stack, ifindex, type, diff.grace, diff.expire);
+	iothconf_stats_add(stack, ifindex, IOTHCONF_PHASE_APPLY, start);
 }
 
 void iothconf_ip_clean(struct ioth *stack, unsigned int ifindex, uint8_t type, uint32_t config_flags) {
@@ -127,6 +405,6 @@ void iothconf_ip_clean(struct ioth *stack, unsigned int ifindex, uint8_t type, u
 	if (type != TIMESTAMP(type)) return;
 	time_t timestamp = ioth_confdata_new_timestamp(stack, ifindex, type);
 	ioth_confdata_write_timestamp(stack, ifindex, type, timestamp);
-	iothconf_ip_update(stack, ifindex, type, config_flags);
+	iothconf_ip_update(stack, ifindex, type, NULL);
 	ioth_confdata_del_timestamp(stack, ifindex, type);
 }
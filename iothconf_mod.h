@@ -3,6 +3,8 @@
 #include <ioth.h>
 #include <iothconf.h>
 #include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
 
 /* defined in iothconf.h
  * #define IOTHCONF_STATIC   1 << 0
@@ -12,20 +14,94 @@
  * #define IOTHCONF_RD       1 << 4
  */
 #define IOTHCONF_RD_SLAAC 1 << 24
+#define IOTHCONF_RD_STABLE 1 << 25
+#define IOTHCONF_DAD 1 << 26
+#define IOTHCONF_ACD 1 << 27
+// mask of the configuration methods
+#define IOTHCONF_ALL (IOTHCONF_STATIC | IOTHCONF_ETH | IOTHCONF_DHCP | IOTHCONF_DHCPV6 | IOTHCONF_RD)
 
 #define DEFAULT_INTERFACE "vde0"
+/* MAX_RTR_SOLICITATION_DELAY (RFC 4861), SOL_MAX_DELAY (RFC 8415) */
+#define IOTHCONF_DEFAULT_DELAY 1000
 #define TIME_INFINITY 0xffffffff
 
-int iothconf_eth   (struct ioth *stack, unsigned int ifindex,
-		const char *fqdn, const char *mac, uint32_t config_flags);
-int iothconf_dhcp  (struct ioth *stack, unsigned int ifindex, const char *fqdn, uint32_t config_flags);
-int iothconf_dhcpv6(struct ioth *stack, unsigned int ifindex, const char *fqdn, uint32_t config_flags);
-int iothconf_rd    (struct ioth *stack, unsigned int ifindex, const char *fqdn, uint32_t config_flags);
+/* retry policy (timeout, retries and maxtime options), see iothconf_retry.h:
+	 timeout <= 0, retries < 0, maxtime < 0 mean "protocol default" */
+struct iothconf_retry {
+	int timeout; // initial retransmission timeout (msecs)
+	int retries; // max number of retransmissions
+	int maxtime; // max duration of each exchange (msecs), 0 = unlimited
+	int delay; // max random delay before the first message (msecs)
+};
 
-void iothconf_ip_update(struct ioth *stack, unsigned int ifindex, uint8_t type, uint32_t config_flags);
+/* configuration parameters of an interface */
+struct iothconf_param {
+	uint32_t config_flags;
+	const char *fqdn;
+	const char *mac;
+	const char *secret;
+	unsigned int grace; // renumbering: old addresses are kept (deprecated) for grace seconds
+	struct iothconf_retry retry;
+};
+
+int iothconf_eth   (struct ioth *stack, unsigned int ifindex, const struct iothconf_param *param);
+int iothconf_dhcp  (struct ioth *stack, unsigned int ifindex, const struct iothconf_param *param);
+int iothconf_dhcpv6(struct ioth *stack, unsigned int ifindex, const struct iothconf_param *param);
+int iothconf_rd    (struct ioth *stack, unsigned int ifindex, const struct iothconf_param *param);
+
+/* param can be NULL: no grace period */
+void iothconf_ip_update(struct ioth *stack, unsigned int ifindex, uint8_t type,
+		const struct iothconf_param *param);
 void iothconf_ip_clean(struct ioth *stack, unsigned int ifindex, uint8_t type, uint32_t config_flags);
+/* stop and join the threads which remove the deprecated addresses of stack */
+void iothconf_ip_stop(struct ioth *stack);
+
+/* duplicate address detection: iothconf_dad6_probe sends the first probes, it must be
+	 called before iothconf_ip_update installs the addresses, iothconf_dad6_start completes
+	 the detection in background. iothconf_dad6_stop joins the threads of a stack */
+struct iothconf_stablekey;
+struct iothconf_dad;
+struct iothconf_dad *iothconf_dad6_probe(struct ioth *stack, unsigned int ifindex, uint8_t type,
+		const struct iothconf_stablekey *stablekey, const uint8_t *macaddr, size_t macaddrlen);
+void iothconf_dad6_start(struct iothconf_dad *da);
+void iothconf_dad6_stop(struct ioth *stack);
+
+/* store the configuration data of a parsed reply (see iothconf_parse.h), as the engines do.
+	 They are used to replay captured messages (see ioth_config_capture). */
+struct iothconf_dhcp_msg;
+struct iothconf_dhcp6_msg;
+struct iothconf_ra_msg;
+void iothconf_dhcp_store(struct ioth *stack, unsigned int ifindex, time_t timestamp,
+		const struct iothconf_dhcp_msg *msg);
+void iothconf_dhcp6_store(struct ioth *stack, unsigned int ifindex, time_t timestamp,
+		const struct iothconf_dhcp6_msg *msg);
+/* macaddr: 6 bytes, used by slaac (param->config_flags & IOTHCONF_RD_SLAAC) */
+void iothconf_rd_store(struct ioth *stack, unsigned int ifindex, time_t timestamp,
+		const struct in6_addr *router, const struct iothconf_ra_msg *ra,
+		const struct iothconf_param *param, const struct iothconf_stablekey *stablekey,
+		uint8_t *macaddr);
+
+/* compose the messages sent by the engines (used by the engines and by the benchmarks):
+	 iothconf_dhcp_build: DHCPDISCOVER, DHCPREQUEST, DHCPDECLINE (IP+UDP+DHCP) in buf
+	 (IOTHCONF_DHCP_MAXLEN bytes), iothconf_dhcp6_build: SOLICIT, REQUEST in a malloc-ed buffer,
+	 iothconf_rs_build: router solicitation in buf (IOTHCONF_RS_LEN bytes).
+	 They return the length of the message (iothconf_dhcp6_build: *len) */
+#define IOTHCONF_DHCP_MAXLEN 576
+#define IOTHCONF_RS_LEN 16
+size_t iothconf_dhcp_build(void *buf, int type, const uint8_t *xid, const uint8_t *macaddr,
+		struct in_addr clientaddr, struct in_addr serveraddr, const char *fqdn);
+char *iothconf_dhcp6_build(int type, const uint8_t *tid, const uint8_t *duid, uint16_t duidlen,
+		const uint8_t *serverid, uint16_t serveridlen, const char *fqdn, const uint8_t *macaddr,
+		const uint8_t *iana_addr, uint16_t iana_addrlen, size_t *len);
+size_t iothconf_rs_build(void *buf, const uint8_t *macaddr);
 
 void iothconf_data_debug(struct ioth *stack, unsigned int ifindex);
 
-char *iothconf_resolvconf(struct ioth *stack, uint32_t ifindex);
+/* prio: sources of DNS data (IOTH_CONFDATA_*_TIMESTAMP) in priority order,
+	 NULL means iothconf_resolvconf_defprio (static, dhcpv6, dhcp, rd) */
+#define IOTHCONF_DNS_NSOURCES 4
+extern const uint8_t iothconf_resolvconf_defprio[IOTHCONF_DNS_NSOURCES];
+char *iothconf_resolvconf(struct ioth *stack, uint32_t ifindex, const uint8_t *prio);
+/* free the cached resolv.conf strings of stack (ioth_config_release) */
+void iothconf_resolvconf_release(struct ioth *stack);
 #endif
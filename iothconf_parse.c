@@ -0,0 +1,340 @@
+/*
+ *   iothconf_parse.c: auto configuration library for ioth
+ *       parsers of DHCPv4, DHCPv6 and router advertisement messages
+ *
+ *   Copyright 2021 Renzo Davoli - Virtual Square Team
+ *   University of Bologna - Italy
+ *
+ *   This library is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or (at
+ *   your option) any later version.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <netinet/icmp6.h>
+
+#include <iothconf.h>
+#include <iothconf_data.h>
+#include <iothconf_parse.h>
+
+#define DHCP_CLIENTPORT 68
+#define DHCP_SERVERPORT 67
+#define BOOTP_LEN 236
+#define BOOTP_REPLY 2
+
+#define DHCP_OPT_PAD        0
+#define DHCP_OPT_MASK       1
+#define DHCP_OPT_ROUTER     3
+#define DHCP_OPT_DNS        6
+#define DHCP_OPT_DOMNAME   15
+#define DHCP_OPT_LEASETIME 51
+#define DHCP_OPT_TYPE      53
+#define DHCP_OPT_SERVID    54
+#define DHCP_OPT_END      255
+
+#define DHCP6_OPT_CLIENTID     1
+#define DHCP6_OPT_SERVERID     2
+#define DHCP6_OPT_IA_NA        3
+#define DHCP6_OPT_IAADDR       5
+#define DHCP6_OPT_DNS_SERVERS 23
+#define DHCP6_OPT_DOMAIN_LIST 24
+
+#define DNS_LABEL_MAXLEN 63
+
+static const uint8_t dhcp_cookie[] = {0x63, 0x82, 0x53, 0x63};
+
+static inline uint16_t get16(const uint8_t *p) {
+	return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+	return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* IP checksum */
+unsigned int iothconf_chksum(unsigned int sum, void *vbuf, size_t len) {
+	uint8_t *buf=vbuf;
+	unsigned int i;
+	for (i = 0; i < len; i++)
+		sum += (i & 1)? buf[i]: buf[i]<<8;
+	sum = (sum>>16) + (sum & 0xffff);
+	sum = (sum>>16) + (sum & 0xffff);
+	return sum;
+}
+
+/* mask to prefix conversion. e.g.: 255.255.255.0 -> 24 */
+static uint8_t mask2prefix(uint32_t mask) {
+	int i;
+	for (i = 0;i < 32; i++, mask >>= 1)
+		if (mask & 1)
+			break;
+	return 32 - i;
+}
+
+int iothconf_dhcp_nextopt(uint8_t *buf, size_t len, size_t *pos, uint8_t **value, size_t *optlen) {
+	while (*pos < len && buf[*pos] == DHCP_OPT_PAD)
+		(*pos)++;
+	if (*pos >= len || buf[*pos] == DHCP_OPT_END)
+		return -1;
+	if (*pos + 2 > len || *pos + 2 + buf[*pos + 1] > len)
+		return -1;
+	int code = buf[*pos];
+	*optlen = buf[*pos + 1];
+	*value = buf + *pos + 2;
+	*pos += 2 + *optlen;
+	return code;
+}
+
+int iothconf_dhcp6_nextopt(uint8_t *buf, size_t len, size_t *pos, uint8_t **value, size_t *optlen) {
+	if (*pos + 4 > len)
+		return -1;
+	int code = get16(buf + *pos);
+	size_t thislen = get16(buf + *pos + 2);
+	if (*pos + 4 + thislen > len)
+		return -1;
+	*optlen = thislen;
+	*value = buf + *pos + 4;
+	*pos += 4 + thislen;
+	return code;
+}
+
+int iothconf_ra_nextopt(uint8_t *buf, size_t len, size_t *pos, uint8_t **value, size_t *optlen) {
+	if (*pos + 2 > len)
+		return -1;
+	size_t thislen = 8 * buf[*pos + 1];
+	if (thislen == 0 || *pos + thislen > len)
+		return -1;
+	*optlen = thislen;
+	*value = buf + *pos;
+	*pos += thislen;
+	return (*value)[0];
+}
+
+int iothconf_dhcp_parse(void *buf, size_t len, struct iothconf_dhcp_msg *msg) {
+	uint8_t *pkt = buf;
+	struct iphdr iph;
+	struct udphdr udph;
+	if (len < sizeof(iph))
+		return -1;
+	memcpy(&iph, pkt, sizeof(iph));
+	size_t iphlen = iph.ihl * 4;
+	size_t hdrlen = iphlen + sizeof(udph) + BOOTP_LEN + sizeof(dhcp_cookie);
+	if (iph.version != 4 || iphlen < sizeof(iph) || len < hdrlen)
+		return -1;
+	if (iothconf_chksum(0, pkt, iphlen) != 0xffff)
+		return -1;
+	if (iph.protocol != IPPROTO_UDP)
+		return -1;
+	/* ignore the link layer padding */
+	if (ntohs(iph.tot_len) < hdrlen || ntohs(iph.tot_len) > len)
+		return -1;
+	len = ntohs(iph.tot_len);
+	memcpy(&udph, pkt + iphlen, sizeof(udph));
+	if (udph.uh_sport != htons(DHCP_SERVERPORT) || udph.uh_dport != htons(DHCP_CLIENTPORT))
+		return -1;
+	uint8_t *bootp = pkt + iphlen + sizeof(udph);
+	if (bootp[0] != BOOTP_REPLY || memcmp(bootp + BOOTP_LEN, dhcp_cookie, sizeof(dhcp_cookie)) != 0)
+		return -1;
+	*msg = (struct iothconf_dhcp_msg) {0};
+	memcpy(msg->xid, bootp + 4, sizeof(msg->xid));
+	memcpy(&msg->yiaddr, bootp + 16, sizeof(msg->yiaddr));
+	uint8_t *opts = pkt + hdrlen;
+	size_t optslen = len - hdrlen;
+	size_t pos = 0;
+	uint8_t *value;
+	size_t optlen;
+	int code;
+	while ((code = iothconf_dhcp_nextopt(opts, optslen, &pos, &value, &optlen)) >= 0) {
+		switch (code) {
+			case DHCP_OPT_TYPE:
+				if (optlen >= 1)
+					msg->type = value[0];
+				break;
+			case DHCP_OPT_SERVID:
+				if (optlen >= sizeof(struct in_addr))
+					msg->server = value;
+				break;
+			case DHCP_OPT_MASK:
+				if (optlen >= sizeof(uint32_t))
+					msg->prefixlen = mask2prefix(get32(value));
+				break;
+			case DHCP_OPT_LEASETIME:
+				if (optlen >= sizeof(uint32_t))
+					msg->leasetime = get32(value);
+				break;
+			case DHCP_OPT_ROUTER:
+				msg->router = value;
+				msg->routerlen = optlen - optlen % sizeof(struct in_addr);
+				break;
+			case DHCP_OPT_DNS:
+				msg->dns = value;
+				msg->dnslen = optlen - optlen % sizeof(struct in_addr);
+				break;
+			case DHCP_OPT_DOMNAME:
+				msg->domain = (char *) value;
+				msg->domainlen = optlen;
+				break;
+		}
+	}
+	return 0;
+}
+
+int iothconf_dhcp6_parse(void *buf, size_t len, struct iothconf_dhcp6_msg *msg) {
+	uint8_t *pkt = buf;
+	if (len < 4)
+		return -1;
+	*msg = (struct iothconf_dhcp6_msg) {.type = pkt[0]};
+	memcpy(msg->tid, pkt + 1, sizeof(msg->tid));
+	uint8_t *opts = pkt + 4;
+	size_t optslen = len - 4;
+	size_t pos = 0;
+	uint8_t *value;
+	size_t optlen;
+	while (pos < optslen) {
+		int code = iothconf_dhcp6_nextopt(opts, optslen, &pos, &value, &optlen);
+		switch (code) {
+			case -1:
+				return -1;
+			case DHCP6_OPT_CLIENTID:
+				msg->clientid = value;
+				msg->clientidlen = optlen;
+				break;
+			case DHCP6_OPT_SERVERID:
+				msg->serverid = value;
+				msg->serveridlen = optlen;
+				break;
+			case DHCP6_OPT_IA_NA:
+				if (optlen >= 12) {
+					msg->iana = value;
+					msg->ianalen = optlen;
+				}
+				break;
+			case DHCP6_OPT_DNS_SERVERS:
+				msg->dns = value;
+				msg->dnslen = optlen - optlen % sizeof(struct in6_addr);
+				break;
+			case DHCP6_OPT_DOMAIN_LIST:
+				msg->domain = value;
+				msg->domainlen = optlen;
+				break;
+		}
+	}
+	return 0;
+}
+
+int iothconf_dhcp6_nextiaaddr(uint8_t *iana, size_t ianalen, size_t *pos, struct ioth_confdata_ip6addr *addr) {
+	uint8_t *value;
+	size_t optlen;
+	int code;
+	if (ianalen < 12)
+		return -1;
+	while ((code = iothconf_dhcp6_nextopt(iana + 12, ianalen - 12, pos, &value, &optlen)) >= 0) {
+		if (code == DHCP6_OPT_IAADDR && optlen >= sizeof(struct in6_addr) + 2 * sizeof(uint32_t)) {
+			*addr = (struct ioth_confdata_ip6addr) {.prefixlen = 128};
+			memcpy(&addr->addr, value, sizeof(addr->addr));
+			addr->preferred_lifetime = get32(value + sizeof(struct in6_addr));
+			addr->valid_lifetime = get32(value + sizeof(struct in6_addr) + sizeof(uint32_t));
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int iothconf_ra_parse(void *buf, size_t len, struct iothconf_ra_msg *msg) {
+	uint8_t *pkt = buf;
+	struct nd_router_advert ra;
+	if (len < sizeof(ra))
+		return -1;
+	memcpy(&ra, pkt, sizeof(ra));
+	if (ra.nd_ra_type != ND_ROUTER_ADVERT || ra.nd_ra_code != 0)
+		return -1;
+	*msg = (struct iothconf_ra_msg) {
+		.flags = ra.nd_ra_flags_reserved,
+		.router_lifetime = ntohs(ra.nd_ra_router_lifetime),
+	};
+	uint8_t *opts = pkt + sizeof(ra);
+	size_t optslen = len - sizeof(ra);
+	size_t pos = 0;
+	uint8_t *value;
+	size_t optlen;
+	while (pos < optslen) {
+		switch (iothconf_ra_nextopt(opts, optslen, &pos, &value, &optlen)) {
+			case -1:
+				return -1;
+			case ND_OPT_PREFIX_INFORMATION:
+				{
+					struct nd_opt_prefix_info pi;
+					if (optlen < sizeof(pi) || msg->nprefixes >= IOTHCONF_RA_MAXPREFIX)
+						break;
+					memcpy(&pi, value, sizeof(pi));
+					if (pi.nd_opt_pi_prefix_len > 128)
+						break;
+					msg->prefixes[msg->nprefixes++] = (struct iothconf_ra_prefix) {
+						.prefix = pi.nd_opt_pi_prefix,
+						.prefixlen = pi.nd_opt_pi_prefix_len,
+						.flags = pi.nd_opt_pi_flags_reserved,
+						.preferred_lifetime = ntohl(pi.nd_opt_pi_preferred_time),
+						.valid_lifetime = ntohl(pi.nd_opt_pi_valid_time),
+					};
+				}
+				break;
+			case ND_OPT_MTU:
+				{
+					struct nd_opt_mtu mtu;
+					if (optlen < sizeof(mtu))
+						break;
+					memcpy(&mtu, value, sizeof(mtu));
+					msg->mtu = ntohl(mtu.nd_opt_mtu_mtu);
+				}
+				break;
+		}
+	}
+	return 0;
+}
+
+/* when mstr is full the names that do not fit are dropped */
+int iothconf_domain2mstr(uint8_t *domain, size_t len, char *mstr, size_t size) {
+	size_t pos = 0;
+	size_t out = 0;
+	while (pos < len) {
+		size_t start = out;
+		size_t namelen = 0;
+		for (;;) {
+			if (pos >= len)
+				return -1;
+			uint8_t labellen = domain[pos++];
+			if (labellen == 0)
+				break;
+			/* compression pointers (0xc0) are > DNS_LABEL_MAXLEN too */
+			if (labellen > DNS_LABEL_MAXLEN || pos + labellen > len)
+				return -1;
+			if (namelen + (namelen > 0) + labellen >= IOTH_DNSDOMAIN_MAXLEN)
+				return -1;
+			if (out + (namelen > 0) + labellen + 1 > size)
+				return start;
+			if (namelen > 0)
+				mstr[out++] = '.', namelen++;
+			for (uint8_t i = 0; i < labellen; i++) {
+				uint8_t c = domain[pos++];
+				if (c <= ' ' || c >= 0x7f || c == '.')
+					return -1;
+				mstr[out++] = c;
+			}
+			namelen += labellen;
+		}
+		/* skip empty (root) names */
+		if (namelen > 0)
+			mstr[out++] = 0;
+	}
+	return out;
+}
@@ -0,0 +1,95 @@
+#ifndef IOTHCONF_PARSE_H
+#define IOTHCONF_PARSE_H
+#include <stdint.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+/* parsers of the DHCPv4, DHCPv6 and router advertisement messages.
+	 The parsers work on a buffer (no sockets, no state): all the length fields
+	 read from the wire are checked against the size of the buffer.
+	 Pointers in the parsed messages refer to the input buffer. */
+
+/* IP checksum (one's complement sum of 16 bit words) */
+unsigned int iothconf_chksum(unsigned int sum, void *vbuf, size_t len);
+
+/* option iterators: *pos is the offset of the next option (set it to 0 to start).
+	 They return the option code (*value and *optlen are set to the option payload),
+	 -1 at the end of the options or if the next option is truncated */
+int iothconf_dhcp_nextopt(uint8_t *buf, size_t len, size_t *pos, uint8_t **value, size_t *optlen);
+int iothconf_dhcp6_nextopt(uint8_t *buf, size_t len, size_t *pos, uint8_t **value, size_t *optlen);
+/* RA options: the option length includes the type and length fields,
+	 the iterator fails on zero length options */
+int iothconf_ra_nextopt(uint8_t *buf, size_t len, size_t *pos, uint8_t **value, size_t *optlen);
+
+/* DHCPv4 reply: IP header, UDP header, bootp header, cookie and options.
+	 iothconf_dhcp_parse returns -1 if the packet is not a well formed DHCP reply
+	 (IP checksum, UDP ports, bootp op, cookie) */
+struct iothconf_dhcp_msg {
+	uint8_t xid[4];
+	struct in_addr yiaddr;
+	uint8_t type;
+	uint8_t prefixlen;
+	uint32_t leasetime;
+	uint8_t *server; // 4 bytes, NULL if missing
+	uint8_t *router; // list of IPv4 addresses
+	size_t routerlen;
+	uint8_t *dns;    // list of IPv4 addresses
+	size_t dnslen;
+	char *domain;    // not null terminated
+	size_t domainlen;
+};
+int iothconf_dhcp_parse(void *buf, size_t len, struct iothconf_dhcp_msg *msg);
+
+/* DHCPv6 message (UDP payload).
+	 iana is the IA_NA option payload (iaid, t1, t2, options), ianalen >= 12.
+	 iothconf_dhcp6_parse returns -1 if the message is truncated */
+struct iothconf_dhcp6_msg {
+	uint8_t type;
+	uint8_t tid[3];
+	uint8_t *clientid;
+	size_t clientidlen;
+	uint8_t *serverid;
+	size_t serveridlen;
+	uint8_t *iana;
+	size_t ianalen;
+	uint8_t *dns;    // list of IPv6 addresses
+	size_t dnslen;
+	uint8_t *domain; // RFC 1035 encoded list of domains
+	size_t domainlen;
+};
+int iothconf_dhcp6_parse(void *buf, size_t len, struct iothconf_dhcp6_msg *msg);
+
+/* IAADDR options of an IA_NA: iterate on *pos as iothconf_dhcp6_nextopt.
+	 return 0 and set addr (prefixlen 128), -1 at the end */
+struct ioth_confdata_ip6addr;
+int iothconf_dhcp6_nextiaaddr(uint8_t *iana, size_t ianalen, size_t *pos, struct ioth_confdata_ip6addr *addr);
+
+/* router advertisement (ICMPv6 message). Prefixes beyond IOTHCONF_RA_MAXPREFIX are ignored.
+	 iothconf_ra_parse returns -1 if the message is not a valid RA (RFC 4861 6.1.2:
+	 truncated message, code != 0, options with zero length or truncated) */
+#define IOTHCONF_RA_MAXPREFIX 8
+struct iothconf_ra_prefix {
+	struct in6_addr prefix;
+	uint8_t prefixlen;
+	uint8_t flags;
+	uint32_t preferred_lifetime;
+	uint32_t valid_lifetime;
+};
+
+struct iothconf_ra_msg {
+	uint8_t flags;
+	uint16_t router_lifetime;
+	uint32_t mtu; // 0 if missing
+	int nprefixes;
+	struct iothconf_ra_prefix prefixes[IOTHCONF_RA_MAXPREFIX];
+};
+int iothconf_ra_parse(void *buf, size_t len, struct iothconf_ra_msg *msg);
+
+/* convert an rfc1035 encoded sequence of domain names (len bytes) in a multistring
+	 (sequence of null terminated strings) stored in mstr (size bytes, len bytes are always enough).
+	 compressed names, labels longer than 63 bytes, names longer than IOTH_DNSDOMAIN_MAXLEN,
+	 non printable chars and truncated names are rejected.
+	 it returns the length of the multistring, -1 in case of error */
+int iothconf_domain2mstr(uint8_t *domain, size_t len, char *mstr, size_t size);
+
+#endif
@@ -34,6 +34,10 @@
 #include <iothconf_mod.h>
 #include <iothconf_data.h>
 #include <iothconf_hash.h>
+#include <iothconf_retry.h>
+#include <iothconf_stats.h>
+#include <iothconf_parse.h>
+#include <iothconf_capture.h>
 
 struct icmp6_LLA_attr {
 	uint8_t type;
@@ -43,32 +47,129 @@ struct icmp6_LLA_attr {
 
 struct in6_addr ll_allrouters = {.s6_addr = {0xff,0x02, [15]=0x02}};
 
+/* router solicitation retransmissions (RFC 4861 6.3.7):
+	 by default a single solicitation is sent. RD_MAX_RT is RTR_SOLICITATION_INTERVAL */
 #define RD_TIMEOUT 1000
+#define RD_MAX_RT 4000
+#define RD_MAX_RC 0
 
-static int iothconf_rd_proto(struct ioth *stack, unsigned int ifindex, const char *fqdn, uint32_t config_flags) {
-	struct {
-		struct icmp6_hdr h;
-		struct icmp6_LLA_attr l;
-	} msg = {
+/* RFC 7217 DAD_Counter: it is stored in the flags field of the RD6_ADDR record
+	 so that the address computed after a DAD failure is kept at each refresh */
+struct rd_dad_counter {
+	struct in6_addr *prefix;
+	uint8_t dad_counter;
+};
+
+static int rd_dad_counter_cb(void *data, void *arg) {
+	struct rd_dad_counter *dc = arg;
+	struct ioth_confdata_ip6addr *ipaddr = data;
+	if (memcmp(ipaddr->addr.s6_addr, dc->prefix->s6_addr, 8) == 0) {
+		dc->dad_counter = ipaddr->flags;
+		return IOTH_CONFDATA_FORALL_BREAK;
+	}
+	return 0;
+}
+
+static uint8_t rd_dad_counter(struct ioth *stack, unsigned int ifindex, struct in6_addr *prefix) {
+	struct rd_dad_counter dc = {prefix, 0};
+	ioth_confdata_forall(stack, ifindex, IOTH_CONFDATA_RD6_ADDR, rd_dad_counter_cb, &dc);
+	return dc.dad_counter;
+}
+
+/* store the configuration data of a router advertisement.
+	 SLAAC addresses are computed from the MAC address (or fqdn or stable key, see param) */
+void iothconf_rd_store(struct ioth *stack, unsigned int ifindex, time_t timestamp,
+		const struct in6_addr *router, const struct iothconf_ra_msg *ra,
+		const struct iothconf_param *param, const struct iothconf_stablekey *stablekey,
+		uint8_t *macaddr) {
+	const char *fqdn = param->fqdn;
+	uint32_t config_flags = param->config_flags;
+	/* the hash based interface id is the same for all the prefixes */
+	struct ioth_hashid fqdn_id;
+	if (stablekey == NULL && fqdn != NULL)
+		ioth_hashid(fqdn, &fqdn_id);
+	ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_RD6_ROUTER, timestamp, 0, struct ioth_confdata_ip6addr,
+			.addr = *router,
+			.flags = ra->flags,
+			.valid_lifetime = ra->router_lifetime);
+	for (int i = 0; i < ra->nprefixes; i++) {
+		const struct iothconf_ra_prefix *this = &ra->prefixes[i];
+		ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_RD6_PREFIX, timestamp, 0, struct ioth_confdata_ip6addr,
+				.addr = this->prefix,
+				.flags = this->flags,
+				.prefixlen = this->prefixlen,
+				.preferred_lifetime = this->preferred_lifetime,
+				.valid_lifetime = this->valid_lifetime);
+		if (config_flags & IOTHCONF_RD_SLAAC && this->prefixlen == 64 &&
+				((this->flags & ND_OPT_PI_FLAG_AUTO) || fqdn != NULL)) {
+			struct in6_addr addr = this->prefix;
+			uint8_t dad_counter = 0;
+			if (stablekey != NULL)
+				dad_counter = iothconf_stableaddr6(&addr, stablekey, macaddr, sizeof(((struct icmp6_LLA_attr *) 0)->addr),
+						NULL, 0, rd_dad_counter(stack, ifindex, &addr));
+			else if (fqdn != NULL)
+				iothconf_hashaddr6_id(&addr, &fqdn_id);
+			else
+				iothconf_eui64(&addr, macaddr);
+			ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_RD6_ADDR, timestamp, 0, struct ioth_confdata_ip6addr,
+					.addr = addr,
+					.flags = dad_counter,
+					.prefixlen = this->prefixlen,
+					.preferred_lifetime = this->preferred_lifetime,
+					.valid_lifetime = this->valid_lifetime);
+		}
+	}
+	if (ra->mtu != 0)
+		ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_RD6_MTU, timestamp, 0, uint32_t, ra->mtu);
+	ioth_confdata_write_timestamp(stack, ifindex, IOTH_CONFDATA_RD6_TIMESTAMP, timestamp);
+}
+
+struct rd_rs {
+	struct icmp6_hdr h;
+	struct icmp6_LLA_attr l;
+};
+
+/* compose a router solicitation (with the source link-layer address option) in buf
+	 (IOTHCONF_RS_LEN bytes), return its length */
+size_t iothconf_rs_build(void *buf, const uint8_t *macaddr) {
+	struct rd_rs *msg = buf;
+	*msg = (struct rd_rs) {
 		.h.icmp6_type = ND_ROUTER_SOLICIT,
 		.l.type = ND_OPT_SOURCE_LINKADDR,
 		.l.len = sizeof(struct icmp6_LLA_attr) / 8,
 	};
+	memcpy(msg->l.addr, macaddr, sizeof(msg->l.addr));
+	return sizeof(*msg);
+}
+
+static int iothconf_rd_proto(struct ioth *stack, unsigned int ifindex, const struct iothconf_param *param,
+		const struct iothconf_stablekey *stablekey) {
+	struct rd_rs msg;
+	uint8_t macaddr[6];
 	time_t ioth_timestamp = ioth_confdata_new_timestamp(stack, ifindex, IOTH_CONFDATA_RD6_TIMESTAMP);
-	ioth_linkgetaddr(stack, ifindex, msg.l.addr);
+	ioth_linkgetaddr(stack, ifindex, macaddr);
+	iothconf_rs_build(&msg, macaddr);
 	struct sockaddr_in6 dst = {
 		.sin6_family = AF_INET6,
 		.sin6_addr = ll_allrouters,
+		.sin6_scope_id = ifindex,
 	};
 	struct sockaddr_in6 router;
 	socklen_t routerlen = sizeof(router);
 	int hoplimit = 255;
 	int sd = ioth_msocket(stack, AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
 	ioth_setsockopt(sd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hoplimit, sizeof(hoplimit));
+	struct iothconf_backoff backoff;
+	iothconf_initial_delay(&param->retry);
+	iothconf_backoff_init(&backoff, &param->retry, RD_TIMEOUT, RD_MAX_RT, RD_MAX_RC, 0, -1);
+	int timeout = iothconf_backoff_next(&backoff);
+	uint64_t rs_start = iothconf_stats_now();
+	iothconf_ratelimit();
+	iothconf_capture_icmp6(ifindex, IOTHCONF_CAPTURE_OUT, NULL, &dst.sin6_addr, &msg, sizeof(msg));
 	int rv = ioth_sendto(sd, &msg, sizeof(msg), 0, (void *) &dst, sizeof(dst));
+	iothconf_stats_count(stack, ifindex, IOTHCONF_COUNT_RD_TX_RS, 1);
 
 	struct pollfd pfd[] = {{sd, POLLIN, 0}};
-	int timeout = RD_TIMEOUT;
 	struct timeval start;
 	struct timeval end;
 	struct timeval timediff;
@@ -77,63 +178,40 @@ static int iothconf_rd_proto(struct ioth *stack, unsigned int ifindex, const cha
 		gettimeofday(&start, NULL);
 		event = poll(pfd, 1, timeout);
 		if (event == 0) {
-			ioth_close(sd);
-			return errno = ETIME, -1;
+			if ((timeout = iothconf_backoff_next(&backoff)) < 0) {
+				ioth_close(sd);
+				iothconf_stats_count(stack, ifindex, IOTHCONF_COUNT_RD_TIMEOUT, 1);
+				return errno = ETIME, -1;
+			}
+			iothconf_ratelimit();
+			iothconf_capture_icmp6(ifindex, IOTHCONF_CAPTURE_OUT, NULL, &dst.sin6_addr, &msg, sizeof(msg));
+			ioth_sendto(sd, &msg, sizeof(msg), 0, (void *) &dst, sizeof(dst));
+			iothconf_stats_count(stack, ifindex, IOTHCONF_COUNT_RD_TX_RS, 1);
+			iothconf_stats_count(stack, ifindex, IOTHCONF_COUNT_RD_RETRY, 1);
+			continue;
 		}
 		rv = ioth_recvfrom(sd, NULL, 0, MSG_PEEK|MSG_TRUNC, (void *) &router, &routerlen);
 		// printf("%d\n", rv);
-		uint8_t inbuf[rv];
-		rv = ioth_recvfrom(sd, inbuf, rv, 0, (void *) &router, &routerlen);
-
-		uint8_t *limit = inbuf + rv;
-		struct nd_router_advert *inh = (void *) inbuf;
-
-		if (inh->nd_ra_type == ND_ROUTER_ADVERT) {
-			unsigned char *opt = (void *) (inh + 1);
-			ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_RD6_ROUTER, ioth_timestamp, 0, struct ioth_confdata_ip6addr,
-					.addr = router.sin6_addr,
-					.flags = inh->nd_ra_flags_reserved,
-					.valid_lifetime = ntohs(inh->nd_ra_router_lifetime));
-			while (opt < limit) {
-				struct nd_opt_hdr *opth = (void *) opt;
-				switch (opth->nd_opt_type)  {
-					case ND_OPT_PREFIX_INFORMATION:
-						{
-							struct nd_opt_prefix_info *this = (void *) opt;
-							ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_RD6_PREFIX, ioth_timestamp, 0, struct ioth_confdata_ip6addr,
-									.addr = this->nd_opt_pi_prefix,
-									.flags = this->nd_opt_pi_flags_reserved,
-									.prefixlen = this->nd_opt_pi_prefix_len,
-									.preferred_lifetime = ntohl(this->nd_opt_pi_preferred_time),
-									.valid_lifetime = ntohl(this->nd_opt_pi_valid_time));
-							if (config_flags & IOTHCONF_RD_SLAAC && this->nd_opt_pi_prefix_len == 64 &&
-									((this->nd_opt_pi_flags_reserved & ND_OPT_PI_FLAG_AUTO) || fqdn != NULL)) {
-								struct in6_addr addr = this->nd_opt_pi_prefix;
-								if (fqdn != NULL)
-									iothconf_hashaddr6(&addr, fqdn);
-								else
-									iothconf_eui64(&addr, msg.l.addr);
-								ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_RD6_ADDR, ioth_timestamp, 0, struct ioth_confdata_ip6addr,
-										.addr = addr,
-										.flags = 0,
-										.prefixlen = this->nd_opt_pi_prefix_len,
-										.preferred_lifetime = ntohl(this->nd_opt_pi_preferred_time),
-										.valid_lifetime = ntohl(this->nd_opt_pi_valid_time));
-
-							}
-						}
-						break;
-					case ND_OPT_MTU:
-						{
-							struct nd_opt_mtu *this = (void *) opt;
-							ioth_confdata_add_data(stack, ifindex, IOTH_CONFDATA_RD6_MTU, ioth_timestamp, 0, uint32_t, this->nd_opt_mtu_mtu);
-						}
-						break;
-				}
-				opt += 8 * opth->nd_opt_len;
-			}
+		uint8_t inbuf[rv > 0 ? rv : 1];
+		rv = ioth_recvfrom(sd, inbuf, sizeof(inbuf), 0, (void *) &router, &routerlen);
+		/* the raw socket receives the messages of all the interfaces of the stack */
+		int otherif = rv > 0 && router.sin6_scope_id != ifindex;
+		if (rv > 0 && !otherif && inbuf[0] == ND_ROUTER_ADVERT)
+			iothconf_capture_icmp6(ifindex, IOTHCONF_CAPTURE_IN, &router.sin6_addr, NULL, inbuf, rv);
+
+		struct iothconf_ra_msg ra;
+
+		if (otherif)
+			;
+		else if (rv > 0 && inbuf[0] != ND_ROUTER_ADVERT)
+			iothconf_stats_count(stack, ifindex, IOTHCONF_COUNT_RD_SPURIOUS, 1);
+		else if (rv < 0 || iothconf_ra_parse(inbuf, rv, &ra) < 0)
+			iothconf_stats_count(stack, ifindex, IOTHCONF_COUNT_PARSE_ERROR, 1);
+		else {
+			iothconf_stats_count(stack, ifindex, IOTHCONF_COUNT_RD_RX_RA, 1);
+			iothconf_stats_add(stack, ifindex, IOTHCONF_PHASE_RD, rs_start);
 			ioth_close(sd);
-			ioth_confdata_write_timestamp(stack, ifindex, IOTH_CONFDATA_RD6_TIMESTAMP, ioth_timestamp);
+			iothconf_rd_store(stack, ifindex, ioth_timestamp, &router.sin6_addr, &ra, param, stablekey, macaddr);
 			return 0;
 		}
 		gettimeofday(&end, NULL);
@@ -143,9 +221,23 @@ static int iothconf_rd_proto(struct ioth *stack, unsigned int ifindex, const cha
 	}
 }
 
-int iothconf_rd(struct ioth *stack, unsigned int ifindex, const char *fqdn, uint32_t config_flags) {
-	int rv = iothconf_rd_proto(stack, ifindex, fqdn, config_flags);
-	if (rv == 0)
-		iothconf_ip_update(stack, ifindex, IOTH_CONFDATA_RD6_TIMESTAMP, config_flags);
+int iothconf_rd(struct ioth *stack, unsigned int ifindex, const struct iothconf_param *param) {
+	uint32_t config_flags = param->config_flags;
+	uint8_t macaddr[sizeof(((struct icmp6_LLA_attr *) 0)->addr)];
+	struct iothconf_stablekey stablekey;
+	ioth_linkgetaddr(stack, ifindex, macaddr);
+	/* RFC 7217 secret key (ioth_config requires secret=... for stable) */
+	if (config_flags & IOTHCONF_RD_STABLE)
+		iothconf_stablekey(&stablekey, param->secret, strlen(param->secret));
+	int rv = iothconf_rd_proto(stack, ifindex, param,
+			(config_flags & IOTHCONF_RD_STABLE) ? &stablekey : NULL);
+	if (rv == 0) {
+		struct iothconf_dad *dad = NULL;
+		if (config_flags & IOTHCONF_DAD)
+			dad = iothconf_dad6_probe(stack, ifindex, IOTH_CONFDATA_RD6_ADDR,
+					(config_flags & IOTHCONF_RD_STABLE) ? &stablekey : NULL, macaddr, sizeof(macaddr));
+		iothconf_ip_update(stack, ifindex, IOTH_CONFDATA_RD6_TIMESTAMP, param);
+		iothconf_dad6_start(dad);
+	}
 	return rv;
 }
@@ -0,0 +1,137 @@
+/*
+ *   iothconf_retry.c: auto configuration library for ioth
+ *       randomized exponential backoff of the retransmissions
+ *
+ *   Copyright 2021 Renzo Davoli - Virtual Square Team
+ *   University of Bologna - Italy
+ *
+ *   This library is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or (at
+ *   your option) any later version.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/random.h>
+
+#include <iothconf_mod.h>
+#include <iothconf_retry.h>
+
+/* random value in the range -range ... +range */
+static int backoff_rand(int range) {
+	uint32_t r;
+	if (range <= 0 || getrandom(&r, sizeof(r), 0) < 0)
+		return 0;
+	return (int) (r % (2 * (uint32_t) range + 1)) - range;
+}
+
+static int backoff_jitter(struct iothconf_backoff *backoff, int rt) {
+	int jitter = (backoff->jitter < 0) ? rt / 10 : backoff->jitter;
+	rt += backoff_rand(jitter);
+	return rt > 0 ? rt : 1;
+}
+
+void iothconf_backoff_init(struct iothconf_backoff *backoff, const struct iothconf_retry *retry,
+		int irt, int mrt, int mrc, int mrd, int jitter) {
+	*backoff = (struct iothconf_backoff) {
+		.irt = irt,
+		.mrt = mrt,
+		.mrc = mrc,
+		.mrd = mrd,
+		.jitter = jitter,
+	};
+	if (retry != NULL) {
+		if (retry->timeout > 0) backoff->irt = retry->timeout;
+		if (retry->retries >= 0) backoff->mrc = retry->retries;
+		if (retry->maxtime >= 0) backoff->mrd = retry->maxtime;
+	}
+	if (backoff->mrt < backoff->irt)
+		backoff->mrt = backoff->irt;
+	gettimeofday(&backoff->start, NULL);
+}
+
+void iothconf_initial_delay(const struct iothconf_retry *retry) {
+	if (retry != NULL && retry->delay > 0) {
+		int delay = (retry->delay + backoff_rand(retry->delay)) / 2;
+		struct timespec ts = {delay / 1000, (delay % 1000) * 1000000};
+		nanosleep(&ts, NULL);
+	}
+}
+
+/* token bucket: rate tokens per second, up to burst tokens.
+	 tokens can become negative: each caller reserves its token and sleeps
+	 until its token has been generated (callers are served in order) */
+static pthread_mutex_t ratelimit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int ratelimit_rate;
+static unsigned int ratelimit_burst;
+static double ratelimit_tokens;
+static struct timespec ratelimit_last;
+
+void ioth_config_ratelimit(unsigned int rate, unsigned int burst) {
+	pthread_mutex_lock(&ratelimit_mutex);
+	ratelimit_rate = rate;
+	ratelimit_burst = burst > 0 ? burst : 1;
+	ratelimit_tokens = ratelimit_burst;
+	clock_gettime(CLOCK_MONOTONIC, &ratelimit_last);
+	pthread_mutex_unlock(&ratelimit_mutex);
+}
+
+void iothconf_ratelimit(void) {
+	double wait = 0;
+	pthread_mutex_lock(&ratelimit_mutex);
+	if (ratelimit_rate > 0) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ratelimit_tokens += ((now.tv_sec - ratelimit_last.tv_sec) +
+				(now.tv_nsec - ratelimit_last.tv_nsec) / 1e9) * ratelimit_rate;
+		if (ratelimit_tokens > ratelimit_burst)
+			ratelimit_tokens = ratelimit_burst;
+		ratelimit_last = now;
+		ratelimit_tokens -= 1;
+		if (ratelimit_tokens < 0)
+			wait = -ratelimit_tokens / ratelimit_rate;
+	}
+	pthread_mutex_unlock(&ratelimit_mutex);
+	if (wait > 0) {
+		struct timespec ts = {(time_t) wait, (long) ((wait - (time_t) wait) * 1e9)};
+		nanosleep(&ts, NULL);
+	}
+}
+
+int iothconf_backoff_next(struct iothconf_backoff *backoff) {
+	int rt;
+	if (backoff->count > backoff->mrc)
+		return -1;
+	if (backoff->count == 0)
+		rt = backoff_jitter(backoff, backoff->irt);
+	else {
+		/* RT = 2*RTprev + RAND*RTprev, if RT > MRT: RT = MRT + RAND*MRT */
+		rt = (backoff->rt > backoff->mrt / 2) ? backoff->mrt : 2 * backoff->rt;
+		rt = backoff_jitter(backoff, rt);
+	}
+	if (backoff->mrd > 0) {
+		struct timeval now;
+		struct timeval elapsed;
+		gettimeofday(&now, NULL);
+		timersub(&now, &backoff->start, &elapsed);
+		int msecs = elapsed.tv_sec * 1000 + elapsed.tv_usec / 1000;
+		int left = backoff->mrd - (msecs > backoff->planned ? msecs : backoff->planned);
+		if (left <= 0)
+			return -1;
+		/* leave time for the remaining transmissions */
+		int share = left / (backoff->mrc + 1 - backoff->count);
+		if (rt > share)
+			rt = share > 0 ? share : 1;
+	}
+	backoff->planned += rt;
+	backoff->rt = rt;
+	backoff->count++;
+	return rt;
+}
@@ -0,0 +1,43 @@
+#ifndef IOTHCONF_RETRY_H
+#define IOTHCONF_RETRY_H
+#include <sys/time.h>
+
+/* randomized exponential backoff of the retransmissions (RFC 8415 section 15, RFC 2131 4.1)
+	 all the times are in msecs.
+	 irt: initial retransmission time, mrt: maximum retransmission time,
+	 mrc: maximum retransmission count, mrd: maximum retransmission duration (0 = unlimited).
+	 mrd bounds the start of the last transmission: the timeout of each transmission is
+	 at most an equal share of the time left for the remaining ones, so all the mrc + 1
+	 transmissions fit in mrd (e.g. 2000, 4000, 8000 msecs become 2000, 2000, 2000 if mrd = 6000)
+	 jitter: < 0: RT is randomized by +/-10% (RFC 8415),
+	         otherwise: RT is randomized by +/- jitter msecs (RFC 2131)
+	 The protocol defaults can be overridden by the retry policy of the interface
+	 (timeout, retries and maxtime options) */
+
+struct iothconf_retry;
+
+struct iothconf_backoff {
+	int irt;
+	int mrt;
+	int mrc;
+	int mrd;
+	int jitter;
+	int rt;
+	int count;
+	int planned; // start of the next transmission (msecs since start, sum of the timeouts)
+	struct timeval start;
+};
+
+void iothconf_backoff_init(struct iothconf_backoff *backoff, const struct iothconf_retry *retry,
+		int irt, int mrt, int mrc, int mrd, int jitter);
+
+/* timeout of the next (re)transmission, -1 if the exchange must give up */
+int iothconf_backoff_next(struct iothconf_backoff *backoff);
+
+/* random delay (0 ... retry->delay msecs) before the first message of an exchange */
+void iothconf_initial_delay(const struct iothconf_retry *retry);
+
+/* process-wide token bucket (see ioth_config_ratelimit):
+	 wait for a token before sending a configuration message */
+void iothconf_ratelimit(void);
+#endif
@@ -0,0 +1,346 @@
+/*
+ *   iothconf_save.c: save/restore the configuration data (warm restart)
+ *
+ *   Copyright 2021 Renzo Davoli - Virtual Square Team
+ *   University of Bologna - Italy
+ *
+ *   This library is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or (at
+ *   your option) any later version.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <iothconf.h>
+#include <iothconf_data.h>
+#include <iothconf_mod.h>
+
+/* file format: a header followed by nrecords records. All the fields are in host byte order
+	 (a byte swapped magic number is rejected), each record is 8 byte aligned: a mmapped
+	 file can be scanned in place.
+	 Only the records acquired by dhcp, dhcpv6 and rd are saved: the static records are
+	 defined by the configuration string.
+	 expire is the absolute time (seconds since the Epoch) when the record becomes invalid:
+	 the lifetime of addresses, prefixes and routers, the longest lifetime of the addresses
+	 of the same source and interface for the other records (dns, domain, mtu...). */
+
+#define IOTHCONF_SAVE_MAGIC 0x494f5443 // "IOTC"
+#define IOTHCONF_SAVE_VERSION 1
+#define IOTHCONF_SAVE_INFINITY UINT64_MAX
+#define IOTHCONF_SAVE_ALIGN(X) (((X) + 7) & ~((size_t) 7))
+
+struct iothconf_save_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t hdrlen; // length of the header: the records start at hdrlen
+	uint32_t nrecords;
+	uint32_t len; // length of the whole snapshot
+	uint64_t saved; // time of the snapshot (seconds since the Epoch)
+};
+
+struct iothconf_save_rec {
+	uint64_t expire;
+	uint64_t timestamp;
+	uint32_t ifindex;
+	uint16_t datalen;
+	uint8_t type;
+	uint8_t flags; // always 0: the restored addresses have to be checked again (DAD)
+	// datalen bytes of data follow, padded to 8 bytes
+};
+
+/* expiration time of records having a lifetime, 0 for the others */
+static uint64_t save_expire(void *data) {
+	uint64_t timestamp = ioth_confdata_gettimestamp(data);
+	uint32_t lifetime;
+	switch (ioth_confdata_gettype(data)) {
+		case IOTH_CONFDATA_DHCP4_ADDR:
+			lifetime = ((struct ioth_confdata_ipaddr *) data)->leasetime;
+			break;
+		case IOTH_CONFDATA_DHCP6_ADDR:
+		case IOTH_CONFDATA_RD6_PREFIX:
+		case IOTH_CONFDATA_RD6_ADDR:
+		case IOTH_CONFDATA_RD6_ROUTER:
+			lifetime = ((struct ioth_confdata_ip6addr *) data)->valid_lifetime;
+			break;
+		default:
+			return 0;
+	}
+	return (lifetime == TIME_INFINITY) ? IOTHCONF_SAVE_INFINITY : timestamp + lifetime;
+}
+
+struct save_lease {
+	uint32_t ifindex;
+	uint64_t expire;
+};
+
+static int save_lease_cb(void *data, void *arg) {
+	struct save_lease *lease = arg;
+	uint64_t expire;
+	if (ioth_confdata_getifindex(data) == lease->ifindex &&
+			(expire = save_expire(data)) > lease->expire)
+		lease->expire = expire;
+	return 0;
+}
+
+struct save_arg {
+	struct ioth_confdata_snapshot *snap;
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+	uint32_t nrecords;
+};
+
+static int save_cb(void *data, void *arg) {
+	struct save_arg *sarg = arg;
+	uint8_t type = ioth_confdata_gettype(data);
+	uint8_t flags = ioth_confdata_setflags(data, 0);
+	struct iothconf_save_rec rec = {
+		.timestamp = ioth_confdata_gettimestamp(data),
+		.ifindex = ioth_confdata_getifindex(data),
+		.datalen = ioth_confdata_getdatalen(data),
+		.type = type,
+	};
+	/* static records and obsolete addresses kept during the grace period are not saved */
+	if (TIMESTAMP(type) == IOTH_CONFDATA_STATIC_TIMESTAMP || (flags & IOTH_CONFDATA_DEPRECATED))
+		return 0;
+	if ((rec.expire = save_expire(data)) == 0) {
+		struct save_lease lease = {.ifindex = rec.ifindex};
+		ioth_confdata_snapshot_forall(sarg->snap, TIMESTAMP(type), IOTH_CONFDATA_MASK_TYPE,
+				save_lease_cb, &lease);
+		rec.expire = lease.expire;
+	}
+	size_t reclen = IOTHCONF_SAVE_ALIGN(sizeof(rec) + rec.datalen);
+	if (sarg->len + reclen <= sarg->size) {
+		memcpy(sarg->buf + sarg->len, &rec, sizeof(rec));
+		memcpy(sarg->buf + sarg->len + sizeof(rec), data, rec.datalen);
+		memset(sarg->buf + sarg->len + sizeof(rec) + rec.datalen, 0, reclen - sizeof(rec) - rec.datalen);
+	}
+	sarg->len += reclen;
+	sarg->nrecords++;
+	return 0;
+}
+
+int ioth_config_save(struct ioth *stack, unsigned int ifindex, void *buf, size_t size) {
+	struct save_arg sarg = {
+		.snap = ioth_confdata_snapshot(stack, ifindex),
+		.buf = buf,
+		.size = (buf == NULL) ? 0 : size,
+		.len = sizeof(struct iothconf_save_hdr),
+	};
+	if (sarg.snap == NULL)
+		return errno = ENOMEM, -1;
+	ioth_confdata_snapshot_forall(sarg.snap, 0, IOTH_CONFDATA_MASK_ALL, save_cb, &sarg);
+	ioth_confdata_snapshot_free(sarg.snap);
+	if (sarg.len > INT32_MAX)
+		return errno = EOVERFLOW, -1;
+	if (sarg.len <= sarg.size) {
+		struct iothconf_save_hdr hdr = {
+			.magic = IOTHCONF_SAVE_MAGIC,
+			.version = IOTHCONF_SAVE_VERSION,
+			.hdrlen = sizeof(hdr),
+			.nrecords = sarg.nrecords,
+			.len = sarg.len,
+			.saved = time(NULL),
+		};
+		memcpy(buf, &hdr, sizeof(hdr));
+	}
+	return sarg.len;
+}
+
+/* minimum length of the data of each type (ioth_ip_record2op and the engines read
+	 the data as structs), 0 for the records without data or with opaque data */
+static size_t restore_minlen(uint8_t type) {
+	switch (type) {
+		case IOTH_CONFDATA_DHCP4_SERVER:
+		case IOTH_CONFDATA_DHCP4_ROUTER:
+		case IOTH_CONFDATA_DHCP4_DNS:
+			return sizeof(struct in_addr);
+		case IOTH_CONFDATA_DHCP4_ADDR:
+			return sizeof(struct ioth_confdata_ipaddr);
+		case IOTH_CONFDATA_DHCP6_ADDR:
+		case IOTH_CONFDATA_RD6_PREFIX:
+		case IOTH_CONFDATA_RD6_ADDR:
+		case IOTH_CONFDATA_RD6_ROUTER:
+			return sizeof(struct ioth_confdata_ip6addr);
+		case IOTH_CONFDATA_DHCP6_DNS:
+			return sizeof(struct in6_addr);
+		case IOTH_CONFDATA_RD6_MTU:
+			return sizeof(uint32_t);
+		default:
+			return 0;
+	}
+}
+
+/* check the header and all the records before restoring anything.
+	 return the offset of the first record, -1 if the snapshot is not valid */
+static ssize_t restore_check(const uint8_t *buf, size_t len, struct iothconf_save_hdr *hdr) {
+	if (buf == NULL || len < sizeof(*hdr))
+		return errno = EINVAL, -1;
+	memcpy(hdr, buf, sizeof(*hdr));
+	if (hdr->magic != IOTHCONF_SAVE_MAGIC)
+		return errno = EINVAL, -1;
+	if (hdr->version != IOTHCONF_SAVE_VERSION)
+		return errno = ENOTSUP, -1;
+	if (hdr->hdrlen < sizeof(*hdr) || hdr->hdrlen % 8 != 0 || hdr->len > len || hdr->hdrlen > hdr->len)
+		return errno = EINVAL, -1;
+	size_t pos = hdr->hdrlen;
+	for (uint32_t i = 0; i < hdr->nrecords; i++) {
+		struct iothconf_save_rec rec;
+		if (hdr->len - pos < sizeof(rec))
+			return errno = EINVAL, -1;
+		memcpy(&rec, buf + pos, sizeof(rec));
+		if (hdr->len - pos < IOTHCONF_SAVE_ALIGN(sizeof(rec) + rec.datalen) ||
+				rec.datalen < restore_minlen(rec.type))
+			return errno = EINVAL, -1;
+		pos += IOTHCONF_SAVE_ALIGN(sizeof(rec) + rec.datalen);
+	}
+	return hdr->hdrlen;
+}
+
+struct restore_source {
+	uint32_t ifindex;
+	uint8_t type;
+};
+
+int ioth_config_restore(struct ioth *stack, const void *buf, size_t len) {
+	const uint8_t *bytes = buf;
+	struct iothconf_save_hdr hdr;
+	ssize_t pos = restore_check(bytes, len, &hdr);
+	uint64_t now = time(NULL);
+	int nrestored = 0;
+	int nsources = 0;
+	if (pos < 0)
+		return -1;
+	struct restore_source *sources = malloc(hdr.nrecords * sizeof(*sources) + 1);
+	if (sources == NULL)
+		return errno = ENOMEM, -1;
+	for (uint32_t i = 0; i < hdr.nrecords; i++) {
+		struct iothconf_save_rec rec;
+		memcpy(&rec, bytes + pos, sizeof(rec));
+		void *data = (void *) (bytes + pos + sizeof(rec));
+		pos += IOTHCONF_SAVE_ALIGN(sizeof(rec) + rec.datalen);
+		if (rec.expire <= now || rec.timestamp == 0)
+			continue;
+		switch (TIMESTAMP(rec.type)) {
+			case IOTH_CONFDATA_DHCP4_TIMESTAMP:
+			case IOTH_CONFDATA_RD6_TIMESTAMP:
+			case IOTH_CONFDATA_DHCP6_TIMESTAMP:
+				break;
+			default:
+				continue;
+		}
+		/* the records are not active: iothconf_ip_update installs addresses and routes */
+		ioth_confdata_add(stack, rec.ifindex, rec.type, rec.timestamp, 0,
+				rec.datalen == 0 ? NULL : data, rec.datalen);
+		nrestored++;
+		int j;
+		for (j = 0; j < nsources; j++) {
+			if (sources[j].ifindex == rec.ifindex && sources[j].type == TIMESTAMP(rec.type))
+				break;
+		}
+		if (j == nsources)
+			sources[nsources++] = (struct restore_source) {rec.ifindex, TIMESTAMP(rec.type)};
+	}
+	for (int j = 0; j < nsources; j++)
+		iothconf_ip_update(stack, sources[j].ifindex, sources[j].type, NULL);
+	ioth_confdata_dispatch();
+	free(sources);
+	return nrestored;
+}
+
+/* the file is written in a temporary file and then renamed:
+	 a crash during the save does not destroy the previous snapshot */
+int ioth_config_save_file(struct ioth *stack, unsigned int ifindex, const char *path) {
+	uint8_t *buf = NULL;
+	int len = 0;
+	char tmppath[strlen(path) + 8];
+	int fd;
+	/* the records can change between the two calls: retry with a larger buffer */
+	for (;;) {
+		int needed = ioth_config_save(stack, ifindex, buf, len);
+		uint8_t *newbuf;
+		if (needed < 0)
+			goto err;
+		if (needed <= len) {
+			len = needed;
+			break;
+		}
+		if ((newbuf = realloc(buf, needed)) == NULL)
+			goto err;
+		buf = newbuf;
+		len = needed;
+	}
+	snprintf(tmppath, sizeof(tmppath), "%s.XXXXXX", path);
+	if ((fd = mkstemp(tmppath)) < 0)
+		goto err;
+	for (int pos = 0; pos < len; ) {
+		ssize_t n = write(fd, buf + pos, len - pos);
+		if (n < 0 && errno != EINTR)
+			goto errfd;
+		if (n > 0)
+			pos += n;
+	}
+	if (fsync(fd) < 0)
+		goto errfd;
+	if (close(fd) < 0 || rename(tmppath, path) < 0) {
+		fd = -1;
+		goto errfd;
+	}
+	free(buf);
+	return 0;
+errfd:
+	{
+		int saved_errno = errno;
+		if (fd >= 0)
+			close(fd);
+		unlink(tmppath);
+		errno = saved_errno;
+	}
+err:
+	free(buf);
+	return -1;
+}
+
+/* the snapshot is mmapped: the records are read in place */
+int ioth_config_restore_file(struct ioth *stack, const char *path) {
+	struct stat st;
+	void *buf;
+	int retvalue;
+	int saved_errno;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		saved_errno = errno;
+		close(fd);
+		return errno = saved_errno, -1;
+	}
+	if (st.st_size < (off_t) sizeof(struct iothconf_save_hdr)) {
+		close(fd);
+		return errno = EINVAL, -1;
+	}
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	saved_errno = errno;
+	close(fd);
+	if (buf == MAP_FAILED)
+		return errno = saved_errno, -1;
+	retvalue = ioth_config_restore(stack, buf, st.st_size);
+	saved_errno = errno;
+	munmap(buf, st.st_size);
+	errno = saved_errno;
+	return retvalue;
+}
@@ -0,0 +1,202 @@
+/*
+ *   iothconf_stats.c: auto configuration library for ioth
+ *       per-phase timing of the configuration runs
+ *
+ *   Copyright 2021 Renzo Davoli - Virtual Square Team
+ *   University of Bologna - Italy
+ *
+ *   This library is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or (at
+ *   your option) any later version.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <iothconf.h>
+#include <iothconf_stats.h>
+
+struct iothconf_stats {
+	struct iothconf_stats *next;
+	struct ioth *stack;
+	unsigned int ifindex;
+	struct ioth_config_stats stats;
+	struct ioth_config_counters counters;
+};
+
+static pthread_mutex_t iothconf_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct iothconf_stats *iothconf_stats_root;
+
+static const char *iothconf_stats_names[IOTHCONF_NPHASES] = {
+	[IOTHCONF_PHASE_TOTAL] = "total",
+	[IOTHCONF_PHASE_ETH] = "eth",
+	[IOTHCONF_PHASE_TIMESTAMP] = "timestamp",
+	[IOTHCONF_PHASE_RD] = "rs-ra",
+	[IOTHCONF_PHASE_DHCP6_ADVERTISE] = "solicit-advertise",
+	[IOTHCONF_PHASE_DHCP6_REPLY] = "request-reply",
+	[IOTHCONF_PHASE_DHCP_OFFER] = "discover-offer",
+	[IOTHCONF_PHASE_DHCP_ACK] = "request-ack",
+	[IOTHCONF_PHASE_APPLY] = "apply",
+};
+
+static const char *iothconf_stats_counter_names[IOTHCONF_NCOUNTERS] = {
+	[IOTHCONF_COUNT_DHCP_TX_DISCOVER] = "dhcp.tx.discover",
+	[IOTHCONF_COUNT_DHCP_TX_REQUEST] = "dhcp.tx.request",
+	[IOTHCONF_COUNT_DHCP_TX_DECLINE] = "dhcp.tx.decline",
+	[IOTHCONF_COUNT_DHCP_RX_OFFER] = "dhcp.rx.offer",
+	[IOTHCONF_COUNT_DHCP_RX_ACK] = "dhcp.rx.ack",
+	[IOTHCONF_COUNT_DHCP_RX_NAK] = "dhcp.rx.nak",
+	[IOTHCONF_COUNT_DHCP_RETRY] = "dhcp.retry",
+	[IOTHCONF_COUNT_DHCP_TIMEOUT] = "dhcp.timeout",
+	[IOTHCONF_COUNT_DHCP_SPURIOUS] = "dhcp.spurious",
+	[IOTHCONF_COUNT_DHCP6_TX_SOLICIT] = "dhcp6.tx.solicit",
+	[IOTHCONF_COUNT_DHCP6_TX_REQUEST] = "dhcp6.tx.request",
+	[IOTHCONF_COUNT_DHCP6_RX_ADVERTISE] = "dhcp6.rx.advertise",
+	[IOTHCONF_COUNT_DHCP6_RX_REPLY] = "dhcp6.rx.reply",
+	[IOTHCONF_COUNT_DHCP6_RETRY] = "dhcp6.retry",
+	[IOTHCONF_COUNT_DHCP6_TIMEOUT] = "dhcp6.timeout",
+	[IOTHCONF_COUNT_DHCP6_SPURIOUS] = "dhcp6.spurious",
+	[IOTHCONF_COUNT_RD_TX_RS] = "rd.tx.rs",
+	[IOTHCONF_COUNT_RD_RX_RA] = "rd.rx.ra",
+	[IOTHCONF_COUNT_RD_RETRY] = "rd.retry",
+	[IOTHCONF_COUNT_RD_TIMEOUT] = "rd.timeout",
+	[IOTHCONF_COUNT_RD_SPURIOUS] = "rd.spurious",
+	[IOTHCONF_COUNT_PARSE_ERROR] = "parse_error",
+	[IOTHCONF_COUNT_RECORD_ADD] = "record.add",
+	[IOTHCONF_COUNT_RECORD_DEL] = "record.del",
+	[IOTHCONF_COUNT_LOCK_WAIT] = "lock.wait",
+	[IOTHCONF_COUNT_LOCK_WAIT_USEC] = "lock.wait_usec",
+};
+
+const char *iothconf_stats_phase_name(int phase) {
+	if (phase < 0 || phase >= IOTHCONF_NPHASES)
+		return "unknown";
+	return iothconf_stats_names[phase];
+}
+
+uint64_t iothconf_stats_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+/* iothconf_stats_mutex must be held */
+static struct iothconf_stats *iothconf_stats_search(struct ioth *stack, unsigned int ifindex, int create) {
+	struct iothconf_stats *scan;
+	for (scan = iothconf_stats_root; scan != NULL; scan = scan->next) {
+		if (scan->stack == stack && scan->ifindex == ifindex)
+			return scan;
+	}
+	if (create && (scan = calloc(1, sizeof(*scan))) != NULL) {
+		scan->stack = stack;
+		scan->ifindex = ifindex;
+		scan->next = iothconf_stats_root;
+		iothconf_stats_root = scan;
+	}
+	return scan;
+}
+
+void iothconf_stats_reset(struct ioth *stack, unsigned int ifindex) {
+	pthread_mutex_lock(&iothconf_stats_mutex);
+	struct iothconf_stats *stats = iothconf_stats_search(stack, ifindex, 1);
+	if (stats != NULL)
+		stats->stats = (struct ioth_config_stats) {{0}};
+	pthread_mutex_unlock(&iothconf_stats_mutex);
+}
+
+void iothconf_stats_add(struct ioth *stack, unsigned int ifindex, int phase, uint64_t start) {
+	uint64_t elapsed = iothconf_stats_now() - start;
+	if (phase < 0 || phase >= IOTHCONF_NPHASES)
+		return;
+	pthread_mutex_lock(&iothconf_stats_mutex);
+	struct iothconf_stats *stats = iothconf_stats_search(stack, ifindex, 1);
+	if (stats != NULL)
+		stats->stats.usec[phase] += elapsed;
+	pthread_mutex_unlock(&iothconf_stats_mutex);
+}
+
+int ioth_config_stats(struct ioth *stack, unsigned int ifindex, struct ioth_config_stats *stats) {
+	int retvalue = 0;
+	pthread_mutex_lock(&iothconf_stats_mutex);
+	struct iothconf_stats *this = iothconf_stats_search(stack, ifindex, 0);
+	if (this == NULL)
+		retvalue = -1, errno = ENOENT;
+	else if (stats != NULL)
+		*stats = this->stats;
+	pthread_mutex_unlock(&iothconf_stats_mutex);
+	return retvalue;
+}
+
+void iothconf_stats_count(struct ioth *stack, unsigned int ifindex, int counter, uint64_t n) {
+	if (counter < 0 || counter >= IOTHCONF_NCOUNTERS)
+		return;
+	pthread_mutex_lock(&iothconf_stats_mutex);
+	struct iothconf_stats *stats = iothconf_stats_search(stack, ifindex, 1);
+	if (stats != NULL)
+		stats->counters.count[counter] += n;
+	pthread_mutex_unlock(&iothconf_stats_mutex);
+}
+
+int ioth_config_counters(struct ioth *stack, unsigned int ifindex, struct ioth_config_counters *counters) {
+	struct ioth_config_counters sum = {{0}};
+	int found = 0;
+	pthread_mutex_lock(&iothconf_stats_mutex);
+	for (struct iothconf_stats *scan = iothconf_stats_root; scan != NULL; scan = scan->next) {
+		if (scan->stack == stack && (ifindex == 0 || scan->ifindex == ifindex)) {
+			for (int i = 0; i < IOTHCONF_NCOUNTERS; i++)
+				sum.count[i] += scan->counters.count[i];
+			found = 1;
+		}
+	}
+	pthread_mutex_unlock(&iothconf_stats_mutex);
+	if (!found)
+		return errno = ENOENT, -1;
+	if (counters != NULL)
+		*counters = sum;
+	return 0;
+}
+
+char *ioth_config_stats_dump(struct ioth *stack, unsigned int ifindex) {
+	char *dump = NULL;
+	size_t dumplen = 0;
+	FILE *f = open_memstream(&dump, &dumplen);
+	if (f == NULL)
+		return NULL;
+	pthread_mutex_lock(&iothconf_stats_mutex);
+	for (struct iothconf_stats *scan = iothconf_stats_root; scan != NULL; scan = scan->next) {
+		if (scan->stack == stack && (ifindex == 0 || scan->ifindex == ifindex)) {
+			for (int i = 0; i < IOTHCONF_NCOUNTERS; i++)
+				fprintf(f, "%u %s %" PRIu64 "\n", scan->ifindex,
+						iothconf_stats_counter_names[i], scan->counters.count[i]);
+			for (int i = 0; i < IOTHCONF_NPHASES; i++)
+				fprintf(f, "%u phase.%s.usec %" PRIu64 "\n", scan->ifindex,
+						iothconf_stats_names[i], scan->stats.usec[i]);
+		}
+	}
+	pthread_mutex_unlock(&iothconf_stats_mutex);
+	fclose(f);
+	return dump;
+}
+
+void iothconf_stats_release(struct ioth *stack) {
+	pthread_mutex_lock(&iothconf_stats_mutex);
+	for (struct iothconf_stats **scan = &iothconf_stats_root; *scan != NULL; ) {
+		struct iothconf_stats *this = *scan;
+		if (this->stack == stack) {
+			*scan = this->next;
+			free(this);
+		} else
+			scan = &this->next;
+	}
+	pthread_mutex_unlock(&iothconf_stats_mutex);
+}
@@ -0,0 +1,24 @@
+#ifndef IOTHCONF_STATS_H
+#define IOTHCONF_STATS_H
+#include <stdint.h>
+
+/* per-phase timing of the configuration runs (see ioth_config_stats).
+	 times are in usecs (CLOCK_MONOTONIC).
+	 iothconf_stats_reset clears the stats of the interface at the beginning of a run,
+	 iothconf_stats_add adds the time elapsed since start to a phase. */
+
+struct ioth;
+
+uint64_t iothconf_stats_now(void);
+void iothconf_stats_reset(struct ioth *stack, unsigned int ifindex);
+void iothconf_stats_add(struct ioth *stack, unsigned int ifindex, int phase, uint64_t start);
+
+/* name of a phase (for debug output) */
+const char *iothconf_stats_phase_name(int phase);
+
+/* add n to a counter (see ioth_config_counters) */
+void iothconf_stats_count(struct ioth *stack, unsigned int ifindex, int counter, uint64_t n);
+
+/* free the stats and the counters of stack (ioth_config_release) */
+void iothconf_stats_release(struct ioth *stack);
+#endif
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <ioth.h>
+#include <iothconf.h>
+#include "iothconf_responder.h"
+
+/* end-to-end test of the configuration engines with no real network:
+	 a server side stack and a client stack are connected by a VDE network
+	 (by default a point to point link), the server stack runs the scripted
+	 responders, the client stack runs each scenario and checks the result.
+	 exit status: 0 success, 1 failure, 77 skipped (stacks not available) */
+
+#define SKIP 77
+
+struct scenario {
+	const char *name;
+	const char *config;
+	int protocols;
+	int expected;
+	const char *check[4];
+	int conflict; // the address offered by dhcp is in use (declined 'conflict' times)
+};
+
+static struct scenario scenarios[] = {
+	{"dhcp", "eth,dhcp", IOTHCONF_DHCP,
+		IOTHCONF_ETH | IOTHCONF_DHCP,
+		{RESPONDER_DHCP_ADDR, RESPONDER_DHCP_DNS, RESPONDER_DOMAIN}, 0},
+	{"dhcp6", "eth,dhcp6", IOTHCONF_DHCPV6,
+		IOTHCONF_ETH | IOTHCONF_DHCPV6,
+		{RESPONDER_DHCP6_ADDR, RESPONDER_DHCP6_DNS, RESPONDER_DOMAIN}, 0},
+	{"rd", "eth,rd,slaac", IOTHCONF_RD,
+		IOTHCONF_ETH | IOTHCONF_RD,
+		{RESPONDER_RD_PREFIX}, 0},
+	{"auto", "eth,auto", 0,
+		IOTHCONF_ETH | IOTHCONF_DHCP | IOTHCONF_DHCPV6 | IOTHCONF_RD,
+		{RESPONDER_DHCP_ADDR, RESPONDER_DHCP6_ADDR, RESPONDER_RD_PREFIX, RESPONDER_DOMAIN}, 0},
+	/* conflict -> DHCPDECLINE -> 10 secs -> DHCPDISCOVER -> address acquired */
+	{"acd", "eth,dhcp,acd", IOTHCONF_DHCP,
+		IOTHCONF_ETH | IOTHCONF_DHCP,
+		{RESPONDER_DHCP_ADDR}, 1},
+};
+#define NSCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static const char *phase_names[IOTHCONF_NPHASES] = {
+	"total", "eth", "timestamp", "rs-ra", "solicit-advertise", "request-reply",
+	"discover-offer", "request-ack", "apply"};
+
+static void usage(char *progname) {
+	fprintf(stderr,
+			"Usage: %s OPTIONS [scenario ...]\n"
+			"OPTIONS:\n"
+			" -s --stack:       ioth stack implementation of the client (default vdestack)\n"
+			" -S --serverstack: ioth stack implementation of the server (default vdestack)\n"
+			" -v --vnl:         vde's virtual network locator (default a ptp link)\n"
+			" -d --drop:        the responders ignore the first N requests of each kind\n"
+			" -w --delay:       the responders wait N msecs before each reply\n"
+			" -V --verbose:     print the configuration data and the counters\n"
+			" -h, --help:       usage message\n"
+			"scenarios: dhcp dhcp6 rd auto acd compiled warm (default all)\n", progname);
+	exit(1);
+}
+
+static uint64_t now_usec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int run_scenario(struct ioth *client, struct ioth *server, unsigned int server_ifindex,
+		struct scenario *sc, struct iothconf_responder_script *script, int verbose) {
+	struct iothconf_responder_script thisscript = *script;
+	struct iothconf_responder *responder;
+	unsigned int ifindex = ioth_if_nametoindex(client, "vde0");
+	char dump[8192];
+	char *rc;
+	int ok = 1;
+	thisscript.protocols = sc->protocols;
+	thisscript.conflict = sc->conflict;
+	responder = iothconf_responder_start(server, server_ifindex, &thisscript);
+	if (responder == NULL) {
+		perror("responder");
+		return 0;
+	}
+	uint64_t start = now_usec();
+	int rv = ioth_config(client, sc->config);
+	uint64_t elapsed = now_usec() - start;
+	int declines = iothconf_responder_count(responder, RESPONDER_DHCP_DECLINE);
+	int discovers = iothconf_responder_count(responder, RESPONDER_DHCP_DISCOVER);
+	iothconf_responder_stop(responder);
+	if (rv < 0) {
+		printf("%-6s FAIL ioth_config: %s\n", sc->name, strerror(errno));
+		return 0;
+	}
+	/* each declined address: DHCPDECLINE, 10 secs, a new DHCPDISCOVER */
+	if (declines != sc->conflict || discovers <= sc->conflict ||
+			elapsed < sc->conflict * 10000000ULL) {
+		printf("%-6s FAIL %d declines %d discovers in %.3f ms\n", sc->name,
+				declines, discovers, elapsed / 1000.0);
+		ok = 0;
+	}
+	if ((rv & sc->expected) != sc->expected) {
+		printf("%-6s FAIL confirmed 0x%x expected 0x%x\n", sc->name, rv, sc->expected);
+		ok = 0;
+	}
+	ioth_config_dump(client, ifindex, dump, sizeof(dump));
+	rc = ioth_resolvconf(client, NULL);
+	for (int i = 0; i < 4 && sc->check[i] != NULL; i++) {
+		if (strstr(dump, sc->check[i]) == NULL && (rc == NULL || strstr(rc, sc->check[i]) == NULL)) {
+			printf("%-6s FAIL %s missing\n", sc->name, sc->check[i]);
+			ok = 0;
+		}
+	}
+	if (ok) {
+		struct ioth_config_stats stats;
+		printf("%-6s ok %8.3f ms", sc->name, elapsed / 1000.0);
+		if (ioth_config_stats(client, ifindex, &stats) == 0) {
+			for (int phase = IOTHCONF_PHASE_ETH; phase < IOTHCONF_NPHASES; phase++)
+				if (stats.usec[phase] > 0)
+					printf(" %s=%.3f", phase_names[phase], stats.usec[phase] / 1000.0);
+		}
+		printf("\n");
+	}
+	if (verbose || !ok) {
+		char *stats = ioth_config_stats_dump(client, ifindex);
+		printf("%s\n", dump);
+		if (rc) printf("%s", rc);
+		if (stats) printf("%s", stats);
+		free(stats);
+	}
+	free(rc);
+	/* clean up for the next scenario */
+	ioth_config(client, "-all");
+	return ok;
+}
+
+/* static configuration through a compiled handle, applied several times
+	 (as a periodic reconfiguration would do) */
+static int run_compiled(struct ioth *client) {
+	unsigned int ifindex = ioth_if_nametoindex(client, "vde0");
+	struct ioth_config_compiled *cc =
+		ioth_config_compile(client, "ip=192.168.253.10/24,dns=192.168.253.1,domain=compiled.test");
+	char dump[8192];
+	char *rc;
+	int ok = 1;
+	if (cc == NULL) {
+		printf("%-6s FAIL ioth_config_compile: %s\n", "compiled", strerror(errno));
+		return 0;
+	}
+	for (int i = 0; i < 3; i++) {
+		int rv = ioth_config_apply(cc);
+		if (rv != IOTHCONF_STATIC) {
+			printf("%-6s FAIL apply #%d returned 0x%x\n", "compiled", i, rv);
+			ok = 0;
+		}
+	}
+	ioth_config_compiled_free(cc);
+	ioth_config_dump(client, ifindex, dump, sizeof(dump));
+	rc = ioth_resolvconf(client, NULL);
+	if (strstr(dump, "192.168.253.10") == NULL ||
+			rc == NULL || strstr(rc, "compiled.test") == NULL) {
+		printf("%-6s FAIL configuration data missing\n", "compiled");
+		ok = 0;
+	} else
+		printf("%-6s ok\n", "compiled");
+	free(rc);
+	if (ioth_config_compile(client, "nosuchopt") != NULL || errno != EINVAL) {
+		printf("%-6s FAIL invalid option accepted\n", "compiled");
+		ok = 0;
+	}
+	ioth_config(client, "-static");
+	return ok;
+}
+
+/* warm restart: save the data acquired by dhcp, clean the configuration,
+	 restore the snapshot with no server: the address must be back at once */
+static int run_warm(struct ioth *client, struct ioth *server, unsigned int server_ifindex,
+		struct iothconf_responder_script *script) {
+	struct iothconf_responder_script thisscript = *script;
+	struct iothconf_responder *responder;
+	unsigned int ifindex = ioth_if_nametoindex(client, "vde0");
+	char dump[8192];
+	uint8_t snap[4096];
+	int len;
+	int ok = 1;
+	thisscript.protocols = IOTHCONF_DHCP;
+	responder = iothconf_responder_start(server, server_ifindex, &thisscript);
+	if (responder == NULL) {
+		perror("responder");
+		return 0;
+	}
+	int rv = ioth_config(client, "eth,dhcp");
+	iothconf_responder_stop(responder);
+	if (rv < 0 || !(rv & IOTHCONF_DHCP)) {
+		printf("%-6s FAIL ioth_config\n", "warm");
+		return 0;
+	}
+	len = ioth_config_save(client, ifindex, snap, sizeof(snap));
+	ioth_config(client, "-dhcp");
+	if (len < 0 || len > (int) sizeof(snap)) {
+		printf("%-6s FAIL ioth_config_save %d\n", "warm", len);
+		ok = 0;
+	} else {
+		uint64_t start = now_usec();
+		int n = ioth_config_restore(client, snap, len);
+		uint64_t elapsed = now_usec() - start;
+		ioth_config_dump(client, ifindex, dump, sizeof(dump));
+		if (n <= 0 || strstr(dump, RESPONDER_DHCP_ADDR) == NULL) {
+			printf("%-6s FAIL ioth_config_restore %d\n", "warm", n);
+			ok = 0;
+		} else
+			printf("%-6s ok %8.3f ms\n", "warm", elapsed / 1000.0);
+		if (ioth_config_restore(client, snap, len - 1) >= 0 || errno != EINVAL) {
+			printf("%-6s FAIL truncated snapshot accepted\n", "warm");
+			ok = 0;
+		}
+	}
+	ioth_config(client, "-all");
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	char *progname = basename(argv[0]);
+	static char *short_options = "s:S:v:d:w:Vh";
+	static struct option long_options[] = {
+		{"stack",       required_argument, 0,  's' },
+		{"serverstack", required_argument, 0,  'S' },
+		{"vnl",         required_argument, 0,  'v' },
+		{"drop",        required_argument, 0,  'd' },
+		{"delay",       required_argument, 0,  'w' },
+		{"verbose",           no_argument, 0,  'V' },
+		{"help",              no_argument, 0,  'h' },
+		{0,             0,                 0,  0 }
+	};
+
+	char *stacklib = "vdestack";
+	char *serverstacklib = "vdestack";
+	char *vnl = NULL;
+	char defvnl[64];
+	struct iothconf_responder_script script = {0};
+	int verbose = 0;
+	int c;
+	while ((c = getopt_long(argc, argv, short_options, long_options, NULL)) >= 0) {
+		switch (c) {
+			case 's': stacklib = optarg; break;
+			case 'S': serverstacklib = optarg; break;
+			case 'v': vnl = optarg; break;
+			case 'd': script.drop = atoi(optarg); break;
+			case 'w': script.delay = atoi(optarg); break;
+			case 'V': verbose = 1; break;
+			case '?':
+			case 'h':
+			default: usage(progname); break;
+		}
+	}
+	if (vnl == NULL) {
+		snprintf(defvnl, sizeof(defvnl), "ptp:///tmp/iothconf_harness.%d", getpid());
+		vnl = defvnl;
+	}
+
+	struct ioth *server = ioth_newstack(serverstacklib, vnl);
+	if (server == NULL) {
+		perror("server stack");
+		return SKIP;
+	}
+	struct ioth *client = ioth_newstack(stacklib, vnl);
+	if (client == NULL) {
+		perror("client stack");
+		ioth_delstack(server);
+		return SKIP;
+	}
+	unsigned int server_ifindex = ioth_if_nametoindex(server, "vde0");
+	ioth_config(server, "eth");
+
+	int failed = 0;
+	for (size_t i = 0; i < NSCENARIOS; i++) {
+		int selected = optind >= argc;
+		for (int j = optind; j < argc; j++)
+			if (strcmp(argv[j], scenarios[i].name) == 0)
+				selected = 1;
+		if (selected && !run_scenario(client, server, server_ifindex, &scenarios[i], &script, verbose))
+			failed++;
+	}
+	int selected = optind >= argc;
+	for (int j = optind; j < argc; j++)
+		if (strcmp(argv[j], "compiled") == 0)
+			selected = 1;
+	if (selected && !run_compiled(client))
+		failed++;
+	selected = optind >= argc;
+	for (int j = optind; j < argc; j++)
+		if (strcmp(argv[j], "warm") == 0)
+			selected = 1;
+	if (selected && !run_warm(client, server, server_ifindex, &script))
+		failed++;
+
+	ioth_config_release(client);
+	ioth_delstack(client);
+	ioth_config_release(server);
+	ioth_delstack(server);
+	if (vnl == defvnl)
+		unlink(defvnl + strlen("ptp://"));
+	return failed ? 1 : 0;
+}
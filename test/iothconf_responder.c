@@ -0,0 +1,527 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <netinet/if_ether.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <ioth.h>
+#include <iothconf.h>
+#include "iothconf_responder.h"
+
+#define DHCP_SERVERPORT 67
+#define DHCP_CLIENTPORT 68
+#define DHCP6_SERVERPORT 547
+#define DHCP6_CLIENTPORT 546
+
+#define BOOTP_LEN 236
+#define BOOTP_MINLEN 300
+#define DHCP_MAXLEN 576
+
+#define DHCPDISCOVER 1
+#define DHCPOFFER 2
+#define DHCPREQUEST 3
+#define DHCPDECLINE 4
+#define DHCPACK 5
+
+#define DHCP6_SOLICIT 1
+#define DHCP6_ADVERTISE 2
+#define DHCP6_REQUEST 3
+#define DHCP6_REPLY 7
+
+#define DHCP6_MAXLEN 1280
+
+struct iothconf_responder {
+	struct ioth *stack;
+	unsigned int ifindex;
+	struct iothconf_responder_script script;
+	uint8_t macaddr[ETH_ALEN];
+	struct in6_addr lladdr;
+	int fd4;
+	int fd6;
+	int fdarp;
+	int efd;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	int count[RESPONDER_NKINDS];
+};
+
+static const uint8_t dhcp_cookie[] = {0x63, 0x82, 0x53, 0x63};
+static const uint8_t bcast_macaddr[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+static const uint8_t allnodes_macaddr[] = {0x33, 0x33, 0x00, 0x00, 0x00, 0x01};
+
+/* count the message, return the number of messages of that kind received before */
+static int responder_count(struct iothconf_responder *r, int kind) {
+	pthread_mutex_lock(&r->mutex);
+	int n = r->count[kind]++;
+	pthread_mutex_unlock(&r->mutex);
+	return n;
+}
+
+/* count the request, return 1 if it has to be dropped */
+static int responder_script(struct iothconf_responder *r, int kind) {
+	int n = responder_count(r, kind);
+	if (n < r->script.drop)
+		return 1;
+	if (r->script.delay > 0)
+		usleep(r->script.delay * 1000);
+	return 0;
+}
+
+static uint32_t sum16(uint32_t sum, const void *buf, size_t len) {
+	const uint8_t *p = buf;
+	for (; len > 1; len -= 2, p += 2)
+		sum += (p[0] << 8) | p[1];
+	if (len > 0)
+		sum += p[0] << 8;
+	return sum;
+}
+
+static uint16_t sumfold(uint32_t sum) {
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return htons(~sum & 0xffff);
+}
+
+/* checksum of an upper layer protocol on IPv6 (RFC 8200 8.1) */
+static uint16_t sum6(struct ip6_hdr *ip6h, const void *buf, size_t len) {
+	uint8_t pseudo[8] = {len >> 24, len >> 16, len >> 8, len, 0, 0, 0, ip6h->ip6_nxt};
+	uint32_t sum = sum16(0, &ip6h->ip6_src, 2 * sizeof(struct in6_addr));
+	sum = sum16(sum, pseudo, sizeof(pseudo));
+	return sumfold(sum16(sum, buf, len));
+}
+
+static void responder_send(struct iothconf_responder *r, int fd, uint16_t protocol,
+		const uint8_t *macaddr, void *pkt, size_t len) {
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(protocol),
+		.sll_ifindex = r->ifindex,
+		.sll_halen = ETH_ALEN,
+	};
+	memcpy(sll.sll_addr, macaddr, ETH_ALEN);
+	ioth_sendto(fd, pkt, len, 0, (struct sockaddr *) &sll, sizeof(sll));
+}
+
+/* DHCPv4 */
+
+static int dhcp_getopt(uint8_t *opt, size_t len, uint8_t code) {
+	for (size_t i = 0; i < len; ) {
+		if (opt[i] == 0) {
+			i++;
+			continue;
+		}
+		if (opt[i] == 255 || i + 2 >= len)
+			break;
+		if (opt[i] == code && opt[i + 1] >= 1)
+			return opt[i + 2];
+		i += 2 + opt[i + 1];
+	}
+	return -1;
+}
+
+static uint8_t *dhcp_putopt(uint8_t *opt, uint8_t code, uint8_t len, const void *data) {
+	opt[0] = code;
+	opt[1] = len;
+	memcpy(opt + 2, data, len);
+	return opt + 2 + len;
+}
+
+static void dhcp_reply(struct iothconf_responder *r, uint8_t *bootp, uint8_t type) {
+	uint8_t pkt[DHCP_MAXLEN] = {0};
+	struct iphdr *iph = (struct iphdr *) pkt;
+	struct udphdr *udph = (struct udphdr *) (iph + 1);
+	uint8_t *obootp = (uint8_t *) (udph + 1);
+	uint8_t *opt = obootp + BOOTP_LEN;
+	struct in_addr server, addr, router, dns;
+	uint32_t mask = htonl(~0U << (32 - RESPONDER_DHCP_PREFIX));
+	uint32_t lease = htonl(RESPONDER_LEASE);
+	inet_pton(AF_INET, RESPONDER_DHCP_SERVER, &server);
+	inet_pton(AF_INET, RESPONDER_DHCP_ADDR, &addr);
+	inet_pton(AF_INET, RESPONDER_DHCP_ROUTER, &router);
+	inet_pton(AF_INET, RESPONDER_DHCP_DNS, &dns);
+	obootp[0] = 2; // boot reply
+	obootp[1] = 1; // ethernet
+	obootp[2] = ETH_ALEN;
+	memcpy(obootp + 4, bootp + 4, 4); // xid
+	memcpy(obootp + 10, bootp + 10, 2); // flags
+	memcpy(obootp + 16, &addr, 4); // yiaddr
+	memcpy(obootp + 20, &server, 4); // siaddr
+	memcpy(obootp + 28, bootp + 28, 16); // chaddr
+	memcpy(opt, dhcp_cookie, sizeof(dhcp_cookie));
+	opt += sizeof(dhcp_cookie);
+	opt = dhcp_putopt(opt, 53, 1, &type);
+	opt = dhcp_putopt(opt, 54, 4, &server);
+	opt = dhcp_putopt(opt, 1, 4, &mask);
+	opt = dhcp_putopt(opt, 3, 4, &router);
+	opt = dhcp_putopt(opt, 6, 4, &dns);
+	opt = dhcp_putopt(opt, 51, 4, &lease);
+	opt = dhcp_putopt(opt, 15, strlen(RESPONDER_DOMAIN), RESPONDER_DOMAIN);
+	*opt++ = 255;
+	size_t len = opt - pkt;
+	if (len < sizeof(*iph) + sizeof(*udph) + BOOTP_MINLEN)
+		len = sizeof(*iph) + sizeof(*udph) + BOOTP_MINLEN;
+	udph->uh_sport = htons(DHCP_SERVERPORT);
+	udph->uh_dport = htons(DHCP_CLIENTPORT);
+	udph->uh_ulen = htons(len - sizeof(*iph));
+	iph->version = 4;
+	iph->ihl = sizeof(*iph) / 4;
+	iph->tot_len = htons(len);
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_UDP;
+	iph->saddr = server.s_addr;
+	iph->daddr = INADDR_BROADCAST;
+	iph->check = sumfold(sum16(0, iph, sizeof(*iph)));
+	responder_send(r, r->fd4, ETH_P_IP, bcast_macaddr, pkt, len);
+}
+
+static void responder_recv4(struct iothconf_responder *r) {
+	uint8_t buf[DHCP_MAXLEN];
+	struct sockaddr_ll sll;
+	socklen_t slllen = sizeof(sll);
+	ssize_t len = ioth_recvfrom(r->fd4, buf, sizeof(buf), 0, (struct sockaddr *) &sll, &slllen);
+	struct iphdr *iph = (struct iphdr *) buf;
+	if (len < (ssize_t) sizeof(*iph) || sll.sll_ifindex != (int) r->ifindex ||
+			sll.sll_pkttype == PACKET_OUTGOING)
+		return;
+	size_t ihl = iph->ihl * 4;
+	struct udphdr *udph = (struct udphdr *) (buf + ihl);
+	uint8_t *bootp = (uint8_t *) (udph + 1);
+	size_t hdrlen = ihl + sizeof(*udph) + BOOTP_LEN + sizeof(dhcp_cookie);
+	if (iph->version != 4 || iph->protocol != IPPROTO_UDP || (size_t) len < hdrlen ||
+			udph->uh_dport != htons(DHCP_SERVERPORT) || bootp[0] != 1 ||
+			memcmp(bootp + BOOTP_LEN, dhcp_cookie, sizeof(dhcp_cookie)) != 0)
+		return;
+	switch (dhcp_getopt(buf + hdrlen, len - hdrlen, 53)) {
+		case DHCPDISCOVER:
+			if (!responder_script(r, RESPONDER_DHCP_DISCOVER))
+				dhcp_reply(r, bootp, DHCPOFFER);
+			break;
+		case DHCPREQUEST:
+			if (!responder_script(r, RESPONDER_DHCP_REQUEST))
+				dhcp_reply(r, bootp, DHCPACK);
+			break;
+		case DHCPDECLINE:
+			responder_count(r, RESPONDER_DHCP_DECLINE);
+			break;
+	}
+}
+
+/* ARP: answer the probes of RESPONDER_DHCP_ADDR (as the node using it would do)
+	 until script.conflict DHCPDECLINE have been received */
+static void responder_recvarp(struct iothconf_responder *r) {
+	static const uint8_t zero[sizeof(struct in_addr)];
+	struct ether_arp arp;
+	struct sockaddr_ll sll;
+	socklen_t slllen = sizeof(sll);
+	struct in_addr addr;
+	uint8_t macaddr[ETH_ALEN];
+	ssize_t len = ioth_recvfrom(r->fdarp, &arp, sizeof(arp), 0, (struct sockaddr *) &sll, &slllen);
+	if (len < (ssize_t) sizeof(arp) || sll.sll_ifindex != (int) r->ifindex ||
+			sll.sll_pkttype == PACKET_OUTGOING || arp.ea_hdr.ar_op != htons(ARPOP_REQUEST))
+		return;
+	inet_pton(AF_INET, RESPONDER_DHCP_ADDR, &addr);
+	/* probe: sender IP 0.0.0.0, target IP the address */
+	if (memcmp(arp.arp_spa, zero, sizeof(zero)) != 0 ||
+			memcmp(arp.arp_tpa, &addr, sizeof(addr)) != 0)
+		return;
+	responder_count(r, RESPONDER_ARP_PROBE);
+	if (iothconf_responder_count(r, RESPONDER_DHCP_DECLINE) >= r->script.conflict)
+		return;
+	memcpy(macaddr, arp.arp_sha, ETH_ALEN);
+	arp.ea_hdr.ar_op = htons(ARPOP_REPLY);
+	memcpy(arp.arp_tha, macaddr, ETH_ALEN);
+	memcpy(arp.arp_tpa, zero, sizeof(zero));
+	memcpy(arp.arp_sha, r->macaddr, ETH_ALEN);
+	memcpy(arp.arp_spa, &addr, sizeof(addr));
+	responder_send(r, r->fdarp, ETH_P_ARP, macaddr, &arp, sizeof(arp));
+}
+
+/* DHCPv6 */
+
+static uint8_t *dhcp6_putopt(uint8_t *opt, uint16_t code, uint16_t len, const void *data) {
+	opt[0] = code >> 8;
+	opt[1] = code;
+	opt[2] = len >> 8;
+	opt[3] = len;
+	if (data != NULL)
+		memcpy(opt + 4, data, len);
+	return opt + 4 + len;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t value) {
+	value = htonl(value);
+	memcpy(p, &value, sizeof(value));
+	return p + sizeof(value);
+}
+
+/* RFC 1035 encoding of a domain name */
+static size_t dns_encode(const char *name, uint8_t *out) {
+	size_t len = 0;
+	while (*name) {
+		size_t labellen = strcspn(name, ".");
+		out[len++] = labellen;
+		memcpy(out + len, name, labellen);
+		len += labellen;
+		name += labellen;
+		if (*name == '.') name++;
+	}
+	out[len++] = 0;
+	return len;
+}
+
+static void dhcp6_reply(struct iothconf_responder *r, struct ip6_hdr *inip6h, uint8_t *macaddr,
+		uint8_t *msg, size_t msglen, uint8_t type) {
+	uint8_t *clientid = NULL;
+	uint16_t clientidlen = 0;
+	uint8_t *iaid = NULL;
+	for (size_t i = 4; i + 4 <= msglen; ) {
+		uint16_t code = (msg[i] << 8) | msg[i + 1];
+		uint16_t len = (msg[i + 2] << 8) | msg[i + 3];
+		if (i + 4 + len > msglen)
+			break;
+		if (code == 1)
+			clientid = msg + i + 4, clientidlen = len;
+		else if (code == 3 && len >= 12)
+			iaid = msg + i + 4;
+		i += 4 + len;
+	}
+	if (clientid == NULL || iaid == NULL)
+		return;
+	uint8_t pkt[DHCP6_MAXLEN] = {0};
+	struct ip6_hdr *ip6h = (struct ip6_hdr *) pkt;
+	struct udphdr *udph = (struct udphdr *) (ip6h + 1);
+	uint8_t *omsg = (uint8_t *) (udph + 1);
+	uint8_t *opt = omsg + 4;
+	uint8_t serverid[4 + ETH_ALEN] = {0, 3, 0, 1}; // DUID-LL
+	uint8_t domain[IOTH_DNSDOMAIN_MAXLEN + 2];
+	struct in6_addr addr, dns;
+	memcpy(serverid + 4, r->macaddr, ETH_ALEN);
+	inet_pton(AF_INET6, RESPONDER_DHCP6_ADDR, &addr);
+	inet_pton(AF_INET6, RESPONDER_DHCP6_DNS, &dns);
+	if (sizeof(pkt) - (opt - pkt) < clientidlen + 256u)
+		return;
+	omsg[0] = type;
+	memcpy(omsg + 1, msg + 1, 3); // transaction id
+	opt = dhcp6_putopt(opt, 1, clientidlen, clientid);
+	opt = dhcp6_putopt(opt, 2, sizeof(serverid), serverid);
+	opt = dhcp6_putopt(opt, 3, 12 + 4 + 24, NULL) - (12 + 4 + 24);
+	memcpy(opt, iaid, 4);
+	opt = put32(opt + 4, RESPONDER_LEASE / 2);
+	opt = put32(opt, RESPONDER_LEASE * 4 / 5);
+	opt = dhcp6_putopt(opt, 5, 24, NULL) - 24;
+	memcpy(opt, &addr, sizeof(addr));
+	opt = put32(opt + sizeof(addr), RESPONDER_LEASE);
+	opt = put32(opt, RESPONDER_LEASE);
+	opt = dhcp6_putopt(opt, 23, sizeof(dns), &dns);
+	opt = dhcp6_putopt(opt, 24, dns_encode(RESPONDER_DOMAIN, domain), domain);
+	size_t len = opt - (uint8_t *) udph;
+	udph->uh_sport = htons(DHCP6_SERVERPORT);
+	udph->uh_dport = htons(DHCP6_CLIENTPORT);
+	udph->uh_ulen = htons(len);
+	ip6h->ip6_flow = htonl(6 << 28);
+	ip6h->ip6_plen = htons(len);
+	ip6h->ip6_nxt = IPPROTO_UDP;
+	ip6h->ip6_hlim = 255;
+	ip6h->ip6_src = r->lladdr;
+	ip6h->ip6_dst = inip6h->ip6_src;
+	udph->uh_sum = sum6(ip6h, udph, len);
+	if (udph->uh_sum == 0)
+		udph->uh_sum = 0xffff;
+	responder_send(r, r->fd6, ETH_P_IPV6, macaddr, pkt, sizeof(*ip6h) + len);
+}
+
+/* router advertisement */
+
+static void rd_reply(struct iothconf_responder *r) {
+	struct {
+		struct ip6_hdr ip6h;
+		struct nd_router_advert ra;
+		struct nd_opt_prefix_info prefix;
+		struct nd_opt_mtu mtu;
+		uint8_t lladdr[8];
+	} pkt = {
+		.ip6h.ip6_flow = htonl(6 << 28),
+		.ip6h.ip6_plen = htons(sizeof(pkt) - sizeof(pkt.ip6h)),
+		.ip6h.ip6_nxt = IPPROTO_ICMPV6,
+		.ip6h.ip6_hlim = 255,
+		.ip6h.ip6_src = r->lladdr,
+		.ip6h.ip6_dst.s6_addr = {0xff, 0x02, [15] = 0x01},
+		.ra.nd_ra_type = ND_ROUTER_ADVERT,
+		.ra.nd_ra_curhoplimit = 64,
+		.ra.nd_ra_router_lifetime = htons(RESPONDER_LEASE / 2),
+		.prefix.nd_opt_pi_type = ND_OPT_PREFIX_INFORMATION,
+		.prefix.nd_opt_pi_len = sizeof(pkt.prefix) / 8,
+		.prefix.nd_opt_pi_prefix_len = RESPONDER_RD_PREFIXLEN,
+		.prefix.nd_opt_pi_flags_reserved = ND_OPT_PI_FLAG_ONLINK | ND_OPT_PI_FLAG_AUTO,
+		.prefix.nd_opt_pi_valid_time = htonl(RESPONDER_LEASE),
+		.prefix.nd_opt_pi_preferred_time = htonl(RESPONDER_LEASE / 2),
+		.mtu.nd_opt_mtu_type = ND_OPT_MTU,
+		.mtu.nd_opt_mtu_len = sizeof(pkt.mtu) / 8,
+		.mtu.nd_opt_mtu_mtu = htonl(RESPONDER_MTU),
+		.lladdr = {ND_OPT_SOURCE_LINKADDR, 1},
+	};
+	inet_pton(AF_INET6, RESPONDER_RD_PREFIX, &pkt.prefix.nd_opt_pi_prefix);
+	memcpy(pkt.lladdr + 2, r->macaddr, ETH_ALEN);
+	pkt.ra.nd_ra_cksum = sum6(&pkt.ip6h, &pkt.ra, sizeof(pkt) - sizeof(pkt.ip6h));
+	responder_send(r, r->fd6, ETH_P_IPV6, allnodes_macaddr, &pkt, sizeof(pkt));
+}
+
+static void responder_recv6(struct iothconf_responder *r) {
+	uint8_t buf[DHCP6_MAXLEN + sizeof(struct ip6_hdr)];
+	struct sockaddr_ll sll;
+	socklen_t slllen = sizeof(sll);
+	ssize_t len = ioth_recvfrom(r->fd6, buf, sizeof(buf), 0, (struct sockaddr *) &sll, &slllen);
+	struct ip6_hdr *ip6h = (struct ip6_hdr *) buf;
+	uint8_t *payload = (uint8_t *) (ip6h + 1);
+	if (len < (ssize_t) sizeof(*ip6h) || sll.sll_ifindex != (int) r->ifindex ||
+			sll.sll_pkttype == PACKET_OUTGOING)
+		return;
+	size_t plen = ntohs(ip6h->ip6_plen);
+	if ((size_t) len < sizeof(*ip6h) + plen)
+		return;
+	switch (ip6h->ip6_nxt) {
+		case IPPROTO_UDP:
+			if ((r->script.protocols & IOTHCONF_DHCPV6) && plen >= sizeof(struct udphdr) + 4 &&
+					((struct udphdr *) payload)->uh_dport == htons(DHCP6_SERVERPORT)) {
+				uint8_t *msg = payload + sizeof(struct udphdr);
+				size_t msglen = plen - sizeof(struct udphdr);
+				switch (msg[0]) {
+					case DHCP6_SOLICIT:
+						if (!responder_script(r, RESPONDER_DHCP6_SOLICIT))
+							dhcp6_reply(r, ip6h, sll.sll_addr, msg, msglen, DHCP6_ADVERTISE);
+						break;
+					case DHCP6_REQUEST:
+						if (!responder_script(r, RESPONDER_DHCP6_REQUEST))
+							dhcp6_reply(r, ip6h, sll.sll_addr, msg, msglen, DHCP6_REPLY);
+						break;
+				}
+			}
+			break;
+		case IPPROTO_ICMPV6:
+			if ((r->script.protocols & IOTHCONF_RD) && plen >= sizeof(struct nd_router_solicit) &&
+					payload[0] == ND_ROUTER_SOLICIT) {
+				if (!responder_script(r, RESPONDER_RD_RS))
+					rd_reply(r);
+			}
+			break;
+	}
+}
+
+static void *responder_thread(void *arg) {
+	struct iothconf_responder *r = arg;
+	struct pollfd pfd[] = {{r->efd, POLLIN, 0}, {r->fd4, POLLIN, 0}, {r->fd6, POLLIN, 0},
+		{r->fdarp, POLLIN, 0}};
+	for (;;) {
+		if (poll(pfd, 4, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (pfd[0].revents)
+			break;
+		if (pfd[1].revents)
+			responder_recv4(r);
+		if (pfd[2].revents)
+			responder_recv6(r);
+		if (pfd[3].revents)
+			responder_recvarp(r);
+	}
+	return NULL;
+}
+
+static int responder_open(struct iothconf_responder *r, uint16_t protocol) {
+	int fd = ioth_msocket(r->stack, AF_PACKET, SOCK_DGRAM, htons(protocol));
+	if (fd >= 0) {
+		/* receive the multicast packets to ff02::2 and ff02::1:2 */
+		struct packet_mreq mr = {.mr_ifindex = r->ifindex, .mr_type = PACKET_MR_ALLMULTI};
+		ioth_setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr));
+	}
+	return fd;
+}
+
+struct iothconf_responder *iothconf_responder_start(struct ioth *stack, unsigned int ifindex,
+		const struct iothconf_responder_script *script) {
+	struct iothconf_responder *r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		return NULL;
+	r->stack = stack;
+	r->ifindex = ifindex;
+	if (script != NULL)
+		r->script = *script;
+	if (r->script.protocols == 0)
+		r->script.protocols = IOTHCONF_DHCP | IOTHCONF_DHCPV6 | IOTHCONF_RD;
+	r->fd4 = r->fd6 = r->fdarp = r->efd = -1;
+	if (ioth_linkgetaddr(stack, ifindex, r->macaddr) < 0)
+		goto err;
+	/* link local address: modified EUI-64 */
+	r->lladdr.s6_addr[0] = 0xfe;
+	r->lladdr.s6_addr[1] = 0x80;
+	r->lladdr.s6_addr[8] = r->macaddr[0] ^ 0x02;
+	r->lladdr.s6_addr[9] = r->macaddr[1];
+	r->lladdr.s6_addr[10] = r->macaddr[2];
+	r->lladdr.s6_addr[11] = 0xff;
+	r->lladdr.s6_addr[12] = 0xfe;
+	memcpy(r->lladdr.s6_addr + 13, r->macaddr + 3, 3);
+	if ((r->efd = eventfd(0, EFD_CLOEXEC)) < 0)
+		goto err;
+	if ((r->script.protocols & IOTHCONF_DHCP) && (r->fd4 = responder_open(r, ETH_P_IP)) < 0)
+		goto err;
+	if ((r->script.protocols & (IOTHCONF_DHCPV6 | IOTHCONF_RD)) &&
+			(r->fd6 = responder_open(r, ETH_P_IPV6)) < 0)
+		goto err;
+	if (r->script.conflict > 0 && (r->fdarp = responder_open(r, ETH_P_ARP)) < 0)
+		goto err;
+	pthread_mutex_init(&r->mutex, NULL);
+	if ((errno = pthread_create(&r->thread, NULL, responder_thread, r)) != 0) {
+		pthread_mutex_destroy(&r->mutex);
+		goto err;
+	}
+	return r;
+err:
+	if (r->fd4 >= 0) ioth_close(r->fd4);
+	if (r->fd6 >= 0) ioth_close(r->fd6);
+	if (r->fdarp >= 0) ioth_close(r->fdarp);
+	if (r->efd >= 0) close(r->efd);
+	free(r);
+	return NULL;
+}
+
+int iothconf_responder_count(struct iothconf_responder *r, int kind) {
+	pthread_mutex_lock(&r->mutex);
+	int count = r->count[kind];
+	pthread_mutex_unlock(&r->mutex);
+	return count;
+}
+
+void iothconf_responder_reset(struct iothconf_responder *r) {
+	pthread_mutex_lock(&r->mutex);
+	memset(r->count, 0, sizeof(r->count));
+	pthread_mutex_unlock(&r->mutex);
+}
+
+void iothconf_responder_stop(struct iothconf_responder *r) {
+	uint64_t one = 1;
+	while (write(r->efd, &one, sizeof(one)) < 0 && errno == EINTR)
+		;
+	pthread_join(r->thread, NULL);
+	pthread_mutex_destroy(&r->mutex);
+	if (r->fd4 >= 0) ioth_close(r->fd4);
+	if (r->fd6 >= 0) ioth_close(r->fd6);
+	if (r->fdarp >= 0) ioth_close(r->fdarp);
+	close(r->efd);
+	free(r);
+}
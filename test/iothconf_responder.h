@@ -0,0 +1,62 @@
+#ifndef IOTHCONF_RESPONDER_H
+#define IOTHCONF_RESPONDER_H
+#include <stdint.h>
+#include <ioth.h>
+
+/* scripted DHCPv4, DHCPv6 and router advertisement responders running on a
+	 server side ioth stack: they build whole IP packets on AF_PACKET sockets,
+	 so the server stack needs no IP configuration (just the link up) */
+
+/* the configuration provided by the responders */
+#define RESPONDER_DHCP_SERVER   "10.0.0.1"
+#define RESPONDER_DHCP_ADDR     "10.0.0.100"
+#define RESPONDER_DHCP_PREFIX   24
+#define RESPONDER_DHCP_ROUTER   "10.0.0.1"
+#define RESPONDER_DHCP_DNS      "10.0.0.53"
+#define RESPONDER_DHCP6_ADDR    "2001:db8::100"
+#define RESPONDER_DHCP6_DNS     "2001:db8::53"
+#define RESPONDER_RD_PREFIX     "2001:db8:1::"
+#define RESPONDER_RD_PREFIXLEN  64
+#define RESPONDER_MTU           1500
+#define RESPONDER_DOMAIN        "harness.test"
+#define RESPONDER_LEASE         3600
+
+/* script:
+	 protocols: IOTHCONF_DHCP | IOTHCONF_DHCPV6 | IOTHCONF_RD (0 means all)
+	 drop: ignore the first 'drop' requests of each kind (to test retransmissions)
+	 delay: wait 'delay' msecs before each reply
+	 conflict: another node uses RESPONDER_DHCP_ADDR (the arp probes are answered)
+	   until 'conflict' DHCPDECLINE have been received (to test acd) */
+struct iothconf_responder_script {
+	int protocols;
+	int drop;
+	int delay;
+	int conflict;
+};
+
+/* message kinds, for the counters of iothconf_responder_count */
+#define RESPONDER_DHCP_DISCOVER 0
+#define RESPONDER_DHCP_REQUEST  1
+#define RESPONDER_DHCP6_SOLICIT 2
+#define RESPONDER_DHCP6_REQUEST 3
+#define RESPONDER_RD_RS         4
+#define RESPONDER_DHCP_DECLINE  5
+#define RESPONDER_ARP_PROBE     6
+#define RESPONDER_NKINDS        7
+
+struct iothconf_responder;
+
+/* start the responders on the interface ifindex of stack (in a thread),
+	 script can be NULL (all the protocols, no drop, no delay) */
+struct iothconf_responder *iothconf_responder_start(struct ioth *stack, unsigned int ifindex,
+		const struct iothconf_responder_script *script);
+
+/* number of messages of a kind received so far (dropped ones included) */
+int iothconf_responder_count(struct iothconf_responder *responder, int kind);
+
+/* reset the counters of the requests (the drop script restarts) */
+void iothconf_responder_reset(struct iothconf_responder *responder);
+
+void iothconf_responder_stop(struct iothconf_responder *responder);
+
+#endif
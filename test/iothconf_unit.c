@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <ioth.h>
+#include <iothconf.h>
+#include <iothconf_data.h>
+#include <iothconf_mod.h>
+#include <iothconf_retry.h>
+
+/* unit checks of the configuration data, no stack is needed:
+	 the records are stored for a fake stack pointer (as in iothconf_replay)
+	 and the interface index is always given (ifindex=2), so the library never
+	 calls the stack. exit status: 0 success, 1 failure */
+
+static char fakestack;
+#define STACK ((struct ioth *) &fakestack)
+#define IFINDEX 2
+#define RCOPT "ifindex=2"
+
+static int failed;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+		failed++; \
+	} \
+} while (0)
+
+static struct in_addr addr4(const char *s) {
+	struct in_addr addr;
+	inet_pton(AF_INET, s, &addr);
+	return addr;
+}
+
+static void add_dns4_ifindex(unsigned int ifindex, uint8_t type, const char *s) {
+	struct in_addr addr = addr4(s);
+	ioth_confdata_add(STACK, ifindex, type, 1, 0, &addr, sizeof(addr));
+}
+
+static void add_dns4(uint8_t type, const char *s) {
+	add_dns4_ifindex(IFINDEX, type, s);
+}
+
+static int del_dns4(uint8_t type, const char *s) {
+	struct in_addr addr = addr4(s);
+	return ioth_confdata_del(STACK, IFINDEX, type, &addr, sizeof(addr));
+}
+
+/* delete all the records of the fake stack */
+static int clean_cb(void *data, void *arg) {
+	(void) data;
+	(void) arg;
+	return IOTH_CONFDATA_FORALL_DELETE;
+}
+
+static void clean(void) {
+	ioth_confdata_forall(STACK, 0, 0, clean_cb, NULL);
+	ioth_confdata_dispatch();
+}
+
+/* the callback uses the library: ioth_resolvconf must not deadlock */
+struct resolvconf_cb_arg {
+	int ncalls;
+	uint32_t events;
+	char *rc;
+};
+
+static void resolvconf_cb(struct ioth *stack, uint32_t events, void *arg) {
+	struct resolvconf_cb_arg *cba = arg;
+	cba->ncalls++;
+	cba->events |= events;
+	free(cba->rc);
+	cba->rc = ioth_resolvconf(stack, RCOPT);
+}
+
+static void test_notify_resolvconf(void) {
+	struct resolvconf_cb_arg cba = {0};
+	struct ioth_config_notify *sub = ioth_config_subscribe(STACK, IFINDEX, 0, IOTHCONF_NOTIFY_DNS,
+			resolvconf_cb, &cba);
+	CHECK(sub != NULL);
+	if (sub == NULL)
+		return;
+	struct pollfd pfd = {ioth_config_notify_fd(sub), POLLIN, 0};
+	add_dns4(IOTH_CONFDATA_STATIC4_DNS, "10.0.0.1");
+	/* events are not dispatched by add, nor by the functions holding library locks */
+	CHECK(cba.ncalls == 0);
+	char *rc = ioth_resolvconf(STACK, RCOPT);
+	CHECK(rc != NULL && strcmp(rc, "nameserver 10.0.0.1\n") == 0);
+	free(rc);
+	CHECK(cba.ncalls == 0);
+	CHECK(poll(&pfd, 1, 0) == 0);
+	/* an address record does not match the subscription */
+	ioth_confdata_add_data(STACK, IFINDEX, IOTH_CONFDATA_STATIC4_ADDR, 1, 0,
+			struct ioth_confdata_ipaddr, .addr = addr4("10.0.0.2"), .prefixlen = 24);
+	ioth_confdata_dispatch();
+	CHECK(cba.ncalls == 1);
+	CHECK(cba.events == (IOTHCONF_NOTIFY_DNS | IOTHCONF_NOTIFY_ADDED));
+	/* the string has been returned already */
+	CHECK(cba.rc == NULL);
+	CHECK(poll(&pfd, 1, 0) == 1);
+	CHECK(ioth_config_notify_events(sub) == (IOTHCONF_NOTIFY_DNS | IOTHCONF_NOTIFY_ADDED));
+	CHECK(poll(&pfd, 1, 0) == 0);
+
+	cba.events = 0;
+	add_dns4(IOTH_CONFDATA_STATIC4_DNS, "10.0.0.3");
+	ioth_confdata_dispatch();
+	CHECK(cba.ncalls == 2);
+	CHECK(cba.rc != NULL && strcmp(cba.rc, "nameserver 10.0.0.1\nnameserver 10.0.0.3\n") == 0);
+
+	cba.events = 0;
+	CHECK(del_dns4(IOTH_CONFDATA_STATIC4_DNS, "10.0.0.1") == 0);
+	ioth_confdata_dispatch();
+	CHECK(cba.ncalls == 3);
+	CHECK(cba.events == (IOTHCONF_NOTIFY_DNS | IOTHCONF_NOTIFY_REMOVED));
+	CHECK(cba.rc != NULL && strcmp(cba.rc, "nameserver 10.0.0.3\n") == 0);
+
+	ioth_config_unsubscribe(sub);
+	free(cba.rc);
+	clean();
+}
+
+/* a new stack at the address of a released one does not inherit its data */
+static void test_release(void) {
+	add_dns4(IOTH_CONFDATA_STATIC4_DNS, "10.0.0.1");
+	char *rc = ioth_resolvconf(STACK, RCOPT);
+	CHECK(rc != NULL);
+	free(rc);
+	ioth_config_release(STACK);
+	CHECK(ioth_resolvconf_generation(STACK, IFINDEX) == 0);
+	errno = EINVAL;
+	CHECK(ioth_resolvconf(STACK, RCOPT) == NULL && errno == 0);
+	add_dns4(IOTH_CONFDATA_STATIC4_DNS, "10.0.0.1");
+	rc = ioth_resolvconf(STACK, RCOPT);
+	CHECK(rc != NULL && strcmp(rc, "nameserver 10.0.0.1\n") == 0);
+	free(rc);
+	ioth_config_release(STACK);
+}
+
+/* check the resolv.conf string of config */
+static void check_resolvconf(const char *config, const char *expected) {
+	char *rc = ioth_resolvconf(STACK, config);
+	CHECK(rc != NULL);
+	if (rc != NULL && strcmp(rc, expected) != 0) {
+		fprintf(stderr, "%s: got:\n%s---\nexpected:\n%s---\n", config, rc, expected);
+		failed++;
+	}
+	free(rc);
+}
+
+/* the same nameserver or domain from different records or sources is listed once */
+static void test_resolvconf_dedup(void) {
+	struct in_addr dhcpdns[] = {addr4("10.0.0.1"), addr4("10.0.0.2"), addr4("10.0.0.2")};
+	static char dhcpdomain[] = "example.org\0v2.example.org";
+	add_dns4(IOTH_CONFDATA_STATIC4_DNS, "10.0.0.1");
+	ioth_confdata_add(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_DNS, 2, 0, dhcpdns, sizeof(dhcpdns));
+	ioth_confdata_add(STACK, IFINDEX, IOTH_CONFDATA_STATIC_DOMAIN, 1, 0, "example.org", sizeof("example.org"));
+	ioth_confdata_add(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_DOMAIN, 2, 0, dhcpdomain, sizeof(dhcpdomain));
+	check_resolvconf(RCOPT,
+			"search example.org v2.example.org\n"
+			"nameserver 10.0.0.1\n"
+			"nameserver 10.0.0.2\n");
+	clean();
+}
+
+/* at most 3 nameservers and 6 search domains (resolv.conf(5)) */
+static void test_resolvconf_limits(void) {
+	struct in_addr dhcpdns[] = {addr4("10.0.0.1"), addr4("10.0.0.2"), addr4("10.0.0.3"),
+		addr4("10.0.0.4"), addr4("10.0.0.5")};
+	static char dhcpdomain[] = "d1.org\0d2.org\0d3.org\0d4.org\0d5.org\0d6.org\0d7.org\0d8.org";
+	ioth_confdata_add(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_DNS, 2, 0, dhcpdns, sizeof(dhcpdns));
+	ioth_confdata_add(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_DOMAIN, 2, 0, dhcpdomain, sizeof(dhcpdomain));
+	check_resolvconf(RCOPT,
+			"search d1.org d2.org d3.org d4.org d5.org d6.org\n"
+			"nameserver 10.0.0.1\n"
+			"nameserver 10.0.0.2\n"
+			"nameserver 10.0.0.3\n");
+	clean();
+}
+
+/* prio= changes the order of the sources (and the cached string) */
+static void test_resolvconf_prio(void) {
+	struct in_addr dhcpdns = addr4("10.0.0.2");
+	add_dns4(IOTH_CONFDATA_STATIC4_DNS, "10.0.0.1");
+	ioth_confdata_add(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_DNS, 2, 0, &dhcpdns, sizeof(dhcpdns));
+	check_resolvconf(RCOPT, "nameserver 10.0.0.1\nnameserver 10.0.0.2\n");
+	check_resolvconf(RCOPT ",prio=dhcp", "nameserver 10.0.0.2\nnameserver 10.0.0.1\n");
+	check_resolvconf(RCOPT ",prio=dhcp6:static", "nameserver 10.0.0.1\nnameserver 10.0.0.2\n");
+	errno = 0;
+	CHECK(ioth_resolvconf(STACK, RCOPT ",prio=dhcp:nosuchsource") == NULL && errno == EINVAL);
+	errno = 0;
+	CHECK(ioth_resolvconf(STACK, RCOPT ",prio") == NULL && errno == EINVAL);
+	clean();
+}
+
+/* ioth_dnsconf: order, sources, lifetimes, size of the arrays */
+static void test_dnsconf(void) {
+	struct in6_addr addr6;
+	struct in_addr dhcpdns[] = {addr4("10.0.0.1"), addr4("10.0.0.2")};
+	static char dhcpdomain[] = "example.org\0v2.example.org";
+	time_t now = time(NULL);
+	inet_pton(AF_INET6, "2001:db8::1", &addr6);
+	ioth_confdata_add(STACK, IFINDEX, IOTH_CONFDATA_STATIC6_DNS, 1, 0, &addr6, sizeof(addr6));
+	add_dns4(IOTH_CONFDATA_STATIC4_DNS, "10.0.0.1");
+	ioth_confdata_add(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_DNS, now, 0, dhcpdns, sizeof(dhcpdns));
+	ioth_confdata_add_data(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_ADDR, now, 0,
+			struct ioth_confdata_ipaddr, .addr = addr4("10.0.0.10"), .prefixlen = 24, .leasetime = 3600);
+	ioth_confdata_add(STACK, IFINDEX, IOTH_CONFDATA_STATIC_DOMAIN, 1, 0, "example.org", sizeof("example.org"));
+	ioth_confdata_add(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_DOMAIN, now, 0, dhcpdomain, sizeof(dhcpdomain));
+
+	struct ioth_dnsserver servers[4];
+	struct ioth_dnsdomain domains[4];
+	int nservers = 4;
+	int ndomains = 4;
+	CHECK(ioth_dnsconf(STACK, IFINDEX, servers, &nservers, domains, &ndomains) == 0);
+	CHECK(nservers == 3);
+	if (nservers == 3) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &servers[0].addr;
+		struct sockaddr_in *sin0 = (struct sockaddr_in *) &servers[1].addr;
+		struct sockaddr_in *sin1 = (struct sockaddr_in *) &servers[2].addr;
+		CHECK(sin6->sin6_family == AF_INET6 && memcmp(&sin6->sin6_addr, &addr6, sizeof(addr6)) == 0);
+		CHECK(servers[0].source == IOTHCONF_STATIC && servers[0].lifetime == 0xffffffff);
+		CHECK(sin0->sin_family == AF_INET && sin0->sin_addr.s_addr == addr4("10.0.0.1").s_addr);
+		CHECK(servers[1].source == IOTHCONF_STATIC && servers[1].lifetime == 0xffffffff);
+		CHECK(sin1->sin_family == AF_INET && sin1->sin_addr.s_addr == addr4("10.0.0.2").s_addr);
+		CHECK(servers[2].source == IOTHCONF_DHCP);
+		CHECK(servers[2].lifetime <= 3600 && servers[2].lifetime >= 3590);
+	}
+	CHECK(ndomains == 2);
+	if (ndomains == 2) {
+		CHECK(strcmp(domains[0].domain, "example.org") == 0 && domains[0].source == IOTHCONF_STATIC);
+		CHECK(strcmp(domains[1].domain, "v2.example.org") == 0 && domains[1].source == IOTHCONF_DHCP);
+	}
+	/* the arrays are filled up to their size */
+	nservers = 1;
+	ndomains = 0;
+	CHECK(ioth_dnsconf(STACK, IFINDEX, servers, &nservers, domains, &ndomains) == 0);
+	CHECK(nservers == 1 && ndomains == 0);
+	CHECK(servers[0].addr.ss_family == AF_INET6);
+	CHECK(ioth_dnsconf(STACK, IFINDEX, NULL, NULL, NULL, NULL) == 0);
+	errno = 0;
+	CHECK(ioth_dnsconf(STACK, 0, servers, &nservers, domains, &ndomains) == -1 && errno == EINVAL);
+	clean();
+}
+
+/* sources filter, unsubscribe, unsubscribe by the callback itself */
+struct unsubscribe_cb_arg {
+	int ncalls;
+	struct ioth_config_notify *sub;
+};
+
+static void unsubscribe_cb(struct ioth *stack, uint32_t events, void *arg) {
+	struct unsubscribe_cb_arg *cba = arg;
+	(void) stack;
+	(void) events;
+	cba->ncalls++;
+	if (cba->sub != NULL)
+		ioth_config_unsubscribe(cba->sub);
+	cba->sub = NULL;
+}
+
+static void test_subscribe(void) {
+	struct unsubscribe_cb_arg cba = {0};
+	struct unsubscribe_cb_arg selfcba = {0};
+	struct in_addr dhcpdns = addr4("10.0.0.2");
+	struct ioth_config_notify *sub = ioth_config_subscribe(STACK, IFINDEX, IOTHCONF_DHCP, 0,
+			unsubscribe_cb, &cba);
+	CHECK(sub != NULL);
+	/* another interface */
+	selfcba.sub = ioth_config_subscribe(STACK, IFINDEX + 1, 0, 0, unsubscribe_cb, &selfcba);
+	CHECK(selfcba.sub != NULL);
+	if (sub == NULL || selfcba.sub == NULL)
+		return;
+	add_dns4(IOTH_CONFDATA_STATIC4_DNS, "10.0.0.1");
+	ioth_confdata_dispatch();
+	CHECK(cba.ncalls == 0);
+	CHECK(selfcba.ncalls == 0);
+	ioth_confdata_add(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_DNS, 2, 0, &dhcpdns, sizeof(dhcpdns));
+	ioth_confdata_dispatch();
+	CHECK(cba.ncalls == 1);
+	CHECK(ioth_config_notify_events(sub) == (IOTHCONF_NOTIFY_DNS | IOTHCONF_NOTIFY_ADDED));
+	/* the callback deletes its own subscription */
+	add_dns4_ifindex(IFINDEX + 1, IOTH_CONFDATA_DHCP4_DNS, "10.0.0.3");
+	ioth_confdata_dispatch();
+	CHECK(selfcba.ncalls == 1 && selfcba.sub == NULL);
+	ioth_confdata_forall(STACK, IFINDEX + 1, 0, clean_cb, NULL);
+	ioth_confdata_dispatch();
+	CHECK(selfcba.ncalls == 1);
+	/* no more events after ioth_config_unsubscribe */
+	ioth_config_unsubscribe(sub);
+	CHECK(del_dns4(IOTH_CONFDATA_DHCP4_DNS, "10.0.0.2") == 0);
+	ioth_confdata_dispatch();
+	CHECK(cba.ncalls == 1);
+	clean();
+}
+
+/* a callback can wait for threads which generate events:
+	 ioth_config of two interfaces joins the thread of the first one */
+struct config_cb_arg {
+	int ncalls;
+	int retvalue;
+};
+
+static void config_cb(struct ioth *stack, uint32_t events, void *arg) {
+	struct config_cb_arg *cba = arg;
+	(void) events;
+	if (cba->ncalls++ == 0)
+		cba->retvalue = ioth_config(stack, "ifindex=3,dns=10.0.1.1,ifindex=4,dns=10.0.1.2");
+}
+
+static void test_notify_config(void) {
+	struct config_cb_arg cba = {0};
+	struct ioth_config_notify *sub = ioth_config_subscribe(STACK, 0, 0, IOTHCONF_NOTIFY_DNS,
+			config_cb, &cba);
+	CHECK(sub != NULL);
+	if (sub == NULL)
+		return;
+	add_dns4(IOTH_CONFDATA_STATIC4_DNS, "10.0.0.1");
+	ioth_confdata_dispatch();
+	CHECK(cba.retvalue == IOTHCONF_STATIC);
+	/* the events of ifindex 3 and 4 have been delivered after the first callback */
+	CHECK(cba.ncalls == 2);
+	ioth_config_unsubscribe(sub);
+	ioth_confdata_forall(STACK, 3, 0, clean_cb, NULL);
+	ioth_confdata_forall(STACK, 4, 0, clean_cb, NULL);
+	clean();
+}
+
+/* ioth_config_dump: records sorted by type, non-ASCII bytes escaped */
+static void test_dump(void) {
+	static char domain[] = "caf\xe9.test";
+	char dump[1024];
+	ioth_confdata_add(STACK, IFINDEX, IOTH_CONFDATA_STATIC_DOMAIN, 1, 0, domain, sizeof(domain));
+	add_dns4(IOTH_CONFDATA_STATIC4_DNS, "10.0.0.9");
+	CHECK(ioth_config_dump(STACK, IFINDEX, dump, sizeof(dump)) > 0);
+	CHECK(strstr(dump, "\"caf\\u00e9.test\"") != NULL);
+	CHECK(strstr(dump, "10.0.0.9") != NULL && strstr(dump, "caf") != NULL &&
+			strstr(dump, "10.0.0.9") < strstr(dump, "caf"));
+	clean();
+}
+
+/* make-before-break: the deprecated address is removed at the end of the grace period,
+	 with no further updates of the source */
+/* records are compared by memcmp: the padding of ioth_confdata_ipaddr must be zeroed */
+static struct ioth_confdata_ipaddr dhcp4_addr(const char *s) {
+	struct ioth_confdata_ipaddr ipaddr;
+	memset(&ipaddr, 0, sizeof(ipaddr));
+	ipaddr.addr = addr4(s);
+	ipaddr.prefixlen = 24;
+	ipaddr.leasetime = 3600;
+	return ipaddr;
+}
+
+static void add_dhcp4_addr(const char *s, time_t timestamp) {
+	struct ioth_confdata_ipaddr ipaddr = dhcp4_addr(s);
+	ioth_confdata_add(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_ADDR, timestamp, 0, &ipaddr, sizeof(ipaddr));
+	ioth_confdata_write_timestamp(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_TIMESTAMP, timestamp);
+}
+
+static uint8_t dhcp4_addr_flags(const char *s) {
+	struct ioth_confdata_ipaddr ipaddr = dhcp4_addr(s);
+	return ioth_confdata_getflags(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_ADDR, &ipaddr, sizeof(ipaddr));
+}
+
+static void test_grace(void) {
+	struct iothconf_param param = {.grace = 1};
+	add_dhcp4_addr("10.0.2.1", ioth_confdata_new_timestamp(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_TIMESTAMP));
+	iothconf_ip_update(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_TIMESTAMP, &param);
+	add_dhcp4_addr("10.0.2.2", ioth_confdata_new_timestamp(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_TIMESTAMP));
+	iothconf_ip_update(STACK, IFINDEX, IOTH_CONFDATA_DHCP4_TIMESTAMP, &param);
+	CHECK(dhcp4_addr_flags("10.0.2.1") & IOTH_CONFDATA_DEPRECATED);
+	CHECK(dhcp4_addr_flags("10.0.2.2") & IOTH_CONFDATA_ACTIVE);
+	sleep(3);
+	CHECK(dhcp4_addr_flags("10.0.2.1") == 0);
+	CHECK(dhcp4_addr_flags("10.0.2.2") & IOTH_CONFDATA_ACTIVE);
+	iothconf_ip_stop(STACK);
+	clean();
+}
+
+/* default retransmissions: three transmissions in 6 secs.
+	 DHCP (iothconf_dhcp.c): 2000 msecs, max 64000, 2 retransmissions, 6000 msecs, +/-1000 msecs.
+	 DHCPv6 (iothconf_dhcpv6.c): 1000 msecs, max 30000, 2 retransmissions, 6000 msecs, +/-10% */
+static void check_backoff(int irt, int mrt, int mrc, int mrd, int jitter) {
+	struct iothconf_backoff backoff;
+	int total = 0;
+	int timeout;
+	int count = 0;
+	iothconf_backoff_init(&backoff, NULL, irt, mrt, mrc, mrd, jitter);
+	while ((timeout = iothconf_backoff_next(&backoff)) >= 0) {
+		CHECK(timeout > 0);
+		total += timeout;
+		count++;
+	}
+	CHECK(count == mrc + 1);
+	CHECK(total <= mrd);
+}
+
+static void test_backoff(void) {
+	for (int i = 0; i < 100; i++) {
+		check_backoff(2000, 64000, 2, 6000, 1000);
+		check_backoff(1000, 30000, 2, 6000, -1);
+	}
+	/* retry policy: timeout=500,retries=4,maxtime=3000 */
+	struct iothconf_retry retry = {.timeout = 500, .retries = 4, .maxtime = 3000};
+	struct iothconf_backoff backoff;
+	int total = 0;
+	int timeout;
+	int count = 0;
+	iothconf_backoff_init(&backoff, &retry, 2000, 64000, 2, 6000, 1000);
+	while ((timeout = iothconf_backoff_next(&backoff)) >= 0)
+		total += timeout, count++;
+	CHECK(count == 5 && total <= 3000);
+}
+
+int main(int argc, char *argv[]) {
+	(void) argc;
+	(void) argv;
+	/* a deadlock is a failure */
+	alarm(20);
+	test_notify_resolvconf();
+	test_release();
+	test_resolvconf_dedup();
+	test_resolvconf_limits();
+	test_resolvconf_prio();
+	test_dnsconf();
+	test_subscribe();
+	test_notify_config();
+	test_backoff();
+	test_dump();
+	test_grace();
+	if (failed)
+		fprintf(stderr, "%d check(s) failed\n", failed);
+	return failed ? 1 : 0;
+}